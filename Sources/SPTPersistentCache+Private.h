@@ -23,7 +23,10 @@
 
 @class SPTPersistentCacheFileManager;
 @class SPTPersistentCacheGarbageCollector;
+@class SPTPersistentCacheHotSet;
 @class SPTPersistentCachePosixWrapper;
+@class SPTPersistentCacheWriteBuffer;
+@class SPTPersistentCacheConcurrencyController;
 
 void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull dispatch_block_t block);
 
@@ -38,6 +41,11 @@ NS_ASSUME_NONNULL_BEGIN
 
 /// Serial queue used to run all internal stuff
 @property (nonatomic, strong, readonly) NSOperationQueue *workQueue;
+/// Queue loads run on, the work queue unless adaptiveConcurrency of options is set
+@property (nonatomic, strong, readonly) NSOperationQueue *readQueue;
+/// Adjust the concurrency of the read and work queues, nil unless adaptiveConcurrency of options is set
+@property (nonatomic, strong, readonly, nullable) SPTPersistentCacheConcurrencyController *readConcurrencyController;
+@property (nonatomic, strong, readonly, nullable) SPTPersistentCacheConcurrencyController *writeConcurrencyController;
 
 @property (nonatomic, strong, readonly) NSFileManager *fileManager;
 
@@ -46,8 +54,32 @@ NS_ASSUME_NONNULL_BEGIN
 @property (nonatomic, assign, readonly) NSTimeInterval currentDateTimeInterval;
 @property (nonatomic, strong, readonly) SPTPersistentCachePosixWrapper *posixWrapper;
 
+/// Tracks loaded keys for warming on next start, nil if hotSetSize of options is 0
+@property (nonatomic, strong, readonly, nullable) SPTPersistentCacheHotSet *hotSet;
+
+/// Holds stores waiting to be written, nil if writeBufferSize of options is 0 or the cache is read-only
+@property (nonatomic, strong, readonly, nullable) SPTPersistentCacheWriteBuffer *writeBuffer;
+
+/// Striped locks used to serialize operations on the same key
+@property (nonatomic, copy, readonly) NSArray<NSRecursiveLock *> *keyLocks;
+
+/// Lease expiration times of records locked by this cache by key, guarded by leaseIndexLock
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSString *, NSNumber *> *leaseIndex;
+@property (nonatomic, strong, readonly) NSLock *leaseIndexLock;
+
+/// Callbacks waiting to be dispatched together by target queue, guarded by callbackBatchesLock
+@property (nonatomic, strong, readonly) NSMapTable<dispatch_queue_t, NSMutableArray<dispatch_block_t> *> *callbackBatches;
+@property (nonatomic, strong, readonly) NSLock *callbackBatchesLock;
+
+/// Whether key can name a record file, keys with path separators or a leading dot could name files outside the cache
++ (BOOL)isValidRecordKey:(nullable NSString *)key;
+
 - (void)runRegularGC;
+/// Releases locks whose lease has run out using the lease index, without scanning the cache directory
+- (NSUInteger)releaseExpiredLeases;
 - (BOOL)pruneBySize;
+/// Writes all records held by the write buffer
+- (void)flushWriteBufferSync;
 
 /**
  * forceExpire = YES treat all unlocked files like they expired
@@ -64,7 +96,29 @@ NS_ASSUME_NONNULL_BEGIN
              callback:(SPTPersistentCacheResponseCallback _Nullable)callback
               onQueue:(dispatch_queue_t _Nullable)queue;
 
+/// Gives block to the caller on queue, or directly, depending on callbackDelivery of the options
+- (void)dispatchCallback:(dispatch_block_t)block onQueue:(dispatch_queue_t _Nullable)queue;
+
 - (void)doWork:(void (^)(void))block priority:(NSOperationQueuePriority)priority qos:(NSQualityOfService)qos;
+/// Runs a load on the read queue, measured by the read concurrency controller
+- (void)doReadWork:(void (^)(void))block priority:(NSOperationQueuePriority)priority qos:(NSQualityOfService)qos;
+/// Runs a store on the work queue, measured by the write concurrency controller
+- (void)doWriteWork:(void (^)(void))block priority:(NSOperationQueuePriority)priority qos:(NSQualityOfService)qos;
+
+/**
+ * Runs block while holding the lock of the given key. Check-then-write sequences on a record must run inside it to be
+ * atomic with respect to other operations on the same key. Calls can be nested for the same key.
+ */
+- (void)serializeWorkForKey:(NSString *)key block:(void (^)(void))block;
+
+/**
+ * Opens the record file of key for reading under the key lock, so it can be read after the lock is released. It must
+ * be closed with closeRecordFile:forKey:.
+ * @return The descriptor, otherwise -1 with a not found or error response.
+ */
+- (int)openRecordFileForKey:(NSString *)key response:(SPTPersistentCacheResponse * _Nullable * _Nullable)response;
+/// Closes a record file opened by openRecordFileForKey:response: under the key lock
+- (void)closeRecordFile:(int)filedes forKey:(NSString *)key;
 
 - (void)logTimingForKey:(NSString *)key method:(SPTPersistentCacheDebugMethodType)method type:(SPTPersistentCacheDebugTimingType)type;
 
@@ -31,23 +31,52 @@
 #import "SPTPersistentCacheTypeUtilities.h"
 #import "SPTPersistentCacheDebugUtilities.h"
 #import "SPTPersistentCachePosixWrapper.h"
+#import "SPTPersistentCacheHotSet.h"
+#import "SPTPersistentCacheDirectoryScanner.h"
+#import "SPTPersistentCacheSnapshot.h"
+#import "SPTPersistentCacheWriteBuffer.h"
+#import "SPTPersistentCacheConcurrencyController.h"
 
 #include <sys/stat.h>
+#include <stdatomic.h>
 #import <mach/mach_time.h>
 
-#include "crc32iso3309.h"
+#include "sptpc.h"
 
 // Enable for more precise logging
 //#define DEBUG_OUTPUT_ENABLED
 
 typedef SPTPersistentCacheResponse* (^SPTPersistentCacheFileProcessingBlockType)(int filedes);
 typedef void (^SPTPersistentCacheRecordHeaderGetCallbackType)(SPTPersistentCacheRecordHeader *header);
+/**
+ * Checked before a store while holding the key lock. Header is NULL if there is no record which can be returned.
+ * Returning an error skips the store.
+ */
+typedef NSError* (^SPTPersistentCacheStorePreconditionType)(const SPTPersistentCacheRecordHeader *header);
 
 NSString *const SPTPersistentCacheErrorDomain = @"persistent.cache.error";
 static NSString * const SPTDataCacheFileNameKey = @"SPTDataCacheFileNameKey";
 static NSString * const SPTDataCacheFileAttributesKey = @"SPTDataCacheFileAttributesKey";
 
 static const uint64_t SPTPersistentCacheTTLUpperBoundInSec = 86400 * 31 * 2;
+static const NSUInteger SPTPersistentCacheKeyLockStripeCount = 64;
+static NSString * const SPTPersistentCacheHotSetFileName = @".hotset";
+// Hidden files of at least this age are leftovers of atomic writes which didn't finish
+static const NSTimeInterval SPTPersistentCacheRecoveryTemporaryFileAge = 60;
+/// Name prefix of the temporary files of atomic Foundation writes
+static NSString * const SPTPersistentCacheFoundationTemporaryFilePrefix = @".dat.nosync";
+/// Length of the ".XXXXXX" suffix libsptpc atomic writes give to the temporary file named after the record
+static const NSUInteger SPTPersistentCacheCoreTemporaryFileSuffixLength = 7;
+// Size of the buffer used to send records where the kernel can't copy them
+static const size_t SPTPersistentCacheSendBufferSize = 64 * 1024;
+// Concurrency adaptive queues start with, it is raised quickly on disks which handle more
+static const NSUInteger SPTPersistentCacheAdaptiveConcurrencyInitialLimit = 4;
+// Number of times a header alteration is tried when other processes keep replacing the record file
+static const NSUInteger SPTPersistentCacheRecordReplacedRetryCount = 3;
+// Number of times read-only caches read a header again which failed its CRC check, the owner may have been rewriting it
+static const NSUInteger SPTPersistentCacheTornHeaderRereadCount = 3;
+// Number of files garbage collection and size pruning read the headers of at once
+static const NSUInteger SPTPersistentCacheHeaderReadBatchSize = 256;
 
 void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull dispatch_block_t block)
 {
@@ -59,11 +88,42 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
     }
 }
 
+static uint32_t SPTPersistentCacheNextRecordVersion(uint32_t version)
+{
+    // Version 0 is reserved for records written before versioning and for absent records
+    const uint32_t nextVersion = version + 1;
+    return (nextVersion == 0 ? 1 : nextVersion);
+}
+
+static NSError *SPTPersistentCacheLastPosixError(void)
+{
+    const int errorNumber = errno;
+    return [NSError errorWithDomain:NSPOSIXErrorDomain
+                               code:errorNumber
+                           userInfo:@{ NSLocalizedDescriptionKey: @(strerror(errorNumber)) }];
+}
+
+typedef void (^SPTPersistentCacheMetadataBlock)(const char *key, SPTPersistentCacheRecordHeader *header);
+
+static int SPTPersistentCacheMetadataScanCallback(const char *key, const sptpc_header *header, void *context)
+{
+    SPTPersistentCacheMetadataBlock block = (__bridge SPTPersistentCacheMetadataBlock)context;
+    SPTPersistentCacheRecordHeader recordHeader;
+    memcpy(&recordHeader, header, SPTPersistentCacheRecordHeaderSize);
+    block(key, &recordHeader);
+    return 0;
+}
+
 // Class extension exists in SPTPersistentCache+Private.h
 
 #pragma mark - SPTPersistentCache
 
 @implementation SPTPersistentCache
+{
+    _Atomic(NSUInteger) _fireAndForgetStoreCount;
+    _Atomic(NSUInteger) _failedFireAndForgetStoreCount;
+    sptpc_metadata *_metadataTable;
+}
 
 - (instancetype)init
 {
@@ -79,23 +139,86 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
         _workQueue.maxConcurrentOperationCount = options.maxConcurrentOperations;
         NSAssert(_workQueue, @"The work queue couldn’t be created using the given options: %@", options);
 
+        _readQueue = _workQueue;
+        if (options.adaptiveConcurrency) {
+            const NSUInteger maximumLimit = (options.maxConcurrentOperations > 0 ?
+                                             (NSUInteger)options.maxConcurrentOperations :
+                                             [NSProcessInfo processInfo].activeProcessorCount * 2);
+            _readConcurrencyController = [[SPTPersistentCacheConcurrencyController alloc] initWithMinimumLimit:1
+                                                                                                  maximumLimit:maximumLimit
+                                                                                                  initialLimit:SPTPersistentCacheAdaptiveConcurrencyInitialLimit];
+            _writeConcurrencyController = [[SPTPersistentCacheConcurrencyController alloc] initWithMinimumLimit:1
+                                                                                                   maximumLimit:maximumLimit
+                                                                                                   initialLimit:SPTPersistentCacheAdaptiveConcurrencyInitialLimit];
+            _workQueue.maxConcurrentOperationCount = (NSInteger)_writeConcurrencyController.limit;
+
+            _readQueue = [[NSOperationQueue alloc] init];
+            _readQueue.name = [options.identifierForQueue stringByAppendingString:@".read"];
+            _readQueue.maxConcurrentOperationCount = (NSInteger)_readConcurrencyController.limit;
+        }
+
         _options = [options copy];
         _fileManager = [NSFileManager defaultManager];
         _debugOutput = [self.options.debugOutput copy];
         _dataCacheFileManager = [[SPTPersistentCacheFileManager alloc] initWithOptions:_options];
         _posixWrapper = [SPTPersistentCachePosixWrapper new];
+
+        NSMutableArray<NSRecursiveLock *> *keyLocks = [NSMutableArray arrayWithCapacity:SPTPersistentCacheKeyLockStripeCount];
+        for (NSUInteger i = 0; i < SPTPersistentCacheKeyLockStripeCount; ++i) {
+            [keyLocks addObject:[NSRecursiveLock new]];
+        }
+        _keyLocks = [keyLocks copy];
+        _leaseIndex = [NSMutableDictionary dictionary];
+        _leaseIndexLock = [NSLock new];
+        _callbackBatches = [NSMapTable mapTableWithKeyOptions:NSPointerFunctionsStrongMemory | NSPointerFunctionsObjectPointerPersonality
+                                                 valueOptions:NSPointerFunctionsStrongMemory];
+        _callbackBatchesLock = [NSLock new];
         _garbageCollector = [[SPTPersistentCacheGarbageCollector alloc] initWithCache:self
                                                                               options:_options
                                                                                 queue:_workQueue];
 
 
-        if (![_dataCacheFileManager createCacheDirectory]) {
+        // Read-only caches attach to a folder owned by another process
+        if (!_options.readOnly && ![_dataCacheFileManager createCacheDirectory]) {
             return nil;
         }
+
+        // Other processes sharing the folder would change records behind the table's back
+        if (_options.useMetadataTable && !_options.readOnly && !_options.processSharedLocking) {
+            _metadataTable = [self openMetadataTable];
+        }
+
+        if (_options.recoverOnStart && !_options.readOnly) {
+            [self recoverWithCallback:nil onQueue:nil];
+        }
+
+        if (_options.writeBufferSize > 0 && !_options.readOnly) {
+            _writeBuffer = [[SPTPersistentCacheWriteBuffer alloc] initWithByteBudget:_options.writeBufferSize];
+        }
+
+        if (_options.hotSetSize > 0) {
+            _hotSet = [[SPTPersistentCacheHotSet alloc] initWithCapacity:_options.hotSetSize
+                                                                halfLife:_options.defaultExpirationPeriod];
+            // Warm keys which were hot before the restart
+            NSArray<NSString *> *hotKeys = [SPTPersistentCacheHotSet keysFromFile:self.hotSetFilePath];
+            if (hotKeys.count > 0) {
+                [self prefetchDataForKeys:hotKeys callback:nil onQueue:nil];
+            }
+        }
     }
     return self;
 }
 
++ (BOOL)isValidRecordKey:(NSString *)key
+{
+    // NUL ends the file system representation early, so it cuts a key like a separator does
+    NSMutableCharacterSet *separators = [NSMutableCharacterSet characterSetWithRange:NSMakeRange(0, 1)];
+    [separators addCharactersInString:@"/"];
+    return (key.length > 0 &&
+            ![key hasPrefix:@"."] &&
+            [key rangeOfCharacterFromSet:separators].location == NSNotFound);
+}
+
 - (BOOL)loadDataForKey:(NSString *)key
           withCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
                onQueue:(dispatch_queue_t _Nullable)queue
@@ -106,7 +229,7 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
 
     callback = [callback copy];
     [self logTimingForKey:key method:SPTPersistentCacheDebugMethodTypeRead type:SPTPersistentCacheDebugTimingTypeQueued];
-    [self doWork:^{
+    [self doReadWork:^{
         [self logTimingForKey:key method:SPTPersistentCacheDebugMethodTypeRead type:SPTPersistentCacheDebugTimingTypeStarting];
         [self loadDataForKeySync:key withCallback:callback onQueue:queue];
         [self logTimingForKey:key method:SPTPersistentCacheDebugMethodTypeRead type:SPTPersistentCacheDebugTimingTypeFinished];
@@ -126,26 +249,31 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
     [self doWork:^{
         [self logTimingForKey:prefix method:SPTPersistentCacheDebugMethodTypeRead type:SPTPersistentCacheDebugTimingTypeStarting];
         NSString *path = [self.dataCacheFileManager subDirectoryPathForKey:prefix];
-        NSMutableArray * __block keys = [NSMutableArray array];
+        NSMutableOrderedSet<NSString *> *keys = [NSMutableOrderedSet orderedSet];
 
         // WARNING: Do not use enumeratorAtURL never ever. Its unsafe bcuz gets locked forever
         NSError *error = nil;
         NSArray *content = [self.fileManager contentsOfDirectoryAtPath:path error:&error];
+        // Records still in the write buffer are candidates too, checking their header below writes them
+        NSArray<NSString *> *bufferedKeys = [self.writeBuffer keysWithPrefix:prefix];
 
         if (content == nil) {
             // If no directory is exist its fine, say not found to user
             if (error.code == NSFileReadNoSuchFileError || error.code == NSFileNoSuchFileError) {
-                [self dispatchEmptyResponseWithResult:SPTPersistentCacheResponseCodeNotFound
-                                             callback:callback
-                                              onQueue:queue];
+                if (bufferedKeys.count == 0) {
+                    [self dispatchEmptyResponseWithResult:SPTPersistentCacheResponseCodeNotFound
+                                                 callback:callback
+                                                  onQueue:queue];
+                    return;
+                }
             } else {
                 [self debugOutput:@"PersistentDataCache: Unable to get dir contents: %@, error: %@", path, [error localizedDescription]];
                 [self dispatchError:error
                              result:SPTPersistentCacheResponseCodeOperationError
                            callback:callback
                             onQueue:queue];
+                return;
             }
-            return;
         }
 
         [content enumerateObjectsUsingBlock:^(NSString *key, NSUInteger idx, BOOL *stop) {
@@ -154,6 +282,7 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
                 [keys addObject:file];
             }
         }];
+        [keys addObjectsFromArray:bufferedKeys];
 
         NSMutableArray * __block keysToConsider = [NSMutableArray array];
 
@@ -164,8 +293,8 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
 
             // WARNING: We may skip return result here bcuz in that case we will skip the key as invalid
             [self alterHeaderForFileAtPath:filePath withBlock:^(SPTPersistentCacheRecordHeader *header) {
-                // Satisfy Req.#1.2
-                if ([self isDataCanBeReturnedWithHeader:header]) {
+                // Satisfy Req.#1.2, stale records are loaded like by loadDataForKey
+                if ([self isDataStaleWithHeader:header] || [self isDataCanBeReturnedWithHeader:header]) {
                     [keysToConsider addObject:key];
                 }
             } writeBack:NO complain:YES];
@@ -213,21 +342,285 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
      withCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
           onQueue:(dispatch_queue_t _Nullable)queue
 
+{
+    return [self storeData:data forKey:key ttl:ttl locked:locked precondition:nil withCallback:callback onQueue:queue];
+}
+
+- (BOOL)storeData:(NSData *)data
+           forKey:(NSString *)key
+         ifAbsent:(BOOL)ifAbsent
+              ttl:(NSUInteger)ttl
+           locked:(BOOL)locked
+     withCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
+          onQueue:(dispatch_queue_t _Nullable)queue
+{
+    SPTPersistentCacheStorePreconditionType precondition = nil;
+    if (ifAbsent) {
+        precondition = ^NSError *(const SPTPersistentCacheRecordHeader *header) {
+            if (header != NULL) {
+                return [NSError spt_persistentDataCacheErrorWithCode:SPTPersistentCacheLoadingErrorRecordAlreadyExists];
+            }
+            return nil;
+        };
+    }
+    return [self storeData:data forKey:key ttl:ttl locked:locked precondition:precondition withCallback:callback onQueue:queue];
+}
+
+- (BOOL)storeData:(NSData *)data
+           forKey:(NSString *)key
+  expectedVersion:(NSUInteger)expectedVersion
+              ttl:(NSUInteger)ttl
+           locked:(BOOL)locked
+     withCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
+          onQueue:(dispatch_queue_t _Nullable)queue
+{
+    SPTPersistentCacheStorePreconditionType precondition = ^NSError *(const SPTPersistentCacheRecordHeader *header) {
+        const NSUInteger currentVersion = (header != NULL ? header->version : 0);
+        if (currentVersion != expectedVersion) {
+            return [NSError spt_persistentDataCacheErrorWithCode:SPTPersistentCacheLoadingErrorVersionMismatch];
+        }
+        return nil;
+    };
+    return [self storeData:data forKey:key ttl:ttl locked:locked precondition:precondition withCallback:callback onQueue:queue];
+}
+
+- (BOOL)storeData:(NSData *)data
+           forKey:(NSString *)key
+              ttl:(NSUInteger)ttl
+           locked:(BOOL)locked
+     precondition:(SPTPersistentCacheStorePreconditionType)precondition
+     withCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
+          onQueue:(dispatch_queue_t _Nullable)queue
 {
     if (data == nil || key == nil || (callback != nil && queue == nil)) {
         return NO;
     }
 
+    // Buffered stores are done once the payload is in memory
+    if (precondition == nil && [self bufferData:data forKey:key ttl:ttl locked:locked]) {
+        [self dispatchEmptyResponseWithResult:SPTPersistentCacheResponseCodeOperationSucceeded callback:callback onQueue:queue];
+        return YES;
+    }
+
+    // Nobody waits for the outcome, so skip the response, timing and callback plumbing
+    if (callback == nil && precondition == nil) {
+        [self storeDataWithoutResponse:data forKey:key ttl:ttl locked:locked];
+        return YES;
+    }
+
+    if ([self rejectWriteWithCallback:callback onQueue:queue]) {
+        return YES;
+    }
+
     callback = [callback copy];
+    precondition = [precondition copy];
     [self logTimingForKey:key method:SPTPersistentCacheDebugMethodTypeStore type:SPTPersistentCacheDebugTimingTypeQueued];
-    [self doWork:^{
+    [self doWriteWork:^{
+        [self logTimingForKey:key method:SPTPersistentCacheDebugMethodTypeStore type:SPTPersistentCacheDebugTimingTypeStarting];
+        [self storeDataSync:data forKey:key ttl:ttl locked:locked precondition:precondition withCallback:callback onQueue:queue];
+        [self logTimingForKey:key method:SPTPersistentCacheDebugMethodTypeStore type:SPTPersistentCacheDebugTimingTypeFinished];
+    } priority:self.options.writePriority qos:self.options.writeQualityOfService];
+    return YES;
+}
+
+- (nullable SPTPersistentCacheRecord *)loadDataForKeySync:(NSString *)key error:(NSError * _Nullable *)error
+{
+    if (key == nil) {
+        return nil;
+    }
+
+    [self logTimingForKey:key method:SPTPersistentCacheDebugMethodTypeRead type:SPTPersistentCacheDebugTimingTypeStarting];
+    SPTPersistentCacheResponse *response = [self loadResponseForKeySync:key];
+    [self logTimingForKey:key method:SPTPersistentCacheDebugMethodTypeRead type:SPTPersistentCacheDebugTimingTypeFinished];
+
+    if (response.result == SPTPersistentCacheResponseCodeOperationError && error != NULL) {
+        *error = response.error;
+    }
+    return response.record;
+}
+
+- (BOOL)storeDataSync:(NSData *)data
+               forKey:(NSString *)key
+                  ttl:(NSUInteger)ttl
+               locked:(BOOL)locked
+                error:(NSError * _Nullable *)error
+{
+    if (data == nil || key == nil) {
+        return NO;
+    }
+
+    NSError *storeError = nil;
+    if (self.options.readOnly) {
+        storeError = [NSError spt_persistentDataCacheErrorWithCode:SPTPersistentCacheLoadingErrorReadOnly];
+    } else {
         [self logTimingForKey:key method:SPTPersistentCacheDebugMethodTypeStore type:SPTPersistentCacheDebugTimingTypeStarting];
-        [self storeDataSync:data forKey:key ttl:ttl locked:locked withCallback:callback onQueue:queue];
+        storeError = [self storeDataSync:data forKey:key ttl:ttl locked:locked withCallback:nil onQueue:nil];
         [self logTimingForKey:key method:SPTPersistentCacheDebugMethodTypeStore type:SPTPersistentCacheDebugTimingTypeFinished];
+    }
+
+    if (storeError != nil && error != NULL) {
+        *error = storeError;
+    }
+    return storeError == nil;
+}
+
+- (BOOL)statDataForKeySync:(NSString *)key
+                    header:(SPTPersistentCacheRecordHeader *)header
+                     error:(NSError * _Nullable *)error
+{
+    if (key == nil || header == NULL) {
+        return NO;
+    }
+
+    NSString *filePath = [self.dataCacheFileManager pathForKey:key];
+    BOOL __block found = NO;
+    SPTPersistentCacheResponse *response = [self alterHeaderForFileAtPath:filePath withBlock:^(SPTPersistentCacheRecordHeader *recordHeader) {
+        // Satisfy Req.#1.2
+        if ([self isDataStaleWithHeader:recordHeader] || [self isDataCanBeReturnedWithHeader:recordHeader]) {
+            memcpy(header, recordHeader, SPTPersistentCacheRecordHeaderSize);
+            found = YES;
+        }
+    } writeBack:NO complain:NO];
+
+    if (response.result == SPTPersistentCacheResponseCodeOperationError && error != NULL) {
+        *error = response.error;
+    }
+    return found;
+}
+
+/**
+ * Puts a store into the write buffer and schedules a flush if none is pending.
+ * @return NO if there is no write buffer or the data doesn't fit in it.
+ */
+- (BOOL)bufferData:(NSData *)data forKey:(NSString *)key ttl:(NSUInteger)ttl locked:(BOOL)locked
+{
+    if (self.writeBuffer == nil || self.options.readOnly) {
+        return NO;
+    }
+
+    SPTPersistentCacheWriteBufferEntry *entry = [[SPTPersistentCacheWriteBufferEntry alloc] initWithData:[data copy]
+                                                                                                     ttl:ttl
+                                                                                                  locked:locked];
+    BOOL needsFlush = NO;
+    if (![self.writeBuffer addEntry:entry forKey:key needsFlush:&needsFlush]) {
+        return NO;
+    }
+
+    if (needsFlush) {
+        [self doWork:^{
+            [self flushWriteBufferSync];
+        } priority:self.options.writePriority qos:self.options.writeQualityOfService];
+    }
+    return YES;
+}
+
+- (void)flushWriteBufferWithCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
+                             onQueue:(dispatch_queue_t _Nullable)queue
+{
+    callback = [callback copy];
+    [self doWork:^{
+        [self flushWriteBufferSync];
+        [self dispatchEmptyResponseWithResult:SPTPersistentCacheResponseCodeOperationSucceeded callback:callback onQueue:queue];
+    } priority:self.options.writePriority qos:self.options.writeQualityOfService];
+}
+
+- (void)storeDataWithoutResponse:(NSData *)data
+                          forKey:(NSString *)key
+                             ttl:(NSUInteger)ttl
+                          locked:(BOOL)locked
+{
+    if (self.options.readOnly) {
+        atomic_fetch_add_explicit(&_failedFireAndForgetStoreCount, 1, memory_order_relaxed);
+        return;
+    }
+
+    [self doWriteWork:^{
+        [self storeDataWithoutResponseSync:data forKey:key ttl:ttl locked:locked];
+    } priority:self.options.writePriority qos:self.options.writeQualityOfService];
+}
+
+- (NSUInteger)fireAndForgetStoreCount
+{
+    return atomic_load_explicit(&_fireAndForgetStoreCount, memory_order_relaxed);
+}
+
+- (NSUInteger)failedFireAndForgetStoreCount
+{
+    return atomic_load_explicit(&_failedFireAndForgetStoreCount, memory_order_relaxed);
+}
+
+- (BOOL)appendData:(NSData *)data
+             toKey:(NSString *)key
+      withCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
+           onQueue:(dispatch_queue_t _Nullable)queue
+{
+    if (data == nil || key == nil || (callback != nil && queue == nil)) {
+        return NO;
+    }
+
+    if ([self rejectWriteWithCallback:callback onQueue:queue]) {
+        return YES;
+    }
+
+    callback = [callback copy];
+    [self logTimingForKey:key method:SPTPersistentCacheDebugMethodTypeAppend type:SPTPersistentCacheDebugTimingTypeQueued];
+    [self doWriteWork:^{
+        [self logTimingForKey:key method:SPTPersistentCacheDebugMethodTypeAppend type:SPTPersistentCacheDebugTimingTypeStarting];
+        [self appendDataSync:data toKey:key withCallback:callback onQueue:queue];
+        [self logTimingForKey:key method:SPTPersistentCacheDebugMethodTypeAppend type:SPTPersistentCacheDebugTimingTypeFinished];
     } priority:self.options.writePriority qos:self.options.writeQualityOfService];
     return YES;
 }
 
+- (BOOL)prefetchDataForKeys:(NSArray<NSString *> *)keys
+                    callback:(SPTPersistentCacheResponseCallback _Nullable)callback
+                     onQueue:(dispatch_queue_t _Nullable)queue
+{
+    if ((callback != nil && queue == nil) || keys.count == 0) {
+        return NO;
+    }
+
+    callback = [callback copy];
+    [self logTimingForKey:[keys description] method:SPTPersistentCacheDebugMethodTypePrefetch type:SPTPersistentCacheDebugTimingTypeQueued];
+    [self doWork:^{
+        [self logTimingForKey:[keys description] method:SPTPersistentCacheDebugMethodTypePrefetch type:SPTPersistentCacheDebugTimingTypeStarting];
+        for (NSString *key in keys) {
+            SPTPersistentCacheResponse *response = [self prefetchDataForKeySync:key];
+            if (callback) {
+                [self dispatchCallback:^{
+                    callback(response);
+                } onQueue:queue];
+            }
+        }
+        [self logTimingForKey:[keys description] method:SPTPersistentCacheDebugMethodTypePrefetch type:SPTPersistentCacheDebugTimingTypeFinished];
+    } priority:self.options.prefetchPriority qos:self.options.prefetchQualityOfService];
+    return YES;
+}
+
+- (BOOL)sendDataForKey:(NSString *)key
+      toFileDescriptor:(int)fileDescriptor
+                 range:(NSRange)range
+              callback:(SPTPersistentCacheResponseCallback _Nullable)callback
+               onQueue:(dispatch_queue_t _Nullable)queue
+{
+    if (key == nil || fileDescriptor < 0 || (callback != nil && queue == nil)) {
+        return NO;
+    }
+
+    callback = [callback copy];
+    [self logTimingForKey:key method:SPTPersistentCacheDebugMethodTypeRead type:SPTPersistentCacheDebugTimingTypeQueued];
+    [self doReadWork:^{
+        [self logTimingForKey:key method:SPTPersistentCacheDebugMethodTypeRead type:SPTPersistentCacheDebugTimingTypeStarting];
+        SPTPersistentCacheResponse *response = [self sendDataForKeySync:key toFileDescriptor:fileDescriptor range:range];
+        if (callback) {
+            [self dispatchCallback:^{
+                callback(response);
+            } onQueue:queue];
+        }
+        [self logTimingForKey:key method:SPTPersistentCacheDebugMethodTypeRead type:SPTPersistentCacheDebugTimingTypeFinished];
+    } priority:self.options.readPriority qos:self.options.readQualityOfService];
+    return YES;
+}
 
 // TODO: return NOT_PERMITTED on try to touch TLL>0
 - (void)touchDataForKey:(NSString *)key
@@ -238,6 +631,10 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
         NSAssert(queue, @"You must specify the queue");
     }
 
+    if ([self rejectWriteWithCallback:callback onQueue:queue]) {
+        return;
+    }
+
     [self logTimingForKey:key method:SPTPersistentCacheDebugMethodTypeStore type:SPTPersistentCacheDebugTimingTypeQueued];
     [self doWork:^{
         [self logTimingForKey:key method:SPTPersistentCacheDebugMethodTypeStore type:SPTPersistentCacheDebugTimingTypeStarting];
@@ -256,6 +653,10 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
                                                                         if (header->ttl == 0) {
                                                                             header->updateTimeSec = spt_uint64rint(self.currentDateTimeInterval);
                                                                         }
+                                                                        // Touching a locked record renews its lease
+                                                                        if (header->leaseExpirationSec != 0 && [self isLockedWithHeader:header]) {
+                                                                            [self renewLockLeaseWithHeader:header forKey:key];
+                                                                        }
                                                                     }
                                                                     writeBack:YES
                                                                      complain:NO];
@@ -268,9 +669,9 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
         }
 
         if (callback) {
-            SPTPersistentCacheSafeDispatch(queue, ^{
+            [self dispatchCallback:^{
                 callback(response);
-            });
+            } onQueue:queue];
         }
         [self logTimingForKey:key method:SPTPersistentCacheDebugMethodTypeStore type:SPTPersistentCacheDebugTimingTypeFinished];
     } priority:self.options.writePriority qos:self.options.writeQualityOfService];
@@ -279,7 +680,10 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
 - (void)removeDataForKeysSync:(NSArray<NSString *> *)keys
 {
     for (NSString *key in keys) {
-        [self.dataCacheFileManager removeDataForKey:key];
+        [self serializeWorkForKey:key block:^{
+            [self.dataCacheFileManager removeDataForKey:key];
+            [self removeMetadataForKey:key];
+        }];
     }
 }
 
@@ -287,6 +691,10 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
                  callback:(SPTPersistentCacheResponseCallback _Nullable)callback
                   onQueue:(dispatch_queue_t _Nullable)queue
 {
+    if ([self rejectWriteWithCallback:callback onQueue:queue]) {
+        return;
+    }
+
     [self logTimingForKey:[keys description] method:SPTPersistentCacheDebugMethodTypeRemove type:SPTPersistentCacheDebugTimingTypeQueued];
     [self doWork:^{
         [self logTimingForKey:[keys description] method:SPTPersistentCacheDebugMethodTypeRemove type:SPTPersistentCacheDebugTimingTypeStarting];
@@ -296,9 +704,9 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
                     SPTPersistentCacheResponse *response = [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationSucceeded
                                                                             error:nil
                                                                            record:nil];
-                    SPTPersistentCacheSafeDispatch(queue, ^{
+                    [self dispatchCallback:^{
                         callback(response);
-                    });
+                    } onQueue:queue];
                 }
         [self logTimingForKey:[keys description] method:SPTPersistentCacheDebugMethodTypeRemove type:SPTPersistentCacheDebugTimingTypeFinished];
     } priority:self.options.deletePriority qos:self.options.deleteQualityOfService];
@@ -312,6 +720,12 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
     if ((callback != nil && queue == nil) || keys.count == 0) {
         return NO;
     }
+    if (self.options.readOnly) {
+        for (NSUInteger i = 0; i < keys.count; ++i) {
+            [self rejectWriteWithCallback:callback onQueue:queue];
+        }
+        return YES;
+    }
     [self logTimingForKey:[keys description] method:SPTPersistentCacheDebugMethodTypeLock type:SPTPersistentCacheDebugTimingTypeQueued];
     [self doWork:^{
         [self logTimingForKey:[keys description] method:SPTPersistentCacheDebugMethodTypeLock type:SPTPersistentCacheDebugTimingTypeStarting];
@@ -320,13 +734,7 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
             BOOL __block expired = NO;
             SPTPersistentCacheResponse *response = [self alterHeaderForFileAtPath:filePath
                                                                         withBlock:^(SPTPersistentCacheRecordHeader *header) {
-                                                                            // Satisfy Req.#1.2
-                                                                            if ([self isDataExpiredWithHeader:header]) {
-                                                                                expired = YES;
-                                                                                return;
-                                                                            }
-                                                                            ++header->refCount;
-                                                                            // Do not update access time since file is locked
+                                                                            expired = ![self lockRecordWithHeader:header forKey:key count:1];
                                                                         }
                                                                         writeBack:YES
                                                                          complain:YES];
@@ -337,9 +745,9 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
                                                                        record:nil];
             }
             if (callback) {
-                SPTPersistentCacheSafeDispatch(queue, ^{
+                [self dispatchCallback:^{
                     callback(response);
-                });
+                } onQueue:queue];
             }
             
         } // for
@@ -355,6 +763,12 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
     if ((callback != nil && queue == nil) || keys.count == 0) {
         return NO;
     }
+    if (self.options.readOnly) {
+        for (NSUInteger i = 0; i < keys.count; ++i) {
+            [self rejectWriteWithCallback:callback onQueue:queue];
+        }
+        return YES;
+    }
     [self logTimingForKey:[keys description] method:SPTPersistentCacheDebugMethodTypeUnlock type:SPTPersistentCacheDebugTimingTypeQueued];
     [self doWork:^{
         [self logTimingForKey:[keys description] method:SPTPersistentCacheDebugMethodTypeUnlock type:SPTPersistentCacheDebugTimingTypeStarting];
@@ -362,18 +776,14 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
             NSString *filePath = [self.dataCacheFileManager pathForKey:key];
             SPTPersistentCacheResponse *response = [self alterHeaderForFileAtPath:filePath
                                                                         withBlock:^(SPTPersistentCacheRecordHeader *header){
-                                                                            if (header->refCount > 0) {
-                                                                                --header->refCount;
-                                                                            } else {
-                                                                                [self debugOutput:@"PersistentDataCache: Error trying to decrement refCount below 0 for file at path:%@", filePath];
-                                                                            }
+                                                                            [self unlockRecordWithHeader:header forKey:key count:1];
                                                                         }
                                                                         writeBack:YES
                                                                          complain:YES];
             if (callback) {
-                SPTPersistentCacheSafeDispatch(queue, ^{
+                [self dispatchCallback:^{
                     callback(response);
-                });
+                } onQueue:queue];
             }
         } // for
         [self logTimingForKey:[keys description] method:SPTPersistentCacheDebugMethodTypeUnlock type:SPTPersistentCacheDebugTimingTypeFinished];
@@ -381,81 +791,371 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
     return YES;
 }
 
-- (void)scheduleGarbageCollector
-{
-    [self.garbageCollector schedule];
-}
-
-- (void)unscheduleGarbageCollector
-{
-    [self.garbageCollector unschedule];
-}
-
-- (void)pruneWithCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
-                  onQueue:(dispatch_queue_t _Nullable)queue
+- (BOOL)batchLockDataForKeys:(NSArray<NSString *> *)keys
+                    callback:(SPTPersistentCacheBatchResponseCallback _Nullable)callback
+                     onQueue:(dispatch_queue_t _Nullable)queue
 {
-    [self logTimingForKey:@"prune" method:SPTPersistentCacheDebugMethodTypeRemove type:SPTPersistentCacheDebugTimingTypeQueued];
+    if ((callback != nil && queue == nil) || keys.count == 0) {
+        return NO;
+    }
+    if (self.options.readOnly) {
+        [self rejectBatchWriteForKeys:keys callback:callback onQueue:queue];
+        return YES;
+    }
+    [self logTimingForKey:[keys description] method:SPTPersistentCacheDebugMethodTypeLock type:SPTPersistentCacheDebugTimingTypeQueued];
     [self doWork:^{
-        [self logTimingForKey:@"prune" method:SPTPersistentCacheDebugMethodTypeRemove type:SPTPersistentCacheDebugTimingTypeStarting];
-        [self.dataCacheFileManager removeAllData];
+        [self logTimingForKey:[keys description] method:SPTPersistentCacheDebugMethodTypeLock type:SPTPersistentCacheDebugTimingTypeStarting];
+        NSDictionary<NSString *, SPTPersistentCacheResponse *> *responses = [self batchAlterHeadersForKeys:keys withBlock:^BOOL(SPTPersistentCacheRecordHeader *header, NSString *key, NSUInteger count) {
+            return [self lockRecordWithHeader:header forKey:key count:count];
+        }];
         if (callback) {
-            SPTPersistentCacheResponse *response = [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationSucceeded
-                                                                                                error:nil
-                                                                                               record:nil];
-            SPTPersistentCacheSafeDispatch(queue, ^{
-                callback(response);
-            });
+            [self dispatchCallback:^{
+                callback(responses);
+            } onQueue:queue];
         }
-        [self logTimingForKey:@"prune" method:SPTPersistentCacheDebugMethodTypeRemove type:SPTPersistentCacheDebugTimingTypeFinished];
-    } priority:self.options.deletePriority qos:self.options.deleteQualityOfService];
+        [self logTimingForKey:[keys description] method:SPTPersistentCacheDebugMethodTypeLock type:SPTPersistentCacheDebugTimingTypeFinished];
+    } priority:self.options.writePriority qos:self.options.writeQualityOfService];
+    return YES;
 }
 
-- (void)wipeLockedFilesWithCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
-                            onQueue:(dispatch_queue_t _Nullable)queue
+- (BOOL)batchUnlockDataForKeys:(NSArray<NSString *> *)keys
+                      callback:(SPTPersistentCacheBatchResponseCallback _Nullable)callback
+                       onQueue:(dispatch_queue_t _Nullable)queue
 {
-    [self logTimingForKey:@"wipeLocked" method:SPTPersistentCacheDebugMethodTypeRemove type:SPTPersistentCacheDebugTimingTypeQueued];
+    if ((callback != nil && queue == nil) || keys.count == 0) {
+        return NO;
+    }
+    if (self.options.readOnly) {
+        [self rejectBatchWriteForKeys:keys callback:callback onQueue:queue];
+        return YES;
+    }
+    [self logTimingForKey:[keys description] method:SPTPersistentCacheDebugMethodTypeUnlock type:SPTPersistentCacheDebugTimingTypeQueued];
     [self doWork:^{
-        [self logTimingForKey:@"wipeLocked" method:SPTPersistentCacheDebugMethodTypeRemove type:SPTPersistentCacheDebugTimingTypeStarting];
-        [self collectGarbageForceExpire:NO forceLocked:YES];
+        [self logTimingForKey:[keys description] method:SPTPersistentCacheDebugMethodTypeUnlock type:SPTPersistentCacheDebugTimingTypeStarting];
+        NSDictionary<NSString *, SPTPersistentCacheResponse *> *responses = [self batchAlterHeadersForKeys:keys withBlock:^BOOL(SPTPersistentCacheRecordHeader *header, NSString *key, NSUInteger count) {
+            [self unlockRecordWithHeader:header forKey:key count:count];
+            return YES;
+        }];
         if (callback) {
-            SPTPersistentCacheResponse *response = [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationSucceeded
-                                                                                                error:nil
-                                                                                               record:nil];
-            SPTPersistentCacheSafeDispatch(queue, ^{
-                callback(response);
-            });
+            [self dispatchCallback:^{
+                callback(responses);
+            } onQueue:queue];
         }
-        [self logTimingForKey:@"wipeLocked" method:SPTPersistentCacheDebugMethodTypeRemove type:SPTPersistentCacheDebugTimingTypeFinished];
+        [self logTimingForKey:[keys description] method:SPTPersistentCacheDebugMethodTypeUnlock type:SPTPersistentCacheDebugTimingTypeFinished];
     } priority:self.options.deletePriority qos:self.options.deleteQualityOfService];
+    return YES;
+}
 
+/**
+ * Increments ref count of a record count times and renews its lease.
+ * @return NO if the record expired and can't be locked. Satisfy Req.#1.2
+ */
+- (BOOL)lockRecordWithHeader:(SPTPersistentCacheRecordHeader *)header forKey:(NSString *)key count:(NSUInteger)count
+{
+    if ([self isDataExpiredWithHeader:header]) {
+        return NO;
+    }
+    // A lock whose lease has run out no longer counts
+    if ([self isLockLeaseExpiredWithHeader:header]) {
+        header->refCount = 0;
+        header->leaseExpirationSec = 0;
+    }
+    header->refCount += (uint32_t)count;
+    [self renewLockLeaseWithHeader:header forKey:key];
+    // Do not update access time since file is locked
+    return YES;
 }
 
-- (void)wipeNonLockedFilesWithCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
-                               onQueue:(dispatch_queue_t _Nullable)queue
+/**
+ * Decrements ref count of a record count times, the lease goes with the last lock.
+ */
+- (void)unlockRecordWithHeader:(SPTPersistentCacheRecordHeader *)header forKey:(NSString *)key count:(NSUInteger)count
 {
-    [self logTimingForKey:@"wipeNonLocked" method:SPTPersistentCacheDebugMethodTypeRemove type:SPTPersistentCacheDebugTimingTypeQueued];
-    [self doWork:^{
-        [self logTimingForKey:@"wipeNonLocked" method:SPTPersistentCacheDebugMethodTypeRemove type:SPTPersistentCacheDebugTimingTypeStarting];
-        [self collectGarbageForceExpire:YES forceLocked:NO];
-        if (callback) {
+    if ([self isLockLeaseExpiredWithHeader:header]) {
+        // The lock was released when its lease ran out
+        header->refCount = 0;
+    } else if (header->refCount >= count) {
+        header->refCount -= (uint32_t)count;
+    } else {
+        [self debugOutput:@"PersistentDataCache: Error trying to decrement refCount below 0 for key:%@", key];
+        header->refCount = 0;
+    }
+    if (header->refCount == 0) {
+        header->leaseExpirationSec = 0;
+        [self removeLockLeaseForKey:key];
+    }
+}
+
+/**
+ * Alters headers of the records of given keys in path order, so records sharing a subdirectory are visited together.
+ * Each distinct key is altered once, the block gets how many times it occurs in keys. Each header only has its data
+ * flushed when it is written, the folder or the drive is flushed once at the end.
+ * @return Response for each distinct key.
+ */
+- (NSDictionary<NSString *, SPTPersistentCacheResponse *> *)batchAlterHeadersForKeys:(NSArray<NSString *> *)keys
+                                                                          withBlock:(BOOL (^)(SPTPersistentCacheRecordHeader *header, NSString *key, NSUInteger count))block
+{
+    NSCountedSet<NSString *> *keyCounts = [[NSCountedSet alloc] initWithArray:keys];
+    NSMutableDictionary<NSString *, NSString *> *pathsByKey = [NSMutableDictionary dictionaryWithCapacity:keyCounts.count];
+    for (NSString *key in keyCounts) {
+        pathsByKey[key] = [self.dataCacheFileManager pathForKey:key];
+    }
+    NSArray<NSString *> *sortedKeys = [pathsByKey keysSortedByValueUsingSelector:@selector(compare:)];
+
+    NSMutableDictionary<NSString *, SPTPersistentCacheResponse *> *responses = [NSMutableDictionary dictionaryWithCapacity:sortedKeys.count];
+    NSMutableArray<NSString *> *alteredKeys = [NSMutableArray arrayWithCapacity:sortedKeys.count];
+    for (NSString *key in sortedKeys) {
+        NSString *filePath = pathsByKey[key];
+        const NSUInteger count = [keyCounts countForObject:key];
+        BOOL __block found = YES;
+        SPTPersistentCacheResponse * __block response = nil;
+        [self serializeWorkForKey:filePath.lastPathComponent block:^{
+            response = [self alterSerializedHeaderForFileAtPath:filePath
+                                                      withBlock:^(SPTPersistentCacheRecordHeader *header) {
+                                                          found = block(header, key, count);
+                                                      }
+                                                      writeBack:YES
+                                                           sync:NO
+                                                       complain:YES];
+        }];
+        if (!found) {
+            response = [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeNotFound
+                                                                    error:nil
+                                                                   record:nil];
+        } else if (response.result == SPTPersistentCacheResponseCodeOperationSucceeded) {
+            [alteredKeys addObject:key];
+        }
+        responses[key] = response;
+    }
+
+    NSError *syncError = (alteredKeys.count > 0 ? [self syncBatchDirectory] : nil);
+    if (syncError != nil) {
+        [self debugOutput:@"PersistentDataCache: Error flushing batch of %lu records, error:%@", (unsigned long)alteredKeys.count, syncError];
+        SPTPersistentCacheResponse *errorResponse = [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationError
+                                                                                                 error:syncError
+                                                                                                record:nil];
+        for (NSString *key in alteredKeys) {
+            responses[key] = errorResponse;
+        }
+    }
+
+    return [responses copy];
+}
+
+/**
+ * Ends a batch whose record files were each flushed with dataSync: as they were written. The cache folder is flushed
+ * once, on Darwin a full sync of the drive flushes its cache for all the files instead.
+ * @return nil on success otherwise POSIX error.
+ */
+- (NSError * _Nullable)syncBatchDirectory
+{
+    const int directory = open(self.options.cachePath.fileSystemRepresentation, O_RDONLY);
+    if (directory == -1) {
+        return SPTPersistentCacheLastPosixError();
+    }
+
+    int result = [self.posixWrapper fullSync:directory];
+    if (result == -1 && errno == ENOTSUP) {
+        result = [self.posixWrapper fsync:directory];
+    }
+    NSError *error = (result == -1 ? SPTPersistentCacheLastPosixError() : nil);
+    [self.posixWrapper close:directory];
+    return error;
+}
+
+/**
+ * Gives SPTPersistentCacheLoadingErrorReadOnly for each distinct key of a batch.
+ */
+- (void)rejectBatchWriteForKeys:(NSArray<NSString *> *)keys
+                       callback:(SPTPersistentCacheBatchResponseCallback _Nullable)callback
+                        onQueue:(dispatch_queue_t _Nullable)queue
+{
+    if (callback == nil) {
+        return;
+    }
+
+    SPTPersistentCacheResponse *response = [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationError
+                                                                                         error:[NSError spt_persistentDataCacheErrorWithCode:SPTPersistentCacheLoadingErrorReadOnly]
+                                                                                        record:nil];
+    NSMutableDictionary<NSString *, SPTPersistentCacheResponse *> *responses = [NSMutableDictionary dictionaryWithCapacity:keys.count];
+    for (NSString *key in keys) {
+        responses[key] = response;
+    }
+    [self dispatchCallback:^{
+        callback(responses);
+    } onQueue:queue];
+}
+
+- (void)scheduleGarbageCollector
+{
+    // Records are collected by the process owning the cache
+    if (self.options.readOnly) {
+        return;
+    }
+    [self.garbageCollector schedule];
+}
+
+- (void)unscheduleGarbageCollector
+{
+    [self.garbageCollector unschedule];
+}
+
+- (void)pruneWithCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
+                  onQueue:(dispatch_queue_t _Nullable)queue
+{
+    if ([self rejectWriteWithCallback:callback onQueue:queue]) {
+        return;
+    }
+
+    [self logTimingForKey:@"prune" method:SPTPersistentCacheDebugMethodTypeRemove type:SPTPersistentCacheDebugTimingTypeQueued];
+    [self doWork:^{
+        [self logTimingForKey:@"prune" method:SPTPersistentCacheDebugMethodTypeRemove type:SPTPersistentCacheDebugTimingTypeStarting];
+        // Buffered records would be written back by the next flush
+        [self.writeBuffer removeEntriesPassingTest:^BOOL(SPTPersistentCacheWriteBufferEntry *entry) {
+            return YES;
+        }];
+        [self.dataCacheFileManager removeAllData];
+        [self clearMetadata];
+        if (callback) {
+            SPTPersistentCacheResponse *response = [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationSucceeded
+                                                                                                error:nil
+                                                                                               record:nil];
+            [self dispatchCallback:^{
+                callback(response);
+            } onQueue:queue];
+        }
+        [self logTimingForKey:@"prune" method:SPTPersistentCacheDebugMethodTypeRemove type:SPTPersistentCacheDebugTimingTypeFinished];
+    } priority:self.options.deletePriority qos:self.options.deleteQualityOfService];
+}
+
+- (void)wipeLockedFilesWithCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
+                            onQueue:(dispatch_queue_t _Nullable)queue
+{
+    if ([self rejectWriteWithCallback:callback onQueue:queue]) {
+        return;
+    }
+
+    [self logTimingForKey:@"wipeLocked" method:SPTPersistentCacheDebugMethodTypeRemove type:SPTPersistentCacheDebugTimingTypeQueued];
+    [self doWork:^{
+        [self logTimingForKey:@"wipeLocked" method:SPTPersistentCacheDebugMethodTypeRemove type:SPTPersistentCacheDebugTimingTypeStarting];
+        [self discardBufferedRecordsLocked:YES];
+        [self collectGarbageForceExpire:NO forceLocked:YES];
+        if (callback) {
             SPTPersistentCacheResponse *response = [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationSucceeded
                                                                                                 error:nil
                                                                                                record:nil];
-            SPTPersistentCacheSafeDispatch(queue, ^{
+            [self dispatchCallback:^{
                 callback(response);
-            });
+            } onQueue:queue];
+        }
+        [self logTimingForKey:@"wipeLocked" method:SPTPersistentCacheDebugMethodTypeRemove type:SPTPersistentCacheDebugTimingTypeFinished];
+    } priority:self.options.deletePriority qos:self.options.deleteQualityOfService];
+
+}
+
+- (void)wipeNonLockedFilesWithCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
+                               onQueue:(dispatch_queue_t _Nullable)queue
+{
+    if ([self rejectWriteWithCallback:callback onQueue:queue]) {
+        return;
+    }
+
+    [self logTimingForKey:@"wipeNonLocked" method:SPTPersistentCacheDebugMethodTypeRemove type:SPTPersistentCacheDebugTimingTypeQueued];
+    [self doWork:^{
+        [self logTimingForKey:@"wipeNonLocked" method:SPTPersistentCacheDebugMethodTypeRemove type:SPTPersistentCacheDebugTimingTypeStarting];
+        [self discardBufferedRecordsLocked:NO];
+        [self collectGarbageForceExpire:YES forceLocked:NO];
+        if (callback) {
+            SPTPersistentCacheResponse *response = [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationSucceeded
+                                                                                                error:nil
+                                                                                               record:nil];
+            [self dispatchCallback:^{
+                callback(response);
+            } onQueue:queue];
         }
         [self logTimingForKey:@"wipeNonLocked" method:SPTPersistentCacheDebugMethodTypeRemove type:SPTPersistentCacheDebugTimingTypeFinished];
     } priority:self.options.deletePriority qos:self.options.deleteQualityOfService];
 }
 
+- (void)recoverWithCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
+                    onQueue:(dispatch_queue_t _Nullable)queue
+{
+    if ([self rejectWriteWithCallback:callback onQueue:queue]) {
+        return;
+    }
+
+    callback = [callback copy];
+    [self logTimingForKey:@"recover" method:SPTPersistentCacheDebugMethodTypeRemove type:SPTPersistentCacheDebugTimingTypeQueued];
+    [self doWork:^{
+        [self logTimingForKey:@"recover" method:SPTPersistentCacheDebugMethodTypeRemove type:SPTPersistentCacheDebugTimingTypeStarting];
+        [self recoverSync];
+        [self dispatchEmptyResponseWithResult:SPTPersistentCacheResponseCodeOperationSucceeded
+                                     callback:callback
+                                      onQueue:queue];
+        [self logTimingForKey:@"recover" method:SPTPersistentCacheDebugMethodTypeRemove type:SPTPersistentCacheDebugTimingTypeFinished];
+    } priority:self.options.garbageCollectionPriority qos:self.options.garbageCollectionQualityOfService];
+}
+
+- (void)exportSnapshotToPath:(NSString *)path
+                    callback:(SPTPersistentCacheResponseCallback _Nullable)callback
+                     onQueue:(dispatch_queue_t _Nullable)queue
+{
+    callback = [callback copy];
+    [self logTimingForKey:path method:SPTPersistentCacheDebugMethodTypeRead type:SPTPersistentCacheDebugTimingTypeQueued];
+    [self doWork:^{
+        [self logTimingForKey:path method:SPTPersistentCacheDebugMethodTypeRead type:SPTPersistentCacheDebugTimingTypeStarting];
+        NSError *error = [self exportSnapshotToPathSync:path];
+        if (error != nil) {
+            [self dispatchError:error result:SPTPersistentCacheResponseCodeOperationError callback:callback onQueue:queue];
+        } else {
+            [self dispatchEmptyResponseWithResult:SPTPersistentCacheResponseCodeOperationSucceeded
+                                         callback:callback
+                                          onQueue:queue];
+        }
+        [self logTimingForKey:path method:SPTPersistentCacheDebugMethodTypeRead type:SPTPersistentCacheDebugTimingTypeFinished];
+    } priority:self.options.garbageCollectionPriority qos:self.options.garbageCollectionQualityOfService];
+}
+
+- (void)importSnapshotFromPath:(NSString *)path
+                      callback:(SPTPersistentCacheResponseCallback _Nullable)callback
+                       onQueue:(dispatch_queue_t _Nullable)queue
+{
+    if ([self rejectWriteWithCallback:callback onQueue:queue]) {
+        return;
+    }
+
+    callback = [callback copy];
+    [self logTimingForKey:path method:SPTPersistentCacheDebugMethodTypeStore type:SPTPersistentCacheDebugTimingTypeQueued];
+    [self doWork:^{
+        [self logTimingForKey:path method:SPTPersistentCacheDebugMethodTypeStore type:SPTPersistentCacheDebugTimingTypeStarting];
+        NSError *error = [self importSnapshotFromPathSync:path];
+        if (error != nil) {
+            [self dispatchError:error result:SPTPersistentCacheResponseCodeOperationError callback:callback onQueue:queue];
+        } else {
+            [self dispatchEmptyResponseWithResult:SPTPersistentCacheResponseCodeOperationSucceeded
+                                         callback:callback
+                                          onQueue:queue];
+        }
+        [self logTimingForKey:path method:SPTPersistentCacheDebugMethodTypeStore type:SPTPersistentCacheDebugTimingTypeFinished];
+    } priority:self.options.writePriority qos:self.options.writeQualityOfService];
+}
+
 - (NSUInteger)totalUsedSizeInBytes
 {
+    if ([self isMetadataTableComplete]) {
+        return (NSUInteger)sptpc_metadata_size(_metadataTable, spt_uint64rint(self.currentDateTimeInterval), NULL);
+    }
     return self.dataCacheFileManager.totalUsedSizeInBytes;
 }
 
 - (NSUInteger)lockedItemsSizeInBytes
 {
+    if ([self isMetadataTableComplete]) {
+        uint64_t lockedSize = 0;
+        sptpc_metadata_size(_metadataTable, spt_uint64rint(self.currentDateTimeInterval), &lockedSize);
+        return (NSUInteger)lockedSize;
+    }
+
     NSUInteger size = 0;
     NSURL *urlPath = [NSURL URLWithString:self.options.cachePath];
     NSDirectoryEnumerator *dirEnumerator = [self.fileManager enumeratorAtURL:urlPath
@@ -479,7 +1179,7 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
                 BOOL __block locked = NO;
                 // WARNING: We may skip return result here bcuz in that case we will not count file as locked
                 [self alterHeaderForFileAtPath:filePath withBlock:^(SPTPersistentCacheRecordHeader *header) {
-                    locked = header->refCount > 0;
+                    locked = [self isLockedWithHeader:header];
                 } writeBack:NO complain:YES];
                 if (locked) {
                     size += [self.dataCacheFileManager getFileSizeAtPath:filePath];
@@ -496,6 +1196,7 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
 - (void)dealloc
 {
     [_garbageCollector unschedule];
+    sptpc_metadata_close(_metadataTable);
 }
 
 /**
@@ -504,161 +1205,847 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
 - (void)loadDataForKeySync:(NSString *)key
               withCallback:(SPTPersistentCacheResponseCallback)callback
                    onQueue:(dispatch_queue_t)queue
+{
+    SPTPersistentCacheResponse *response = [self loadResponseForKeySync:key];
+
+    // Callback only after we finished everyhing to avoid situation when user gets notified and we are still writting
+    [self dispatchCallback:^{
+        callback(response);
+    } onQueue:queue];
+}
+
+/**
+ * Loads the record for key on the calling thread with the same per-key serialization as the queued load.
+ */
+- (SPTPersistentCacheResponse *)loadResponseForKeySync:(NSString *)key
+{
+    SPTPersistentCacheResponse *bufferedResponse = [self bufferedResponseForKey:key];
+    if (bufferedResponse != nil) {
+        return bufferedResponse;
+    }
+
+    // Nothing is written back by read-only caches and the owner replaces record files atomically, so no lock is needed.
+    // The owner does rewrite headers in place though, a record whose header was caught changing is read again.
+    if (self.options.readOnly) {
+        SPTPersistentCacheResponse *response = nil;
+        NSUInteger attempt = 0;
+        do {
+            response = [self loadSerializedResponseForKeySync:key];
+        } while ([self isTornHeaderError:response.error] && attempt++ < SPTPersistentCacheTornHeaderRereadCount);
+        return response;
+    }
+
+    SPTPersistentCacheResponse * __block response = nil;
+    [self serializeWorkForKey:key block:^{
+        response = [self loadSerializedResponseForKeySync:key];
+    }];
+    return response;
+}
+
+/**
+ * Does the actual loading for loadResponseForKeySync:. Must be called holding the key lock since the access time is
+ * written back, unless the cache is read-only.
+ */
+- (SPTPersistentCacheResponse *)loadSerializedResponseForKeySync:(NSString *)key
 {
     NSString *filePath = [self.dataCacheFileManager pathForKey:key];
 
-    // File not exist -> inform user
-    if (![self.fileManager fileExistsAtPath:filePath]) {
-        [self dispatchEmptyResponseWithResult:SPTPersistentCacheResponseCodeNotFound callback:callback onQueue:queue];
-        return;
+    NSError *error = nil;
+    const BOOL readOnly = self.options.readOnly;
+    // Read-only caches never write back so the mapping is used as is, others alter the header in memory
+    NSMutableData *writableData = nil;
+    NSData *rawData = nil;
+    if (readOnly) {
+        rawData = [NSData dataWithContentsOfFile:filePath options:NSDataReadingMappedAlways error:&error];
     } else {
-        // File exist
-        NSError *error = nil;
-        NSMutableData *rawData = [NSMutableData dataWithContentsOfFile:filePath
-                                                               options:NSDataReadingMappedIfSafe
-                                                                 error:&error];
-        if (rawData == nil) {
-            // File read with error -> inform user
-            [self dispatchError:error
-                         result:SPTPersistentCacheResponseCodeOperationError
-                       callback:callback
-                        onQueue:queue];
-        } else {
-            SPTPersistentCacheRecordHeader *header = SPTPersistentCacheGetHeaderFromData(rawData.mutableBytes, rawData.length);
+        writableData = [NSMutableData dataWithContentsOfFile:filePath options:NSDataReadingMappedIfSafe error:&error];
+        rawData = writableData;
+    }
+    if (rawData == nil) {
+        // File not exist -> inform user, found out by the read itself instead of a lookup before it
+        if ([error.domain isEqualToString:NSCocoaErrorDomain] && error.code == NSFileReadNoSuchFileError) {
+            return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeNotFound error:nil record:nil];
+        }
+        // File read with error -> inform user
+        return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationError error:error record:nil];
+    }
 
-            // If not enough data to cast to header, its not the file we can process
-            if (header == NULL) {
-                NSError *headerError = [NSError spt_persistentDataCacheErrorWithCode:SPTPersistentCacheLoadingErrorNotEnoughDataToGetHeader];
-                [self dispatchError:headerError
-                             result:SPTPersistentCacheResponseCodeOperationError
-                           callback:callback
-                            onQueue:queue];
-                return;
-            }
+    // If not enough data to cast to header, its not the file we can process
+    if (rawData.length < SPTPersistentCacheRecordHeaderSize) {
+        NSError *headerError = [NSError spt_persistentDataCacheErrorWithCode:SPTPersistentCacheLoadingErrorNotEnoughDataToGetHeader];
+        return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationError error:headerError record:nil];
+    }
 
-            SPTPersistentCacheRecordHeader localHeader;
-            memcpy(&localHeader, header, sizeof(localHeader));
+    SPTPersistentCacheRecordHeader localHeader;
+    memcpy(&localHeader, rawData.bytes, sizeof(localHeader));
 
-            // Check header is valid
-            NSError *headerError = SPTPersistentCacheCheckValidHeader(&localHeader);
-            if (headerError != nil) {
-                [self dispatchError:headerError
-                             result:SPTPersistentCacheResponseCodeOperationError
-                           callback:callback
-                            onQueue:queue];
-                return;
-            }
+    // Check header is valid
+    NSError *headerError = SPTPersistentCacheCheckValidHeader(&localHeader);
+    if (headerError != nil) {
+        return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationError error:headerError record:nil];
+    }
 
-            const NSUInteger refCount = localHeader.refCount;
+    // Locks whose lease has run out are reported as released
+    const NSUInteger refCount = [self isLockedWithHeader:&localHeader] ? localHeader.refCount : 0;
 
-            // We return locked files even if they expired, GC doesnt collect them too so they valuable to user
-            // Satisfy Req.#1.2
-            if (![self isDataCanBeReturnedWithHeader:&localHeader]) {
+    // Expired records are still given to the caller within the grace period, marked as stale
+    const BOOL stale = [self isDataStaleWithHeader:&localHeader];
+
+    // We return locked files even if they expired, GC doesnt collect them too so they valuable to user
+    // Satisfy Req.#1.2
+    if (!stale && ![self isDataCanBeReturnedWithHeader:&localHeader]) {
 #ifdef DEBUG_OUTPUT_ENABLED
-                [self debugOutput:@"PersistentDataCache: Record with key: %@ expired, t:%llu, TTL:%llu", key, localHeader.updateTimeSec, localHeader.ttl];
+        [self debugOutput:@"PersistentDataCache: Record with key: %@ expired, t:%llu, TTL:%llu", key, localHeader.updateTimeSec, localHeader.ttl];
 #endif
-                [self dispatchEmptyResponseWithResult:SPTPersistentCacheResponseCodeNotFound
-                                             callback:callback
-                                              onQueue:queue];
-                return;
+        return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeNotFound error:nil record:nil];
+    }
+
+    // Check that payload is correct size, appendable records may have an uncommitted tail
+    const uint64_t storedPayloadSize = [rawData length] - SPTPersistentCacheRecordHeaderSize;
+    const BOOL appendable = (localHeader.flags & SPTPersistentCacheRecordHeaderFlagsAppendable) != 0;
+    if (appendable ? localHeader.payloadSizeBytes > storedPayloadSize : localHeader.payloadSizeBytes != storedPayloadSize) {
+        [self debugOutput:@"PersistentDataCache: Error: Wrong payload size for key:%@ , will return error", key];
+        return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationError
+                                                            error:[NSError spt_persistentDataCacheErrorWithCode:SPTPersistentCacheLoadingErrorWrongPayloadSize]
+                                                           record:nil];
+    }
+
+    NSRange payloadRange = NSMakeRange(SPTPersistentCacheRecordHeaderSize, (NSUInteger)localHeader.payloadSizeBytes);
+    NSData *payload = (readOnly ? [self noCopyDataWithRange:payloadRange ofMappedData:rawData] : [rawData subdataWithRange:payloadRange]);
+    const NSUInteger ttl = (NSUInteger)localHeader.ttl;
+
+
+    SPTPersistentCacheRecord *record = [[SPTPersistentCacheRecord alloc] initWithData:payload
+                                                                                  key:key
+                                                                             refCount:refCount
+                                                                                  ttl:ttl
+                                                                              version:localHeader.version];
+
+    [self.hotSet recordAccessForKey:key time:self.currentDateTimeInterval];
+
+    SPTPersistentCacheResponse *response = [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationSucceeded
+                                                                                        error:nil
+                                                                                       record:record
+                                                                                        stale:stale
+                                                                           refreshRecommended:[self isRefreshRecommendedWithHeader:&localHeader]];
+    // If data ttl == 0 we update access time, stale records keep it so they still expire
+    if (ttl == 0 && !stale && !readOnly && self.options.processSharedLocking) {
+        // Other processes change the lock fields in place under the header lock, rewriting the whole record would
+        // revert them. Only the update time is set, under the same lock, in the header as it is now.
+        const uint64_t updateTime = spt_uint64rint(self.currentDateTimeInterval);
+        const uint32_t version = localHeader.version;
+        [self alterSerializedHeaderForFileAtPath:filePath withBlock:^(SPTPersistentCacheRecordHeader *header) {
+            if (header->version == version && header->ttl == 0) {
+                header->updateTimeSec = updateTime;
             }
+        } writeBack:YES complain:NO];
+    } else if (ttl == 0 && !stale && !readOnly) {
+        localHeader.updateTimeSec = spt_uint64rint(self.currentDateTimeInterval);
+        localHeader.crc = SPTPersistentCacheCalculateHeaderCRC(&localHeader);
+        [writableData replaceBytesInRange:NSMakeRange(0, sizeof(localHeader)) withBytes:&localHeader];
+
+        // Write back with updated access attributes
+        NSError *werror = nil;
+        if (![writableData writeToFile:filePath options:NSDataWritingAtomic error:&werror]) {
+            [self debugOutput:@"PersistentDataCache: Error writing back record:%@, error:%@", filePath.lastPathComponent, werror];
+        } else {
+            [self updateMetadataForKey:key header:&localHeader];
+#ifdef DEBUG_OUTPUT_ENABLED
+            [self debugOutput:@"PersistentDataCache: Writing back record:%@ OK", filePath.lastPathComponent];
+#endif
+        }
+    }
 
-            // Check that payload is correct size
-            if (localHeader.payloadSizeBytes != [rawData length] - SPTPersistentCacheRecordHeaderSize) {
-                [self debugOutput:@"PersistentDataCache: Error: Wrong payload size for key:%@ , will return error", key];
-                [self dispatchError:[NSError spt_persistentDataCacheErrorWithCode:SPTPersistentCacheLoadingErrorWrongPayloadSize]
-                             result:SPTPersistentCacheResponseCodeOperationError
-                           callback:callback onQueue:queue];
-                return;
+    return response;
+}
+
+/**
+ * Store method used internaly. Called on work queue.
+ */
+- (NSError *)storeDataSync:(NSData *)data
+                    forKey:(NSString *)key
+                       ttl:(NSUInteger)ttl
+                    locked:(BOOL)isLocked
+              withCallback:(SPTPersistentCacheResponseCallback)callback
+                   onQueue:(dispatch_queue_t)queue
+{
+    return [self storeDataSync:data forKey:key ttl:ttl locked:isLocked precondition:nil withCallback:callback onQueue:queue];
+}
+
+/**
+ * Store method used internaly. Called on work queue.
+ * The precondition check, the version bump and the write happen under the key lock, the callback is dispatched once
+ * it is released.
+ */
+- (NSError *)storeDataSync:(NSData *)data
+                    forKey:(NSString *)key
+                       ttl:(NSUInteger)ttl
+                    locked:(BOOL)isLocked
+              precondition:(SPTPersistentCacheStorePreconditionType)precondition
+              withCallback:(SPTPersistentCacheResponseCallback)callback
+                   onQueue:(dispatch_queue_t)queue
+{
+    SPTPersistentCacheResponse * __block response = nil;
+
+    [self serializeWorkForKey:key block:^{
+        response = [self storeResponseForData:data forKey:key ttl:ttl locked:isLocked precondition:precondition];
+    }];
+
+    if (callback != nil) {
+        [self dispatchCallback:^{
+            callback(response);
+        } onQueue:queue];
+    }
+
+    return response.error;
+}
+
+/**
+ * Checks the precondition and writes a record for key whose version follows the current one.
+ * Must be called holding the key lock.
+ */
+- (SPTPersistentCacheResponse *)storeResponseForData:(NSData *)data
+                                              forKey:(NSString *)key
+                                                 ttl:(NSUInteger)ttl
+                                              locked:(BOOL)isLocked
+                                        precondition:(SPTPersistentCacheStorePreconditionType)precondition
+{
+    NSString *filePath = [self.dataCacheFileManager pathForKey:key];
+
+    // Read header of the current record to continue its version and to check the precondition
+    BOOL __block hasHeader = NO;
+    BOOL __block canBeReturned = NO;
+    SPTPersistentCacheRecordHeader __block currentHeader;
+    memset(&currentHeader, 0, SPTPersistentCacheRecordHeaderSize);
+    [self alterHeaderForFileAtPath:filePath withBlock:^(SPTPersistentCacheRecordHeader *header) {
+        memcpy(&currentHeader, header, SPTPersistentCacheRecordHeaderSize);
+        hasHeader = YES;
+        // Satisfy Req.#1.2
+        canBeReturned = [self isDataCanBeReturnedWithHeader:header];
+    } writeBack:NO complain:NO];
+
+    if (precondition != nil) {
+        NSError *error = precondition(canBeReturned ? &currentHeader : NULL);
+        if (error != nil) {
+            return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationError
+                                                                error:error
+                                                               record:nil];
+        }
+    }
+
+    NSData *rawData = [self recordDataWithPayload:data
+                                           forKey:key
+                                              ttl:ttl
+                                           locked:isLocked
+                                  previousVersion:(hasHeader ? currentHeader.version : 0)];
+
+    NSError *writeError = nil;
+
+    if (![rawData writeToFile:filePath options:NSDataWritingAtomic error:&writeError]) {
+        [self debugOutput:@"PersistentDataCache: Error writting to file:%@ , for key:%@. Removing it...", filePath, key];
+        [self removeDataForKeysSync:@[key]];
+        return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationError
+                                                            error:writeError
+                                                           record:nil];
+    }
+    [self updateMetadataForKey:key record:rawData];
+
+    return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationSucceeded
+                                                        error:nil
+                                                       record:nil];
+}
+
+/**
+ * Fire-and-forget store used internaly. Called on work queue.
+ * Nothing is given to the caller, so no response or error is built and failures are only counted.
+ */
+- (void)storeDataWithoutResponseSync:(NSData *)data
+                              forKey:(NSString *)key
+                                 ttl:(NSUInteger)ttl
+                              locked:(BOOL)isLocked
+{
+    [self serializeWorkForKey:key block:^{
+        if ([self writeRecordWithPayload:data forKey:key ttl:ttl locked:isLocked error:NULL]) {
+            atomic_fetch_add_explicit(&self->_fireAndForgetStoreCount, 1, memory_order_relaxed);
+        } else {
+            atomic_fetch_add_explicit(&self->_failedFireAndForgetStoreCount, 1, memory_order_relaxed);
+        }
+    }];
+}
+
+/**
+ * Writes a record for key whose version follows the current one, removing the record if the write fails.
+ * Must be called holding the key lock.
+ */
+- (BOOL)writeRecordWithPayload:(NSData *)data
+                        forKey:(NSString *)key
+                           ttl:(NSUInteger)ttl
+                        locked:(BOOL)isLocked
+                         error:(NSError * _Nullable *)error
+{
+    NSString *filePath = [self.dataCacheFileManager pathForKey:key];
+
+    // Only the version of the current record is needed, so its header is read without the alteration machinery
+    sptpc_header currentHeader;
+    const BOOL hasHeader = (sptpc_read_header(filePath.fileSystemRepresentation, &currentHeader) == SPTPC_OK);
+
+    NSData *rawData = [self recordDataWithPayload:data
+                                           forKey:key
+                                              ttl:ttl
+                                           locked:isLocked
+                                  previousVersion:(hasHeader ? currentHeader.version : 0)];
+
+    if ([rawData writeToFile:filePath options:NSDataWritingAtomic error:error]) {
+        [self updateMetadataForKey:key record:rawData];
+        return YES;
+    }
+    [self.dataCacheFileManager removeDataForKey:key];
+    [self removeMetadataForKey:key];
+    return NO;
+}
+
+/**
+ * Drops the buffered records which are locked or not so a wipe doesn't see them written back by the next flush. The
+ * records they replace on disk are removed as well, since the dropped stores superseded them.
+ */
+- (void)discardBufferedRecordsLocked:(BOOL)locked
+{
+    NSArray<NSString *> *keys = [self.writeBuffer removeEntriesPassingTest:^BOOL(SPTPersistentCacheWriteBufferEntry *entry) {
+        return entry.locked == locked;
+    }];
+    [self removeDataForKeysSync:keys];
+}
+
+- (void)flushWriteBufferSync
+{
+    for (NSString *key in [self.writeBuffer beginFlush]) {
+        // Taking the key lock writes the buffered record
+        [self serializeWorkForKey:key block:^{}];
+    }
+}
+
+/**
+ * Writes the buffered record for key, if any, so operations on the key find it on disk.
+ * Must be called holding the key lock.
+ */
+- (void)writeBufferedRecordForKey:(NSString *)key
+{
+    SPTPersistentCacheWriteBufferEntry *entry = [self.writeBuffer takeEntryForKey:key];
+    if (entry == nil) {
+        return;
+    }
+
+    NSError *error = nil;
+    if (![self writeRecordWithPayload:entry.data forKey:key ttl:entry.ttl locked:entry.locked error:&error]) {
+        [self debugOutput:@"PersistentDataCache: Error writing buffered record for key:%@, error:%@", key, error];
+    }
+}
+
+/**
+ * Gives the buffered record for key without touching the disk, nil if it isn't buffered.
+ */
+- (SPTPersistentCacheResponse *)bufferedResponseForKey:(NSString *)key
+{
+    SPTPersistentCacheWriteBufferEntry *entry = [self.writeBuffer entryForKey:key];
+    if (entry == nil) {
+        return nil;
+    }
+
+    // The version is only known once the record is written
+    SPTPersistentCacheRecord *record = [[SPTPersistentCacheRecord alloc] initWithData:entry.data
+                                                                                  key:key
+                                                                             refCount:(entry.locked ? 1 : 0)
+                                                                                  ttl:entry.ttl
+                                                                              version:0];
+    [self.hotSet recordAccessForKey:key time:self.currentDateTimeInterval];
+    return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationSucceeded
+                                                        error:nil
+                                                       record:record];
+}
+
+/**
+ * Builds the contents of a record file for payload and creates the directory of the record.
+ * Must be called holding the key lock.
+ */
+- (NSData *)recordDataWithPayload:(NSData *)data
+                           forKey:(NSString *)key
+                              ttl:(NSUInteger)ttl
+                           locked:(BOOL)isLocked
+                  previousVersion:(uint32_t)previousVersion
+{
+    NSString *subDir = [self.dataCacheFileManager subDirectoryPathForKey:key];
+    [self.fileManager createDirectoryAtPath:subDir withIntermediateDirectories:YES attributes:nil error:nil];
+
+    const NSUInteger payloadLength = [data length];
+    const NSUInteger rawDataLength = SPTPersistentCacheRecordHeaderSize + payloadLength;
+
+    NSMutableData *rawData = [NSMutableData dataWithCapacity:rawDataLength];
+
+    // Spread expiration of records stored together by shortening their TTL, the update time stays the time of the
+    // write since pruning and the metadata table order records by it
+    const uint64_t effectiveTTL = ttl - (ttl > 0 ? [self expirationJitterForPeriod:ttl] : 0);
+
+    SPTPersistentCacheRecordHeader header = SPTPersistentCacheRecordHeaderMake(effectiveTTL,
+                                                                               payloadLength,
+                                                                               spt_uint64rint(self.currentDateTimeInterval),
+                                                                               isLocked);
+    header.version = SPTPersistentCacheNextRecordVersion(previousVersion);
+    if (isLocked) {
+        [self renewLockLeaseWithHeader:&header forKey:key];
+    }
+    header.crc = SPTPersistentCacheCalculateHeaderCRC(&header);
+
+    [rawData appendBytes:&header length:SPTPersistentCacheRecordHeaderSize];
+    [rawData appendData:data];
+
+    return rawData;
+}
+
+/**
+ * Append method used internaly. Called on work queue.
+ */
+- (void)appendDataSync:(NSData *)data
+                 toKey:(NSString *)key
+          withCallback:(SPTPersistentCacheResponseCallback)callback
+               onQueue:(dispatch_queue_t)queue
+{
+    SPTPersistentCacheResponse * __block response = nil;
+
+    [self serializeWorkForKey:key block:^{
+        NSString *filePath = [self.dataCacheFileManager pathForKey:key];
+
+        response = [self guardOpenFileWithPath:filePath
+                                      jobBlock:^SPTPersistentCacheResponse*(int filedes) {
+                                          if (self.options.processSharedLocking) {
+                                              SPTPersistentCacheResponse *lockResponse = [self lockHeaderOfOpenedFile:filedes atPath:filePath];
+                                              if (lockResponse != nil) {
+                                                  return lockResponse;
+                                              }
+                                          }
+                                          return [self appendData:data
+                                                     toOpenedFile:filedes
+                                                           atPath:filePath];
+                                      }
+                                      complain:NO
+                                     writeBack:YES];
+
+        // Nothing to append to, so the data becomes the payload of a new record
+        if (response.result == SPTPersistentCacheResponseCodeNotFound) {
+            response = [self storeResponseForData:data forKey:key ttl:0 locked:NO precondition:nil];
+        }
+    }];
+
+    if (callback != nil) {
+        [self dispatchCallback:^{
+            callback(response);
+        } onQueue:queue];
+    }
+}
+
+/**
+ * Appends data to the payload of an already opened record file using a length-commit protocol:
+ * 1. Mark record as appendable so bytes behind the committed payload are ignored by loads.
+ * 2. Drop leftovers of an interrupted append and write the data behind the committed payload.
+ * 3. Commit the new payload length by rewriting the header.
+ * Each step is synced to disk before the next one starts.
+ */
+- (SPTPersistentCacheResponse *)appendData:(NSData *)data
+                              toOpenedFile:(int)filedes
+                                    atPath:(NSString *)filePath
+{
+    SPTPersistentCacheRecordHeader header;
+    SPTPersistentCacheResponse *headerResponse = [self readHeader:&header fromOpenedFile:filedes atPath:filePath];
+    if (headerResponse != nil) {
+        return headerResponse;
+    }
+
+    // Satisfy Req.#1.2
+    if (![self isDataCanBeReturnedWithHeader:&header]) {
+        return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeNotFound
+                                                            error:nil
+                                                           record:nil];
+    }
+
+    NSError *error = nil;
+
+    if ((header.flags & SPTPersistentCacheRecordHeaderFlagsAppendable) == 0) {
+        header.flags |= SPTPersistentCacheRecordHeaderFlagsAppendable;
+        header.crc = SPTPersistentCacheCalculateHeaderCRC(&header);
+        error = [self writeHeader:&header toOpenedFile:filedes];
+    }
+
+    if (error == nil) {
+        const off_t committedLength = (off_t)(SPTPersistentCacheRecordHeaderSize + header.payloadSizeBytes);
+        if ([self.posixWrapper ftruncate:filedes length:committedLength] != 0 ||
+            [self.posixWrapper pwrite:filedes buffer:data.bytes bufferSize:data.length offset:committedLength] != (ssize_t)data.length ||
+            [self.posixWrapper fsync:filedes] != 0) {
+            error = SPTPersistentCacheLastPosixError();
+        }
+    }
+
+    if (error == nil) {
+        header.payloadSizeBytes += data.length;
+        header.updateTimeSec = spt_uint64rint(self.currentDateTimeInterval);
+        header.version = SPTPersistentCacheNextRecordVersion(header.version);
+        header.crc = SPTPersistentCacheCalculateHeaderCRC(&header);
+        error = [self writeHeader:&header toOpenedFile:filedes];
+    }
+
+    if (error != nil) {
+        [self debugOutput:@"PersistentDataCache: Error appending to file path:%@ , error:%@", filePath, [error localizedDescription]];
+        return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationError
+                                                            error:error
+                                                           record:nil];
+    }
+    [self updateMetadataForKey:filePath.lastPathComponent header:&header];
+
+    return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationSucceeded
+                                                        error:nil
+                                                       record:nil];
+}
+
+/**
+ * Returns payload which points into the mapping of a record file instead of copying it. The mapping stays alive as
+ * long as the payload does.
+ */
+- (NSData *)noCopyDataWithRange:(NSRange)range ofMappedData:(NSData *)mappedData
+{
+    const uint8_t *bytes = (const uint8_t *)mappedData.bytes + range.location;
+    dispatch_data_t payload = dispatch_data_create(bytes, range.length, NULL, ^{
+        (void)mappedData;
+    });
+    return (NSData *)payload;
+}
+
+/**
+ * Reads and validates header from the current position of an opened record file.
+ * @return nil on success otherwise error response.
+ */
+- (SPTPersistentCacheResponse *)readHeader:(SPTPersistentCacheRecordHeader *)header
+                            fromOpenedFile:(int)filedes
+                                    atPath:(NSString *)filePath
+{
+    ssize_t readBytes = [self.posixWrapper read:filedes
+                                         buffer:header
+                                     bufferSize:SPTPersistentCacheRecordHeaderSize];
+    if (readBytes != (ssize_t)SPTPersistentCacheRecordHeaderSize) {
+        NSError *error = (readBytes == -1 ? SPTPersistentCacheLastPosixError()
+                                          : [NSError spt_persistentDataCacheErrorWithCode:SPTPersistentCacheLoadingErrorNotEnoughDataToGetHeader]);
+        [self debugOutput:@"PersistentDataCache: Error not enough data to read the header of file path:%@ , error:%@",
+         filePath, [error localizedDescription]];
+        return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationError
+                                                            error:error
+                                                           record:nil];
+    }
+
+    NSError *headerError = [self rereadTornHeader:header
+                                   fromOpenedFile:filedes
+                                        withError:SPTPersistentCacheCheckValidHeader(header)];
+    if (headerError != nil) {
+        [self debugOutput:@"PersistentDataCache: Error checking header at file path:%@ , error:%@", filePath, headerError];
+        return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationError
+                                                            error:headerError
+                                                           record:nil];
+    }
+
+    return nil;
+}
+
+/**
+ * Whether a read of a read-only cache failed on a header the owner may have been rewriting in place at the time.
+ */
+- (BOOL)isTornHeaderError:(NSError *)error
+{
+    return self.options.readOnly &&
+           [error.domain isEqualToString:SPTPersistentCacheErrorDomain] &&
+           error.code == SPTPersistentCacheLoadingErrorInvalidHeaderCRC;
+}
+
+/**
+ * Reads the header of an opened record file again while it fails its CRC check as a torn header.
+ * @return nil if a reread header is valid otherwise the error of the last check.
+ */
+- (NSError *)rereadTornHeader:(SPTPersistentCacheRecordHeader *)header
+               fromOpenedFile:(int)filedes
+                    withError:(NSError *)headerError
+{
+    for (NSUInteger attempt = 0; [self isTornHeaderError:headerError] && attempt < SPTPersistentCacheTornHeaderRereadCount; ++attempt) {
+        ssize_t readBytes = [self.posixWrapper pread:filedes
+                                              buffer:header
+                                          bufferSize:SPTPersistentCacheRecordHeaderSize
+                                              offset:0];
+        if (readBytes != (ssize_t)SPTPersistentCacheRecordHeaderSize) {
+            break;
+        }
+        headerError = SPTPersistentCacheCheckValidHeader(header);
+    }
+    return headerError;
+}
+
+/**
+ * Prefetch method used internaly. Called on work queue.
+ * Validates the header of the record and asks the system to read its payload ahead into the page cache.
+ */
+- (SPTPersistentCacheResponse *)prefetchDataForKeySync:(NSString *)key
+{
+    SPTPersistentCacheResponse * __block response = nil;
+    [self serializeWorkForKey:key block:^{
+        NSString *filePath = [self.dataCacheFileManager pathForKey:key];
+        response = [self guardOpenFileWithPath:filePath jobBlock:^SPTPersistentCacheResponse*(int filedes) {
+            SPTPersistentCacheRecordHeader header;
+            SPTPersistentCacheResponse *headerResponse = [self readHeader:&header fromOpenedFile:filedes atPath:filePath];
+            if (headerResponse != nil) {
+                return headerResponse;
             }
 
-            NSRange payloadRange = NSMakeRange(SPTPersistentCacheRecordHeaderSize, (NSUInteger)localHeader.payloadSizeBytes);
-            NSData *payload = [rawData subdataWithRange:payloadRange];
-            const NSUInteger ttl = (NSUInteger)localHeader.ttl;
+            // Satisfy Req.#1.2, stale records are still given by loads so warm them too
+            if (![self isDataCanBeReturnedWithHeader:&header] && ![self isDataStaleWithHeader:&header]) {
+                return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeNotFound
+                                                                    error:nil
+                                                                   record:nil];
+            }
+
+            // Advice is only a hint, failing to give it doesn't make the record unusable
+            if ([self.posixWrapper adviseWillNeed:filedes
+                                           offset:(off_t)SPTPersistentCacheRecordHeaderSize
+                                           length:(off_t)header.payloadSizeBytes] != 0) {
+                [self debugOutput:@"PersistentDataCache: Unable to advise read ahead for file path:%@ , error:%@",
+                 filePath, [SPTPersistentCacheLastPosixError() localizedDescription]];
+            }
 
+            return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationSucceeded
+                                                                error:nil
+                                                               record:nil];
+        } complain:NO writeBack:NO];
+    }];
+    return response;
+}
+
+/**
+ * Send method used internaly. Called on work queue.
+ * The record is opened and validated under the key lock and sent once it is released. Records are replaced by
+ * renaming a new file over them and appends only write behind the committed payload, so the opened file keeps the
+ * validated payload while other operations on the key go on. It is closed under the key lock again.
+ */
+- (SPTPersistentCacheResponse *)sendDataForKeySync:(NSString *)key
+                                  toFileDescriptor:(int)fileDescriptor
+                                             range:(NSRange)range
+{
+    NSString *filePath = [self.dataCacheFileManager pathForKey:key];
+    SPTPersistentCacheResponse * __block response = nil;
+    SPTPersistentCacheRecordHeader __block header;
+    int __block filedes = -1;
+
+    [self serializeWorkForKey:key block:^{
+        SPTPersistentCacheResponse *openResponse = nil;
+        const int openedFile = [self openRecordFileForKey:key response:&openResponse];
+        if (openedFile == -1) {
+            response = openResponse;
+            return;
+        }
+
+        response = [self readSendableHeader:&header fromOpenedFile:openedFile atPath:filePath range:range];
+        if (response != nil) {
+            [self.posixWrapper close:openedFile];
+            return;
+        }
+        filedes = openedFile;
+    }];
+
+    if (filedes == -1) {
+        return response;
+    }
+
+    const BOOL stale = [self isDataStaleWithHeader:&header];
+    const uint64_t length = MIN((uint64_t)range.length, header.payloadSizeBytes - range.location);
+    NSError *error = [self sendFileRangeOfOpenedFile:filedes
+                                              offset:(off_t)(SPTPersistentCacheRecordHeaderSize + range.location)
+                                              length:length
+                                    toFileDescriptor:fileDescriptor];
+    [self closeRecordFile:filedes forKey:key];
+    if (error != nil) {
+        [self debugOutput:@"PersistentDataCache: Error sending record:%@ , error:%@", key, [error localizedDescription]];
+        return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationError
+                                                            error:error
+                                                           record:nil];
+    }
 
-            SPTPersistentCacheRecord *record = [[SPTPersistentCacheRecord alloc] initWithData:payload
-                                                                                          key:key
-                                                                                     refCount:refCount
-                                                                                          ttl:ttl];
+    [self.hotSet recordAccessForKey:key time:self.currentDateTimeInterval];
 
-            SPTPersistentCacheResponse *response = [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationSucceeded
-                                                                                                error:nil
-                                                                                               record:record];
-            // If data ttl == 0 we update access time
-            if (ttl == 0) {
-                localHeader.updateTimeSec = spt_uint64rint(self.currentDateTimeInterval);
-                localHeader.crc = SPTPersistentCacheCalculateHeaderCRC(&localHeader);
-                memcpy(header, &localHeader, sizeof(localHeader));
-
-                // Write back with updated access attributes
-                NSError *werror = nil;
-                if (![rawData writeToFile:filePath options:NSDataWritingAtomic error:&werror]) {
-                    [self debugOutput:@"PersistentDataCache: Error writing back record:%@, error:%@", filePath.lastPathComponent, werror];
-                } else {
-#ifdef DEBUG_OUTPUT_ENABLED
-                    [self debugOutput:@"PersistentDataCache: Writing back record:%@ OK", filePath.lastPathComponent];
-#endif
-                }
+    // Same access time as loads, written into the header of the sent record only if it wasn't replaced meanwhile
+    if (header.ttl == 0 && !stale && !self.options.readOnly) {
+        const uint64_t updateTime = spt_uint64rint(self.currentDateTimeInterval);
+        const uint32_t version = header.version;
+        [self alterHeaderForFileAtPath:filePath withBlock:^(SPTPersistentCacheRecordHeader *currentHeader) {
+            if (currentHeader->version == version && currentHeader->ttl == 0) {
+                currentHeader->updateTimeSec = updateTime;
             }
+        } writeBack:YES complain:NO];
+    }
 
-            // Callback only after we finished everyhing to avoid situation when user gets notified and we are still writting
-            SPTPersistentCacheSafeDispatch(queue, ^{
-                callback(response);
-            });
-
-        } // if rawData
-    } // file exist
+    return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationSucceeded
+                                                        error:nil
+                                                       record:nil
+                                                        stale:stale
+                                           refreshRecommended:[self isRefreshRecommendedWithHeader:&header]];
 }
 
 /**
- * Store method used internaly. Called on work queue.
+ * Opens the record file of key for reading under the key lock, so it can be read after the lock is released. It must
+ * be closed with closeRecordFile:forKey:.
+ * @return The descriptor, otherwise -1 with a not found or error response.
  */
-- (NSError *)storeDataSync:(NSData *)data
-                    forKey:(NSString *)key
-                       ttl:(NSUInteger)ttl
-                    locked:(BOOL)isLocked
-              withCallback:(SPTPersistentCacheResponseCallback)callback
-                   onQueue:(dispatch_queue_t)queue
+- (int)openRecordFileForKey:(NSString *)key response:(SPTPersistentCacheResponse * _Nullable *)response
 {
-    NSString *filePath = [self.dataCacheFileManager pathForKey:key];
+    int __block filedes = -1;
+    SPTPersistentCacheResponse * __block openResponse = nil;
+    [self serializeWorkForKey:key block:^{
+        filedes = open([self.dataCacheFileManager pathForKey:key].fileSystemRepresentation, O_RDONLY);
+        if (filedes == -1) {
+            const BOOL missing = (errno == ENOENT || errno == ENOTDIR);
+            NSError *openError = (missing ? nil : SPTPersistentCacheLastPosixError());
+            openResponse = [[SPTPersistentCacheResponse alloc] initWithResult:(missing ? SPTPersistentCacheResponseCodeNotFound
+                                                                                       : SPTPersistentCacheResponseCodeOperationError)
+                                                                        error:openError
+                                                                       record:nil];
+        }
+    }];
 
-    NSString *subDir = [self.dataCacheFileManager subDirectoryPathForKey:key];
-    [self.fileManager createDirectoryAtPath:subDir withIntermediateDirectories:YES attributes:nil error:nil];
+    if (response != NULL) {
+        *response = openResponse;
+    }
+    return filedes;
+}
 
-    const NSUInteger payloadLength = [data length];
-    const NSUInteger rawDataLength = SPTPersistentCacheRecordHeaderSize + payloadLength;
+/**
+ * Closes a record file opened by openRecordFileForKey:response: under the key lock. Without open file description locks
+ * closing it releases the header locks of the process on the file, which other threads only hold under the key lock.
+ */
+- (void)closeRecordFile:(int)filedes forKey:(NSString *)key
+{
+    [self serializeWorkForKey:key block:^{
+        [self.posixWrapper close:filedes];
+    }];
+}
 
-    NSMutableData *rawData = [NSMutableData dataWithCapacity:rawDataLength];
+/**
+ * Reads the header of an opened record file and checks that range of its payload can be sent.
+ * @return nil if it can otherwise error response.
+ */
+- (SPTPersistentCacheResponse *)readSendableHeader:(SPTPersistentCacheRecordHeader *)header
+                                    fromOpenedFile:(int)filedes
+                                            atPath:(NSString *)filePath
+                                             range:(NSRange)range
+{
+    SPTPersistentCacheResponse *headerResponse = [self readHeader:header fromOpenedFile:filedes atPath:filePath];
+    if (headerResponse != nil) {
+        return headerResponse;
+    }
 
-    SPTPersistentCacheRecordHeader header = SPTPersistentCacheRecordHeaderMake(ttl,
-                                                                               payloadLength,
-                                                                               spt_uint64rint(self.currentDateTimeInterval),
-                                                                               isLocked);
+    // Satisfy Req.#1.2
+    if (![self isDataStaleWithHeader:header] && ![self isDataCanBeReturnedWithHeader:header]) {
+        return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeNotFound
+                                                            error:nil
+                                                           record:nil];
+    }
 
-    [rawData appendBytes:&header length:SPTPersistentCacheRecordHeaderSize];
-    [rawData appendData:data];
+    // Same payload size check as loads, appendable records may have an uncommitted tail
+    struct stat fileStat;
+    if ([self.posixWrapper fstat:filedes statStruct:&fileStat] == -1) {
+        return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationError
+                                                            error:SPTPersistentCacheLastPosixError()
+                                                           record:nil];
+    }
+    const uint64_t storedPayloadSize = (uint64_t)fileStat.st_size - MIN((uint64_t)fileStat.st_size, SPTPersistentCacheRecordHeaderSize);
+    const BOOL appendable = (header->flags & SPTPersistentCacheRecordHeaderFlagsAppendable) != 0;
+    if ((appendable ? header->payloadSizeBytes > storedPayloadSize : header->payloadSizeBytes != storedPayloadSize) ||
+        range.location > header->payloadSizeBytes) {
+        return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationError
+                                                            error:[NSError spt_persistentDataCacheErrorWithCode:SPTPersistentCacheLoadingErrorWrongPayloadSize]
+                                                           record:nil];
+    }
 
-    NSError *error = nil;
+    return nil;
+}
 
-    if (![rawData writeToFile:filePath options:NSDataWritingAtomic error:&error]) {
-        [self debugOutput:@"PersistentDataCache: Error writting to file:%@ , for key:%@. Removing it...", filePath, key];
-        [self removeDataForKeysSync:@[key]];
-        [self dispatchError:error result:SPTPersistentCacheResponseCodeOperationError callback:callback onQueue:queue];
-    } else {
+/**
+ * Copies a range of an opened record file to a descriptor, in the kernel where possible.
+ * @return nil on success otherwise error.
+ */
+- (NSError *)sendFileRangeOfOpenedFile:(int)filedes
+                                offset:(off_t)offset
+                                length:(uint64_t)length
+                      toFileDescriptor:(int)fileDescriptor
+{
+    BOOL useBuffer = NO;
+    while (length > 0 && !useBuffer) {
+        ssize_t sentBytes = [self.posixWrapper sendFile:filedes
+                                           toDescriptor:fileDescriptor
+                                                 offset:offset
+                                                 length:(size_t)MIN(length, (uint64_t)SSIZE_MAX)];
+        if (sentBytes > 0) {
+            offset += sentBytes;
+            length -= (uint64_t)sentBytes;
+        } else if (sentBytes == -1 && errno == EINTR) {
+            continue;
+        } else if (sentBytes == -1 && (errno == ENOTSOCK || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+            // Destination not supported by the kernel copy
+            useBuffer = YES;
+        } else {
+            return (sentBytes == 0 ? [NSError spt_persistentDataCacheErrorWithCode:SPTPersistentCacheLoadingErrorWrongPayloadSize]
+                                   : SPTPersistentCacheLastPosixError());
+        }
+    }
 
-        if (callback != nil) {
-            SPTPersistentCacheResponse *response = [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationSucceeded
-                                                                                                error:nil
-                                                                                               record:nil];
+    uint8_t buffer[SPTPersistentCacheSendBufferSize];
+    while (length > 0) {
+        ssize_t readBytes = [self.posixWrapper pread:filedes
+                                              buffer:buffer
+                                          bufferSize:(size_t)MIN(length, (uint64_t)sizeof(buffer))
+                                              offset:offset];
+        if (readBytes <= 0) {
+            if (readBytes == -1 && errno == EINTR) {
+                continue;
+            }
+            return (readBytes == 0 ? [NSError spt_persistentDataCacheErrorWithCode:SPTPersistentCacheLoadingErrorWrongPayloadSize]
+                                   : SPTPersistentCacheLastPosixError());
+        }
 
-            SPTPersistentCacheSafeDispatch(queue, ^{
-                callback(response);
-            });
+        ssize_t writtenBytes = 0;
+        while (writtenBytes < readBytes) {
+            ssize_t result = [self.posixWrapper write:fileDescriptor
+                                               buffer:buffer + writtenBytes
+                                           bufferSize:(size_t)(readBytes - writtenBytes)];
+            if (result == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return SPTPersistentCacheLastPosixError();
+            }
+            writtenBytes += result;
         }
+
+        offset += readBytes;
+        length -= (uint64_t)readBytes;
     }
 
-    return error;
+    return nil;
+}
+
+/**
+ * Writes header to the beginning of an opened record file and syncs it to disk.
+ * @return nil on success otherwise POSIX error.
+ */
+- (NSError *)writeHeader:(const SPTPersistentCacheRecordHeader *)header toOpenedFile:(int)filedes
+{
+    ssize_t writtenBytes = [self.posixWrapper pwrite:filedes
+                                              buffer:header
+                                          bufferSize:SPTPersistentCacheRecordHeaderSize
+                                              offset:0];
+    if (writtenBytes != (ssize_t)SPTPersistentCacheRecordHeaderSize || [self.posixWrapper fsync:filedes] != 0) {
+        return SPTPersistentCacheLastPosixError();
+    }
+    return nil;
 }
 
 /**
@@ -671,46 +2058,75 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
                                              complain:(BOOL)needComplains
                                             writeBack:(BOOL)writeBack
 {
-    if (![self.fileManager fileExistsAtPath:filePath]) {
-        if (needComplains) {
-            [self debugOutput:@"PersistentDataCache: Record not exist at path:%@", filePath];
+    const int SPTPersistentCacheInvalidResult = -1;
+    const int flags = (writeBack ? O_RDWR : O_RDONLY);
+
+    int fd = open([filePath UTF8String], flags);
+    if (fd == SPTPersistentCacheInvalidResult) {
+        const int errorNumber = errno;
+        // A missing record is found out by the open itself instead of a lookup before it
+        if (errorNumber == ENOENT || errorNumber == ENOTDIR) {
+            if (needComplains) {
+                [self debugOutput:@"PersistentDataCache: Record not exist at path:%@", filePath];
+            }
+            return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeNotFound error:nil record:nil];
         }
-        return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeNotFound error:nil record:nil];
+        NSString *errorDescription = @(strerror(errorNumber));
+        [self debugOutput:@"PersistentDataCache: Error opening file:%@ , error:%@", filePath, errorDescription];
+        NSError *error = [NSError errorWithDomain:NSPOSIXErrorDomain
+                                             code:errorNumber
+                                         userInfo:@{ NSLocalizedDescriptionKey: errorDescription }];
+        return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationError
+                                                            error:error
+                                                           record:nil];
+    }
 
-    } else {
-        const int SPTPersistentCacheInvalidResult = -1;
-        const int flags = (writeBack ? O_RDWR : O_RDONLY);
-
-        int fd = open([filePath UTF8String], flags);
-        if (fd == SPTPersistentCacheInvalidResult) {
-            const int errorNumber = errno;
-            NSString *errorDescription = @(strerror(errorNumber));
-            [self debugOutput:@"PersistentDataCache: Error opening file:%@ , error:%@", filePath, errorDescription];
-            NSError *error = [NSError errorWithDomain:NSPOSIXErrorDomain
-                                                 code:errorNumber
-                                             userInfo:@{ NSLocalizedDescriptionKey: errorDescription }];
-            return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationError
-                                                                error:error
-                                                               record:nil];
-        }
+    SPTPersistentCacheResponse *response = jobBlock(fd);
+
+    fd = [self.posixWrapper close:fd];
+    if (fd == SPTPersistentCacheInvalidResult) {
+        const int errorNumber = errno;
+        NSString *errorDescription = @(strerror(errorNumber));
+        [self debugOutput:@"PersistentDataCache: Error closing file:%@ , error:%@", filePath, errorDescription];
+        NSError *error = [NSError errorWithDomain:NSPOSIXErrorDomain
+                                             code:errorNumber
+                                         userInfo:@{ NSLocalizedDescriptionKey: errorDescription }];
+        return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationError
+                                                            error:error
+                                                           record:nil];
+    }
 
-        SPTPersistentCacheResponse *response = jobBlock(fd);
+    return response;
+}
 
-        fd = [self.posixWrapper close:fd];
-        if (fd == SPTPersistentCacheInvalidResult) {
-            const int errorNumber = errno;
-            NSString *errorDescription = @(strerror(errorNumber));
-            [self debugOutput:@"PersistentDataCache: Error closing file:%@ , error:%@", filePath, errorDescription];
-            NSError *error = [NSError errorWithDomain:NSPOSIXErrorDomain
-                                                 code:errorNumber
-                                             userInfo:@{ NSLocalizedDescriptionKey: errorDescription }];
-            return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationError
-                                                                error:error
-                                                               record:nil];
-        }
+/**
+ * Takes the inter-process lock of the header of an opened record file and checks the file is still the one at the
+ * path, other processes replace records by renaming a new file over them. The lock goes with the close of filedes.
+ * Without open file description locks any close of the file by the process releases it too, which is why record files
+ * are only opened and closed under the key lock.
+ * @return nil on success otherwise error response.
+ */
+- (SPTPersistentCacheResponse *)lockHeaderOfOpenedFile:(int)filedes atPath:(NSString *)filePath
+{
+    if ([self.posixWrapper lockRange:filedes type:F_WRLCK offset:0 length:(off_t)SPTPersistentCacheRecordHeaderSize] == -1) {
+        NSError *error = SPTPersistentCacheLastPosixError();
+        [self debugOutput:@"PersistentDataCache: Error locking header of file path:%@ , error:%@", filePath, [error localizedDescription]];
+        return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationError
+                                                            error:error
+                                                           record:nil];
+    }
 
-        return response;
+    struct stat openedStat;
+    struct stat pathStat;
+    if ([self.posixWrapper fstat:filedes statStruct:&openedStat] == -1 ||
+        [self.posixWrapper stat:filePath.fileSystemRepresentation statStruct:&pathStat] == -1 ||
+        openedStat.st_ino != pathStat.st_ino || openedStat.st_dev != pathStat.st_dev) {
+        return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationError
+                                                            error:[NSError spt_persistentDataCacheErrorWithCode:SPTPersistentCacheLoadingErrorRecordReplaced]
+                                                           record:nil];
     }
+
+    return nil;
 }
 
 /**
@@ -720,9 +2136,72 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
                                                withBlock:(SPTPersistentCacheRecordHeaderGetCallbackType)modifyBlock
                                                writeBack:(BOOL)needWriteBack
                                                 complain:(BOOL)needComplains
+{
+    SPTPersistentCacheResponse * __block response = nil;
+    [self serializeWorkForKey:filePath.lastPathComponent block:^{
+        response = [self alterSerializedHeaderForFileAtPath:filePath
+                                                  withBlock:modifyBlock
+                                                  writeBack:needWriteBack
+                                                   complain:needComplains];
+    }];
+    return response;
+}
+
+/**
+ * Header alteration itself. Must be called while holding the lock of the record's key.
+ * Alteration is retried if another process replaced the record file while we waited for its header lock.
+ */
+- (SPTPersistentCacheResponse *)alterSerializedHeaderForFileAtPath:(NSString *)filePath
+                                                         withBlock:(SPTPersistentCacheRecordHeaderGetCallbackType)modifyBlock
+                                                         writeBack:(BOOL)needWriteBack
+                                                          complain:(BOOL)needComplains
+{
+    return [self alterSerializedHeaderForFileAtPath:filePath
+                                          withBlock:modifyBlock
+                                          writeBack:needWriteBack
+                                               sync:YES
+                                           complain:needComplains];
+}
+
+/**
+ * needSync = NO only flushes the data of the written header, flushing the folder or the drive is left to the caller.
+ */
+- (SPTPersistentCacheResponse *)alterSerializedHeaderForFileAtPath:(NSString *)filePath
+                                                         withBlock:(SPTPersistentCacheRecordHeaderGetCallbackType)modifyBlock
+                                                         writeBack:(BOOL)needWriteBack
+                                                              sync:(BOOL)needSync
+                                                          complain:(BOOL)needComplains
+{
+    SPTPersistentCacheResponse *response = nil;
+    NSUInteger attempt = 0;
+    do {
+        response = [self alterSerializedHeaderOnceForFileAtPath:filePath
+                                                      withBlock:modifyBlock
+                                                      writeBack:needWriteBack
+                                                           sync:needSync
+                                                       complain:needComplains];
+    } while ([response.error.domain isEqualToString:SPTPersistentCacheErrorDomain] &&
+             response.error.code == SPTPersistentCacheLoadingErrorRecordReplaced &&
+             ++attempt < SPTPersistentCacheRecordReplacedRetryCount);
+    return response;
+}
+
+- (SPTPersistentCacheResponse *)alterSerializedHeaderOnceForFileAtPath:(NSString *)filePath
+                                                             withBlock:(SPTPersistentCacheRecordHeaderGetCallbackType)modifyBlock
+                                                             writeBack:(BOOL)needWriteBack
+                                                                  sync:(BOOL)needSync
+                                                              complain:(BOOL)needComplains
 {
     return [self guardOpenFileWithPath:filePath jobBlock:^SPTPersistentCacheResponse*(int filedes) {
 
+        // Processes sharing the folder serialize their read-modify-write of the header, the lock goes with the close
+        if (needWriteBack && self.options.processSharedLocking) {
+            SPTPersistentCacheResponse *lockResponse = [self lockHeaderOfOpenedFile:filedes atPath:filePath];
+            if (lockResponse != nil) {
+                return lockResponse;
+            }
+        }
+
         SPTPersistentCacheRecordHeader header;
         ssize_t readBytes = [self.posixWrapper read:filedes
                                              buffer:&header
@@ -745,7 +2224,9 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
                                                                record:nil];
         }
 
-        NSError *nsError = SPTPersistentCacheCheckValidHeader(&header);
+        NSError *nsError = [self rereadTornHeader:&header
+                                   fromOpenedFile:filedes
+                                        withError:SPTPersistentCacheCheckValidHeader(&header)];
         if (nsError != nil) {
             [self debugOutput:@"PersistentDataCache: Error checking header at file path:%@ , error:%@", filePath, nsError];
             return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationError
@@ -784,6 +2265,10 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
                 ssize_t writtenBytes = [self.posixWrapper write:filedes
                                                          buffer:&header
                                                      bufferSize:SPTPersistentCacheRecordHeaderSize];
+                if (writtenBytes == (ssize_t)SPTPersistentCacheRecordHeaderSize) {
+                    [self updateMetadataForKey:filePath.lastPathComponent header:&header];
+                }
+
                 if (writtenBytes != (ssize_t)SPTPersistentCacheRecordHeaderSize) {
                     const int errorNumber = errno;
                     NSString *errorDescription = @(strerror(errorNumber));
@@ -796,7 +2281,7 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
                                                                        record:nil];
 
                 } else {
-                    int result = [self.posixWrapper fsync:filedes];
+                    int result = (needSync ? [self.posixWrapper fsync:filedes] : [self.posixWrapper dataSync:filedes]);
                     if (result == -1) {
                         const int errorNumber = errno;
                         NSString *errorDescription = @(strerror(errorNumber));
@@ -819,88 +2304,432 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
 }
 
 /**
- * Only this method check data expiration. Past check is also supported.
+ * Only this method check data expiration. Past check is also supported.
+ */
+- (BOOL)isDataExpiredWithHeader:(SPTPersistentCacheRecordHeader *)header
+{
+    assert(header != nil);
+    uint64_t ttl = header->ttl;
+    if (ttl > SPTPersistentCacheTTLUpperBoundInSec) {
+        [self debugOutput:@"PersistentDataCache: WARNING: TTL seems too big: %llu > %llu sec", ttl, SPTPersistentCacheTTLUpperBoundInSec];
+    }
+
+    return sptpc_header_is_expired((const sptpc_header *)(const void *)header,
+                                   spt_uint64rint(self.currentDateTimeInterval),
+                                   self.options.defaultExpirationPeriod) != 0;
+}
+
+/**
+ * Methos checks whether data can be given to caller with accordance to API.
+ */
+- (BOOL)isDataCanBeReturnedWithHeader:(SPTPersistentCacheRecordHeader *)header
+{
+    return !([self isDataExpiredWithHeader:header] && ![self isLockedWithHeader:header]);
+}
+
+/**
+ * Method checks whether the record is locked. Locks whose lease has run out don't count.
+ */
+- (BOOL)isLockedWithHeader:(SPTPersistentCacheRecordHeader *)header
+{
+    return sptpc_header_is_locked((const sptpc_header *)(const void *)header, spt_uint64rint(self.currentDateTimeInterval)) != 0;
+}
+
+- (BOOL)isLockLeaseExpiredWithHeader:(SPTPersistentCacheRecordHeader *)header
+{
+    return header->leaseExpirationSec != 0 && spt_uint64rint(self.currentDateTimeInterval) >= header->leaseExpirationSec;
+}
+
+/**
+ * Extends the lease of a locked record by lockLeaseDuration and records it in the lease index.
+ */
+- (void)renewLockLeaseWithHeader:(SPTPersistentCacheRecordHeader *)header forKey:(NSString *)key
+{
+    const NSUInteger leaseDuration = self.options.lockLeaseDuration;
+    if (leaseDuration == 0) {
+        return;
+    }
+
+    header->leaseExpirationSec = spt_uint64rint(self.currentDateTimeInterval) + leaseDuration;
+
+    [self.leaseIndexLock lock];
+    self.leaseIndex[key] = @(header->leaseExpirationSec);
+    [self.leaseIndexLock unlock];
+}
+
+- (void)removeLockLeaseForKey:(NSString *)key
+{
+    [self.leaseIndexLock lock];
+    [self.leaseIndex removeObjectForKey:key];
+    [self.leaseIndexLock unlock];
+}
+
+/**
+ * Method checks whether data has expired but is still within the stale-while-revalidate grace period.
+ */
+- (BOOL)isDataStaleWithHeader:(SPTPersistentCacheRecordHeader *)header
+{
+    const NSUInteger gracePeriod = self.options.staleWhileRevalidatePeriod;
+    if (gracePeriod == 0 || [self isLockedWithHeader:header] || ![self isDataExpiredWithHeader:header]) {
+        return NO;
+    }
+
+    uint64_t ttl = header->ttl;
+    uint64_t current = spt_uint64rint(self.currentDateTimeInterval);
+    int64_t threshold = (int64_t)((ttl > 0) ? ttl : self.options.defaultExpirationPeriod) + (int64_t)gracePeriod;
+
+    return (int64_t)(current - header->updateTimeSec) <= threshold;
+}
+
+/**
+ * Method decides whether caller should refresh the data ahead of its expiration. This is XFetch: refresh if
+ * now - recompute_time * beta * log(random) >= expiration_time, random uniform in (0, 1].
+ */
+- (BOOL)isRefreshRecommendedWithHeader:(SPTPersistentCacheRecordHeader *)header
+{
+    const double beta = self.options.earlyExpirationBeta;
+    if (beta <= 0.0) {
+        return NO;
+    }
+
+    uint64_t ttl = header->ttl;
+    const double expirationTime = (double)header->updateTimeSec + (double)((ttl > 0) ? ttl : self.options.defaultExpirationPeriod);
+    const double random = ((double)arc4random_uniform(UINT32_MAX) + 1.0) / (double)UINT32_MAX;
+
+    return self.currentDateTimeInterval - self.options.earlyExpirationRecomputeTime * beta * log(random) >= expirationTime;
+}
+
+/**
+ * Returns random jitter in [0, expirationJitterFactor * period) to subtract from expiration period of a record.
+ */
+- (uint64_t)expirationJitterForPeriod:(uint64_t)period
+{
+    const double factor = MIN(MAX(self.options.expirationJitterFactor, 0.0), 1.0);
+    const uint64_t maxJitter = MIN((uint64_t)(factor * (double)period), (uint64_t)UINT32_MAX);
+    if (maxJitter == 0) {
+        return 0;
+    }
+    return arc4random_uniform((uint32_t)maxJitter);
+}
+
+- (void)runRegularGC
+{
+    [self releaseExpiredLeases];
+    [self collectGarbageForceExpire:NO forceLocked:NO];
+    [self persistHotSet];
+}
+
+- (SPTPersistentCacheDirectoryScanner *)scannerWithMaxConcurrentOperations:(NSInteger)maxConcurrentOperations
+{
+    return [[SPTPersistentCacheDirectoryScanner alloc] initWithFileManager:self.fileManager
+                                                   maxConcurrentOperations:maxConcurrentOperations
+                                                          qualityOfService:self.options.garbageCollectionQualityOfService];
+}
+
+- (NSString *)hotSetFilePath
+{
+    return [self.options.cachePath stringByAppendingPathComponent:SPTPersistentCacheHotSetFileName];
+}
+
+- (BOOL)persistHotSet
+{
+    if (self.hotSet == nil || self.options.readOnly) {
+        return NO;
+    }
+
+    BOOL written = [self.hotSet writeHottestKeysToFile:self.hotSetFilePath time:self.currentDateTimeInterval];
+    if (!written) {
+        [self debugOutput:@"PersistentDataCache: Error writing hot set to file:%@", self.hotSetFilePath];
+    }
+    return written;
+}
+
+- (NSUInteger)releaseExpiredLeases
+{
+    const uint64_t now = spt_uint64rint(self.currentDateTimeInterval);
+    NSMutableArray<NSString *> *expiredKeys = [NSMutableArray array];
+
+    [self.leaseIndexLock lock];
+    for (NSString *key in self.leaseIndex) {
+        if (now >= self.leaseIndex[key].unsignedLongLongValue) {
+            [expiredKeys addObject:key];
+        }
+    }
+    [self.leaseIndex removeObjectsForKeys:expiredKeys];
+    [self.leaseIndexLock unlock];
+
+    NSUInteger __block releasedCount = 0;
+    for (NSString *key in expiredKeys) {
+        NSString *filePath = [self.dataCacheFileManager pathForKey:key];
+        // The lease may have been renewed by another process since it was indexed, the header is checked again
+        [self alterHeaderForFileAtPath:filePath withBlock:^(SPTPersistentCacheRecordHeader *header) {
+            if (header->refCount > 0 && [self isLockLeaseExpiredWithHeader:header]) {
+                header->refCount = 0;
+                header->leaseExpirationSec = 0;
+                ++releasedCount;
+            }
+        } writeBack:YES complain:NO];
+    }
+
+    if (releasedCount > 0) {
+        [self debugOutput:@"PersistentDataCache: Released %lu locks with expired lease", (unsigned long)releasedCount];
+    }
+    return releasedCount;
+}
+
+- (void)collectGarbageForceExpire:(BOOL)forceExpire forceLocked:(BOOL)forceLocked
+{
+    [self debugOutput:@"PersistentDataCache: Run GC with forceExpire:%d forceLock:%d", forceExpire, forceLocked];
+
+    // Only records which look collectable take the key lock, unreadable ones are reported there
+    BOOL (^isCandidate)(SPTPersistentCacheRecordHeader *) = ^BOOL(SPTPersistentCacheRecordHeader *header) {
+        int reason = 0;
+        return (header == NULL ||
+                [self isGarbageWithHeader:header forceExpire:forceExpire forceLocked:forceLocked reason:&reason] ||
+                (header->refCount > 0 && [self isLockLeaseExpiredWithHeader:header]));
+    };
+    NSMutableArray<NSString *> *candidatePaths = [NSMutableArray array];
+
+    if ([self isMetadataTableComplete]) {
+        // The checks of isCandidate made over the table columns at once
+        unsigned selection = SPTPC_SELECT_LEASE_EXPIRED;
+        if (forceExpire && forceLocked) {
+            selection |= SPTPC_SELECT_UNLOCKED | SPTPC_SELECT_LOCKED;
+        } else if (forceExpire) {
+            selection |= SPTPC_SELECT_UNLOCKED;
+        } else if (forceLocked) {
+            selection |= SPTPC_SELECT_LOCKED;
+        } else {
+            selection |= SPTPC_SELECT_EXPIRED;
+        }
+        [self selectMetadata:selection withBlock:^(const char *key, SPTPersistentCacheRecordHeader *header) {
+            [candidatePaths addObject:[self.dataCacheFileManager pathForKey:@(key)]];
+        }];
+    } else {
+        NSURL *urlPath = [NSURL URLWithString:self.options.cachePath];
+        SPTPersistentCacheDirectoryScanner *scanner = [self scannerWithMaxConcurrentOperations:self.options.scanMaxConcurrentOperations];
+
+        // Files are visited concurrently, their headers are read afterwards in batches
+        NSMutableArray<NSString *> *filePaths = [NSMutableArray array];
+        NSLock *filePathsLock = [NSLock new];
+
+        [scanner scanDirectoryAtURL:urlPath fileBlock:^(NSURL *theURL) {
+            // That satisfies Req.#1.3
+            NSString *filePath = [self.dataCacheFileManager pathForKey:theURL.lastPathComponent];
+            [filePathsLock lock];
+            [filePaths addObject:filePath];
+            [filePathsLock unlock];
+        } failureBlock:^(NSURL *theURL) {
+            [self debugOutput:@"Unable to fetch isDir#4 attribute:%@", theURL];
+        }];
+
+        [self readHeadersOfFilesAtPaths:filePaths withBlock:^(NSString *filePath, SPTPersistentCacheRecordHeader *header) {
+            if (isCandidate(header)) {
+                [candidatePaths addObject:filePath];
+            }
+        }];
+    }
+
+    for (NSString *filePath in candidatePaths) {
+        [self collectGarbageAtPath:filePath forceExpire:forceExpire forceLocked:forceLocked];
+    }
+}
+
+/**
+ * Checks again, under the lock of the record's key, whether the record should be removed or its lease released.
+ */
+- (void)collectGarbageAtPath:(NSString *)filePath forceExpire:(BOOL)forceExpire forceLocked:(BOOL)forceLocked
+{
+    NSString *key = filePath.lastPathComponent;
+    // The lock keeps check and removal atomic with other operations on the key
+    [self serializeWorkForKey:key block:^{
+        BOOL __block needRemove = NO;
+        BOOL __block leaseExpired = NO;
+        int __block reason = 0;
+        // WARNING: We may skip return result here bcuz in that case we won't remove file we do not know what is it
+        SPTPersistentCacheResponse *response = [self alterHeaderForFileAtPath:filePath withBlock:^(SPTPersistentCacheRecordHeader *header) {
+            needRemove = [self isGarbageWithHeader:header forceExpire:forceExpire forceLocked:forceLocked reason:&reason];
+            // Catches leases the index doesn't know about, e.g. taken before a restart
+            leaseExpired = header->refCount > 0 && [self isLockLeaseExpiredWithHeader:header];
+        } writeBack:NO complain:YES];
+        if (needRemove) {
+            [self debugOutput:@"PersistentDataCache: gc removing record: %@, reason:%d", filePath.lastPathComponent, reason];
+            [self.dataCacheFileManager removeDataForKey:key];
+            [self removeMetadataForKey:key];
+            [self removeLockLeaseForKey:key];
+        } else if (response.result == SPTPersistentCacheResponseCodeNotFound) {
+            // The row of a record removed while the table wasn't updated
+            [self removeMetadataForKey:key];
+        } else if (leaseExpired) {
+            [self debugOutput:@"PersistentDataCache: gc releasing lock with expired lease: %@", filePath.lastPathComponent];
+            [self alterHeaderForFileAtPath:filePath withBlock:^(SPTPersistentCacheRecordHeader *header) {
+                if ([self isLockLeaseExpiredWithHeader:header]) {
+                    header->refCount = 0;
+                    header->leaseExpirationSec = 0;
+                }
+            } writeBack:YES complain:NO];
+            [self removeLockLeaseForKey:key];
+        }
+    }];
+}
+
+- (BOOL)isGarbageWithHeader:(SPTPersistentCacheRecordHeader *)header
+                forceExpire:(BOOL)forceExpire
+                forceLocked:(BOOL)forceLocked
+                     reason:(int *)reason
+{
+    if (forceExpire && forceLocked) {
+        // delete all
+        *reason = 1;
+        return YES;
+    } else if (forceExpire && !forceLocked) {
+        // delete those: header->refCount == 0
+        *reason = 2;
+        return ![self isLockedWithHeader:header];
+    } else if (!forceExpire && forceLocked) {
+        // delete those: header->refCount > 0
+        *reason = 3;
+        return [self isLockedWithHeader:header];
+    } else {
+        // delete those: [self isDataExpiredWithHeader:header] && header->refCount == 0
+        // Keep stale ones until their grace period has passed
+        *reason = 4;
+        return ![self isDataCanBeReturnedWithHeader:header] && ![self isDataStaleWithHeader:header];
+    }
+}
+
+- (sptpc_metadata *)openMetadataTable
+{
+    const sptpc_options coreOptions = {
+        .cache_path = self.options.cachePath.fileSystemRepresentation,
+        .use_directory_separation = self.options.useDirectorySeparation,
+        .default_expiration_sec = self.options.defaultExpirationPeriod,
+        .header_queue_depth = self.options.headerReadQueueDepth,
+    };
+    sptpc_metadata *table = NULL;
+    if (sptpc_metadata_open(&coreOptions, &table) != SPTPC_OK) {
+        [self debugOutput:@"PersistentDataCache: Unable to open metadata table in:%@, error:%@",
+         self.options.cachePath, SPTPersistentCacheLastPosixError()];
+        return NULL;
+    }
+    return table;
+}
+
+/**
+ * Whether the metadata table mirrors every record so maintenance can scan it instead of the folder.
+ */
+- (BOOL)isMetadataTableComplete
+{
+    return _metadataTable != NULL && sptpc_metadata_is_complete(_metadataTable);
+}
+
+/**
+ * Mirrors the header of a record into the metadata table. Must be called holding the key lock once the header is
+ * written.
  */
-- (BOOL)isDataExpiredWithHeader:(SPTPersistentCacheRecordHeader *)header
+- (void)updateMetadataForKey:(NSString *)key header:(const SPTPersistentCacheRecordHeader *)header
 {
-    assert(header != nil);
-    uint64_t ttl = header->ttl;
-    uint64_t current = spt_uint64rint(self.currentDateTimeInterval);
-    int64_t threshold = (int64_t)((ttl > 0) ? ttl : self.options.defaultExpirationPeriod);
-
-    if (ttl > SPTPersistentCacheTTLUpperBoundInSec) {
-        [self debugOutput:@"PersistentDataCache: WARNING: TTL seems too big: %llu > %llu sec", ttl, SPTPersistentCacheTTLUpperBoundInSec];
+    if (_metadataTable != NULL &&
+        sptpc_metadata_update(_metadataTable, key.UTF8String, (const sptpc_header *)(const void *)header) != SPTPC_OK) {
+        [self debugOutput:@"PersistentDataCache: Unable to mirror header of key:%@, error:%@", key, SPTPersistentCacheLastPosixError()];
     }
-
-    return (int64_t)(current - header->updateTimeSec) > threshold;
 }
 
-/**
- * Methos checks whether data can be given to caller with accordance to API.
- */
-- (BOOL)isDataCanBeReturnedWithHeader:(SPTPersistentCacheRecordHeader *)header
+- (void)updateMetadataForKey:(NSString *)key record:(NSData *)recordData
 {
-    return !([self isDataExpiredWithHeader:header] && header->refCount == 0);
+    if (_metadataTable != NULL && recordData.length >= SPTPersistentCacheRecordHeaderSize) {
+        SPTPersistentCacheRecordHeader header;
+        memcpy(&header, recordData.bytes, SPTPersistentCacheRecordHeaderSize);
+        [self updateMetadataForKey:key header:&header];
+    }
 }
 
-- (void)runRegularGC
+- (void)removeMetadataForKey:(NSString *)key
 {
-    [self collectGarbageForceExpire:NO forceLocked:NO];
+    if (_metadataTable != NULL) {
+        sptpc_metadata_remove(_metadataTable, key.UTF8String);
+    }
 }
 
-- (void)collectGarbageForceExpire:(BOOL)forceExpire forceLocked:(BOOL)forceLocked
+- (void)clearMetadata
 {
-    [self debugOutput:@"PersistentDataCache: Run GC with forceExpire:%d forceLock:%d", forceExpire, forceLocked];
+    if (_metadataTable != NULL) {
+        sptpc_metadata_clear(_metadataTable);
+    }
+}
 
-    NSURL *urlPath = [NSURL URLWithString:self.options.cachePath];
-    NSDirectoryEnumerator *dirEnumerator = [self.fileManager enumeratorAtURL:urlPath
-                                                  includingPropertiesForKeys:@[NSURLIsDirectoryKey]
-                                                                     options:NSDirectoryEnumerationSkipsHiddenFiles
-                                                                errorHandler:nil];
+/**
+ * Calls block with the key and mirrored header of each record matching any of the sptpc_selection flags now. The table
+ * can't be changed from the block. Expiration includes the
+ * staleWhileRevalidatePeriod like isDataStaleWithHeader: does.
+ */
+- (void)selectMetadata:(unsigned)selection withBlock:(SPTPersistentCacheMetadataBlock)block
+{
+    if (_metadataTable != NULL) {
+        sptpc_metadata_select(_metadataTable,
+                              selection,
+                              spt_uint64rint(self.currentDateTimeInterval),
+                              self.options.defaultExpirationPeriod,
+                              self.options.staleWhileRevalidatePeriod,
+                              SPTPersistentCacheMetadataScanCallback,
+                              (__bridge void *)block);
+    }
+}
 
-    // Enumerate the dirEnumerator results, each value is stored in allURLs
-    NSURL *theURL = nil;
-    while ((theURL = [dirEnumerator nextObject])) {
+/**
+ * Reads the headers of files without taking their key locks, in batches with up to `headerReadQueueDepth` reads in
+ * flight on threads kept for the whole scan. Paths are sorted first so files of a directory are read together. The
+ * block gets NULL where the header could not be read or is invalid.
+ * Header locks which closing any descriptor of the file releases are only safe from closes under the key lock, so
+ * with those each header is read under its key lock instead.
+ */
+- (void)readHeadersOfFilesAtPaths:(NSArray<NSString *> *)filePaths
+                        withBlock:(void (^)(NSString *filePath, SPTPersistentCacheRecordHeader *header))block
+{
+    NSArray<NSString *> *sortedPaths = [filePaths sortedArrayUsingSelector:@selector(compare:)];
+
+    if (self.options.processSharedLocking && !self.posixWrapper.locksOpenFileDescriptions) {
+        for (NSString *filePath in sortedPaths) {
+            @autoreleasepool {
+                sptpc_header __block header;
+                sptpc_status __block status = SPTPC_ERROR_NOT_FOUND;
+                [self serializeWorkForKey:filePath.lastPathComponent block:^{
+                    status = sptpc_read_header(filePath.fileSystemRepresentation, &header);
+                }];
+                block(filePath, (status == SPTPC_OK ? (SPTPersistentCacheRecordHeader *)(void *)&header : NULL));
+            }
+        }
+        return;
+    }
 
-        // Retrieve the file name. From cached during the enumeration.
-        NSNumber *isDirectory;
-        if ([theURL getResourceValue:&isDirectory forKey:NSURLIsDirectoryKey error:NULL]) {
-            if ([isDirectory boolValue] == NO) {
+    const char **paths = calloc(SPTPersistentCacheHeaderReadBatchSize, sizeof(*paths));
+    sptpc_header *headers = calloc(SPTPersistentCacheHeaderReadBatchSize, sizeof(*headers));
+    sptpc_status *statuses = calloc(SPTPersistentCacheHeaderReadBatchSize, sizeof(*statuses));
+    if (paths == NULL || headers == NULL || statuses == NULL) {
+        [self debugOutput:@"PersistentDataCache: Unable to allocate header batch of %lu files",
+         (unsigned long)SPTPersistentCacheHeaderReadBatchSize];
+        sortedPaths = @[];
+    }
+    sptpc_header_reader *reader = (sortedPaths.count > 0 ? sptpc_header_reader_create(self.options.headerReadQueueDepth) : NULL);
 
-                NSString *key = theURL.lastPathComponent;
-                // That satisfies Req.#1.3
-                NSString *filePath = [self.dataCacheFileManager pathForKey:key];
-                BOOL __block needRemove = NO;
-                int __block reason = 0;
-                // WARNING: We may skip return result here bcuz in that case we won't remove file we do not know what is it
-                [self alterHeaderForFileAtPath:filePath withBlock:^(SPTPersistentCacheRecordHeader *header) {
-                    if (forceExpire && forceLocked) {
-                        // delete all
-                        needRemove = YES;
-                        reason = 1;
-                    } else if (forceExpire && !forceLocked) {
-                        // delete those: header->refCount == 0
-                        needRemove = header->refCount == 0;
-                        reason = 2;
-                    } else if (!forceExpire && forceLocked) {
-                        // delete those: header->refCount > 0
-                        needRemove = header->refCount > 0;
-                        reason = 3;
-                    } else {
-                        // delete those: [self isDataExpiredWithHeader:header] && header->refCount == 0
-                        needRemove = ![self isDataCanBeReturnedWithHeader:header];
-                        reason = 4;
-                    }
-                } writeBack:NO complain:YES];
-                if (needRemove) {
-                    [self debugOutput:@"PersistentDataCache: gc removing record: %@, reason:%d", filePath.lastPathComponent, reason];
-                    [self.dataCacheFileManager removeDataForKey:key];
-                }
-            } // is dir
-        } else {
-            [self debugOutput:@"Unable to fetch isDir#4 attribute:%@", theURL];
+    for (NSUInteger offset = 0; offset < sortedPaths.count; offset += SPTPersistentCacheHeaderReadBatchSize) {
+        @autoreleasepool {
+            const NSUInteger count = MIN(SPTPersistentCacheHeaderReadBatchSize, sortedPaths.count - offset);
+            for (NSUInteger i = 0; i < count; ++i) {
+                paths[i] = sortedPaths[offset + i].fileSystemRepresentation;
+            }
+            sptpc_header_reader_read(reader, paths, count, headers, statuses);
+            for (NSUInteger i = 0; i < count; ++i) {
+                block(sortedPaths[offset + i],
+                      (statuses[i] == SPTPC_OK ? (SPTPersistentCacheRecordHeader *)(void *)&headers[i] : NULL));
+            }
         }
-    } // for
+    }
+
+    sptpc_header_reader_destroy(reader);
+    free(paths);
+    free(headers);
+    free(statuses);
 }
 
 - (void)dispatchEmptyResponseWithResult:(SPTPersistentCacheResponseCode)result
@@ -911,12 +2740,12 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
         return;
     }
 
-    SPTPersistentCacheSafeDispatch(queue, ^{
+    [self dispatchCallback:^{
         SPTPersistentCacheResponse *response = [[SPTPersistentCacheResponse alloc] initWithResult:result
                                                                                             error:nil
                                                                                            record:nil];
         callback(response);
-    });
+    } onQueue:queue];
 }
 
 - (void)dispatchError:(NSError *)error
@@ -928,14 +2757,80 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
         return;
     }
 
-    SPTPersistentCacheSafeDispatch(queue, ^{
+    [self dispatchCallback:^{
         SPTPersistentCacheResponse *response = [[SPTPersistentCacheResponse alloc] initWithResult:result
                                                                                             error:error
                                                                                            record:nil];
         callback(response);
+    } onQueue:queue];
+}
+
+/**
+ * Gives a callback block to the caller the way callbackDelivery of the options asks for.
+ */
+- (void)dispatchCallback:(dispatch_block_t)block onQueue:(dispatch_queue_t _Nullable)queue
+{
+    const SPTPersistentCacheCallbackDelivery delivery = self.options.callbackDelivery;
+    if (delivery == SPTPersistentCacheCallbackDeliveryWorkerThread) {
+        block();
+    } else if (delivery == SPTPersistentCacheCallbackDeliveryBatched) {
+        [self batchCallback:block onQueue:queue ?: dispatch_get_main_queue()];
+    } else {
+        SPTPersistentCacheSafeDispatch(queue, block);
+    }
+}
+
+/**
+ * Adds block to the pending callbacks of queue. The first callback of a batch schedules the block which runs them all
+ * on queue once callbackBatchInterval of the options has passed.
+ */
+- (void)batchCallback:(dispatch_block_t)block onQueue:(dispatch_queue_t)queue
+{
+    [self.callbackBatchesLock lock];
+    NSMutableArray<dispatch_block_t> *batch = [self.callbackBatches objectForKey:queue];
+    const BOOL needsScheduling = (batch == nil);
+    if (needsScheduling) {
+        batch = [NSMutableArray array];
+        [self.callbackBatches setObject:batch forKey:queue];
+    }
+    [batch addObject:[block copy]];
+    [self.callbackBatchesLock unlock];
+
+    if (!needsScheduling) {
+        return;
+    }
+
+    const int64_t delay = (int64_t)(self.options.callbackBatchInterval * NSEC_PER_SEC);
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, delay), queue, ^{
+        [self.callbackBatchesLock lock];
+        NSArray<dispatch_block_t> *callbacks = [self.callbackBatches objectForKey:queue];
+        [self.callbackBatches removeObjectForKey:queue];
+        [self.callbackBatchesLock unlock];
+
+        for (dispatch_block_t callback in callbacks) {
+            callback();
+        }
     });
 }
 
+/**
+ * Gives SPTPersistentCacheLoadingErrorReadOnly to the caller if the cache is read-only.
+ * @return YES if the write must not be performed.
+ */
+- (BOOL)rejectWriteWithCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
+                        onQueue:(dispatch_queue_t _Nullable)queue
+{
+    if (!self.options.readOnly) {
+        return NO;
+    }
+
+    [self dispatchError:[NSError spt_persistentDataCacheErrorWithCode:SPTPersistentCacheLoadingErrorReadOnly]
+                 result:SPTPersistentCacheResponseCodeOperationError
+               callback:callback
+                onQueue:queue];
+    return YES;
+}
+
 - (void)debugOutput:(NSString *)format, ... NS_FORMAT_FUNCTION(1,2)
 {
     SPTPersistentCacheDebugCallback const debugOutput = self.debugOutput;
@@ -973,83 +2868,359 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
         [images removeLastObject];
 
         NSString *fileName = image[SPTDataCacheFileNameKey];
-        NSError *localError = nil;
-        if (fileName.length > 0 && ![self.fileManager removeItemAtPath:fileName error:&localError]) {
-            [self debugOutput:@"PersistentDataCache: %@ ERROR %@", @(__PRETTY_FUNCTION__), [localError localizedDescription]];
+        NSString *key = fileName.lastPathComponent;
+        BOOL __block removed = NO;
+        // Under the key lock a store can't land between removing the file and removing its row
+        [self serializeWorkForKey:key block:^{
+            // The listing may predate a lock of the record, locked records are kept
+            BOOL __block locked = NO;
+            [self alterSerializedHeaderForFileAtPath:fileName withBlock:^(SPTPersistentCacheRecordHeader *header) {
+                locked = [self isLockedWithHeader:header];
+            } writeBack:NO complain:NO];
+            if (locked) {
+                return;
+            }
+
+            NSError *localError = nil;
+            if (fileName.length > 0 && ![self.fileManager removeItemAtPath:fileName error:&localError]) {
+                [self debugOutput:@"PersistentDataCache: %@ ERROR %@", @(__PRETTY_FUNCTION__), [localError localizedDescription]];
+                if ([localError.domain isEqualToString:NSCocoaErrorDomain] && localError.code == NSFileNoSuchFileError) {
+                    [self removeMetadataForKey:key];
+                }
+            } else {
+                [self debugOutput:@"PersistentDataCache: evicting by size key:%@", key];
+                [self removeMetadataForKey:key];
+                removed = YES;
+            }
+        }];
+
+        if (!removed) {
             continue;
-        } else {
-            [self debugOutput:@"PersistentDataCache: evicting by size key:%@", fileName.lastPathComponent];
         }
-
         currentCacheSize -= [image[SPTDataCacheFileAttributesKey][NSFileSize] integerValue];
     }
     return YES;
 }
 
-- (NSMutableArray *)storedImageNamesAndAttributes
+/**
+ * Recovery method used internaly. Called on work queue.
+ */
+- (void)recoverSync
 {
     NSURL *urlPath = [NSURL URLWithString:self.options.cachePath];
+    SPTPersistentCacheDirectoryScanner *scanner = [self scannerWithMaxConcurrentOperations:self.options.recoveryMaxConcurrentOperations];
+    scanner.skipsHiddenFiles = NO;
 
-    // Enumerate the directory (specified elsewhere in your code)
-    // Ignore hidden files
-    // The errorHandler: parameter is set to nil. Typically you'd want to present a panel
-    NSDirectoryEnumerator *dirEnumerator = [self.fileManager enumeratorAtURL:urlPath
-                                                  includingPropertiesForKeys:@[NSURLIsDirectoryKey]
-                                                                     options:NSDirectoryEnumerationSkipsHiddenFiles
-                                                                errorHandler:nil];
+    const NSTimeInterval currentTime = [[NSDate date] timeIntervalSince1970];
+    NSLock *totalsLock = [NSLock new];
+    NSUInteger __block removedFiles = 0;
+    unsigned long long __block removedBytes = 0;
 
-    // An array to store the all the enumerated file names in
-    NSMutableArray *images = [NSMutableArray array];
+    [scanner scanDirectoryAtURL:urlPath fileBlock:^(NSURL *theURL) {
+        NSString *filePath = [NSString stringWithUTF8String:theURL.fileSystemRepresentation];
 
-    // Enumerate the dirEnumerator results, each value is stored in allURLs
-    NSURL *theURL = nil;
-    while ((theURL = [dirEnumerator nextObject])) {
+        struct stat fileStat;
+        if ([self.posixWrapper stat:theURL.fileSystemRepresentation statStruct:&fileStat] == -1 || !S_ISREG(fileStat.st_mode)) {
+            return;
+        }
 
-        // Retrieve the file name. From cached during the enumeration.
-        NSNumber *isDirectory;
-        if ([theURL getResourceValue:&isDirectory forKey:NSURLIsDirectoryKey error:NULL]) {
+        off_t removedSize = 0;
+        const BOOL removed = ([filePath.lastPathComponent hasPrefix:@"."] ?
+                              [self removeTemporaryFileAtPath:filePath fileStat:&fileStat currentTime:currentTime] :
+                              [self removeTornRecordAtPath:filePath removedSize:&removedSize]);
+        if (removed) {
+            [totalsLock lock];
+            ++removedFiles;
+            removedBytes += (unsigned long long)(removedSize > 0 ? removedSize : fileStat.st_size);
+            [totalsLock unlock];
+        }
+    } failureBlock:^(NSURL *theURL) {
+        [self debugOutput:@"Unable to fetch isDir#6 attribute:%@", theURL];
+    }];
 
-            if ([isDirectory boolValue] == NO) {
+    [self debugOutput:@"PersistentDataCache: Recovery removed %lu files, %llu bytes", (unsigned long)removedFiles, removedBytes];
+}
 
-                // We skip locked files always
-                BOOL __block locked = NO;
+/**
+ * Removes hidden file if it is a leftover of an atomic write. Other hidden files are left alone.
+ */
+- (BOOL)removeTemporaryFileAtPath:(NSString *)filePath
+                         fileStat:(const struct stat *)fileStat
+                      currentTime:(NSTimeInterval)currentTime
+{
+    if (![self isTemporaryFileAtPath:filePath] ||
+        currentTime - (NSTimeInterval)fileStat->st_mtime < SPTPersistentCacheRecoveryTemporaryFileAge) {
+        return NO;
+    }
 
-                // WARNING: We may skip return result here bcuz in that case we will remove unknown file as unlocked trash
-                [self alterHeaderForFileAtPath:[NSString stringWithUTF8String:theURL.fileSystemRepresentation]
-                                     withBlock:^(SPTPersistentCacheRecordHeader *header) {
-                                         locked = (header->refCount > 0);
-                                     } writeBack:NO
-                                      complain:YES];
+    [self debugOutput:@"PersistentDataCache: Recovery removing temporary file:%@", filePath];
+    return [self.fileManager removeItemAtPath:filePath error:nil];
+}
 
-                if (locked) {
-                    continue;
-                }
+/**
+ * Whether the hidden file at path is the temporary file of an atomic write: one of Foundation, or one of libsptpc named
+ * ".<key>.XXXXXX" in the directory of the record for key.
+ */
+- (BOOL)isTemporaryFileAtPath:(NSString *)filePath
+{
+    NSString *fileName = filePath.lastPathComponent;
+    if ([fileName hasPrefix:SPTPersistentCacheFoundationTemporaryFilePrefix]) {
+        return YES;
+    }
 
-                /* We use this since this is most reliable method to get file info and URL stuff fails sometimes
-                 which is described in apple doc and its our case here */
+    const NSUInteger suffixLength = SPTPersistentCacheCoreTemporaryFileSuffixLength;
+    if (fileName.length <= 1 + suffixLength || [fileName characterAtIndex:fileName.length - suffixLength] != '.') {
+        return NO;
+    }
+    NSString *uniquePart = [fileName substringFromIndex:fileName.length - suffixLength + 1];
+    if ([uniquePart rangeOfCharacterFromSet:[NSCharacterSet alphanumericCharacterSet].invertedSet].location != NSNotFound) {
+        return NO;
+    }
+    NSString *key = [fileName substringWithRange:NSMakeRange(1, fileName.length - 1 - suffixLength)];
+    NSString *recordDirectoryName = [self.dataCacheFileManager subDirectoryPathForKey:key].lastPathComponent;
+    return [recordDirectoryName isEqualToString:filePath.stringByDeletingLastPathComponent.lastPathComponent];
+}
 
-                struct stat fileStat;
-                int ret = [self.posixWrapper stat:[theURL fileSystemRepresentation] statStruct:&fileStat];
-                if (ret == -1) {
-                    [self debugOutput:@"Cannot find the stats of file: %@", theURL.absoluteString];
-                    continue;
-                }
+/**
+ * Removes record if its file size doesn't match the payload size in its header.
+ * Files without valid header aren't ours so they are left alone. Records which are kept are mirrored into the
+ * metadata table again, in case they changed while the table wasn't updated.
+ * The size is taken from the file opened under the key lock, so a record stored after the scan is judged by its own.
+ */
+- (BOOL)removeTornRecordAtPath:(NSString *)filePath removedSize:(off_t *)removedSize
+{
+    NSString *key = filePath.lastPathComponent;
+    BOOL __block removed = NO;
+
+    [self serializeWorkForKey:key block:^{
+        BOOL __block torn = NO;
+        BOOL __block valid = NO;
+        SPTPersistentCacheRecordHeader __block recordHeader;
+        [self guardOpenFileWithPath:filePath jobBlock:^SPTPersistentCacheResponse*(int filedes) {
+            struct stat fileStat;
+            if ([self.posixWrapper read:filedes buffer:&recordHeader bufferSize:SPTPersistentCacheRecordHeaderSize] != (ssize_t)SPTPersistentCacheRecordHeaderSize ||
+                SPTPersistentCacheCheckValidHeader(&recordHeader) != nil ||
+                [self.posixWrapper fstat:filedes statStruct:&fileStat] == -1) {
+                return nil;
+            }
+            const uint64_t storedPayloadSize = (uint64_t)fileStat.st_size - SPTPersistentCacheRecordHeaderSize;
+            const BOOL appendable = (recordHeader.flags & SPTPersistentCacheRecordHeaderFlagsAppendable) != 0;
+            torn = (appendable ? recordHeader.payloadSizeBytes > storedPayloadSize : recordHeader.payloadSizeBytes != storedPayloadSize);
+            *removedSize = fileStat.st_size;
+            valid = YES;
+            return nil;
+        } complain:NO writeBack:NO];
+
+        if (torn) {
+            [self debugOutput:@"PersistentDataCache: Recovery removing torn record:%@", key];
+            removed = [self.fileManager removeItemAtPath:filePath error:nil];
+        }
+        if (removed) {
+            [self removeMetadataForKey:key];
+        } else if (valid) {
+            [self updateMetadataForKey:key header:&recordHeader];
+        }
+    }];
+
+    return removed;
+}
+
+/**
+ * Export method used internaly. Called on work queue.
+ * Record files are read under their key lock and funneled into one sequential archive writer.
+ */
+- (NSError *)exportSnapshotToPathSync:(NSString *)path
+{
+    NSError *error = nil;
+    SPTPersistentCacheSnapshotWriter *writer = [[SPTPersistentCacheSnapshotWriter alloc] initWithPath:path error:&error];
+    if (writer == nil) {
+        [self debugOutput:@"PersistentDataCache: Error creating snapshot at path:%@ , error:%@", path, [error localizedDescription]];
+        return error;
+    }
+
+    NSURL *urlPath = [NSURL URLWithString:self.options.cachePath];
+    SPTPersistentCacheDirectoryScanner *scanner = [self scannerWithMaxConcurrentOperations:self.options.scanMaxConcurrentOperations];
+    NSLock *writerLock = [NSLock new];
+    NSError * __block writeError = nil;
+
+    [scanner scanDirectoryAtURL:urlPath fileBlock:^(NSURL *theURL) {
+        NSString *key = theURL.lastPathComponent;
+        NSData * __block record = nil;
+
+        [self serializeWorkForKey:key block:^{
+            record = [self snapshotRecordForKey:key];
+        }];
 
-                /*
-                 Use modification time even for files with TTL
-                 Files with TTL have updateTime set once on creation.
-                 */
-                NSDate *mdate = [NSDate dateWithTimeIntervalSince1970:(fileStat.st_mtimespec.tv_sec + fileStat.st_mtimespec.tv_nsec*1e9)];
-                NSNumber *fsize = [NSNumber numberWithLongLong:fileStat.st_size];
-                NSDictionary *values = @{NSFileModificationDate : mdate, NSFileSize: fsize};
+        if (record == nil) {
+            return;
+        }
 
-                [images addObject:@{ SPTDataCacheFileNameKey : [NSString stringWithUTF8String:[theURL fileSystemRepresentation]],
-                                     SPTDataCacheFileAttributesKey : values }];
+        [writerLock lock];
+        if (writeError == nil) {
+            NSError *appendError = nil;
+            if (![writer appendRecord:record forKey:key error:&appendError]) {
+                writeError = appendError;
             }
-        } else {
-            [self debugOutput:@"Unable to fetch isDir#5 attribute:%@", theURL];
         }
+        [writerLock unlock];
+    } failureBlock:^(NSURL *theURL) {
+        [self debugOutput:@"Unable to fetch isDir#7 attribute:%@", theURL];
+    }];
+
+    error = writeError;
+    if (error == nil && [writer finishWithError:&error]) {
+        [self debugOutput:@"PersistentDataCache: Exported %lu records to snapshot:%@", (unsigned long)writer.recordCount, path];
+        return nil;
+    }
+
+    [self debugOutput:@"PersistentDataCache: Error writing snapshot at path:%@ , error:%@", path, [error localizedDescription]];
+    return error;
+}
+
+/**
+ * Returns record file bytes to put in a snapshot or nil if the record can't be returned. Must be called while holding
+ * the lock of the key.
+ */
+- (NSData *)snapshotRecordForKey:(NSString *)key
+{
+    NSString *filePath = [self.dataCacheFileManager pathForKey:key];
+    NSData *rawData = [NSData dataWithContentsOfFile:filePath options:NSDataReadingMappedIfSafe error:nil];
+    if (rawData.length < SPTPersistentCacheRecordHeaderSize) {
+        return nil;
+    }
+
+    SPTPersistentCacheRecordHeader header;
+    memcpy(&header, rawData.bytes, SPTPersistentCacheRecordHeaderSize);
+
+    if (SPTPersistentCacheCheckValidHeader(&header) != nil ||
+        (header.flags & SPTPersistentCacheRecordHeaderFlagsStreamIncomplete) != 0 ||
+        ![self isDataCanBeReturnedWithHeader:&header]) {
+        return nil;
+    }
+
+    // Tail of an interrupted append is left behind
+    const NSUInteger recordLength = (NSUInteger)(SPTPersistentCacheRecordHeaderSize + header.payloadSizeBytes);
+    if (rawData.length < recordLength ||
+        (rawData.length > recordLength && (header.flags & SPTPersistentCacheRecordHeaderFlagsAppendable) == 0)) {
+        return nil;
+    }
+
+    return [rawData subdataWithRange:NSMakeRange(0, recordLength)];
+}
+
+/**
+ * Import method used internaly. Called on work queue.
+ * The whole archive is validated before the first record is stored.
+ */
+- (NSError *)importSnapshotFromPathSync:(NSString *)path
+{
+    NSError *error = nil;
+    SPTPersistentCacheSnapshotReader *reader = [[SPTPersistentCacheSnapshotReader alloc] initWithPath:path error:&error];
+    if (reader == nil) {
+        [self debugOutput:@"PersistentDataCache: Error reading snapshot at path:%@ , error:%@", path, [error localizedDescription]];
+        return error;
+    }
+
+    NSUInteger __block importedRecords = 0;
+    NSUInteger __block skippedRecords = 0;
+    NSError * __block writeError = nil;
+
+    [reader enumerateRecordsUsingBlock:^(NSString *key, NSData *record, BOOL *stop) {
+        SPTPersistentCacheRecordHeader header;
+        if (record.length < SPTPersistentCacheRecordHeaderSize) {
+            ++skippedRecords;
+            return;
+        }
+        memcpy(&header, record.bytes, SPTPersistentCacheRecordHeaderSize);
+
+        if (SPTPersistentCacheCheckValidHeader(&header) != nil ||
+            SPTPersistentCacheRecordHeaderSize + header.payloadSizeBytes != record.length ||
+            ![SPTPersistentCache isValidRecordKey:key]) {
+            [self debugOutput:@"PersistentDataCache: Skipping invalid snapshot record for key:%@", key];
+            ++skippedRecords;
+            return;
+        }
+
+        [self serializeWorkForKey:key block:^{
+            NSString *subDir = [self.dataCacheFileManager subDirectoryPathForKey:key];
+            [self.fileManager createDirectoryAtPath:subDir withIntermediateDirectories:YES attributes:nil error:nil];
+
+            NSError *recordError = nil;
+            if ([record writeToFile:[self.dataCacheFileManager pathForKey:key] options:NSDataWritingAtomic error:&recordError]) {
+                [self updateMetadataForKey:key record:record];
+                ++importedRecords;
+            } else {
+                writeError = recordError;
+                *stop = YES;
+            }
+        }];
+    }];
+
+    if (writeError != nil) {
+        [self debugOutput:@"PersistentDataCache: Error importing snapshot at path:%@ , error:%@", path, [writeError localizedDescription]];
+        return writeError;
+    }
+
+    [self debugOutput:@"PersistentDataCache: Imported %lu records from snapshot:%@, skipped %lu",
+     (unsigned long)importedRecords, path, (unsigned long)skippedRecords];
+    return nil;
+}
+
+- (NSMutableArray *)storedImageNamesAndAttributes
+{
+    if ([self isMetadataTableComplete]) {
+        return [self storedImageNamesAndAttributesFromMetadata];
+    }
+
+    NSURL *urlPath = [NSURL URLWithString:self.options.cachePath];
+
+    // Enumerate the directory (specified elsewhere in your code)
+    // Ignore hidden files
+    SPTPersistentCacheDirectoryScanner *scanner = [self scannerWithMaxConcurrentOperations:self.options.scanMaxConcurrentOperations];
+
+    // An array to store the all the enumerated file names in, files are visited concurrently
+    NSMutableArray *images = [NSMutableArray array];
+    NSLock *imagesLock = [NSLock new];
+
+    [scanner scanDirectoryAtURL:urlPath fileBlock:^(NSURL *theURL) {
+        /* We use this since this is most reliable method to get file info and URL stuff fails sometimes
+         which is described in apple doc and its our case here */
+
+        struct stat fileStat;
+        int ret = [self.posixWrapper stat:[theURL fileSystemRepresentation] statStruct:&fileStat];
+        if (ret == -1) {
+            [self debugOutput:@"Cannot find the stats of file: %@", theURL.absoluteString];
+            return;
+        }
+
+        /*
+         Use modification time even for files with TTL
+         Files with TTL have updateTime set once on creation.
+         */
+        NSDate *mdate = [NSDate dateWithTimeIntervalSince1970:(NSTimeInterval)fileStat.st_mtime];
+        NSNumber *fsize = [NSNumber numberWithLongLong:fileStat.st_size];
+        NSDictionary *values = @{NSFileModificationDate : mdate, NSFileSize: fsize};
+
+        [imagesLock lock];
+        [images addObject:@{ SPTDataCacheFileNameKey : [NSString stringWithUTF8String:[theURL fileSystemRepresentation]],
+                             SPTDataCacheFileAttributesKey : values }];
+        [imagesLock unlock];
+    } failureBlock:^(NSURL *theURL) {
+        [self debugOutput:@"Unable to fetch isDir#5 attribute:%@", theURL];
+    }];
+
+    // We skip locked files always, their headers are read in batches once the scan is done
+    NSMutableDictionary<NSString *, NSDictionary *> *imagesByPath = [NSMutableDictionary dictionaryWithCapacity:images.count];
+    for (NSDictionary *image in images) {
+        imagesByPath[image[SPTDataCacheFileNameKey]] = image;
     }
+    [images removeAllObjects];
+    [self readHeadersOfFilesAtPaths:imagesByPath.allKeys withBlock:^(NSString *filePath, SPTPersistentCacheRecordHeader *header) {
+        // WARNING: A header we can't read means the file is removed as unlocked trash
+        if (header == NULL || ![self isLockedWithHeader:header]) {
+            [images addObject:imagesByPath[filePath]];
+        }
+    }];
 
     // Oldest goes last
     NSComparisonResult(^SPTSortFilesByModificationDate)(id, id) = ^NSComparisonResult(NSDictionary *file1, NSDictionary *file2) {
@@ -1063,6 +3234,30 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
     return [sortedImages mutableCopy];
 }
 
+/**
+ * Same as storedImageNamesAndAttributes from the metadata table. The update time of a record stands in for the
+ * modification time of its file, the header and payload size for the file size.
+ */
+- (NSMutableArray *)storedImageNamesAndAttributesFromMetadata
+{
+    NSMutableArray *images = [NSMutableArray array];
+    // We skip locked files always
+    [self selectMetadata:SPTPC_SELECT_UNLOCKED withBlock:^(const char *key, SPTPersistentCacheRecordHeader *header) {
+        NSDate *mdate = [NSDate dateWithTimeIntervalSince1970:(NSTimeInterval)header->updateTimeSec];
+        NSNumber *fsize = @(SPTPersistentCacheRecordHeaderSize + header->payloadSizeBytes);
+        [images addObject:@{ SPTDataCacheFileNameKey : [self.dataCacheFileManager pathForKey:@(key)],
+                             SPTDataCacheFileAttributesKey : @{ NSFileModificationDate : mdate, NSFileSize : fsize } }];
+    }];
+
+    // Oldest goes last
+    [images sortUsingComparator:^NSComparisonResult(NSDictionary *file1, NSDictionary *file2) {
+        NSDate *date1 = file1[SPTDataCacheFileAttributesKey][NSFileModificationDate];
+        NSDate *date2 = file2[SPTDataCacheFileAttributesKey][NSFileModificationDate];
+        return [date2 compare:date1];
+    }];
+    return images;
+}
+
 - (NSTimeInterval)currentDateTimeInterval
 {
     return [[NSDate date] timeIntervalSince1970];
@@ -1076,6 +3271,58 @@ void SPTPersistentCacheSafeDispatch(_Nullable dispatch_queue_t queue, _Nonnull d
     [self.workQueue addOperation:operation];
 }
 
+- (void)doReadWork:(void (^)(void))block priority:(NSOperationQueuePriority)priority qos:(NSQualityOfService)qos
+{
+    SPTPersistentCacheConcurrencyController *controller = self.readConcurrencyController;
+    if (controller == nil) {
+        [self doWork:block priority:priority qos:qos];
+        return;
+    }
+
+    NSBlockOperation *operation = [NSBlockOperation blockOperationWithBlock:[self measuredBlock:block
+                                                                                         queue:self.readQueue
+                                                                                    controller:controller]];
+    operation.qualityOfService = qos;
+    operation.queuePriority = priority;
+    [self.readQueue addOperation:operation];
+}
+
+- (void)doWriteWork:(void (^)(void))block priority:(NSOperationQueuePriority)priority qos:(NSQualityOfService)qos
+{
+    SPTPersistentCacheConcurrencyController *controller = self.writeConcurrencyController;
+    if (controller != nil) {
+        block = [self measuredBlock:block queue:self.workQueue controller:controller];
+    }
+    [self doWork:block priority:priority qos:qos];
+}
+
+/**
+ * Wraps block so its latency is given to controller, which then sets the concurrency of queue.
+ */
+- (void (^)(void))measuredBlock:(void (^)(void))block
+                          queue:(NSOperationQueue *)queue
+                     controller:(SPTPersistentCacheConcurrencyController *)controller
+{
+    return ^{
+        [controller operationDidStart];
+        const uint64_t startTime = mach_absolute_time();
+        block();
+        if ([controller operationDidFinishWithLatency:mach_absolute_time() - startTime]) {
+            queue.maxConcurrentOperationCount = (NSInteger)controller.limit;
+        }
+    };
+}
+
+- (void)serializeWorkForKey:(NSString *)key block:(void (^)(void))block
+{
+    NSRecursiveLock *lock = self.keyLocks[key.hash % self.keyLocks.count];
+    [lock lock];
+    // A buffered record is written before anything else touches the key
+    [self writeBufferedRecordForKey:key];
+    block();
+    [lock unlock];
+}
+
 - (void)logTimingForKey:(NSString *)key method:(SPTPersistentCacheDebugMethodType)method type:(SPTPersistentCacheDebugTimingType)type
 {
     if (self.options.timingCallback) {
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#import <Foundation/Foundation.h>
+#import <SPTPersistentCache/SPTPersistentCache.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ *  Talks to a SPTPersistentCacheServer running in another local process.
+ *  @discussion Calls mirror the ones of SPTPersistentCache and give the same responses. Requests are sent one at a
+ *  time in call order. Loaded payloads map the file passed by the server instead of being copied through the socket.
+ *  If the connection is lost, requests fail with a POSIX error until connectWithError: succeeds again.
+ */
+@interface SPTPersistentCacheClient : NSObject
+
+/**
+ *  Path of the socket of the server.
+ */
+@property (nonatomic, copy, readonly) NSString *socketPath;
+
+/**
+ *  Initializes a client. It doesn't connect until asked to.
+ *
+ *  @param socketPath Path of the socket of the server.
+ */
+- (instancetype)initWithSocketPath:(NSString *)socketPath NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ *  Connects to the server, dropping any previous connection.
+ *
+ *  @param error Set if the server can't be reached.
+ *  @return YES if connected.
+ */
+- (BOOL)connectWithError:(NSError * _Nullable *)error;
+
+/**
+ *  Drops the connection. Requests already sent still get their responses.
+ */
+- (void)disconnect;
+
+/**
+ *  See SPTPersistentCache loadDataForKey:withCallback:onQueue:.
+ */
+- (BOOL)loadDataForKey:(NSString *)key
+          withCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
+               onQueue:(dispatch_queue_t _Nullable)queue;
+
+/**
+ *  See SPTPersistentCache storeData:forKey:ttl:locked:withCallback:onQueue:. The payload is passed to the server in an
+ *  anonymous file.
+ */
+- (BOOL)storeData:(NSData *)data
+           forKey:(NSString *)key
+              ttl:(NSUInteger)ttl
+           locked:(BOOL)locked
+     withCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
+          onQueue:(dispatch_queue_t _Nullable)queue;
+
+/**
+ *  See SPTPersistentCache lockDataForKeys:callback:onQueue:.
+ */
+- (BOOL)lockDataForKeys:(NSArray<NSString *> *)keys
+               callback:(SPTPersistentCacheResponseCallback _Nullable)callback
+                onQueue:(dispatch_queue_t _Nullable)queue;
+
+/**
+ *  See SPTPersistentCache unlockDataForKeys:callback:onQueue:.
+ */
+- (BOOL)unlockDataForKeys:(NSArray<NSString *> *)keys
+                 callback:(SPTPersistentCacheResponseCallback _Nullable)callback
+                  onQueue:(dispatch_queue_t _Nullable)queue;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#import "SPTPersistentCacheClient.h"
+#import "SPTPersistentCacheSocketProtocol.h"
+#import "SPTPersistentCacheRecord+Private.h"
+#import "SPTPersistentCacheResponse+Private.h"
+#import "SPTPersistentCache+Private.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+@interface SPTPersistentCacheClient ()
+@property (nonatomic, strong) dispatch_queue_t requestQueue;
+// Only accessed on requestQueue
+@property (nonatomic, assign) int socket;
+@end
+
+@implementation SPTPersistentCacheClient
+
+#pragma mark Object Life Cycle
+
+- (instancetype)initWithSocketPath:(NSString *)socketPath
+{
+    self = [super init];
+    if (self) {
+        _socketPath = [socketPath copy];
+        _requestQueue = dispatch_queue_create("com.spotify.persistentcache.client", DISPATCH_QUEUE_SERIAL);
+        _socket = -1;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    if (_socket != -1) {
+        close(_socket);
+    }
+}
+
+#pragma mark Connection
+
+- (BOOL)connectWithError:(NSError * _Nullable *)error
+{
+    struct sockaddr_un address;
+    if (!SPTPersistentCacheSocketMakeAddress(self.socketPath, &address, sizeof(address))) {
+        if (error) {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENAMETOOLONG userInfo:nil];
+        }
+        return NO;
+    }
+
+    int newSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (newSocket != -1 && connect(newSocket, (const struct sockaddr *)&address, sizeof(address)) == -1) {
+        const int errorNumber = errno;
+        close(newSocket);
+        newSocket = -1;
+        errno = errorNumber;
+    }
+    if (newSocket == -1) {
+        if (error) {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+        }
+        return NO;
+    }
+    SPTPersistentCacheSocketDisableSigPipe(newSocket);
+
+    dispatch_sync(self.requestQueue, ^{
+        [self closeSocket];
+        self.socket = newSocket;
+    });
+    return YES;
+}
+
+- (void)disconnect
+{
+    dispatch_async(self.requestQueue, ^{
+        [self closeSocket];
+    });
+}
+
+- (void)closeSocket
+{
+    if (self.socket != -1) {
+        close(self.socket);
+        self.socket = -1;
+    }
+}
+
+#pragma mark Requests
+
+- (BOOL)loadDataForKey:(NSString *)key
+          withCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
+               onQueue:(dispatch_queue_t _Nullable)queue
+{
+    if (callback == nil || queue == nil) {
+        return NO;
+    }
+    [self sendOperation:SPTPersistentCacheSocketOperationLoad key:key payload:nil ttl:0 locked:NO callback:callback onQueue:queue];
+    return YES;
+}
+
+- (BOOL)storeData:(NSData *)data
+           forKey:(NSString *)key
+              ttl:(NSUInteger)ttl
+           locked:(BOOL)locked
+     withCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
+          onQueue:(dispatch_queue_t _Nullable)queue
+{
+    if (data == nil || key == nil || (callback != nil && queue == nil)) {
+        return NO;
+    }
+    [self sendOperation:SPTPersistentCacheSocketOperationStore key:key payload:data ttl:ttl locked:locked callback:callback onQueue:queue];
+    return YES;
+}
+
+- (BOOL)lockDataForKeys:(NSArray<NSString *> *)keys
+               callback:(SPTPersistentCacheResponseCallback _Nullable)callback
+                onQueue:(dispatch_queue_t _Nullable)queue
+{
+    if ((callback != nil && queue == nil) || keys.count == 0) {
+        return NO;
+    }
+    for (NSString *key in keys) {
+        [self sendOperation:SPTPersistentCacheSocketOperationLock key:key payload:nil ttl:0 locked:NO callback:callback onQueue:queue];
+    }
+    return YES;
+}
+
+- (BOOL)unlockDataForKeys:(NSArray<NSString *> *)keys
+                 callback:(SPTPersistentCacheResponseCallback _Nullable)callback
+                  onQueue:(dispatch_queue_t _Nullable)queue
+{
+    if ((callback != nil && queue == nil) || keys.count == 0) {
+        return NO;
+    }
+    for (NSString *key in keys) {
+        [self sendOperation:SPTPersistentCacheSocketOperationUnlock key:key payload:nil ttl:0 locked:NO callback:callback onQueue:queue];
+    }
+    return YES;
+}
+
+- (void)sendOperation:(SPTPersistentCacheSocketOperation)operation
+                  key:(NSString *)key
+              payload:(NSData *)payload
+                  ttl:(NSUInteger)ttl
+               locked:(BOOL)locked
+             callback:(SPTPersistentCacheResponseCallback)callback
+              onQueue:(dispatch_queue_t)queue
+{
+    callback = [callback copy];
+    dispatch_async(self.requestQueue, ^{
+        SPTPersistentCacheResponse *response = [self responseForOperation:operation key:key payload:payload ttl:ttl locked:locked];
+        if (callback != nil) {
+            SPTPersistentCacheSafeDispatch(queue, ^{
+                callback(response);
+            });
+        }
+    });
+}
+
+/**
+ * Sends one request and waits for its reply. Called on request queue.
+ */
+- (SPTPersistentCacheResponse *)responseForOperation:(SPTPersistentCacheSocketOperation)operation
+                                                 key:(NSString *)key
+                                             payload:(NSData *)payload
+                                                 ttl:(NSUInteger)ttl
+                                              locked:(BOOL)locked
+{
+    if (self.socket == -1) {
+        return [self errorResponseWithPOSIXCode:ENOTCONN];
+    }
+
+    NSData *keyData = [key dataUsingEncoding:NSUTF8StringEncoding];
+
+    SPTPersistentCacheSocketRequest request;
+    memset(&request, 0, sizeof(request));
+    request.magic = SPTPersistentCacheSocketMagic;
+    request.operation = operation;
+    request.locked = locked ? 1 : 0;
+    request.keyLength = (uint32_t)keyData.length;
+    request.ttl = ttl;
+    request.payloadLength = payload.length;
+
+    int payloadFileDescriptor = -1;
+    if (payload != nil) {
+        payloadFileDescriptor = SPTPersistentCacheSocketCreateAnonymousFile(payload);
+        if (payloadFileDescriptor == -1) {
+            return [self errorResponseWithPOSIXCode:errno];
+        }
+    }
+
+    const BOOL sent = SPTPersistentCacheSocketSend(self.socket, &request, sizeof(request), keyData, payloadFileDescriptor);
+    const int sendErrorNumber = errno;
+    if (payloadFileDescriptor != -1) {
+        close(payloadFileDescriptor);
+    }
+
+    SPTPersistentCacheSocketReply reply;
+    int replyFileDescriptor = -1;
+    if (!sent || !SPTPersistentCacheSocketReceive(self.socket, &reply, sizeof(reply), &replyFileDescriptor) ||
+        reply.magic != SPTPersistentCacheSocketMagic) {
+        if (replyFileDescriptor != -1) {
+            close(replyFileDescriptor);
+        }
+        [self closeSocket];
+        return [self errorResponseWithPOSIXCode:(sent ? ECONNRESET : sendErrorNumber)];
+    }
+
+    SPTPersistentCacheRecord *record = nil;
+    if (replyFileDescriptor != -1) {
+        NSData *data = SPTPersistentCacheSocketMapFile(replyFileDescriptor, reply.payloadOffset, reply.payloadLength);
+        const int mapErrorNumber = errno;
+        close(replyFileDescriptor);
+        if (data == nil) {
+            return [self errorResponseWithPOSIXCode:mapErrorNumber];
+        }
+        record = [[SPTPersistentCacheRecord alloc] initWithData:data
+                                                            key:key
+                                                       refCount:reply.refCount
+                                                            ttl:(NSUInteger)reply.ttl
+                                                        version:reply.version];
+    }
+
+    return [[SPTPersistentCacheResponse alloc] initWithResult:(SPTPersistentCacheResponseCode)reply.result
+                                                        error:[self errorFromReply:&reply]
+                                                       record:record
+                                                        stale:(reply.stale != 0)
+                                           refreshRecommended:(reply.refreshRecommended != 0)];
+}
+
+- (NSError *)errorFromReply:(const SPTPersistentCacheSocketReply *)reply
+{
+    switch ((SPTPersistentCacheSocketErrorDomain)reply->errorDomain) {
+        case SPTPersistentCacheSocketErrorDomainNone:
+            return nil;
+        case SPTPersistentCacheSocketErrorDomainCache:
+            return [NSError errorWithDomain:SPTPersistentCacheErrorDomain code:(NSInteger)reply->errorCode userInfo:nil];
+        case SPTPersistentCacheSocketErrorDomainPOSIX:
+            return [NSError errorWithDomain:NSPOSIXErrorDomain code:(NSInteger)reply->errorCode userInfo:nil];
+        case SPTPersistentCacheSocketErrorDomainCocoa:
+            return [NSError errorWithDomain:NSCocoaErrorDomain code:(NSInteger)reply->errorCode userInfo:nil];
+    }
+    return [NSError errorWithDomain:SPTPersistentCacheErrorDomain code:SPTPersistentCacheLoadingErrorInternalInconsistency userInfo:nil];
+}
+
+- (SPTPersistentCacheResponse *)errorResponseWithPOSIXCode:(int)code
+{
+    return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationError
+                                                        error:[NSError errorWithDomain:NSPOSIXErrorDomain code:code userInfo:nil]
+                                                       record:nil];
+}
+
+@end
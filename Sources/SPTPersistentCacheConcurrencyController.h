@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ *  Finds the number of concurrent operations a disk handles best from the latency of finished operations.
+ *  @discussion Latencies are averaged over windows of operations. The lowest average seen is the baseline of an
+ *  unloaded disk. When the average of a window is more than twice the baseline the limit is cut by a quarter, otherwise
+ *  it grows by one if the operations of the window used all of it (AIMD). Latencies can be in any unit as long as it is
+ *  the same for all calls.
+ */
+@interface SPTPersistentCacheConcurrencyController : NSObject
+
+/**
+ *  The lowest limit the controller settles on.
+ */
+@property (nonatomic, assign, readonly) NSUInteger minimumLimit;
+
+/**
+ *  The highest limit the controller settles on.
+ */
+@property (nonatomic, assign, readonly) NSUInteger maximumLimit;
+
+/**
+ *  The number of operations which should run concurrently. Safe to read from any thread.
+ */
+@property (nonatomic, assign, readonly) NSUInteger limit;
+
+/**
+ *  Initializes a controller.
+ *
+ *  @param minimumLimit The lowest limit, at least 1.
+ *  @param maximumLimit The highest limit, at least minimumLimit.
+ *  @param initialLimit The limit to start with, clamped to the bounds.
+ */
+- (instancetype)initWithMinimumLimit:(NSUInteger)minimumLimit
+                        maximumLimit:(NSUInteger)maximumLimit
+                        initialLimit:(NSUInteger)initialLimit NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ *  Tells the controller an operation started. Safe to call from any thread.
+ */
+- (void)operationDidStart;
+
+/**
+ *  Tells the controller an operation finished. Safe to call from any thread.
+ *
+ *  @param latency The time the operation took.
+ *  @return YES if the limit changed.
+ */
+- (BOOL)operationDidFinishWithLatency:(uint64_t)latency;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#import "SPTPersistentCacheConcurrencyController.h"
+
+// Number of finished operations the latency is averaged over before the limit is adjusted
+static const NSUInteger SPTPersistentCacheConcurrencyControllerWindowSize = 16;
+// How much the average latency of a window may exceed the baseline before the disk is considered overloaded
+static const uint64_t SPTPersistentCacheConcurrencyControllerLatencyTolerance = 2;
+// Weight of a window average which raises the baseline, so the baseline follows a disk which got slower for good
+static const uint64_t SPTPersistentCacheConcurrencyControllerBaselineDecay = 16;
+
+@interface SPTPersistentCacheConcurrencyController ()
+@property (nonatomic, strong) NSLock *lock;
+@property (nonatomic, assign) NSUInteger currentLimit;
+@property (nonatomic, assign) NSUInteger inFlightCount;
+@property (nonatomic, assign) NSUInteger windowMaxInFlightCount;
+@property (nonatomic, assign) NSUInteger windowCount;
+@property (nonatomic, assign) uint64_t windowLatencySum;
+@property (nonatomic, assign) uint64_t baselineLatency;
+@end
+
+@implementation SPTPersistentCacheConcurrencyController
+
+#pragma mark Object Life Cycle
+
+- (instancetype)initWithMinimumLimit:(NSUInteger)minimumLimit
+                        maximumLimit:(NSUInteger)maximumLimit
+                        initialLimit:(NSUInteger)initialLimit
+{
+    self = [super init];
+    if (self) {
+        _minimumLimit = MAX(minimumLimit, 1u);
+        _maximumLimit = MAX(maximumLimit, _minimumLimit);
+        _currentLimit = MIN(MAX(initialLimit, _minimumLimit), _maximumLimit);
+        _lock = [NSLock new];
+    }
+    return self;
+}
+
+#pragma mark Measuring
+
+- (NSUInteger)limit
+{
+    [self.lock lock];
+    const NSUInteger limit = self.currentLimit;
+    [self.lock unlock];
+    return limit;
+}
+
+- (void)operationDidStart
+{
+    [self.lock lock];
+    self.inFlightCount += 1;
+    self.windowMaxInFlightCount = MAX(self.windowMaxInFlightCount, self.inFlightCount);
+    [self.lock unlock];
+}
+
+- (BOOL)operationDidFinishWithLatency:(uint64_t)latency
+{
+    [self.lock lock];
+
+    self.inFlightCount -= MIN(self.inFlightCount, 1u);
+    self.windowCount += 1;
+    self.windowLatencySum += latency;
+
+    const NSUInteger previousLimit = self.currentLimit;
+    if (self.windowCount >= SPTPersistentCacheConcurrencyControllerWindowSize) {
+        [self adjustLimitWithAverageLatency:self.windowLatencySum / self.windowCount];
+        self.windowCount = 0;
+        self.windowLatencySum = 0;
+        self.windowMaxInFlightCount = self.inFlightCount;
+    }
+    const BOOL changed = (self.currentLimit != previousLimit);
+
+    [self.lock unlock];
+    return changed;
+}
+
+/**
+ *  Must be called holding the lock.
+ */
+- (void)adjustLimitWithAverageLatency:(uint64_t)averageLatency
+{
+    const uint64_t baseline = self.baselineLatency;
+    if (baseline == 0 || averageLatency < baseline) {
+        self.baselineLatency = averageLatency;
+    } else {
+        self.baselineLatency = baseline + (averageLatency - baseline) / SPTPersistentCacheConcurrencyControllerBaselineDecay;
+    }
+
+    const NSUInteger limit = self.currentLimit;
+    if (baseline > 0 && averageLatency > baseline * SPTPersistentCacheConcurrencyControllerLatencyTolerance) {
+        const NSUInteger decrease = MAX(limit / 4, 1u);
+        self.currentLimit = MAX(limit - MIN(decrease, limit), self.minimumLimit);
+    } else if (self.windowMaxInFlightCount >= limit) {
+        self.currentLimit = MIN(limit + 1, self.maximumLimit);
+    }
+}
+
+@end
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ *  Type of block called for each file found by the scanner.
+ *  @param fileURL URL of the file.
+ */
+typedef void (^SPTPersistentCacheDirectoryScannerFileBlock)(NSURL *fileURL);
+/**
+ *  Type of block called for each URL which the scanner couldn't tell to be a file or a directory.
+ *  @param URL The URL which couldn't be inspected.
+ */
+typedef void (^SPTPersistentCacheDirectoryScannerFailureBlock)(NSURL *URL);
+
+/**
+ *  Walks a cache folder with the subdirectories created by `useDirectorySeparation` scanned in parallel.
+ *  @discussion Files directly in the folder are visited first, then every subdirectory is walked by its own operation.
+ *  The number of operations running at the same time bounds the I/O depth.
+ */
+@interface SPTPersistentCacheDirectoryScanner : NSObject
+
+/**
+ *  File manager used to enumerate the directories.
+ */
+@property (nonatomic, strong, readonly) NSFileManager *fileManager;
+/**
+ *  Max number of subdirectories walked at the same time.
+ */
+@property (nonatomic, assign, readonly) NSInteger maxConcurrentOperations;
+/**
+ *  Quality of service of the walking operations.
+ */
+@property (nonatomic, assign, readonly) NSQualityOfService qualityOfService;
+/**
+ *  Whether hidden files and directories are skipped. Defaults to `YES`.
+ */
+@property (nonatomic, assign) BOOL skipsHiddenFiles;
+
+/**
+ *  Initializes a scanner.
+ *
+ *  @param fileManager File manager used to enumerate the directories.
+ *  @param maxConcurrentOperations Max number of subdirectories walked at the same time.
+ *  @param qualityOfService Quality of service of the walking operations.
+ */
+- (instancetype)initWithFileManager:(NSFileManager *)fileManager
+            maxConcurrentOperations:(NSInteger)maxConcurrentOperations
+                   qualityOfService:(NSQualityOfService)qualityOfService NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ *  Walks the directory and its subdirectories and returns once all of them are walked.
+ *
+ *  @warning The blocks are called concurrently from several threads, they must be thread-safe.
+ *
+ *  @param directoryURL The directory to walk.
+ *  @param fileBlock Block called for each file.
+ *  @param failureBlock Block called for each URL which couldn't be inspected.
+ */
+- (void)scanDirectoryAtURL:(NSURL *)directoryURL
+                 fileBlock:(SPTPersistentCacheDirectoryScannerFileBlock)fileBlock
+              failureBlock:(SPTPersistentCacheDirectoryScannerFailureBlock)failureBlock;
+
+@end
+
+NS_ASSUME_NONNULL_END
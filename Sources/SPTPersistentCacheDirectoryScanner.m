@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#import "SPTPersistentCacheDirectoryScanner.h"
+
+@implementation SPTPersistentCacheDirectoryScanner
+
+#pragma mark Object Life Cycle
+
+- (instancetype)initWithFileManager:(NSFileManager *)fileManager
+            maxConcurrentOperations:(NSInteger)maxConcurrentOperations
+                   qualityOfService:(NSQualityOfService)qualityOfService
+{
+    self = [super init];
+    if (self) {
+        _fileManager = fileManager;
+        _maxConcurrentOperations = MAX(maxConcurrentOperations, 1);
+        _qualityOfService = qualityOfService;
+        _skipsHiddenFiles = YES;
+    }
+    return self;
+}
+
+#pragma mark Scanning
+
+- (void)scanDirectoryAtURL:(NSURL *)directoryURL
+                 fileBlock:(SPTPersistentCacheDirectoryScannerFileBlock)fileBlock
+              failureBlock:(SPTPersistentCacheDirectoryScannerFailureBlock)failureBlock
+{
+    NSOperationQueue *queue = [NSOperationQueue new];
+    queue.maxConcurrentOperationCount = self.maxConcurrentOperations;
+    queue.qualityOfService = self.qualityOfService;
+
+    // Top level is walked here, each subdirectory is handed to its own operation
+    NSDirectoryEnumerator *dirEnumerator = [self enumeratorAtURL:directoryURL
+                                                         options:NSDirectoryEnumerationSkipsSubdirectoryDescendants];
+    NSURL *theURL = nil;
+    while ((theURL = [dirEnumerator nextObject])) {
+        NSNumber *isDirectory;
+        if (![theURL getResourceValue:&isDirectory forKey:NSURLIsDirectoryKey error:NULL]) {
+            failureBlock(theURL);
+        } else if ([isDirectory boolValue]) {
+            NSURL *subdirectoryURL = theURL;
+            [queue addOperationWithBlock:^{
+                [self walkDirectoryAtURL:subdirectoryURL fileBlock:fileBlock failureBlock:failureBlock];
+            }];
+        } else {
+            fileBlock(theURL);
+        }
+    }
+
+    [queue waitUntilAllOperationsAreFinished];
+}
+
+- (void)walkDirectoryAtURL:(NSURL *)directoryURL
+                 fileBlock:(SPTPersistentCacheDirectoryScannerFileBlock)fileBlock
+              failureBlock:(SPTPersistentCacheDirectoryScannerFailureBlock)failureBlock
+{
+    NSDirectoryEnumerator *dirEnumerator = [self enumeratorAtURL:directoryURL options:0];
+    NSURL *theURL = nil;
+    while ((theURL = [dirEnumerator nextObject])) {
+        @autoreleasepool {
+            NSNumber *isDirectory;
+            if (![theURL getResourceValue:&isDirectory forKey:NSURLIsDirectoryKey error:NULL]) {
+                failureBlock(theURL);
+            } else if (![isDirectory boolValue]) {
+                fileBlock(theURL);
+            }
+        }
+    }
+}
+
+- (NSDirectoryEnumerator *)enumeratorAtURL:(NSURL *)directoryURL options:(NSDirectoryEnumerationOptions)options
+{
+    if (self.skipsHiddenFiles) {
+        options |= NSDirectoryEnumerationSkipsHiddenFiles;
+    }
+    return [self.fileManager enumeratorAtURL:directoryURL
+                  includingPropertiesForKeys:@[NSURLIsDirectoryKey]
+                                     options:options
+                                errorHandler:nil];
+}
+
+@end
@@ -22,9 +22,9 @@
 
 #import "NSError+SPTPersistentCacheDomainErrors.h"
 
-#include "crc32iso3309.h"
+#include "sptpc.h"
 
-const SPTPersistentCacheMagicType SPTPersistentCacheMagicValue = 0x46545053; // SPTF
+const SPTPersistentCacheMagicType SPTPersistentCacheMagicValue = SPTPC_MAGIC; // SPTF
 const size_t SPTPersistentCacheRecordHeaderSize = sizeof(SPTPersistentCacheRecordHeader);
 
 _Static_assert(sizeof(SPTPersistentCacheRecordHeader) == 64,
@@ -32,12 +32,18 @@ _Static_assert(sizeof(SPTPersistentCacheRecordHeader) == 64,
 _Static_assert(sizeof(SPTPersistentCacheRecordHeader) % 4 == 0,
                "Struct size has to be multiple of 4");
 
-NS_INLINE BOOL SPTPersistentCachePointerMagicAlignCheck(const void *ptr)
-{
-    const unsigned align = _Alignof(SPTPersistentCacheMagicType);
-    uint64_t v = (uint64_t)(ptr);
-    return (v % align == 0);
-}
+// The format is implemented by the portable core, its header must have the same layout
+_Static_assert(sizeof(SPTPersistentCacheRecordHeader) == sizeof(sptpc_header) &&
+               offsetof(SPTPersistentCacheRecordHeader, refCount) == offsetof(sptpc_header, ref_count) &&
+               offsetof(SPTPersistentCacheRecordHeader, ttl) == offsetof(sptpc_header, ttl) &&
+               offsetof(SPTPersistentCacheRecordHeader, payloadSizeBytes) == offsetof(sptpc_header, payload_size_bytes) &&
+               offsetof(SPTPersistentCacheRecordHeader, leaseExpirationSec) == offsetof(sptpc_header, lease_expiration_sec) &&
+               offsetof(SPTPersistentCacheRecordHeader, flags) == offsetof(sptpc_header, flags) &&
+               offsetof(SPTPersistentCacheRecordHeader, crc) == offsetof(sptpc_header, crc),
+               "SPTPersistentCacheRecordHeader has to match sptpc_header");
+_Static_assert((int)SPTPC_ERROR_MAGIC_MISMATCH == (int)SPTPersistentCacheLoadingErrorMagicMismatch &&
+               (int)SPTPC_ERROR_INTERNAL_INCONSISTENCY == (int)SPTPersistentCacheLoadingErrorInternalInconsistency,
+               "Core format errors have to match SPTPersistentCacheLoadingError");
 
 SPTPersistentCacheRecordHeader SPTPersistentCacheRecordHeaderMake(uint64_t ttl,
                                                                   uint64_t payloadSize,
@@ -45,19 +51,10 @@ SPTPersistentCacheRecordHeader SPTPersistentCacheRecordHeaderMake(uint64_t ttl,
                                                                   BOOL isLocked)
 
 {
-    SPTPersistentCacheRecordHeader dummy;
-    memset(&dummy, 0, SPTPersistentCacheRecordHeaderSize);
-    SPTPersistentCacheRecordHeader *header = &dummy;
-    
-    header->magic = SPTPersistentCacheMagicValue;
-    header->headerSize = (uint32_t)SPTPersistentCacheRecordHeaderSize;
-    header->refCount = (isLocked ? 1 : 0);
-    header->ttl = ttl;
-    header->payloadSizeBytes = payloadSize;
-    header->updateTimeSec = updateTime;
-    header->crc = SPTPersistentCacheCalculateHeaderCRC(header);
-    
-    return dummy;
+    const sptpc_header coreHeader = sptpc_header_make(ttl, payloadSize, updateTime, isLocked);
+    SPTPersistentCacheRecordHeader header;
+    memcpy(&header, &coreHeader, SPTPersistentCacheRecordHeaderSize);
+    return header;
 }
 
 SPTPersistentCacheRecordHeader *SPTPersistentCacheGetHeaderFromData(void *data, size_t size)
@@ -71,32 +68,12 @@ SPTPersistentCacheRecordHeader *SPTPersistentCacheGetHeaderFromData(void *data,
 
 int /*SPTPersistentCacheLoadingError*/ SPTPersistentCacheValidateHeader(const SPTPersistentCacheRecordHeader *header)
 {
-    if (header == NULL) {
-        return SPTPersistentCacheLoadingErrorInternalInconsistency;
-    }
-
-    // Check that header could be read according to alignment
-    if (!SPTPersistentCachePointerMagicAlignCheck(header)) {
-        return SPTPersistentCacheLoadingErrorHeaderAlignmentMismatch;
-    }
-
-    // 1. Check magic
-    if (header->magic != SPTPersistentCacheMagicValue) {
-        return SPTPersistentCacheLoadingErrorMagicMismatch;
+    const sptpc_status status = sptpc_header_validate((const sptpc_header *)(const void *)header);
+    if (status == SPTPC_OK) {
+        return -1;
     }
 
-    // 2. Check CRC
-    uint32_t crc = SPTPersistentCacheCalculateHeaderCRC(header);
-    if (crc != header->crc) {
-        return SPTPersistentCacheLoadingErrorInvalidHeaderCRC;
-    }
-
-    // 3. Check header size
-    if (header->headerSize != SPTPersistentCacheRecordHeaderSize) {
-        return SPTPersistentCacheLoadingErrorWrongHeaderSize;
-    }
-
-    return -1;
+    return (int)status;
 }
 
 NSError * SPTPersistentCacheCheckValidHeader(SPTPersistentCacheRecordHeader *header)
@@ -111,11 +88,5 @@ NSError * SPTPersistentCacheCheckValidHeader(SPTPersistentCacheRecordHeader *hea
 
 uint32_t SPTPersistentCacheCalculateHeaderCRC(const SPTPersistentCacheRecordHeader *header)
 {
-    if (header == NULL) {
-        return 0;
-    }
-
-    return spt_crc32((const uint8_t *)header, SPTPersistentCacheRecordHeaderSize - sizeof(header->crc));
+    return sptpc_header_crc((const sptpc_header *)(const void *)header);
 }
-
-
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ *  Keeps track of the most frequently and recently accessed keys of a cache.
+ *  @discussion Every access adds 1 to the score of a key. Scores decay exponentially with the given half-life so keys
+ *  that are no longer accessed fall out of the set. The set of hottest keys can be persisted to a file and read back
+ *  on the next start to warm the cache.
+ */
+@interface SPTPersistentCacheHotSet : NSObject
+
+/**
+ *  The maximum number of keys returned as hottest keys.
+ */
+@property (nonatomic, assign, readonly) NSUInteger capacity;
+
+/**
+ *  Time in seconds after which the score of a key which is not accessed is halved.
+ */
+@property (nonatomic, assign, readonly) NSTimeInterval halfLife;
+
+/**
+ *  Initializes an empty hot set.
+ *
+ *  @param capacity The maximum number of keys returned as hottest keys.
+ *  @param halfLife Time in seconds after which the score of a key which is not accessed is halved.
+ */
+- (instancetype)initWithCapacity:(NSUInteger)capacity halfLife:(NSTimeInterval)halfLife NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ *  Records an access of a key. Safe to call from any thread.
+ *
+ *  @param key The key which was accessed.
+ *  @param time The unix time of the access.
+ */
+- (void)recordAccessForKey:(NSString *)key time:(NSTimeInterval)time;
+
+/**
+ *  Returns up to `capacity` keys with the highest score at the given time, hottest first.
+ *
+ *  @param time The unix time to decay the scores to.
+ */
+- (NSArray<NSString *> *)hottestKeysAtTime:(NSTimeInterval)time;
+
+/**
+ *  Writes the hottest keys at the given time to a file atomically.
+ *
+ *  @param path The path of the file to write.
+ *  @param time The unix time to decay the scores to.
+ *  @return YES if the file was written.
+ */
+- (BOOL)writeHottestKeysToFile:(NSString *)path time:(NSTimeInterval)time;
+
+/**
+ *  Reads keys previously written with `writeHottestKeysToFile:time:`.
+ *
+ *  @param path The path of the file to read.
+ *  @return The keys, hottest first. Empty if the file doesn't exist or is invalid.
+ */
++ (NSArray<NSString *> *)keysFromFile:(NSString *)path;
+
+@end
+
+NS_ASSUME_NONNULL_END
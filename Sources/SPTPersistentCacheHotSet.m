@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#import "SPTPersistentCacheHotSet.h"
+
+// Number of tracked keys per key of capacity before the coldest ones are dropped
+static const NSUInteger SPTPersistentCacheHotSetTrackingFactor = 4;
+
+/**
+ *  Decayed access score of a single key.
+ */
+@interface SPTPersistentCacheHotSetEntry : NSObject
+@property (nonatomic, assign) double score;
+@property (nonatomic, assign) NSTimeInterval lastAccessTime;
+@end
+
+@implementation SPTPersistentCacheHotSetEntry
+@end
+
+
+@interface SPTPersistentCacheHotSet ()
+@property (nonatomic, strong) NSMutableDictionary<NSString *, SPTPersistentCacheHotSetEntry *> *entries;
+@property (nonatomic, strong) NSLock *lock;
+@end
+
+@implementation SPTPersistentCacheHotSet
+
+#pragma mark Object Life Cycle
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity halfLife:(NSTimeInterval)halfLife
+{
+    self = [super init];
+    if (self) {
+        _capacity = capacity;
+        _halfLife = halfLife;
+        _entries = [NSMutableDictionary dictionary];
+        _lock = [NSLock new];
+    }
+    return self;
+}
+
+#pragma mark Tracking
+
+- (double)scoreOfEntry:(SPTPersistentCacheHotSetEntry *)entry atTime:(NSTimeInterval)time
+{
+    const NSTimeInterval age = MAX(time - entry.lastAccessTime, 0.0);
+    return entry.score * exp2(-age / MAX(self.halfLife, 1.0));
+}
+
+- (void)recordAccessForKey:(NSString *)key time:(NSTimeInterval)time
+{
+    if (self.capacity == 0) {
+        return;
+    }
+
+    [self.lock lock];
+
+    SPTPersistentCacheHotSetEntry *entry = self.entries[key];
+    if (entry == nil) {
+        entry = [SPTPersistentCacheHotSetEntry new];
+        self.entries[key] = entry;
+    }
+    entry.score = [self scoreOfEntry:entry atTime:time] + 1.0;
+    entry.lastAccessTime = time;
+
+    if (self.entries.count > self.capacity * SPTPersistentCacheHotSetTrackingFactor) {
+        // Keep the hottest half of the tracked keys
+        NSArray<NSString *> *sortedKeys = [self sortedKeysAtTime:time];
+        NSRange coldRange = NSMakeRange(sortedKeys.count / 2, sortedKeys.count - sortedKeys.count / 2);
+        [self.entries removeObjectsForKeys:[sortedKeys subarrayWithRange:coldRange]];
+    }
+
+    [self.lock unlock];
+}
+
+/**
+ *  Returns all tracked keys, hottest first. Must be called holding the lock.
+ */
+- (NSArray<NSString *> *)sortedKeysAtTime:(NSTimeInterval)time
+{
+    NSMutableDictionary<NSString *, NSNumber *> *scores = [NSMutableDictionary dictionaryWithCapacity:self.entries.count];
+    [self.entries enumerateKeysAndObjectsUsingBlock:^(NSString *key, SPTPersistentCacheHotSetEntry *entry, BOOL *stop) {
+        scores[key] = @([self scoreOfEntry:entry atTime:time]);
+    }];
+
+    return [scores keysSortedByValueUsingComparator:^NSComparisonResult(NSNumber *score1, NSNumber *score2) {
+        return [score2 compare:score1];
+    }];
+}
+
+- (NSArray<NSString *> *)hottestKeysAtTime:(NSTimeInterval)time
+{
+    [self.lock lock];
+    NSArray<NSString *> *sortedKeys = [self sortedKeysAtTime:time];
+    [self.lock unlock];
+
+    if (sortedKeys.count <= self.capacity) {
+        return sortedKeys;
+    }
+    return [sortedKeys subarrayWithRange:NSMakeRange(0, self.capacity)];
+}
+
+#pragma mark Persistence
+
+- (BOOL)writeHottestKeysToFile:(NSString *)path time:(NSTimeInterval)time
+{
+    return [[self hottestKeysAtTime:time] writeToFile:path atomically:YES];
+}
+
++ (NSArray<NSString *> *)keysFromFile:(NSString *)path
+{
+    NSArray *keys = [NSArray arrayWithContentsOfFile:path];
+    NSMutableArray<NSString *> *validKeys = [NSMutableArray arrayWithCapacity:keys.count];
+    for (id key in keys) {
+        if ([key isKindOfClass:[NSString class]]) {
+            [validKeys addObject:key];
+        }
+    }
+    return [validKeys copy];
+}
+
+@end
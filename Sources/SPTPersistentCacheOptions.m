@@ -51,10 +51,15 @@ static NSUInteger SPTGuardedPropertyValue(NSUInteger proposedValue, NSUInteger m
         _cachePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"/com.spotify.temppersistent.image.cache"];
         _cacheIdentifier = @"persistent.cache";
         _useDirectorySeparation = YES;
+        _callbackBatchInterval = 0.005;
 
         _garbageCollectionInterval = SPTPersistentCacheDefaultGCIntervalSec;
         _defaultExpirationPeriod = SPTPersistentCacheDefaultExpirationTimeSec;
         _sizeConstraintBytes = SPTPersistentCacheDefaultCacheSizeInBytes;
+        _earlyExpirationRecomputeTime = 1.0;
+        _scanMaxConcurrentOperations = 4;
+        _headerReadQueueDepth = 8;
+        _recoveryMaxConcurrentOperations = 2;
         _maxConcurrentOperations = NSOperationQueueDefaultMaxConcurrentOperationCount;
         _writePriority = NSOperationQueuePriorityNormal;
         _writeQualityOfService = NSQualityOfServiceDefault;
@@ -62,6 +67,8 @@ static NSUInteger SPTGuardedPropertyValue(NSUInteger proposedValue, NSUInteger m
         _readQualityOfService = NSQualityOfServiceDefault;
         _deletePriority = NSOperationQueuePriorityNormal;
         _deleteQualityOfService = NSQualityOfServiceDefault;
+        _prefetchPriority = NSOperationQueuePriorityVeryLow;
+        _prefetchQualityOfService = NSQualityOfServiceUtility;
         _garbageCollectionPriority = NSOperationQueuePriorityLow;
         _garbageCollectionQualityOfService = NSQualityOfServiceBackground;
     }
@@ -113,10 +120,30 @@ static NSUInteger SPTGuardedPropertyValue(NSUInteger proposedValue, NSUInteger m
     copy.cacheIdentifier = self.cacheIdentifier;
     copy.cachePath = self.cachePath;
     copy.useDirectorySeparation = self.useDirectorySeparation;
+    copy.readOnly = self.readOnly;
+    copy.processSharedLocking = self.processSharedLocking;
+    copy.callbackDelivery = self.callbackDelivery;
+    copy.callbackBatchInterval = self.callbackBatchInterval;
+    copy.adaptiveConcurrency = self.adaptiveConcurrency;
 
     copy.garbageCollectionInterval = self.garbageCollectionInterval;
     copy.defaultExpirationPeriod = self.defaultExpirationPeriod;
     copy.sizeConstraintBytes = self.sizeConstraintBytes;
+    copy.staleWhileRevalidatePeriod = self.staleWhileRevalidatePeriod;
+    copy.earlyExpirationBeta = self.earlyExpirationBeta;
+    copy.earlyExpirationRecomputeTime = self.earlyExpirationRecomputeTime;
+    copy.expirationJitterFactor = self.expirationJitterFactor;
+    copy.lockLeaseDuration = self.lockLeaseDuration;
+
+    copy.prefetchPriority = self.prefetchPriority;
+    copy.prefetchQualityOfService = self.prefetchQualityOfService;
+    copy.scanMaxConcurrentOperations = self.scanMaxConcurrentOperations;
+    copy.headerReadQueueDepth = self.headerReadQueueDepth;
+    copy.useMetadataTable = self.useMetadataTable;
+    copy.recoverOnStart = self.recoverOnStart;
+    copy.recoveryMaxConcurrentOperations = self.recoveryMaxConcurrentOperations;
+    copy.hotSetSize = self.hotSetSize;
+    copy.writeBufferSize = self.writeBufferSize;
 
     copy.debugOutput = self.debugOutput;
     copy.timingCallback = self.timingCallback;
@@ -138,9 +165,22 @@ static NSUInteger SPTGuardedPropertyValue(NSUInteger proposedValue, NSUInteger m
                                                self.cachePath, @"cache-path",
                                                self.identifierForQueue, @"identifier-for-queue",
                                                @(self.useDirectorySeparation), @"use-directory-separation",
+                                               @(self.readOnly), @"read-only",
+                                               @(self.processSharedLocking), @"process-shared-locking",
+                                               @(self.callbackDelivery), @"callback-delivery",
+                                               @(self.callbackBatchInterval), @"callback-batch-interval",
+                                               @(self.adaptiveConcurrency), @"adaptive-concurrency",
                                                @(self.garbageCollectionInterval), @"garbage-collection-interval",
                                                @(self.defaultExpirationPeriod), @"default-expiration-period",
-                                               @(self.sizeConstraintBytes), @"size-constraint-bytes");
+                                               @(self.staleWhileRevalidatePeriod), @"stale-while-revalidate-period",
+                                               @(self.earlyExpirationBeta), @"early-expiration-beta",
+                                               @(self.expirationJitterFactor), @"expiration-jitter-factor",
+                                               @(self.lockLeaseDuration), @"lock-lease-duration",
+                                               @(self.sizeConstraintBytes), @"size-constraint-bytes",
+                                               @(self.headerReadQueueDepth), @"header-read-queue-depth",
+                                               @(self.useMetadataTable), @"use-metadata-table",
+                                               @(self.hotSetSize), @"hot-set-size",
+                                               @(self.writeBufferSize), @"write-buffer-size");
 }
 
 @end
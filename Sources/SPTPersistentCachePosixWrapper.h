@@ -53,11 +53,85 @@
  * @param bufferSize The size of the memory to write into the file.
  */
 - (ssize_t)write:(int)descriptor buffer:(const void *)buffer bufferSize:(size_t)bufferSize;
+/**
+ * See POSIX "pwrite"
+ * @param descriptor The file descriptor to write to.
+ * @param buffer The memory to write into the file.
+ * @param bufferSize The size of the memory to write into the file.
+ * @param offset The position in the file to write at.
+ */
+- (ssize_t)pwrite:(int)descriptor buffer:(const void *)buffer bufferSize:(size_t)bufferSize offset:(off_t)offset;
+/**
+ * See POSIX "pread"
+ * @param descriptor The file descriptor to read.
+ * @param buffer The memory to read into.
+ * @param bufferSize The amount of the file to read into memory.
+ * @param offset The position in the file to read at.
+ */
+- (ssize_t)pread:(int)descriptor buffer:(void *)buffer bufferSize:(size_t)bufferSize offset:(off_t)offset;
+/**
+ * Copies a range of a file to another descriptor within the kernel. Uses "sendfile" of the platform, which on Darwin
+ * only writes to sockets.
+ * @param descriptor The file descriptor of the file to copy from.
+ * @param outDescriptor The file descriptor to copy to, written at its current position.
+ * @param offset The beginning of the range to copy.
+ * @param length The length of the range to copy.
+ * @return Number of bytes copied, which may be less than length, otherwise -1 with errno set.
+ */
+- (ssize_t)sendFile:(int)descriptor toDescriptor:(int)outDescriptor offset:(off_t)offset length:(size_t)length;
+/**
+ * See POSIX "ftruncate"
+ * @param descriptor The file descriptor of the file to truncate.
+ * @param length The length to truncate the file to.
+ */
+- (int)ftruncate:(int)descriptor length:(off_t)length;
 /**
  * See POSIX "fsync"
  * @param descriptor The file descriptor to synchronise.
  */
 - (int)fsync:(int)descriptor;
+/**
+ * Synchronises the data of a file without the metadata which isn't needed to read it back, see POSIX "fdatasync".
+ * Uses "fsync" where the system has no synchronized I/O.
+ * @param descriptor The file descriptor to synchronise.
+ */
+- (int)dataSync:(int)descriptor;
+/**
+ * Flushes the data already handed to the drive holding the file out of the drive cache, see Darwin fcntl "F_FULLFSYNC".
+ * @param descriptor A file descriptor of any file or directory on the drive.
+ * @return 0 on success, otherwise -1 with errno set. errno is ENOTSUP where the system can't do it.
+ */
+- (int)fullSync:(int)descriptor;
+/**
+ * Advises the system that a range of the file will be read soon. Uses fcntl "F_RDADVISE" where available, otherwise
+ * POSIX "posix_fadvise" with "POSIX_FADV_WILLNEED".
+ * @param descriptor The file descriptor of the file to be read.
+ * @param offset The beginning of the range to be read.
+ * @param length The length of the range to be read.
+ * @return 0 on success, otherwise -1 with errno set.
+ */
+- (int)adviseWillNeed:(int)descriptor offset:(off_t)offset length:(off_t)length;
+/**
+ * Waits for and takes an advisory record lock. Uses an open file description lock, see Linux fcntl "F_OFD_SETLKW",
+ * where available, which is released when the descriptor is closed. Otherwise a POSIX lock, see fcntl "F_SETLKW",
+ * which is released when any descriptor of the file is closed by the process. Both kinds exclude each other.
+ * @param descriptor The file descriptor of the file to lock.
+ * @param type The lock type, "F_RDLCK", "F_WRLCK" or "F_UNLCK".
+ * @param offset The beginning of the range to lock.
+ * @param length The length of the range to lock.
+ */
+- (int)lockRange:(int)descriptor type:(short)type offset:(off_t)offset length:(off_t)length;
+/**
+ * Whether lockRange:type:offset:length: takes open file description locks, only released by closing the descriptor
+ * which was locked.
+ */
+@property (nonatomic, assign, readonly) BOOL locksOpenFileDescriptions;
+/**
+ * See POSIX "fstat"
+ * @param descriptor The file descriptor of the file to get the stats for.
+ * @param statStruct The structure to store the file stats in.
+ */
+- (int)fstat:(int)descriptor statStruct:(struct stat *)statStruct;
 /**
  * See POSIX "stat"
  * @param path The path to file to get the stats for.
@@ -20,6 +20,14 @@
  */
 #import "SPTPersistentCachePosixWrapper.h"
 
+#include <fcntl.h>
+#if defined(__APPLE__)
+#include <sys/socket.h>
+#include <sys/uio.h>
+#else
+#include <sys/sendfile.h>
+#endif
+
 @implementation SPTPersistentCachePosixWrapper
 
 - (int)close:(int)descriptor
@@ -42,11 +50,110 @@
     return write(descriptor, buffer, bufferSize);
 }
 
+- (ssize_t)pwrite:(int)descriptor buffer:(const void *)buffer bufferSize:(size_t)bufferSize offset:(off_t)offset
+{
+    return pwrite(descriptor, buffer, bufferSize, offset);
+}
+
+- (ssize_t)pread:(int)descriptor buffer:(void *)buffer bufferSize:(size_t)bufferSize offset:(off_t)offset
+{
+    return pread(descriptor, buffer, bufferSize, offset);
+}
+
+- (ssize_t)sendFile:(int)descriptor toDescriptor:(int)outDescriptor offset:(off_t)offset length:(size_t)length
+{
+#if defined(__APPLE__)
+    off_t sentBytes = (off_t)length;
+    if (sendfile(descriptor, outDescriptor, offset, &sentBytes, NULL, 0) == -1 && sentBytes == 0) {
+        return -1;
+    }
+    return (ssize_t)sentBytes;
+#else
+    return sendfile(outDescriptor, descriptor, &offset, length);
+#endif
+}
+
+- (int)ftruncate:(int)descriptor length:(off_t)length
+{
+    return ftruncate(descriptor, length);
+}
+
 - (int)fsync:(int)descriptor
 {
     return fsync(descriptor);
 }
 
+- (int)dataSync:(int)descriptor
+{
+#if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+    return fdatasync(descriptor);
+#else
+    return fsync(descriptor);
+#endif
+}
+
+- (int)fullSync:(int)descriptor
+{
+#if defined(F_FULLFSYNC)
+    return fcntl(descriptor, F_FULLFSYNC);
+#else
+    (void)descriptor;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+- (int)adviseWillNeed:(int)descriptor offset:(off_t)offset length:(off_t)length
+{
+#if defined(F_RDADVISE)
+    struct radvisory advisory = {
+        .ra_offset = offset,
+        .ra_count = (int)MIN(length, (off_t)INT_MAX),
+    };
+    return fcntl(descriptor, F_RDADVISE, &advisory);
+#else
+    const int result = posix_fadvise(descriptor, offset, length, POSIX_FADV_WILLNEED);
+    if (result != 0) {
+        errno = result;
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+- (int)lockRange:(int)descriptor type:(short)type offset:(off_t)offset length:(off_t)length
+{
+    struct flock lock = {
+        .l_start = offset,
+        .l_len = length,
+        .l_type = type,
+        .l_whence = SEEK_SET,
+    };
+    int result;
+    do {
+#if defined(F_OFD_SETLKW)
+        result = fcntl(descriptor, F_OFD_SETLKW, &lock);
+#else
+        result = fcntl(descriptor, F_SETLKW, &lock);
+#endif
+    } while (result == -1 && errno == EINTR);
+    return result;
+}
+
+- (BOOL)locksOpenFileDescriptions
+{
+#if defined(F_OFD_SETLKW)
+    return YES;
+#else
+    return NO;
+#endif
+}
+
+- (int)fstat:(int)descriptor statStruct:(struct stat *)statStruct
+{
+    return fstat(descriptor, statStruct);
+}
+
 - (int)stat:(const char *)path statStruct:(struct stat *)statStruct
 {
     return stat(path, statStruct);
@@ -27,4 +27,10 @@
                     refCount:(NSUInteger)refCount
                          ttl:(NSUInteger)ttl;
 
+- (instancetype)initWithData:(NSData *)data
+                         key:(NSString *)key
+                    refCount:(NSUInteger)refCount
+                         ttl:(NSUInteger)ttl
+                     version:(NSUInteger)version;
+
 @end
@@ -29,11 +29,21 @@
                          key:(NSString *)key
                     refCount:(NSUInteger)refCount
                          ttl:(NSUInteger)ttl
+{
+    return [self initWithData:data key:key refCount:refCount ttl:ttl version:0];
+}
+
+- (instancetype)initWithData:(NSData *)data
+                         key:(NSString *)key
+                    refCount:(NSUInteger)refCount
+                         ttl:(NSUInteger)ttl
+                     version:(NSUInteger)version
 {
     self = [super init];
     if (self) {
         _refCount = refCount;
         _ttl = ttl;
+        _version = version;
         _key = [key copy];
         _data = data;
     }
@@ -49,7 +59,11 @@
 
 - (NSString *)debugDescription
 {
-    return SPTPersistentCacheObjectDescription(self, self.key, @"key", @(self.ttl), @"ttl", @(self.refCount), @"ref-count");
+    return SPTPersistentCacheObjectDescription(self,
+                                               self.key, @"key",
+                                               @(self.ttl), @"ttl",
+                                               @(self.refCount), @"ref-count",
+                                               @(self.version), @"version");
 }
 
 @end
@@ -28,4 +28,15 @@ extern NSString *NSStringFromSPTPersistentCacheResponseCode(SPTPersistentCacheRe
                          error:(NSError *)error
                         record:(SPTPersistentCacheRecord *)record;
 
+- (instancetype)initWithResult:(SPTPersistentCacheResponseCode)result
+                         error:(NSError *)error
+                        record:(SPTPersistentCacheRecord *)record
+                         stale:(BOOL)stale;
+
+- (instancetype)initWithResult:(SPTPersistentCacheResponseCode)result
+                         error:(NSError *)error
+                        record:(SPTPersistentCacheRecord *)record
+                         stale:(BOOL)stale
+            refreshRecommended:(BOOL)refreshRecommended;
+
 @end
@@ -28,6 +28,8 @@
 @property (nonatomic, assign, readwrite) SPTPersistentCacheResponseCode result;
 @property (nonatomic, strong, readwrite) NSError *error;
 @property (nonatomic, strong, readwrite) SPTPersistentCacheRecord *record;
+@property (nonatomic, assign, readwrite, getter = isStale) BOOL stale;
+@property (nonatomic, assign, readwrite, getter = isRefreshRecommended) BOOL refreshRecommended;
 
 @end
 
@@ -36,12 +38,31 @@
 - (instancetype)initWithResult:(SPTPersistentCacheResponseCode)result
                          error:(NSError *)error
                         record:(SPTPersistentCacheRecord *)record
+{
+    return [self initWithResult:result error:error record:record stale:NO];
+}
+
+- (instancetype)initWithResult:(SPTPersistentCacheResponseCode)result
+                         error:(NSError *)error
+                        record:(SPTPersistentCacheRecord *)record
+                         stale:(BOOL)stale
+{
+    return [self initWithResult:result error:error record:record stale:stale refreshRecommended:stale];
+}
+
+- (instancetype)initWithResult:(SPTPersistentCacheResponseCode)result
+                         error:(NSError *)error
+                        record:(SPTPersistentCacheRecord *)record
+                         stale:(BOOL)stale
+            refreshRecommended:(BOOL)refreshRecommended
 {
     self = [super init];
     if (self) {
         _result = result;
         _error = error;
         _record = record;
+        _stale = stale;
+        _refreshRecommended = stale || refreshRecommended;
     }
     return self;
 }
@@ -67,6 +88,8 @@ NSString *NSStringFromSPTPersistentCacheResponseCode(SPTPersistentCacheResponseC
     return SPTPersistentCacheObjectDescription(self,
                                                NSStringFromSPTPersistentCacheResponseCode(self.result), @"result",
                                                self.record.debugDescription, @"record",
+                                               @(self.stale), @"stale",
+                                               @(self.refreshRecommended), @"refresh-recommended",
                                                self.error.debugDescription, @"error");
 }
 
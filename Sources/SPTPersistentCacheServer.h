@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#import <Foundation/Foundation.h>
+
+@class SPTPersistentCache;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ *  Serves load, store, lock and unlock requests of local processes for one cache over a Unix-domain socket.
+ *  @discussion Running the cache in a single daemon process gives all clients one garbage collector and one view of
+ *  the records. Clients connect with SPTPersistentCacheClient. Payloads are passed as file descriptors: loads hand out
+ *  the record file itself, so neither side copies the payload through the socket. Each connection is served on its own
+ *  serial queue.
+ */
+@interface SPTPersistentCacheServer : NSObject
+
+/**
+ *  The cache requests are served from.
+ */
+@property (nonatomic, strong, readonly) SPTPersistentCache *cache;
+/**
+ *  Path of the socket clients connect to.
+ */
+@property (nonatomic, copy, readonly) NSString *socketPath;
+
+/**
+ *  Initializes a server.
+ *
+ *  @param cache The cache to serve requests from.
+ *  @param socketPath Path of the socket. A file left at the path by a previous server is replaced on start.
+ */
+- (instancetype)initWithCache:(SPTPersistentCache *)cache socketPath:(NSString *)socketPath NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ *  Binds the socket and starts accepting clients.
+ *
+ *  @param error Set if the socket can't be bound.
+ *  @return YES if the server is running.
+ */
+- (BOOL)startWithError:(NSError * _Nullable *)error;
+
+/**
+ *  Stops accepting clients, drops connected ones and removes the socket.
+ */
+- (void)stop;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#import "SPTPersistentCacheServer.h"
+#import "SPTPersistentCacheSocketProtocol.h"
+#import "SPTPersistentCacheResponse+Private.h"
+#import "SPTPersistentCache+Private.h"
+#import <SPTPersistentCache/SPTPersistentCache.h>
+#import <SPTPersistentCache/SPTPersistentCacheHeader.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Keys longer than this are rejected instead of being read
+static const uint32_t SPTPersistentCacheServerMaxKeyLength = 4096;
+static const int SPTPersistentCacheServerListenBacklog = 16;
+
+/**
+ *  A connected client, served on its own serial queue.
+ */
+@interface SPTPersistentCacheServerConnection : NSObject
+@property (nonatomic, assign) int socket;
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, strong) dispatch_source_t readSource;
+@end
+
+@implementation SPTPersistentCacheServerConnection
+@end
+
+
+@interface SPTPersistentCacheServer ()
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, strong) dispatch_source_t listenSource;
+@property (nonatomic, strong) NSMutableSet<SPTPersistentCacheServerConnection *> *connections;
+@property (nonatomic, strong) NSLock *lock;
+@end
+
+@implementation SPTPersistentCacheServer
+
+#pragma mark Object Life Cycle
+
+- (instancetype)initWithCache:(SPTPersistentCache *)cache socketPath:(NSString *)socketPath
+{
+    self = [super init];
+    if (self) {
+        _cache = cache;
+        _socketPath = [socketPath copy];
+        _queue = dispatch_queue_create("com.spotify.persistentcache.server", DISPATCH_QUEUE_SERIAL);
+        _connections = [NSMutableSet set];
+        _lock = [NSLock new];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [self stop];
+}
+
+#pragma mark Listening
+
+- (BOOL)startWithError:(NSError * _Nullable *)error
+{
+    struct sockaddr_un address;
+    if (!SPTPersistentCacheSocketMakeAddress(self.socketPath, &address, sizeof(address))) {
+        if (error) {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENAMETOOLONG userInfo:nil];
+        }
+        return NO;
+    }
+
+    const int listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenSocket == -1) {
+        if (error) {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+        }
+        return NO;
+    }
+
+    unlink(self.socketPath.fileSystemRepresentation);
+    if (bind(listenSocket, (const struct sockaddr *)&address, sizeof(address)) == -1 ||
+        listen(listenSocket, SPTPersistentCacheServerListenBacklog) == -1) {
+        const int errorNumber = errno;
+        close(listenSocket);
+        if (error) {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errorNumber userInfo:nil];
+        }
+        return NO;
+    }
+
+    dispatch_source_t listenSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, (uintptr_t)listenSocket, 0, self.queue);
+    __weak __typeof(self) weakSelf = self;
+    dispatch_source_set_event_handler(listenSource, ^{
+        [weakSelf acceptConnectionOnSocket:listenSocket];
+    });
+    dispatch_source_set_cancel_handler(listenSource, ^{
+        close(listenSocket);
+    });
+
+    [self.lock lock];
+    self.listenSource = listenSource;
+    [self.lock unlock];
+    dispatch_resume(listenSource);
+    return YES;
+}
+
+- (void)stop
+{
+    [self.lock lock];
+    dispatch_source_t listenSource = self.listenSource;
+    NSSet<SPTPersistentCacheServerConnection *> *connections = [self.connections copy];
+    self.listenSource = nil;
+    [self.connections removeAllObjects];
+    [self.lock unlock];
+
+    if (listenSource == nil) {
+        return;
+    }
+
+    dispatch_source_cancel(listenSource);
+    unlink(self.socketPath.fileSystemRepresentation);
+
+    for (SPTPersistentCacheServerConnection *connection in connections) {
+        dispatch_source_cancel(connection.readSource);
+    }
+}
+
+- (void)acceptConnectionOnSocket:(int)listenSocket
+{
+    const int clientSocket = accept(listenSocket, NULL, NULL);
+    if (clientSocket == -1) {
+        return;
+    }
+    SPTPersistentCacheSocketDisableSigPipe(clientSocket);
+
+    SPTPersistentCacheServerConnection *connection = [SPTPersistentCacheServerConnection new];
+    connection.socket = clientSocket;
+    connection.queue = dispatch_queue_create("com.spotify.persistentcache.server.connection", DISPATCH_QUEUE_SERIAL);
+    connection.readSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, (uintptr_t)clientSocket, 0, connection.queue);
+
+    __weak __typeof(self) weakSelf = self;
+    __weak SPTPersistentCacheServerConnection *weakConnection = connection;
+    dispatch_source_set_event_handler(connection.readSource, ^{
+        SPTPersistentCacheServerConnection *strongConnection = weakConnection;
+        if (strongConnection != nil) {
+            [weakSelf serveRequestOfConnection:strongConnection];
+        }
+    });
+    dispatch_source_set_cancel_handler(connection.readSource, ^{
+        close(clientSocket);
+    });
+
+    [self.lock lock];
+    [self.connections addObject:connection];
+    [self.lock unlock];
+    dispatch_resume(connection.readSource);
+}
+
+- (void)dropConnection:(SPTPersistentCacheServerConnection *)connection
+{
+    dispatch_source_cancel(connection.readSource);
+    [self.lock lock];
+    [self.connections removeObject:connection];
+    [self.lock unlock];
+}
+
+#pragma mark Serving
+
+/**
+ * Reads one request and starts serving it. Reading is suspended until the reply is sent, clients wait for a reply
+ * before sending the next request anyway.
+ */
+- (void)serveRequestOfConnection:(SPTPersistentCacheServerConnection *)connection
+{
+    SPTPersistentCacheSocketRequest request;
+    int payloadFileDescriptor = -1;
+    if (!SPTPersistentCacheSocketReceive(connection.socket, &request, sizeof(request), &payloadFileDescriptor)) {
+        [self dropConnection:connection];
+        return;
+    }
+
+    NSMutableData *keyData = [NSMutableData dataWithLength:MIN(request.keyLength, SPTPersistentCacheServerMaxKeyLength)];
+    if (request.magic != SPTPersistentCacheSocketMagic ||
+        request.keyLength == 0 || request.keyLength > SPTPersistentCacheServerMaxKeyLength ||
+        !SPTPersistentCacheSocketReadFully(connection.socket, keyData.mutableBytes, keyData.length)) {
+        if (payloadFileDescriptor != -1) {
+            close(payloadFileDescriptor);
+        }
+        [self dropConnection:connection];
+        return;
+    }
+
+    NSString *key = [[NSString alloc] initWithData:keyData encoding:NSUTF8StringEncoding];
+    dispatch_source_t readSource = connection.readSource;
+    dispatch_suspend(readSource);
+
+    SPTPersistentCacheResponseCallback callback = ^(SPTPersistentCacheResponse *response) {
+        [self replyToConnection:connection withResponse:response];
+        dispatch_resume(readSource);
+    };
+
+    // Keys become file names, ones which aren't UTF-8 or could name files outside the cache folder are refused
+    if (![SPTPersistentCache isValidRecordKey:key]) {
+        if (payloadFileDescriptor != -1) {
+            close(payloadFileDescriptor);
+        }
+        callback([self errorResponseWithError:[NSError errorWithDomain:NSPOSIXErrorDomain code:EINVAL userInfo:nil]]);
+        return;
+    }
+
+    // The cache doesn't call back when it refuses to start an operation, the reply is sent here then
+    BOOL started = NO;
+    switch (request.operation) {
+        case SPTPersistentCacheSocketOperationLoad:
+            started = [self.cache loadDataForKey:key withCallback:callback onQueue:connection.queue];
+            break;
+        case SPTPersistentCacheSocketOperationStore: {
+            // Copied rather than mapped, the client could truncate its file while the store is in flight
+            NSData *payload = (payloadFileDescriptor != -1 ?
+                               SPTPersistentCacheSocketReadFile(payloadFileDescriptor, request.payloadOffset, request.payloadLength) :
+                               nil);
+            if (payload != nil) {
+                started = [self.cache storeData:payload
+                                         forKey:key
+                                            ttl:(NSUInteger)request.ttl
+                                         locked:(request.locked != 0)
+                                   withCallback:callback
+                                        onQueue:connection.queue];
+            }
+            break;
+        }
+        case SPTPersistentCacheSocketOperationLock:
+            started = [self.cache lockDataForKeys:@[key] callback:callback onQueue:connection.queue];
+            break;
+        case SPTPersistentCacheSocketOperationUnlock:
+            started = [self.cache unlockDataForKeys:@[key] callback:callback onQueue:connection.queue];
+            break;
+        default:
+            break;
+    }
+
+    if (payloadFileDescriptor != -1) {
+        close(payloadFileDescriptor);
+    }
+    if (!started) {
+        callback([self errorResponseWithCode:SPTPersistentCacheLoadingErrorInternalInconsistency]);
+    }
+}
+
+- (SPTPersistentCacheResponse *)errorResponseWithCode:(SPTPersistentCacheLoadingError)code
+{
+    return [self errorResponseWithError:[NSError errorWithDomain:SPTPersistentCacheErrorDomain code:code userInfo:nil]];
+}
+
+- (SPTPersistentCacheResponse *)errorResponseWithError:(NSError *)error
+{
+    return [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseCodeOperationError
+                                                        error:error
+                                                       record:nil];
+}
+
+- (void)replyToConnection:(SPTPersistentCacheServerConnection *)connection
+             withResponse:(SPTPersistentCacheResponse *)response
+{
+    SPTPersistentCacheSocketReply reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.magic = SPTPersistentCacheSocketMagic;
+    reply.result = (int32_t)response.result;
+    reply.stale = response.isStale ? 1 : 0;
+    reply.refreshRecommended = response.refreshRecommended ? 1 : 0;
+
+    NSError *error = response.error;
+    if (error != nil) {
+        reply.errorCode = error.code;
+        if ([error.domain isEqualToString:SPTPersistentCacheErrorDomain]) {
+            reply.errorDomain = SPTPersistentCacheSocketErrorDomainCache;
+        } else if ([error.domain isEqualToString:NSPOSIXErrorDomain]) {
+            reply.errorDomain = SPTPersistentCacheSocketErrorDomainPOSIX;
+        } else {
+            reply.errorDomain = SPTPersistentCacheSocketErrorDomainCocoa;
+        }
+    }
+
+    int payloadFileDescriptor = -1;
+    SPTPersistentCacheRecord *record = response.record;
+    if (record != nil) {
+        reply.refCount = (uint32_t)record.refCount;
+        reply.ttl = record.ttl;
+        reply.version = (uint32_t)record.version;
+        reply.payloadLength = record.data.length;
+        payloadFileDescriptor = [self openPayloadOfRecord:record payloadOffset:&reply.payloadOffset];
+    }
+
+    if (!SPTPersistentCacheSocketSend(connection.socket, &reply, sizeof(reply), nil, payloadFileDescriptor)) {
+        [self dropConnection:connection];
+    }
+
+    if (payloadFileDescriptor != -1 && reply.payloadOffset != 0) {
+        [self.cache closeRecordFile:payloadFileDescriptor forKey:record.key];
+    } else if (payloadFileDescriptor != -1) {
+        close(payloadFileDescriptor);
+    }
+}
+
+/**
+ * Opens the file to pass with a loaded record. That is the record file itself while it still holds the loaded version,
+ * otherwise an anonymous file holding a copy of the payload. The record file is opened and closed by the cache under
+ * the key lock, like its own sends.
+ */
+- (int)openPayloadOfRecord:(SPTPersistentCacheRecord *)record payloadOffset:(uint64_t *)payloadOffset
+{
+    const int fd = [self.cache openRecordFileForKey:record.key response:NULL];
+    if (fd != -1) {
+        SPTPersistentCacheRecordHeader header;
+        struct stat fileStat;
+        if (pread(fd, &header, SPTPersistentCacheRecordHeaderSize, 0) == (ssize_t)SPTPersistentCacheRecordHeaderSize &&
+            SPTPersistentCacheCheckValidHeader(&header) == nil &&
+            header.version == record.version &&
+            header.payloadSizeBytes == record.data.length &&
+            fstat(fd, &fileStat) == 0 &&
+            (uint64_t)fileStat.st_size >= SPTPersistentCacheRecordHeaderSize + header.payloadSizeBytes) {
+            *payloadOffset = SPTPersistentCacheRecordHeaderSize;
+            return fd;
+        }
+        [self.cache closeRecordFile:fd forKey:record.key];
+    }
+
+    *payloadOffset = 0;
+    return SPTPersistentCacheSocketCreateAnonymousFile(record.data);
+}
+
+@end
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ *  Snapshot archive layout, all integers are little endian:
+ *  | magic "SPTPCSNP" | format version uint32 | reserved uint32 |
+ *  | per record: key length uint32 | key UTF-8 bytes | record length uint64 | record file bytes (header + payload) |
+ *  | index: offset of each record entry uint64 |
+ *  | trailer: index offset uint64 | record count uint64 | magic "SPTPCSNP" |
+ *  Records can be streamed front to back, the trailing index allows to validate the archive without reading it whole.
+ */
+FOUNDATION_EXPORT const uint32_t SPTPersistentCacheSnapshotFormatVersion;
+
+/**
+ *  Writes a snapshot archive sequentially through a large buffer. The archive appears at its path only once finished.
+ *  @warning Not thread-safe.
+ */
+@interface SPTPersistentCacheSnapshotWriter : NSObject
+
+/**
+ *  Number of records appended so far.
+ */
+@property (nonatomic, assign, readonly) NSUInteger recordCount;
+
+/**
+ *  Creates a writer for an archive at the given path.
+ *
+ *  @param path Path of the archive. Replaced by the new archive when it is finished.
+ *  @param error Set if the archive can't be created.
+ */
+- (nullable instancetype)initWithPath:(NSString *)path error:(NSError * _Nullable *)error NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ *  Appends a record.
+ *
+ *  @param record Record file bytes, header included.
+ *  @param key Key of the record.
+ *  @param error Set if the record can't be written.
+ *  @return YES if the record was appended.
+ */
+- (BOOL)appendRecord:(NSData *)record forKey:(NSString *)key error:(NSError * _Nullable *)error;
+
+/**
+ *  Writes the index and the trailer and moves the archive to its path.
+ *
+ *  @param error Set if the archive can't be finished.
+ *  @return YES if the archive was finished.
+ */
+- (BOOL)finishWithError:(NSError * _Nullable *)error;
+
+@end
+
+/**
+ *  Reads a snapshot archive. The archive is memory mapped and fully validated on creation.
+ */
+@interface SPTPersistentCacheSnapshotReader : NSObject
+
+/**
+ *  Number of records in the archive.
+ */
+@property (nonatomic, assign, readonly) NSUInteger recordCount;
+
+/**
+ *  Opens the archive at the given path.
+ *
+ *  @param path Path of the archive.
+ *  @param error Set if the archive can't be read or is malformed.
+ */
+- (nullable instancetype)initWithPath:(NSString *)path error:(NSError * _Nullable *)error NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ *  Calls the block for every record in archive order.
+ *
+ *  @param block Block receiving key and record file bytes, header included. Set stop to YES to stop enumerating.
+ */
+- (void)enumerateRecordsUsingBlock:(void (^)(NSString *key, NSData *record, BOOL *stop))block;
+
+@end
+
+NS_ASSUME_NONNULL_END
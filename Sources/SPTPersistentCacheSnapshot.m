@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#import "SPTPersistentCacheSnapshot.h"
+#import "NSError+SPTPersistentCacheDomainErrors.h"
+#import <SPTPersistentCache/SPTPersistentCache.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+const uint32_t SPTPersistentCacheSnapshotFormatVersion = 1;
+
+static const char SPTPersistentCacheSnapshotMagic[8] = { 'S', 'P', 'T', 'P', 'C', 'S', 'N', 'P' };
+static const NSUInteger SPTPersistentCacheSnapshotPreambleSize = sizeof(SPTPersistentCacheSnapshotMagic) + 2 * sizeof(uint32_t);
+static const NSUInteger SPTPersistentCacheSnapshotTrailerSize = 2 * sizeof(uint64_t) + sizeof(SPTPersistentCacheSnapshotMagic);
+// Records are gathered in memory and written in chunks of this size
+static const NSUInteger SPTPersistentCacheSnapshotWriteBufferSize = 1024 * 1024;
+
+static NSError *SPTPersistentCacheSnapshotPosixError(void)
+{
+    const int errorNumber = errno;
+    return [NSError errorWithDomain:NSPOSIXErrorDomain
+                               code:errorNumber
+                           userInfo:@{ NSLocalizedDescriptionKey: @(strerror(errorNumber)) }];
+}
+
+static void SPTPersistentCacheSnapshotAppendUInt32(NSMutableData *data, uint32_t value)
+{
+    uint32_t littleEndian = CFSwapInt32HostToLittle(value);
+    [data appendBytes:&littleEndian length:sizeof(littleEndian)];
+}
+
+static void SPTPersistentCacheSnapshotAppendUInt64(NSMutableData *data, uint64_t value)
+{
+    uint64_t littleEndian = CFSwapInt64HostToLittle(value);
+    [data appendBytes:&littleEndian length:sizeof(littleEndian)];
+}
+
+static uint32_t SPTPersistentCacheSnapshotReadUInt32(const uint8_t *bytes)
+{
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return CFSwapInt32LittleToHost(value);
+}
+
+static uint64_t SPTPersistentCacheSnapshotReadUInt64(const uint8_t *bytes)
+{
+    uint64_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return CFSwapInt64LittleToHost(value);
+}
+
+
+#pragma mark - SPTPersistentCacheSnapshotWriter
+
+@interface SPTPersistentCacheSnapshotWriter ()
+@property (nonatomic, copy) NSString *path;
+@property (nonatomic, copy) NSString *temporaryPath;
+@property (nonatomic, assign) int filedes;
+@property (nonatomic, strong) NSMutableData *buffer;
+@property (nonatomic, strong) NSMutableData *index;
+@property (nonatomic, assign) uint64_t offset;
+@property (nonatomic, assign, readwrite) NSUInteger recordCount;
+@end
+
+@implementation SPTPersistentCacheSnapshotWriter
+
+#pragma mark Object Life Cycle
+
+- (nullable instancetype)initWithPath:(NSString *)path error:(NSError * _Nullable *)error
+{
+    self = [super init];
+    if (self) {
+        _path = [path copy];
+        _temporaryPath = [path stringByAppendingPathExtension:[NSUUID UUID].UUIDString];
+        _filedes = open(_temporaryPath.fileSystemRepresentation, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+        if (_filedes == -1) {
+            if (error) {
+                *error = SPTPersistentCacheSnapshotPosixError();
+            }
+            return nil;
+        }
+
+        _buffer = [NSMutableData dataWithCapacity:SPTPersistentCacheSnapshotWriteBufferSize];
+        _index = [NSMutableData data];
+
+        [_buffer appendBytes:SPTPersistentCacheSnapshotMagic length:sizeof(SPTPersistentCacheSnapshotMagic)];
+        SPTPersistentCacheSnapshotAppendUInt32(_buffer, SPTPersistentCacheSnapshotFormatVersion);
+        SPTPersistentCacheSnapshotAppendUInt32(_buffer, 0);
+        _offset = _buffer.length;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    // Not finished archive is dropped
+    if (_filedes != -1) {
+        close(_filedes);
+        unlink(_temporaryPath.fileSystemRepresentation);
+    }
+}
+
+#pragma mark Writing
+
+- (BOOL)flushBufferWithError:(NSError * _Nullable *)error
+{
+    const uint8_t *bytes = self.buffer.bytes;
+    NSUInteger remaining = self.buffer.length;
+    while (remaining > 0) {
+        ssize_t writtenBytes = write(self.filedes, bytes, remaining);
+        if (writtenBytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (error) {
+                *error = SPTPersistentCacheSnapshotPosixError();
+            }
+            return NO;
+        }
+        bytes += writtenBytes;
+        remaining -= (NSUInteger)writtenBytes;
+    }
+    self.buffer.length = 0;
+    return YES;
+}
+
+- (BOOL)appendRecord:(NSData *)record forKey:(NSString *)key error:(NSError * _Nullable *)error
+{
+    NSData *keyData = [key dataUsingEncoding:NSUTF8StringEncoding];
+
+    SPTPersistentCacheSnapshotAppendUInt64(self.index, self.offset);
+
+    SPTPersistentCacheSnapshotAppendUInt32(self.buffer, (uint32_t)keyData.length);
+    [self.buffer appendData:keyData];
+    SPTPersistentCacheSnapshotAppendUInt64(self.buffer, record.length);
+    [self.buffer appendData:record];
+
+    self.offset += sizeof(uint32_t) + keyData.length + sizeof(uint64_t) + record.length;
+    self.recordCount += 1;
+
+    if (self.buffer.length >= SPTPersistentCacheSnapshotWriteBufferSize) {
+        return [self flushBufferWithError:error];
+    }
+    return YES;
+}
+
+- (BOOL)finishWithError:(NSError * _Nullable *)error
+{
+    [self.buffer appendData:self.index];
+    SPTPersistentCacheSnapshotAppendUInt64(self.buffer, self.offset);
+    SPTPersistentCacheSnapshotAppendUInt64(self.buffer, self.recordCount);
+    [self.buffer appendBytes:SPTPersistentCacheSnapshotMagic length:sizeof(SPTPersistentCacheSnapshotMagic)];
+
+    if (![self flushBufferWithError:error]) {
+        return NO;
+    }
+
+    if (fsync(self.filedes) == -1 || close(self.filedes) == -1) {
+        if (error) {
+            *error = SPTPersistentCacheSnapshotPosixError();
+        }
+        return NO;
+    }
+    self.filedes = -1;
+
+    if (rename(self.temporaryPath.fileSystemRepresentation, self.path.fileSystemRepresentation) == -1) {
+        if (error) {
+            *error = SPTPersistentCacheSnapshotPosixError();
+        }
+        unlink(self.temporaryPath.fileSystemRepresentation);
+        return NO;
+    }
+
+    return YES;
+}
+
+@end
+
+
+#pragma mark - SPTPersistentCacheSnapshotReader
+
+@interface SPTPersistentCacheSnapshotReader ()
+@property (nonatomic, strong) NSData *archive;
+@property (nonatomic, strong) NSArray<NSString *> *keys;
+@property (nonatomic, strong) NSArray<NSValue *> *recordRanges;
+@end
+
+@implementation SPTPersistentCacheSnapshotReader
+
+#pragma mark Object Life Cycle
+
+- (nullable instancetype)initWithPath:(NSString *)path error:(NSError * _Nullable *)error
+{
+    self = [super init];
+    if (self) {
+        _archive = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:error];
+        if (_archive == nil) {
+            return nil;
+        }
+        if (![self parseArchive]) {
+            if (error) {
+                *error = [NSError spt_persistentDataCacheErrorWithCode:SPTPersistentCacheLoadingErrorInvalidSnapshot];
+            }
+            return nil;
+        }
+    }
+    return self;
+}
+
+#pragma mark Reading
+
+- (BOOL)parseArchive
+{
+    const uint8_t *bytes = self.archive.bytes;
+    const uint64_t length = self.archive.length;
+
+    if (length < SPTPersistentCacheSnapshotPreambleSize + SPTPersistentCacheSnapshotTrailerSize ||
+        memcmp(bytes, SPTPersistentCacheSnapshotMagic, sizeof(SPTPersistentCacheSnapshotMagic)) != 0 ||
+        memcmp(bytes + length - sizeof(SPTPersistentCacheSnapshotMagic), SPTPersistentCacheSnapshotMagic, sizeof(SPTPersistentCacheSnapshotMagic)) != 0 ||
+        SPTPersistentCacheSnapshotReadUInt32(bytes + sizeof(SPTPersistentCacheSnapshotMagic)) != SPTPersistentCacheSnapshotFormatVersion) {
+        return NO;
+    }
+
+    const uint8_t *trailer = bytes + length - SPTPersistentCacheSnapshotTrailerSize;
+    const uint64_t indexOffset = SPTPersistentCacheSnapshotReadUInt64(trailer);
+    const uint64_t recordCount = SPTPersistentCacheSnapshotReadUInt64(trailer + sizeof(uint64_t));
+    const uint64_t indexEnd = length - SPTPersistentCacheSnapshotTrailerSize;
+
+    if (indexOffset < SPTPersistentCacheSnapshotPreambleSize || indexOffset > indexEnd ||
+        recordCount != (indexEnd - indexOffset) / sizeof(uint64_t) ||
+        (indexEnd - indexOffset) % sizeof(uint64_t) != 0) {
+        return NO;
+    }
+
+    NSMutableArray<NSString *> *keys = [NSMutableArray arrayWithCapacity:(NSUInteger)recordCount];
+    NSMutableArray<NSValue *> *recordRanges = [NSMutableArray arrayWithCapacity:(NSUInteger)recordCount];
+
+    // Entries must follow each other with no gaps up to the index
+    uint64_t expectedOffset = SPTPersistentCacheSnapshotPreambleSize;
+    for (uint64_t i = 0; i < recordCount; ++i) {
+        const uint64_t offset = SPTPersistentCacheSnapshotReadUInt64(bytes + indexOffset + i * sizeof(uint64_t));
+        if (offset != expectedOffset || indexOffset - offset < sizeof(uint32_t)) {
+            return NO;
+        }
+
+        const uint64_t keyLength = SPTPersistentCacheSnapshotReadUInt32(bytes + offset);
+        const uint64_t keyOffset = offset + sizeof(uint32_t);
+        if (indexOffset - keyOffset < keyLength + sizeof(uint64_t)) {
+            return NO;
+        }
+
+        const uint64_t recordLength = SPTPersistentCacheSnapshotReadUInt64(bytes + keyOffset + keyLength);
+        const uint64_t recordOffset = keyOffset + keyLength + sizeof(uint64_t);
+        if (indexOffset - recordOffset < recordLength) {
+            return NO;
+        }
+
+        NSString *key = [[NSString alloc] initWithBytes:bytes + keyOffset
+                                                 length:(NSUInteger)keyLength
+                                               encoding:NSUTF8StringEncoding];
+        if (key.length == 0) {
+            return NO;
+        }
+
+        [keys addObject:key];
+        [recordRanges addObject:[NSValue valueWithRange:NSMakeRange((NSUInteger)recordOffset, (NSUInteger)recordLength)]];
+        expectedOffset = recordOffset + recordLength;
+    }
+
+    if (expectedOffset != indexOffset) {
+        return NO;
+    }
+
+    self.keys = keys;
+    self.recordRanges = recordRanges;
+    return YES;
+}
+
+- (NSUInteger)recordCount
+{
+    return self.keys.count;
+}
+
+- (void)enumerateRecordsUsingBlock:(void (^)(NSString *key, NSData *record, BOOL *stop))block
+{
+    BOOL stop = NO;
+    for (NSUInteger i = 0; i < self.keys.count && !stop; ++i) {
+        @autoreleasepool {
+            block(self.keys[i], [self.archive subdataWithRange:self.recordRanges[i].rangeValue], &stop);
+        }
+    }
+}
+
+@end
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ *  Binary protocol spoken between SPTPersistentCacheServer and SPTPersistentCacheClient over a Unix-domain socket.
+ *  @discussion Each request is a SPTPersistentCacheSocketRequest followed by the UTF-8 key, answered by exactly one
+ *  SPTPersistentCacheSocketReply. Payloads never go through the socket: they are passed as file descriptors with
+ *  SCM_RIGHTS, together with the offset and length of the payload within the file. Both ends run on the same host so
+ *  integers are in host byte order.
+ */
+FOUNDATION_EXPORT const uint32_t SPTPersistentCacheSocketMagic;
+
+/**
+ *  Operations a client can ask the server to perform.
+ */
+typedef NS_ENUM(uint8_t, SPTPersistentCacheSocketOperation) {
+    SPTPersistentCacheSocketOperationLoad = 1,
+    SPTPersistentCacheSocketOperationStore,
+    SPTPersistentCacheSocketOperationLock,
+    SPTPersistentCacheSocketOperationUnlock
+};
+
+/**
+ *  Domain of the error carried by a reply.
+ */
+typedef NS_ENUM(uint32_t, SPTPersistentCacheSocketErrorDomain) {
+    SPTPersistentCacheSocketErrorDomainNone = 0,
+    SPTPersistentCacheSocketErrorDomainCache,
+    SPTPersistentCacheSocketErrorDomainPOSIX,
+    SPTPersistentCacheSocketErrorDomainCocoa
+};
+
+/**
+ *  Request header. A store passes the file descriptor holding the payload along with it.
+ */
+typedef struct SPTPersistentCacheSocketRequest {
+    uint32_t magic;
+    uint8_t operation;
+    uint8_t locked;
+    uint16_t reserved;
+    uint32_t keyLength;
+    uint32_t reserved2;
+    uint64_t ttl;
+    uint64_t payloadOffset;
+    uint64_t payloadLength;
+} SPTPersistentCacheSocketRequest;
+
+/**
+ *  Reply header. A successful load passes the file descriptor holding the payload along with it.
+ */
+typedef struct SPTPersistentCacheSocketReply {
+    uint32_t magic;
+    int32_t result;
+    int64_t errorCode;
+    uint32_t errorDomain;
+    uint32_t refCount;
+    uint64_t ttl;
+    uint64_t payloadOffset;
+    uint64_t payloadLength;
+    uint32_t version;
+    uint8_t stale;
+    uint8_t refreshRecommended;
+    uint16_t reserved;
+} SPTPersistentCacheSocketReply;
+
+/**
+ *  Fills an `sockaddr_un` compatible buffer for the given path.
+ *  @return NO if the path doesn't fit.
+ */
+FOUNDATION_EXPORT BOOL SPTPersistentCacheSocketMakeAddress(NSString *socketPath, void *address, size_t addressSize);
+
+/**
+ *  Prevents writes to a closed peer from raising SIGPIPE where the platform allows it per socket.
+ */
+FOUNDATION_EXPORT void SPTPersistentCacheSocketDisableSigPipe(int socket);
+
+/**
+ *  Sends a message made of a header and an optional trailer, with an optional file descriptor.
+ *  @param fd File descriptor to pass, or -1.
+ *  @return NO with errno set if the message couldn't be sent.
+ */
+FOUNDATION_EXPORT BOOL SPTPersistentCacheSocketSend(int socket,
+                                                    const void *header,
+                                                    size_t headerSize,
+                                                    NSData * _Nullable trailer,
+                                                    int fd);
+
+/**
+ *  Receives a message header and the file descriptor passed with it, if any.
+ *  @param fd Set to the passed file descriptor, or -1. The caller owns it.
+ *  @return NO if the peer closed the connection or the header couldn't be read.
+ */
+FOUNDATION_EXPORT BOOL SPTPersistentCacheSocketReceive(int socket, void *header, size_t headerSize, int *fd);
+
+/**
+ *  Reads exactly the given number of bytes.
+ *  @return NO if the peer closed the connection or reading failed.
+ */
+FOUNDATION_EXPORT BOOL SPTPersistentCacheSocketReadFully(int socket, void *buffer, size_t length);
+
+/**
+ *  Creates an unlinked file holding the data, a memfd where available.
+ *  @return File descriptor positioned anywhere, or -1 with errno set.
+ */
+FOUNDATION_EXPORT int SPTPersistentCacheSocketCreateAnonymousFile(NSData *data);
+
+/**
+ *  Reads a range of a file into memory. Use it for files another process can still change, a mapping of those faults
+ *  once they are truncated.
+ *  @return nil with errno set if the range couldn't be read.
+ */
+FOUNDATION_EXPORT NSData * _Nullable SPTPersistentCacheSocketReadFile(int fd, uint64_t offset, uint64_t length);
+
+/**
+ *  Maps a range of a file read-only. The returned data unmaps it when deallocated.
+ *  @return nil with errno set if the range couldn't be mapped.
+ */
+FOUNDATION_EXPORT NSData * _Nullable SPTPersistentCacheSocketMapFile(int fd, uint64_t offset, uint64_t length);
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,292 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#import "SPTPersistentCacheSocketProtocol.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+const uint32_t SPTPersistentCacheSocketMagic = 0x53505443; // "SPTC"
+
+#if defined(MSG_NOSIGNAL)
+static const int SPTPersistentCacheSocketSendFlags = MSG_NOSIGNAL;
+#else
+static const int SPTPersistentCacheSocketSendFlags = 0;
+#endif
+
+BOOL SPTPersistentCacheSocketMakeAddress(NSString *socketPath, void *address, size_t addressSize)
+{
+    struct sockaddr_un *unixAddress = address;
+    const char *path = socketPath.fileSystemRepresentation;
+    if (addressSize < sizeof(*unixAddress) || strlen(path) >= sizeof(unixAddress->sun_path)) {
+        return NO;
+    }
+
+    memset(unixAddress, 0, sizeof(*unixAddress));
+    unixAddress->sun_family = AF_UNIX;
+    strncpy(unixAddress->sun_path, path, sizeof(unixAddress->sun_path) - 1);
+    return YES;
+}
+
+void SPTPersistentCacheSocketDisableSigPipe(int socket)
+{
+#if defined(SO_NOSIGPIPE)
+    const int value = 1;
+    setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &value, sizeof(value));
+#else
+    (void)socket;
+#endif
+}
+
+static BOOL SPTPersistentCacheSocketWriteFully(int socket, const uint8_t *bytes, size_t length)
+{
+    while (length > 0) {
+        ssize_t writtenBytes = send(socket, bytes, length, SPTPersistentCacheSocketSendFlags);
+        if (writtenBytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return NO;
+        }
+        bytes += writtenBytes;
+        length -= (size_t)writtenBytes;
+    }
+    return YES;
+}
+
+BOOL SPTPersistentCacheSocketSend(int socket, const void *header, size_t headerSize, NSData *trailer, int fd)
+{
+    // Header and trailer go in one buffer so the descriptor is attached to the first byte of the message
+    NSMutableData *message = [NSMutableData dataWithCapacity:headerSize + trailer.length];
+    [message appendBytes:header length:headerSize];
+    if (trailer != nil) {
+        [message appendData:trailer];
+    }
+
+    struct iovec vector = {
+        .iov_base = message.mutableBytes,
+        .iov_len = message.length,
+    };
+    union {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr messageHeader;
+    memset(&messageHeader, 0, sizeof(messageHeader));
+    messageHeader.msg_iov = &vector;
+    messageHeader.msg_iovlen = 1;
+
+    if (fd != -1) {
+        messageHeader.msg_control = control.buffer;
+        messageHeader.msg_controllen = sizeof(control.buffer);
+        struct cmsghdr *controlHeader = CMSG_FIRSTHDR(&messageHeader);
+        controlHeader->cmsg_level = SOL_SOCKET;
+        controlHeader->cmsg_type = SCM_RIGHTS;
+        controlHeader->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(controlHeader), &fd, sizeof(int));
+    }
+
+    ssize_t sentBytes;
+    do {
+        sentBytes = sendmsg(socket, &messageHeader, SPTPersistentCacheSocketSendFlags);
+    } while (sentBytes == -1 && errno == EINTR);
+
+    if (sentBytes == -1) {
+        return NO;
+    }
+
+    return SPTPersistentCacheSocketWriteFully(socket,
+                                              (const uint8_t *)message.bytes + sentBytes,
+                                              message.length - (size_t)sentBytes);
+}
+
+BOOL SPTPersistentCacheSocketReceive(int socket, void *header, size_t headerSize, int *fd)
+{
+    *fd = -1;
+
+    struct iovec vector = {
+        .iov_base = header,
+        .iov_len = headerSize,
+    };
+    union {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr messageHeader;
+    memset(&messageHeader, 0, sizeof(messageHeader));
+    messageHeader.msg_iov = &vector;
+    messageHeader.msg_iovlen = 1;
+    messageHeader.msg_control = control.buffer;
+    messageHeader.msg_controllen = sizeof(control.buffer);
+
+    ssize_t receivedBytes;
+    do {
+        receivedBytes = recvmsg(socket, &messageHeader, 0);
+    } while (receivedBytes == -1 && errno == EINTR);
+
+    if (receivedBytes <= 0) {
+        return NO;
+    }
+
+    for (struct cmsghdr *controlHeader = CMSG_FIRSTHDR(&messageHeader);
+         controlHeader != NULL;
+         controlHeader = CMSG_NXTHDR(&messageHeader, controlHeader)) {
+        if (controlHeader->cmsg_level == SOL_SOCKET && controlHeader->cmsg_type == SCM_RIGHTS) {
+            memcpy(fd, CMSG_DATA(controlHeader), sizeof(int));
+        }
+    }
+
+    if (!SPTPersistentCacheSocketReadFully(socket, (uint8_t *)header + receivedBytes, headerSize - (size_t)receivedBytes)) {
+        if (*fd != -1) {
+            close(*fd);
+            *fd = -1;
+        }
+        return NO;
+    }
+
+    return YES;
+}
+
+BOOL SPTPersistentCacheSocketReadFully(int socket, void *buffer, size_t length)
+{
+    uint8_t *bytes = buffer;
+    while (length > 0) {
+        ssize_t readBytes = recv(socket, bytes, length, 0);
+        if (readBytes == -1 && errno == EINTR) {
+            continue;
+        }
+        if (readBytes <= 0) {
+            return NO;
+        }
+        bytes += readBytes;
+        length -= (size_t)readBytes;
+    }
+    return YES;
+}
+
+int SPTPersistentCacheSocketCreateAnonymousFile(NSData *data)
+{
+#if defined(__linux__)
+    int fd = memfd_create("SPTPersistentCache", MFD_CLOEXEC);
+#else
+    NSString *template = [NSTemporaryDirectory() stringByAppendingPathComponent:@"SPTPersistentCache.XXXXXX"];
+    char *path = strdup(template.fileSystemRepresentation);
+    int fd = mkstemp(path);
+    if (fd != -1) {
+        unlink(path);
+    }
+    free(path);
+#endif
+    if (fd == -1) {
+        return -1;
+    }
+
+    const uint8_t *bytes = data.bytes;
+    size_t remaining = data.length;
+    while (remaining > 0) {
+        ssize_t writtenBytes = write(fd, bytes, remaining);
+        if (writtenBytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            const int errorNumber = errno;
+            close(fd);
+            errno = errorNumber;
+            return -1;
+        }
+        bytes += writtenBytes;
+        remaining -= (size_t)writtenBytes;
+    }
+
+    return fd;
+}
+
+NSData *SPTPersistentCacheSocketReadFile(int fd, uint64_t offset, uint64_t length)
+{
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) == -1) {
+        return nil;
+    }
+    const uint64_t fileSize = (uint64_t)fileStat.st_size;
+    if (length > fileSize || offset > fileSize - length) {
+        errno = EINVAL;
+        return nil;
+    }
+
+    NSMutableData *data = [NSMutableData dataWithLength:(NSUInteger)length];
+    uint8_t *bytes = data.mutableBytes;
+    NSUInteger readLength = 0;
+    while (readLength < data.length) {
+        const ssize_t readBytes = pread(fd, bytes + readLength, data.length - readLength, (off_t)(offset + readLength));
+        if (readBytes == -1 && errno == EINTR) {
+            continue;
+        }
+        if (readBytes == -1) {
+            return nil;
+        }
+        if (readBytes == 0) {
+            // Shrunk since it was checked
+            errno = EINVAL;
+            return nil;
+        }
+        readLength += (NSUInteger)readBytes;
+    }
+    return data;
+}
+
+NSData *SPTPersistentCacheSocketMapFile(int fd, uint64_t offset, uint64_t length)
+{
+    if (length == 0) {
+        return [NSData data];
+    }
+
+    // Mappings start at a page boundary, the payload is sliced out of it
+    const uint64_t pageSize = (uint64_t)getpagesize();
+    const uint64_t mappingOffset = offset - offset % pageSize;
+    const size_t mappingLength = (size_t)(offset - mappingOffset + length);
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) == -1) {
+        return nil;
+    }
+    if ((uint64_t)fileStat.st_size < offset + length) {
+        errno = EINVAL;
+        return nil;
+    }
+
+    void *mapping = mmap(NULL, mappingLength, PROT_READ, MAP_SHARED, fd, (off_t)mappingOffset);
+    if (mapping == MAP_FAILED) {
+        return nil;
+    }
+
+    return [[NSData alloc] initWithBytesNoCopy:(uint8_t *)mapping + (offset - mappingOffset)
+                                        length:(NSUInteger)length
+                                   deallocator:^(void *bytes, NSUInteger bytesLength) {
+                                       munmap(mapping, mappingLength);
+                                   }];
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ *  A record waiting in the write buffer to be written to disk.
+ */
+@interface SPTPersistentCacheWriteBufferEntry : NSObject
+
+@property (nonatomic, strong, readonly) NSData *data;
+@property (nonatomic, assign, readonly) NSUInteger ttl;
+@property (nonatomic, assign, readonly) BOOL locked;
+
+- (instancetype)initWithData:(NSData *)data ttl:(NSUInteger)ttl locked:(BOOL)locked NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+@end
+
+/**
+ *  Holds stored records in memory until they are written to disk.
+ *  @discussion The payloads held never exceed the byte budget. A newer entry for a key replaces the older one. The
+ *  buffer only keeps track of whether a flush is pending, writing the entries is left to its owner.
+ */
+@interface SPTPersistentCacheWriteBuffer : NSObject
+
+/**
+ *  The maximum number of payload bytes held.
+ */
+@property (nonatomic, assign, readonly) NSUInteger byteBudget;
+
+/**
+ *  The number of payload bytes currently held.
+ */
+@property (nonatomic, assign, readonly) NSUInteger byteCount;
+
+/**
+ *  Initializes an empty write buffer.
+ *
+ *  @param byteBudget The maximum number of payload bytes held.
+ */
+- (instancetype)initWithByteBudget:(NSUInteger)byteBudget NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/**
+ *  Adds an entry for key, replacing the previous one. Safe to call from any thread.
+ *
+ *  @param entry The entry to add.
+ *  @param key The key of the record.
+ *  @param needsFlush Set to YES if no flush is pending, the caller must then schedule one.
+ *  @return NO if the entry doesn't fit in the byte budget, nothing is added then.
+ */
+- (BOOL)addEntry:(SPTPersistentCacheWriteBufferEntry *)entry forKey:(NSString *)key needsFlush:(BOOL *)needsFlush;
+
+/**
+ *  Returns the entry for key without removing it. Safe to call from any thread.
+ */
+- (nullable SPTPersistentCacheWriteBufferEntry *)entryForKey:(NSString *)key;
+
+/**
+ *  Removes and returns the entry for key. Safe to call from any thread.
+ */
+- (nullable SPTPersistentCacheWriteBufferEntry *)takeEntryForKey:(NSString *)key;
+
+/**
+ *  Returns the keys held which start with prefix. Safe to call from any thread.
+ */
+- (NSArray<NSString *> *)keysWithPrefix:(NSString *)prefix;
+
+/**
+ *  Removes the entries for which predicate returns YES and returns their keys. Safe to call from any thread, predicate
+ *  is called with the buffer locked.
+ */
+- (NSArray<NSString *> *)removeEntriesPassingTest:(BOOL (^)(SPTPersistentCacheWriteBufferEntry *entry))predicate;
+
+/**
+ *  Marks the pending flush as started and returns the keys held, largest payload first. Entries added afterwards ask
+ *  for another flush.
+ */
+- (NSArray<NSString *> *)beginFlush;
+
+@end
+
+NS_ASSUME_NONNULL_END
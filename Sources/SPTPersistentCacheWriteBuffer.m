@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#import "SPTPersistentCacheWriteBuffer.h"
+
+@implementation SPTPersistentCacheWriteBufferEntry
+
+- (instancetype)initWithData:(NSData *)data ttl:(NSUInteger)ttl locked:(BOOL)locked
+{
+    self = [super init];
+    if (self) {
+        _data = data;
+        _ttl = ttl;
+        _locked = locked;
+    }
+    return self;
+}
+
+@end
+
+
+@interface SPTPersistentCacheWriteBuffer ()
+@property (nonatomic, strong) NSMutableDictionary<NSString *, SPTPersistentCacheWriteBufferEntry *> *entries;
+@property (nonatomic, strong) NSLock *lock;
+@property (nonatomic, assign) NSUInteger heldBytes;
+@property (nonatomic, assign) BOOL flushPending;
+@end
+
+@implementation SPTPersistentCacheWriteBuffer
+
+#pragma mark Object Life Cycle
+
+- (instancetype)initWithByteBudget:(NSUInteger)byteBudget
+{
+    self = [super init];
+    if (self) {
+        _byteBudget = byteBudget;
+        _entries = [NSMutableDictionary dictionary];
+        _lock = [NSLock new];
+    }
+    return self;
+}
+
+#pragma mark Buffering
+
+- (NSUInteger)byteCount
+{
+    [self.lock lock];
+    const NSUInteger byteCount = self.heldBytes;
+    [self.lock unlock];
+    return byteCount;
+}
+
+- (BOOL)addEntry:(SPTPersistentCacheWriteBufferEntry *)entry forKey:(NSString *)key needsFlush:(BOOL *)needsFlush
+{
+    [self.lock lock];
+
+    const NSUInteger replacedBytes = self.entries[key].data.length;
+    const NSUInteger heldBytes = self.heldBytes - replacedBytes;
+    const BOOL fits = (entry.data.length <= self.byteBudget - heldBytes);
+    if (fits) {
+        self.entries[key] = entry;
+        self.heldBytes = heldBytes + entry.data.length;
+    }
+
+    *needsFlush = (fits && !self.flushPending);
+    if (*needsFlush) {
+        self.flushPending = YES;
+    }
+
+    [self.lock unlock];
+    return fits;
+}
+
+- (nullable SPTPersistentCacheWriteBufferEntry *)entryForKey:(NSString *)key
+{
+    [self.lock lock];
+    SPTPersistentCacheWriteBufferEntry *entry = self.entries[key];
+    [self.lock unlock];
+    return entry;
+}
+
+- (nullable SPTPersistentCacheWriteBufferEntry *)takeEntryForKey:(NSString *)key
+{
+    [self.lock lock];
+    SPTPersistentCacheWriteBufferEntry *entry = self.entries[key];
+    if (entry != nil) {
+        [self.entries removeObjectForKey:key];
+        self.heldBytes -= entry.data.length;
+    }
+    [self.lock unlock];
+    return entry;
+}
+
+- (NSArray<NSString *> *)keysWithPrefix:(NSString *)prefix
+{
+    NSMutableArray<NSString *> *keys = [NSMutableArray array];
+    [self.lock lock];
+    for (NSString *key in self.entries) {
+        if ([key hasPrefix:prefix]) {
+            [keys addObject:key];
+        }
+    }
+    [self.lock unlock];
+    return keys;
+}
+
+- (NSArray<NSString *> *)removeEntriesPassingTest:(BOOL (^)(SPTPersistentCacheWriteBufferEntry *entry))predicate
+{
+    [self.lock lock];
+    NSArray<NSString *> *keys = [self.entries keysOfEntriesPassingTest:^BOOL(NSString *key,
+                                                                             SPTPersistentCacheWriteBufferEntry *entry,
+                                                                             BOOL *stop) {
+        return predicate(entry);
+    }].allObjects;
+    for (NSString *key in keys) {
+        self.heldBytes -= self.entries[key].data.length;
+        [self.entries removeObjectForKey:key];
+    }
+    [self.lock unlock];
+    return keys;
+}
+
+#pragma mark Flushing
+
+- (NSArray<NSString *> *)beginFlush
+{
+    [self.lock lock];
+    self.flushPending = NO;
+    NSDictionary<NSString *, SPTPersistentCacheWriteBufferEntry *> *entries = [self.entries copy];
+    [self.lock unlock];
+
+    // Largest payloads are written first since they free most of the budget
+    return [entries keysSortedByValueUsingComparator:^NSComparisonResult(SPTPersistentCacheWriteBufferEntry *entry1,
+                                                                         SPTPersistentCacheWriteBufferEntry *entry2) {
+        if (entry1.data.length == entry2.data.length) {
+            return NSOrderedSame;
+        }
+        return (entry1.data.length > entry2.data.length ? NSOrderedAscending : NSOrderedDescending);
+    }];
+}
+
+@end
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#import <XCTest/XCTest.h>
+#import "SPTPersistentCacheConcurrencyController.h"
+
+// Operations per window of the controller
+static const NSUInteger SPTPersistentCacheConcurrencyControllerTestsWindowSize = 16;
+
+@interface SPTPersistentCacheConcurrencyControllerTests : XCTestCase
+@property (nonatomic, strong) SPTPersistentCacheConcurrencyController *controller;
+@end
+
+@implementation SPTPersistentCacheConcurrencyControllerTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.controller = [[SPTPersistentCacheConcurrencyController alloc] initWithMinimumLimit:1 maximumLimit:8 initialLimit:4];
+}
+
+/**
+ * Runs a window of operations with concurrency operations in flight at a time, each taking latency.
+ */
+- (BOOL)runWindowWithConcurrency:(NSUInteger)concurrency latency:(uint64_t)latency
+{
+    BOOL changed = NO;
+    for (NSUInteger i = 0; i < SPTPersistentCacheConcurrencyControllerTestsWindowSize; i += concurrency) {
+        for (NSUInteger j = 0; j < concurrency; ++j) {
+            [self.controller operationDidStart];
+        }
+        for (NSUInteger j = 0; j < concurrency; ++j) {
+            changed = [self.controller operationDidFinishWithLatency:latency] || changed;
+        }
+    }
+    return changed;
+}
+
+- (void)testInitializerClampsLimits
+{
+    SPTPersistentCacheConcurrencyController *controller = [[SPTPersistentCacheConcurrencyController alloc] initWithMinimumLimit:0
+                                                                                                                   maximumLimit:0
+                                                                                                                   initialLimit:4];
+    XCTAssertEqual(controller.minimumLimit, 1u);
+    XCTAssertEqual(controller.maximumLimit, 1u);
+    XCTAssertEqual(controller.limit, 1u);
+    XCTAssertEqual(self.controller.limit, 4u);
+}
+
+- (void)testLimitGrowsWhileSaturatedAndLatencyIsSteady
+{
+    XCTAssertTrue([self runWindowWithConcurrency:4 latency:100]);
+    XCTAssertEqual(self.controller.limit, 5u);
+
+    // Operations which don't use the whole limit don't raise it
+    XCTAssertFalse([self runWindowWithConcurrency:2 latency:100]);
+    XCTAssertEqual(self.controller.limit, 5u);
+}
+
+- (void)testLimitNeverExceedsMaximum
+{
+    for (NSUInteger i = 0; i < 10; ++i) {
+        [self runWindowWithConcurrency:8 latency:100];
+    }
+    XCTAssertEqual(self.controller.limit, 8u);
+}
+
+- (void)testLimitShrinksWhenLatencyClimbs
+{
+    [self runWindowWithConcurrency:4 latency:100];
+    XCTAssertEqual(self.controller.limit, 5u);
+
+    XCTAssertTrue([self runWindowWithConcurrency:4 latency:300]);
+    XCTAssertEqual(self.controller.limit, 4u);
+
+    for (NSUInteger i = 0; i < 5; ++i) {
+        [self runWindowWithConcurrency:1 latency:1000];
+    }
+    XCTAssertEqual(self.controller.limit, 1u);
+}
+
+@end
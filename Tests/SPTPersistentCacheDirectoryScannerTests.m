@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#import <XCTest/XCTest.h>
+#import "SPTPersistentCacheDirectoryScanner.h"
+
+@interface SPTPersistentCacheDirectoryScannerTests : XCTestCase
+@property (nonatomic, copy) NSString *directoryPath;
+@property (nonatomic, strong) SPTPersistentCacheDirectoryScanner *scanner;
+@end
+
+@implementation SPTPersistentCacheDirectoryScannerTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.directoryPath = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    self.scanner = [[SPTPersistentCacheDirectoryScanner alloc] initWithFileManager:[NSFileManager defaultManager]
+                                                           maxConcurrentOperations:2
+                                                                  qualityOfService:NSQualityOfServiceUtility];
+
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    for (NSString *path in @[@"A0", @"B1/B1", @"B1/B2", @"C3/C3", @"D4/D4", @".hidden", @"C3/.hidden"]) {
+        NSString *filePath = [self.directoryPath stringByAppendingPathComponent:path];
+        [fileManager createDirectoryAtPath:[filePath stringByDeletingLastPathComponent]
+               withIntermediateDirectories:YES
+                                attributes:nil
+                                     error:nil];
+        [fileManager createFileAtPath:filePath contents:[path dataUsingEncoding:NSUTF8StringEncoding] attributes:nil];
+    }
+}
+
+- (void)tearDown
+{
+    [[NSFileManager defaultManager] removeItemAtPath:self.directoryPath error:nil];
+    [super tearDown];
+}
+
+- (NSArray<NSString *> *)scannedRelativePaths
+{
+    NSMutableArray<NSString *> *paths = [NSMutableArray array];
+    NSLock *pathsLock = [NSLock new];
+    NSString *rootPath = [[NSURL fileURLWithPath:self.directoryPath].URLByResolvingSymlinksInPath.path stringByAppendingString:@"/"];
+
+    [self.scanner scanDirectoryAtURL:[NSURL fileURLWithPath:self.directoryPath] fileBlock:^(NSURL *fileURL) {
+        NSString *path = fileURL.URLByResolvingSymlinksInPath.path;
+        [pathsLock lock];
+        [paths addObject:[path stringByReplacingOccurrencesOfString:rootPath withString:@""]];
+        [pathsLock unlock];
+    } failureBlock:^(NSURL *URL) {
+        XCTFail(@"Unexpected failure for URL: %@", URL);
+    }];
+
+    return [paths sortedArrayUsingSelector:@selector(compare:)];
+}
+
+- (void)testInitializer
+{
+    XCTAssertEqual(self.scanner.maxConcurrentOperations, 2);
+    XCTAssertEqual(self.scanner.qualityOfService, NSQualityOfServiceUtility);
+    XCTAssertTrue(self.scanner.skipsHiddenFiles);
+}
+
+- (void)testVisitsEveryVisibleFileOnce
+{
+    NSArray<NSString *> *expected = @[@"A0", @"B1/B1", @"B1/B2", @"C3/C3", @"D4/D4"];
+    XCTAssertEqualObjects([self scannedRelativePaths], expected);
+}
+
+- (void)testVisitsHiddenFilesWhenAsked
+{
+    self.scanner.skipsHiddenFiles = NO;
+    NSArray<NSString *> *expected = @[@".hidden", @"A0", @"B1/B1", @"B1/B2", @"C3/.hidden", @"C3/C3", @"D4/D4"];
+    XCTAssertEqualObjects([self scannedRelativePaths], expected);
+}
+
+- (void)testMissingDirectoryVisitsNothing
+{
+    [[NSFileManager defaultManager] removeItemAtPath:self.directoryPath error:nil];
+    XCTAssertEqualObjects([self scannedRelativePaths], @[]);
+}
+
+@end
@@ -87,8 +87,8 @@
                                                                                updateTime,
                                                                                isLocked);
     
-    XCTAssertEqual(header.reserved1, (uint64_t)0);
-    XCTAssertEqual(header.reserved2, (uint64_t)0);
+    XCTAssertEqual(header.version, (uint32_t)0);
+    XCTAssertEqual(header.leaseExpirationSec, (uint64_t)0);
     XCTAssertEqual(header.reserved3, (uint64_t)0);
     XCTAssertEqual(header.reserved4, (uint64_t)0);
     XCTAssertEqual(header.flags, (uint32_t)0);
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#import <XCTest/XCTest.h>
+#import "SPTPersistentCacheHotSet.h"
+
+static const NSTimeInterval SPTPersistentCacheHotSetTestsHalfLife = 100.0;
+
+@interface SPTPersistentCacheHotSetTests : XCTestCase
+@property (nonatomic, strong) SPTPersistentCacheHotSet *hotSet;
+@end
+
+@implementation SPTPersistentCacheHotSetTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.hotSet = [[SPTPersistentCacheHotSet alloc] initWithCapacity:2 halfLife:SPTPersistentCacheHotSetTestsHalfLife];
+}
+
+- (void)testInitializer
+{
+    XCTAssertEqual(self.hotSet.capacity, 2u);
+    XCTAssertEqual(self.hotSet.halfLife, SPTPersistentCacheHotSetTestsHalfLife);
+    XCTAssertEqualObjects([self.hotSet hottestKeysAtTime:0], @[]);
+}
+
+- (void)testMostFrequentKeysAreHottest
+{
+    [self.hotSet recordAccessForKey:@"A" time:0];
+    [self.hotSet recordAccessForKey:@"B" time:0];
+    [self.hotSet recordAccessForKey:@"B" time:0];
+    [self.hotSet recordAccessForKey:@"C" time:0];
+    [self.hotSet recordAccessForKey:@"C" time:0];
+    [self.hotSet recordAccessForKey:@"C" time:0];
+
+    XCTAssertEqualObjects([self.hotSet hottestKeysAtTime:0], (@[@"C", @"B"]));
+}
+
+- (void)testScoresDecayOverTime
+{
+    [self.hotSet recordAccessForKey:@"A" time:0];
+    [self.hotSet recordAccessForKey:@"A" time:0];
+    [self.hotSet recordAccessForKey:@"A" time:0];
+    // Three half-lives later the old accesses of A count less than one recent access
+    [self.hotSet recordAccessForKey:@"B" time:3 * SPTPersistentCacheHotSetTestsHalfLife];
+
+    XCTAssertEqualObjects([self.hotSet hottestKeysAtTime:3 * SPTPersistentCacheHotSetTestsHalfLife], (@[@"B", @"A"]));
+}
+
+- (void)testColdKeysAreDropped
+{
+    for (NSUInteger i = 0; i < 100; ++i) {
+        [self.hotSet recordAccessForKey:@"HOT" time:0];
+        [self.hotSet recordAccessForKey:[NSString stringWithFormat:@"COLD%lu", (unsigned long)i] time:0];
+    }
+
+    XCTAssertEqualObjects([self.hotSet hottestKeysAtTime:0].firstObject, @"HOT");
+}
+
+- (void)testZeroCapacityTracksNothing
+{
+    SPTPersistentCacheHotSet *hotSet = [[SPTPersistentCacheHotSet alloc] initWithCapacity:0 halfLife:1.0];
+    [hotSet recordAccessForKey:@"A" time:0];
+    XCTAssertEqualObjects([hotSet hottestKeysAtTime:0], @[]);
+}
+
+- (void)testWriteAndReadFile
+{
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+    [self.hotSet recordAccessForKey:@"A" time:0];
+    [self.hotSet recordAccessForKey:@"B" time:0];
+    [self.hotSet recordAccessForKey:@"B" time:0];
+
+    XCTAssertTrue([self.hotSet writeHottestKeysToFile:path time:0]);
+    XCTAssertEqualObjects([SPTPersistentCacheHotSet keysFromFile:path], (@[@"B", @"A"]));
+
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testReadMissingFile
+{
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+    XCTAssertEqualObjects([SPTPersistentCacheHotSet keysFromFile:path], @[]);
+}
+
+@end
@@ -124,9 +124,28 @@ static NSString * const SPTPersistentCacheOptionsPathComponent = @"com.spotify.t
     original.cachePath = [NSTemporaryDirectory() stringByAppendingPathComponent:SPTPersistentCacheOptionsPathComponent];
     original.cacheIdentifier = @"test";
     original.useDirectorySeparation = NO;
+    original.readOnly = YES;
+    original.processSharedLocking = YES;
+    original.callbackDelivery = SPTPersistentCacheCallbackDeliveryBatched;
+    original.callbackBatchInterval = 0.1;
+    original.adaptiveConcurrency = YES;
     original.garbageCollectionInterval = SPTPersistentCacheDefaultGCIntervalSec + 10;
     original.defaultExpirationPeriod = SPTPersistentCacheDefaultExpirationTimeSec + 10;
     original.sizeConstraintBytes = 1024 * 1024;
+    original.staleWhileRevalidatePeriod = 30;
+    original.earlyExpirationBeta = 1.0;
+    original.earlyExpirationRecomputeTime = 2.0;
+    original.expirationJitterFactor = 0.1;
+    original.lockLeaseDuration = 120;
+    original.prefetchPriority = NSOperationQueuePriorityLow;
+    original.prefetchQualityOfService = NSQualityOfServiceBackground;
+    original.recoverOnStart = YES;
+    original.scanMaxConcurrentOperations = 8;
+    original.headerReadQueueDepth = 16;
+    original.useMetadataTable = YES;
+    original.recoveryMaxConcurrentOperations = 4;
+    original.hotSetSize = 100;
+    original.writeBufferSize = 1024;
     original.debugOutput = ^(NSString *message) {
         NSLog(@"Foo: %@", message);
     };
@@ -145,9 +164,28 @@ static NSString * const SPTPersistentCacheOptionsPathComponent = @"com.spotify.t
     XCTAssertEqualObjects(original.cacheIdentifier, copy.cacheIdentifier, @"The values of the property \"cacheIdentifier\" should be equal");
 
     XCTAssertEqual(original.useDirectorySeparation, copy.useDirectorySeparation, @"The values of the property \"useDirectorySeparation\" should be equal");
+    XCTAssertEqual(original.readOnly, copy.readOnly, @"The values of the property \"readOnly\" should be equal");
+    XCTAssertEqual(original.processSharedLocking, copy.processSharedLocking, @"The values of the property \"processSharedLocking\" should be equal");
+    XCTAssertEqual(original.callbackDelivery, copy.callbackDelivery, @"The values of the property \"callbackDelivery\" should be equal");
+    XCTAssertEqual(original.callbackBatchInterval, copy.callbackBatchInterval, @"The values of the property \"callbackBatchInterval\" should be equal");
+    XCTAssertEqual(original.adaptiveConcurrency, copy.adaptiveConcurrency, @"The values of the property \"adaptiveConcurrency\" should be equal");
     XCTAssertEqual(original.garbageCollectionInterval, copy.garbageCollectionInterval, @"The values of the property \"garbageCollectionInterval\" should be equal");
     XCTAssertEqual(original.defaultExpirationPeriod, copy.defaultExpirationPeriod, @"The values of the property \"defaultExpirationPeriod\" should be equal");
     XCTAssertEqual(original.sizeConstraintBytes, copy.sizeConstraintBytes, @"The values of the property \"sizeConstraintBytes\" should be equal");
+    XCTAssertEqual(original.staleWhileRevalidatePeriod, copy.staleWhileRevalidatePeriod, @"The values of the property \"staleWhileRevalidatePeriod\" should be equal");
+    XCTAssertEqual(original.earlyExpirationBeta, copy.earlyExpirationBeta, @"The values of the property \"earlyExpirationBeta\" should be equal");
+    XCTAssertEqual(original.earlyExpirationRecomputeTime, copy.earlyExpirationRecomputeTime, @"The values of the property \"earlyExpirationRecomputeTime\" should be equal");
+    XCTAssertEqual(original.expirationJitterFactor, copy.expirationJitterFactor, @"The values of the property \"expirationJitterFactor\" should be equal");
+    XCTAssertEqual(original.lockLeaseDuration, copy.lockLeaseDuration, @"The values of the property \"lockLeaseDuration\" should be equal");
+    XCTAssertEqual(original.prefetchPriority, copy.prefetchPriority, @"The values of the property \"prefetchPriority\" should be equal");
+    XCTAssertEqual(original.prefetchQualityOfService, copy.prefetchQualityOfService, @"The values of the property \"prefetchQualityOfService\" should be equal");
+    XCTAssertEqual(original.recoverOnStart, copy.recoverOnStart, @"The values of the property \"recoverOnStart\" should be equal");
+    XCTAssertEqual(original.scanMaxConcurrentOperations, copy.scanMaxConcurrentOperations, @"The values of the property \"scanMaxConcurrentOperations\" should be equal");
+    XCTAssertEqual(original.headerReadQueueDepth, copy.headerReadQueueDepth, @"The values of the property \"headerReadQueueDepth\" should be equal");
+    XCTAssertEqual(original.useMetadataTable, copy.useMetadataTable, @"The values of the property \"useMetadataTable\" should be equal");
+    XCTAssertEqual(original.recoveryMaxConcurrentOperations, copy.recoveryMaxConcurrentOperations, @"The values of the property \"recoveryMaxConcurrentOperations\" should be equal");
+    XCTAssertEqual(original.hotSetSize, copy.hotSetSize, @"The values of the property \"hotSetSize\" should be equal");
+    XCTAssertEqual(original.writeBufferSize, copy.writeBufferSize, @"The values of the property \"writeBufferSize\" should be equal");
 }
 
 #pragma mark Compatibility Properties for Deprecated Properties
@@ -38,6 +38,11 @@
  * When this is set to YES the "read:" method will return the readValue above.
  */
 @property (nonatomic, assign, readwrite, getter = isReadOverridden) BOOL readOverridden;
+/**
+ * The number of header reads, by the "read:" or "pread:" method, which get the header with a broken CRC as if it was
+ * being rewritten at the time.
+ */
+@property (nonatomic, assign, readwrite) NSUInteger tornHeaderReadCount;
 /**
  * The value to return when executing the "lseek:" method.
  */
@@ -20,6 +20,8 @@
  */
 #import "SPTPersistentCachePosixWrapperMock.h"
 
+#import <SPTPersistentCache/SPTPersistentCacheHeader.h>
+
 @implementation SPTPersistentCachePosixWrapperMock
 
 - (int)close:(int)descriptor
@@ -32,7 +34,26 @@
     if (self.readOverridden) {
         return self.readValue;
     }
-    return [super read:descriptor buffer:buffer bufferSize:bufferSize];
+    ssize_t readBytes = [super read:descriptor buffer:buffer bufferSize:bufferSize];
+    [self tearHeader:buffer readBytes:readBytes];
+    return readBytes;
+}
+
+- (ssize_t)pread:(int)descriptor buffer:(void *)buffer bufferSize:(size_t)bufferSize offset:(off_t)offset
+{
+    ssize_t readBytes = [super pread:descriptor buffer:buffer bufferSize:bufferSize offset:offset];
+    if (offset == 0) {
+        [self tearHeader:buffer readBytes:readBytes];
+    }
+    return readBytes;
+}
+
+- (void)tearHeader:(void *)buffer readBytes:(ssize_t)readBytes
+{
+    if (self.tornHeaderReadCount > 0 && readBytes == (ssize_t)SPTPersistentCacheRecordHeaderSize) {
+        self.tornHeaderReadCount--;
+        ((SPTPersistentCacheRecordHeader *)buffer)->crc ^= 1u;
+    }
 }
 
 - (off_t)lseek:(int)descriptor seekType:(off_t)seekType seekAmount:(int)seekAmount
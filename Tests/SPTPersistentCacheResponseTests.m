@@ -57,6 +57,17 @@ static const SPTPersistentCacheResponseCode SPTPersistentCacheResponseTestsTestC
     XCTAssertEqual(self.persistentCacheResponse.result, SPTPersistentCacheResponseTestsTestCode);
     XCTAssertEqualObjects(self.persistentCacheResponse.error, self.testError);
     XCTAssertEqualObjects(self.persistentCacheResponse.record, self.testCacheRecord);
+    XCTAssertFalse(self.persistentCacheResponse.stale);
+}
+
+- (void)testStaleInitializer
+{
+    SPTPersistentCacheResponse *response = [[SPTPersistentCacheResponse alloc] initWithResult:SPTPersistentCacheResponseTestsTestCode
+                                                                                        error:nil
+                                                                                       record:self.testCacheRecord
+                                                                                        stale:YES];
+    XCTAssertTrue(response.isStale);
+    XCTAssertTrue(response.isRefreshRecommended, @"Stale responses should always recommend a refresh");
 }
 
 #pragma mark Test describing objects
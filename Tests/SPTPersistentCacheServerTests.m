@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#import <XCTest/XCTest.h>
+#import <SPTPersistentCache/SPTPersistentCache.h>
+#import "SPTPersistentCacheServer.h"
+#import "SPTPersistentCacheClient.h"
+#import "SPTPersistentCacheSocketProtocol.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static const NSTimeInterval SPTPersistentCacheServerTestsWaitTime = 5.0;
+
+@interface SPTPersistentCacheServerTests : XCTestCase
+@property (nonatomic, copy) NSString *cachePath;
+@property (nonatomic, strong) SPTPersistentCacheServer *server;
+@property (nonatomic, strong) SPTPersistentCacheClient *client;
+@end
+
+@implementation SPTPersistentCacheServerTests
+
+- (void)setUp
+{
+    [super setUp];
+
+    self.cachePath = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    SPTPersistentCacheOptions *options = [SPTPersistentCacheOptions new];
+    options.cachePath = self.cachePath;
+    options.cacheIdentifier = @"Test";
+    SPTPersistentCache *cache = [[SPTPersistentCache alloc] initWithOptions:options];
+
+    // Socket paths are limited to about a hundred bytes
+    NSString *socketPath = [@"/tmp" stringByAppendingPathComponent:[[NSUUID UUID].UUIDString substringToIndex:8]];
+    self.server = [[SPTPersistentCacheServer alloc] initWithCache:cache socketPath:socketPath];
+    NSError *error = nil;
+    XCTAssertTrue([self.server startWithError:&error], @"%@", error);
+
+    self.client = [[SPTPersistentCacheClient alloc] initWithSocketPath:socketPath];
+    XCTAssertTrue([self.client connectWithError:&error], @"%@", error);
+}
+
+- (void)tearDown
+{
+    [self.client disconnect];
+    [self.server stop];
+    [[NSFileManager defaultManager] removeItemAtPath:self.cachePath error:nil];
+    [super tearDown];
+}
+
+- (void)testStoreAndLoadThroughServer
+{
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+
+    __weak XCTestExpectation * const storeExpectation = [self expectationWithDescription:@"store"];
+    [self.client storeData:data forKey:@"TEST_SERVER" ttl:0 locked:NO withCallback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        [storeExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+
+    __weak XCTestExpectation * const loadExpectation = [self expectationWithDescription:@"load"];
+    [self.client loadDataForKey:@"TEST_SERVER" withCallback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        XCTAssertEqualObjects(response.record.data, data);
+        XCTAssertEqualObjects(response.record.key, @"TEST_SERVER");
+        XCTAssertEqual(response.record.version, 1u);
+        [loadExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+
+    [self waitForExpectationsWithTimeout:SPTPersistentCacheServerTestsWaitTime handler:nil];
+}
+
+- (void)testLoadOfMissingKeyThroughServer
+{
+    __weak XCTestExpectation * const loadExpectation = [self expectationWithDescription:@"load"];
+    [self.client loadDataForKey:@"TEST_SERVER_MISSING" withCallback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeNotFound);
+        XCTAssertNil(response.record);
+        [loadExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+
+    [self waitForExpectationsWithTimeout:SPTPersistentCacheServerTestsWaitTime handler:nil];
+}
+
+- (void)testLockAndUnlockThroughServer
+{
+    [self.client storeData:[@"TEST" dataUsingEncoding:NSUTF8StringEncoding] forKey:@"TEST_SERVER_LOCK" ttl:0 locked:NO withCallback:nil onQueue:nil];
+
+    __weak XCTestExpectation * const lockExpectation = [self expectationWithDescription:@"lock"];
+    [self.client lockDataForKeys:@[@"TEST_SERVER_LOCK"] callback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        [lockExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+
+    __weak XCTestExpectation * const loadExpectation = [self expectationWithDescription:@"load"];
+    [self.client loadDataForKey:@"TEST_SERVER_LOCK" withCallback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.record.refCount, 1u);
+        [loadExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+
+    __weak XCTestExpectation * const unlockExpectation = [self expectationWithDescription:@"unlock"];
+    [self.client unlockDataForKeys:@[@"TEST_SERVER_LOCK"] callback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        [unlockExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+
+    [self waitForExpectationsWithTimeout:SPTPersistentCacheServerTestsWaitTime handler:nil];
+}
+
+- (void)testKeysNamingOtherFilesAreRefusedByServer
+{
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+    NSString *escapedPath = [self.cachePath.stringByDeletingLastPathComponent stringByAppendingPathComponent:@"TEST_SERVER_ESCAPE"];
+
+    for (NSString *key in @[@"../TEST_SERVER_ESCAPE", @"TEST/SERVER", @".TEST_SERVER"]) {
+        __weak XCTestExpectation * const storeExpectation = [self expectationWithDescription:key];
+        [self.client storeData:data forKey:key ttl:0 locked:NO withCallback:^(SPTPersistentCacheResponse *response) {
+            XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationError);
+            XCTAssertEqualObjects(response.error.domain, NSPOSIXErrorDomain);
+            XCTAssertEqual(response.error.code, EINVAL);
+            [storeExpectation fulfill];
+        } onQueue:dispatch_get_main_queue()];
+    }
+
+    [self waitForExpectationsWithTimeout:SPTPersistentCacheServerTestsWaitTime handler:nil];
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:escapedPath]);
+}
+
+- (void)testKeysWhichAreNotUTF8AreRefusedByServer
+{
+    struct sockaddr_un address;
+    XCTAssertTrue(SPTPersistentCacheSocketMakeAddress(self.server.socketPath, &address, sizeof(address)));
+    const int clientSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    XCTAssertNotEqual(connect(clientSocket, (const struct sockaddr *)&address, sizeof(address)), -1);
+
+    const uint8_t invalidKey[] = { 0xC3, 0x28 };
+    SPTPersistentCacheSocketRequest request;
+    memset(&request, 0, sizeof(request));
+    request.magic = SPTPersistentCacheSocketMagic;
+    request.operation = SPTPersistentCacheSocketOperationLoad;
+    request.keyLength = sizeof(invalidKey);
+
+    // The connection stays usable after the refusal
+    for (int i = 0; i < 2; ++i) {
+        XCTAssertTrue(SPTPersistentCacheSocketSend(clientSocket, &request, sizeof(request),
+                                                   [NSData dataWithBytes:invalidKey length:sizeof(invalidKey)], -1));
+        SPTPersistentCacheSocketReply reply;
+        int replyFileDescriptor = -1;
+        XCTAssertTrue(SPTPersistentCacheSocketReceive(clientSocket, &reply, sizeof(reply), &replyFileDescriptor));
+        XCTAssertEqual(reply.result, (int32_t)SPTPersistentCacheResponseCodeOperationError);
+        XCTAssertEqual(reply.errorDomain, (uint32_t)SPTPersistentCacheSocketErrorDomainPOSIX);
+        XCTAssertEqual(reply.errorCode, (int64_t)EINVAL);
+        XCTAssertEqual(replyFileDescriptor, -1);
+    }
+
+    close(clientSocket);
+}
+
+- (void)testRequestsFailWhenDisconnected
+{
+    [self.client disconnect];
+
+    __weak XCTestExpectation * const loadExpectation = [self expectationWithDescription:@"load"];
+    [self.client loadDataForKey:@"TEST_SERVER" withCallback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationError);
+        XCTAssertEqualObjects(response.error.domain, NSPOSIXErrorDomain);
+        XCTAssertEqual(response.error.code, ENOTCONN);
+        [loadExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+
+    [self waitForExpectationsWithTimeout:SPTPersistentCacheServerTestsWaitTime handler:nil];
+}
+
+@end
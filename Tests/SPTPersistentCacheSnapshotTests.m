@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#import <XCTest/XCTest.h>
+#import "SPTPersistentCacheSnapshot.h"
+#import <SPTPersistentCache/SPTPersistentCache.h>
+
+@interface SPTPersistentCacheSnapshotTests : XCTestCase
+@property (nonatomic, copy) NSString *path;
+@end
+
+@implementation SPTPersistentCacheSnapshotTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+}
+
+- (void)tearDown
+{
+    [[NSFileManager defaultManager] removeItemAtPath:self.path error:nil];
+    [super tearDown];
+}
+
+- (void)writeRecords:(NSDictionary<NSString *, NSData *> *)records
+{
+    SPTPersistentCacheSnapshotWriter *writer = [[SPTPersistentCacheSnapshotWriter alloc] initWithPath:self.path error:nil];
+    XCTAssertNotNil(writer);
+    for (NSString *key in [records.allKeys sortedArrayUsingSelector:@selector(compare:)]) {
+        XCTAssertTrue([writer appendRecord:records[key] forKey:key error:nil]);
+    }
+    XCTAssertEqual(writer.recordCount, records.count);
+    XCTAssertTrue([writer finishWithError:nil]);
+}
+
+- (void)testRecordsRoundTrip
+{
+    NSDictionary<NSString *, NSData *> *records = @{ @"A": [NSData dataWithBytes:"AAAA" length:4],
+                                                     @"BB": [NSData data],
+                                                     @"CCC": [NSData dataWithBytes:"CC" length:2] };
+    [self writeRecords:records];
+
+    NSError *error = nil;
+    SPTPersistentCacheSnapshotReader *reader = [[SPTPersistentCacheSnapshotReader alloc] initWithPath:self.path error:&error];
+    XCTAssertNotNil(reader);
+    XCTAssertNil(error);
+    XCTAssertEqual(reader.recordCount, records.count);
+
+    NSMutableArray<NSString *> *keys = [NSMutableArray array];
+    [reader enumerateRecordsUsingBlock:^(NSString *key, NSData *record, BOOL *stop) {
+        XCTAssertEqualObjects(record, records[key]);
+        [keys addObject:key];
+    }];
+    XCTAssertEqualObjects(keys, (@[@"A", @"BB", @"CCC"]));
+}
+
+- (void)testEmptySnapshot
+{
+    [self writeRecords:@{}];
+
+    SPTPersistentCacheSnapshotReader *reader = [[SPTPersistentCacheSnapshotReader alloc] initWithPath:self.path error:nil];
+    XCTAssertNotNil(reader);
+    XCTAssertEqual(reader.recordCount, 0u);
+}
+
+- (void)testUnfinishedSnapshotIsNotCreated
+{
+    @autoreleasepool {
+        SPTPersistentCacheSnapshotWriter *writer = [[SPTPersistentCacheSnapshotWriter alloc] initWithPath:self.path error:nil];
+        XCTAssertTrue([writer appendRecord:[NSData dataWithBytes:"A" length:1] forKey:@"A" error:nil]);
+    }
+
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:self.path]);
+}
+
+- (void)testTruncatedSnapshotIsRejected
+{
+    [self writeRecords:@{ @"A": [NSData dataWithBytes:"AAAA" length:4] }];
+
+    NSData *archive = [NSData dataWithContentsOfFile:self.path];
+    for (NSUInteger length = 0; length < archive.length; ++length) {
+        [[archive subdataWithRange:NSMakeRange(0, length)] writeToFile:self.path atomically:YES];
+
+        NSError *error = nil;
+        SPTPersistentCacheSnapshotReader *reader = [[SPTPersistentCacheSnapshotReader alloc] initWithPath:self.path error:&error];
+        XCTAssertNil(reader);
+        XCTAssertNotNil(error);
+        if (length > 0) {
+            XCTAssertEqual(error.code, SPTPersistentCacheLoadingErrorInvalidSnapshot);
+        }
+    }
+}
+
+@end
@@ -36,12 +36,18 @@
 #import "SPTPersistentCacheGarbageCollector.h"
 #import "SPTPersistentCache+Private.h"
 #import "SPTPersistentCacheFileManager.h"
+#import "SPTPersistentCacheWriteBuffer.h"
+#import "SPTPersistentCacheConcurrencyController.h"
 #import "NSFileManagerMock.h"
 #import "SPTPersistentCachePosixWrapperMock.h"
 #import "SPTPersistentCache+Private.h"
+#include "sptpc.h"
 
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 static const char* kImages[] = {
@@ -163,6 +169,28 @@ typedef NSTimeInterval (^SPTPersistentCacheCurrentTimeSecCallback)(void);
 
 @end
 
+/// Counts the flushes made through it
+@interface SPTPersistentCacheSyncCountingPosixWrapper : SPTPersistentCachePosixWrapper
+@property (atomic, assign) NSUInteger fsyncCount;
+@property (atomic, assign) NSUInteger dataSyncCount;
+@end
+
+@implementation SPTPersistentCacheSyncCountingPosixWrapper
+
+- (int)fsync:(int)descriptor
+{
+    self.fsyncCount++;
+    return [super fsync:descriptor];
+}
+
+- (int)dataSync:(int)descriptor
+{
+    self.dataSyncCount++;
+    return [super dataSync:descriptor];
+}
+
+@end
+
 
 @interface SPTPersistentCacheTests : XCTestCase
 @property (nonatomic, strong) SPTPersistentCacheForUnitTests *cache;
@@ -1481,18 +1509,34 @@ typedef NSTimeInterval (^SPTPersistentCacheCurrentTimeSecCallback)(void);
 
 - (void)testOpenFailure
 {
-    NSFileManagerMock *fileManagerMock = [NSFileManagerMock new];
-    self.cache.test_fileManager = fileManagerMock;
-    __weak __typeof(fileManagerMock) weakFileManagerMock = fileManagerMock;
-    fileManagerMock.blockCalledOnFileExistsAtPath = ^ {
-        __strong __typeof(weakFileManagerMock) strongFileManagerMock = weakFileManagerMock;
-        [[NSFileManager defaultManager] removeItemAtPath:strongFileManagerMock.lastPathCalledOnExists error:nil];
-    };
-    __block BOOL called = NO;
+    // A directory in place of the record can't be opened for writing
+    SPTPersistentCacheFileManager *fileManager = [[SPTPersistentCacheFileManager alloc] initWithOptions:self.cache.options];
+    NSString *path = [fileManager pathForKey:self.imageNames[0]];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+    [[NSFileManager defaultManager] createDirectoryAtPath:path withIntermediateDirectories:NO attributes:nil error:nil];
+    __weak XCTestExpectation * const expectation = [self expectationWithDescription:@"touch"];
     [self.cache touchDataForKey:self.imageNames[0] callback:^(SPTPersistentCacheResponse *response) {
-        called = YES;
         XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationError);
+        [expectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+}
+
+- (void)testMissingRecordIsFoundOutByOpening
+{
+    NSFileManagerMock *fileManagerMock = [NSFileManagerMock new];
+    self.cache.test_fileManager = fileManagerMock;
+    __weak XCTestExpectation * const expectation = [self expectationWithDescription:@"touch"];
+    [self.cache touchDataForKey:@"TEST_MISSING" callback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeNotFound);
+        [expectation fulfill];
     } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    NSError *error = nil;
+    XCTAssertNil([self.cache loadDataForKeySync:@"TEST_MISSING" error:&error]);
+    XCTAssertNil(error);
+    XCTAssertNil(fileManagerMock.lastPathCalledOnExists, @"No lookup should precede the open");
 }
 
 - (void)testCloseFailure
@@ -1812,6 +1856,1407 @@ typedef NSTimeInterval (^SPTPersistentCacheCurrentTimeSecCallback)(void);
     [self waitForExpectationsWithTimeout:2.0 handler:nil];
 }
 
+- (void)testStoreIfAbsentSkipsExistingRecord
+{
+    NSString *key = @"TEST_IF_ABSENT";
+    NSData *firstData = [@"FIRST" dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *secondData = [@"SECOND" dataUsingEncoding:NSUTF8StringEncoding];
+
+    __weak XCTestExpectation * const firstExpectation = [self expectationWithDescription:@"first store"];
+    [self.cache storeData:firstData
+                   forKey:key
+                 ifAbsent:YES
+                      ttl:0
+                   locked:NO
+             withCallback:^(SPTPersistentCacheResponse *response) {
+                 XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+                 [firstExpectation fulfill];
+             }
+                  onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    __weak XCTestExpectation * const secondExpectation = [self expectationWithDescription:@"second store"];
+    [self.cache storeData:secondData
+                   forKey:key
+                 ifAbsent:YES
+                      ttl:0
+                   locked:NO
+             withCallback:^(SPTPersistentCacheResponse *response) {
+                 XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationError);
+                 XCTAssertEqual(response.error.code, SPTPersistentCacheLoadingErrorRecordAlreadyExists);
+                 [secondExpectation fulfill];
+             }
+                  onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    __weak XCTestExpectation * const loadExpectation = [self expectationWithDescription:@"load"];
+    [self.cache loadDataForKey:key withCallback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqualObjects(response.record.data, firstData);
+        XCTAssertEqual(response.record.version, 1u);
+        [loadExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+}
+
+- (void)testStoreWithExpectedVersion
+{
+    NSString *key = @"TEST_EXPECTED_VERSION";
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+
+    // Absent record has version 0, every successful store increments it
+    const NSUInteger versions[] = { 0, 1, 1 };
+    const SPTPersistentCacheResponseCode results[] = {
+        SPTPersistentCacheResponseCodeOperationSucceeded,
+        SPTPersistentCacheResponseCodeOperationSucceeded,
+        SPTPersistentCacheResponseCodeOperationError,
+    };
+    for (NSUInteger i = 0; i < sizeof(versions) / sizeof(versions[0]); ++i) {
+        const SPTPersistentCacheResponseCode expectedResult = results[i];
+        __weak XCTestExpectation * const expectation = [self expectationWithDescription:@"store"];
+        [self.cache storeData:data
+                       forKey:key
+              expectedVersion:versions[i]
+                          ttl:0
+                       locked:NO
+                 withCallback:^(SPTPersistentCacheResponse *response) {
+                     XCTAssertEqual(response.result, expectedResult);
+                     if (response.result == SPTPersistentCacheResponseCodeOperationError) {
+                         XCTAssertEqual(response.error.code, SPTPersistentCacheLoadingErrorVersionMismatch);
+                     }
+                     [expectation fulfill];
+                 }
+                      onQueue:dispatch_get_main_queue()];
+        [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+    }
+
+    SPTPersistentCacheRecordHeader header;
+    SPTPersistentCacheFileManager *fileManager = [[SPTPersistentCacheFileManager alloc] initWithOptions:self.cache.options];
+    NSString *path = [fileManager pathForKey:key];
+    XCTAssertTrue(spt_test_ReadHeaderForFile(path.UTF8String, YES, &header));
+    XCTAssertEqual(header.version, 2u);
+}
+
+- (void)testAppendDataExtendsPayload
+{
+    NSString *key = @"TEST_APPEND";
+    NSData *firstData = [@"AB" dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *secondData = [@"CD" dataUsingEncoding:NSUTF8StringEncoding];
+
+    // Appending to absent record creates it
+    for (NSData *data in @[firstData, secondData]) {
+        __weak XCTestExpectation * const expectation = [self expectationWithDescription:@"append"];
+        [self.cache appendData:data toKey:key withCallback:^(SPTPersistentCacheResponse *response) {
+            XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+            [expectation fulfill];
+        } onQueue:dispatch_get_main_queue()];
+        [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+    }
+
+    SPTPersistentCacheFileManager *fileManager = [[SPTPersistentCacheFileManager alloc] initWithOptions:self.cache.options];
+    NSString *path = [fileManager pathForKey:key];
+    SPTPersistentCacheRecordHeader header;
+    XCTAssertTrue(spt_test_ReadHeaderForFile(path.UTF8String, YES, &header));
+    XCTAssertEqual(header.payloadSizeBytes, 4u);
+    XCTAssertEqual(header.version, 2u);
+    XCTAssertTrue((header.flags & SPTPersistentCacheRecordHeaderFlagsAppendable) != 0);
+
+    // Simulate an append which was interrupted before its length was committed
+    NSFileHandle *fileHandle = [NSFileHandle fileHandleForWritingAtPath:path];
+    [fileHandle seekToEndOfFile];
+    [fileHandle writeData:[@"XYZ" dataUsingEncoding:NSUTF8StringEncoding]];
+    [fileHandle closeFile];
+
+    __weak XCTestExpectation * const loadExpectation = [self expectationWithDescription:@"load"];
+    [self.cache loadDataForKey:key withCallback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        XCTAssertEqualObjects(response.record.data, [@"ABCD" dataUsingEncoding:NSUTF8StringEncoding]);
+        [loadExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    // Next append replaces the uncommitted tail
+    __weak XCTestExpectation * const appendExpectation = [self expectationWithDescription:@"append"];
+    [self.cache appendData:firstData toKey:key withCallback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        [appendExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    NSData *rawData = [NSData dataWithContentsOfFile:path];
+    XCTAssertEqual(rawData.length, SPTPersistentCacheRecordHeaderSize + 6);
+    NSData *payload = [rawData subdataWithRange:NSMakeRange(SPTPersistentCacheRecordHeaderSize, 6)];
+    XCTAssertEqualObjects(payload, [@"ABCDAB" dataUsingEncoding:NSUTF8StringEncoding]);
+}
+
+- (void)testAppendDataWithoutCallbackParameters
+{
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+    XCTAssertFalse([self.cache appendData:data toKey:@"TEST" withCallback:^(SPTPersistentCacheResponse *response) {} onQueue:nil]);
+}
+
+- (void)testStaleWhileRevalidate
+{
+    SPTPersistentCacheOptions *options = [SPTPersistentCacheOptions new];
+    options.cachePath = self.cachePath;
+    options.cacheIdentifier = @"Test";
+    options.staleWhileRevalidatePeriod = 60;
+
+    NSTimeInterval __block currentTime = kTestEpochTime;
+    SPTPersistentCacheForUnitTests *cache = [[SPTPersistentCacheForUnitTests alloc] initWithOptions:options];
+    cache.timeIntervalCallback = ^NSTimeInterval{
+        return currentTime;
+    };
+
+    NSString *key = @"TEST_STALE";
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+    __weak XCTestExpectation * const storeExpectation = [self expectationWithDescription:@"store"];
+    [cache storeData:data forKey:key ttl:0 locked:NO withCallback:^(SPTPersistentCacheResponse *response) {
+        [storeExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    SPTPersistentCacheFileManager *fileManager = [[SPTPersistentCacheFileManager alloc] initWithOptions:options];
+    NSString *path = [fileManager pathForKey:key];
+
+    // Expired but within grace period
+    currentTime = kTestEpochTime + SPTPersistentCacheDefaultExpirationTimeSec + 30;
+    __weak XCTestExpectation * const staleExpectation = [self expectationWithDescription:@"stale load"];
+    [cache loadDataForKey:key withCallback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        XCTAssertTrue(response.isStale);
+        XCTAssertEqualObjects(response.record.data, data);
+        [staleExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    // Prefix loads agree with key loads
+    __weak XCTestExpectation * const stalePrefixExpectation = [self expectationWithDescription:@"stale prefix load"];
+    [cache loadDataForKeysWithPrefix:@"TEST_ST" chooseKeyCallback:^NSString *(NSArray<NSString *> *keys) {
+        XCTAssertEqualObjects(keys, @[key]);
+        return keys.firstObject;
+    } withCallback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        XCTAssertTrue(response.isStale);
+        XCTAssertEqualObjects(response.record.data, data);
+        [stalePrefixExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    // Stale load must not refresh access time
+    SPTPersistentCacheRecordHeader header;
+    XCTAssertTrue(spt_test_ReadHeaderForFile(path.UTF8String, YES, &header));
+    XCTAssertEqual(header.updateTimeSec, kTestEpochTime);
+
+    [cache runRegularGC];
+    XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:path], @"GC must keep records within grace period");
+
+    // Grace period has passed
+    currentTime = kTestEpochTime + SPTPersistentCacheDefaultExpirationTimeSec + 61;
+    __weak XCTestExpectation * const notFoundExpectation = [self expectationWithDescription:@"expired load"];
+    [cache loadDataForKey:key withCallback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeNotFound);
+        [notFoundExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    [cache runRegularGC];
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:path]);
+}
+
+- (void)testEarlyExpirationRecommendsRefresh
+{
+    SPTPersistentCacheOptions *options = [SPTPersistentCacheOptions new];
+    options.cachePath = self.cachePath;
+    options.cacheIdentifier = @"Test";
+    // Recompute time far beyond expiration period makes the recommendation certain
+    options.earlyExpirationBeta = 1.0;
+    options.earlyExpirationRecomputeTime = 1e9;
+
+    SPTPersistentCacheForUnitTests *cache = [[SPTPersistentCacheForUnitTests alloc] initWithOptions:options];
+    cache.timeIntervalCallback = ^NSTimeInterval{
+        return kTestEpochTime;
+    };
+
+    NSString *key = @"TEST_EARLY_EXPIRATION";
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+    __weak XCTestExpectation * const storeExpectation = [self expectationWithDescription:@"store"];
+    [cache storeData:data forKey:key ttl:kTTL1 locked:NO withCallback:^(SPTPersistentCacheResponse *response) {
+        [storeExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    __weak XCTestExpectation * const loadExpectation = [self expectationWithDescription:@"load"];
+    [cache loadDataForKey:key withCallback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        XCTAssertFalse(response.isStale);
+        XCTAssertTrue(response.isRefreshRecommended);
+        [loadExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+}
+
+- (void)testExpirationJitterOnStore
+{
+    SPTPersistentCacheOptions *options = [SPTPersistentCacheOptions new];
+    options.cachePath = self.cachePath;
+    options.cacheIdentifier = @"Test";
+    options.expirationJitterFactor = 0.5;
+
+    SPTPersistentCacheForUnitTests *cache = [[SPTPersistentCacheForUnitTests alloc] initWithOptions:options];
+    cache.timeIntervalCallback = ^NSTimeInterval{
+        return kTestEpochTime;
+    };
+    SPTPersistentCacheFileManager *fileManager = [[SPTPersistentCacheFileManager alloc] initWithOptions:options];
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+
+    for (NSNumber *ttl in @[@(kTTL1), @0]) {
+        NSString *key = [NSString stringWithFormat:@"TEST_JITTER_%@", ttl];
+        __weak XCTestExpectation * const expectation = [self expectationWithDescription:key];
+        [cache storeData:data forKey:key ttl:ttl.unsignedIntegerValue locked:NO withCallback:^(SPTPersistentCacheResponse *response) {
+            [expectation fulfill];
+        } onQueue:dispatch_get_main_queue()];
+        [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+        SPTPersistentCacheRecordHeader header;
+        XCTAssertTrue(spt_test_ReadHeaderForFile([fileManager pathForKey:key].UTF8String, YES, &header));
+        // Only the TTL is shortened, the update time is the time of the write
+        XCTAssertEqual(header.updateTimeSec, kTestEpochTime);
+        if (ttl.unsignedIntegerValue > 0) {
+            XCTAssertGreaterThan(header.ttl, kTTL1 / 2);
+            XCTAssertLessThanOrEqual(header.ttl, kTTL1);
+            XCTAssertEqual([cache loadDataForKeySync:key error:nil].ttl, (NSUInteger)header.ttl, @"Loaded records carry the jittered TTL");
+        } else {
+            XCTAssertEqual(header.ttl, 0u);
+        }
+    }
+}
+
+- (void)testPrefetchDataForKeys
+{
+    NSString *key = @"TEST_PREFETCH";
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+    __weak XCTestExpectation * const storeExpectation = [self expectationWithDescription:@"store"];
+    [self.cache storeData:data forKey:key locked:NO withCallback:^(SPTPersistentCacheResponse *response) {
+        [storeExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    NSMutableArray<NSNumber *> *results = [NSMutableArray array];
+    __weak XCTestExpectation * const prefetchExpectation = [self expectationWithDescription:@"prefetch"];
+    BOOL scheduled = [self.cache prefetchDataForKeys:@[key, @"TEST_PREFETCH_MISSING"] callback:^(SPTPersistentCacheResponse *response) {
+        [results addObject:@(response.result)];
+        if (results.count == 2) {
+            [prefetchExpectation fulfill];
+        }
+    } onQueue:dispatch_get_main_queue()];
+    XCTAssertTrue(scheduled);
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    XCTAssertEqualObjects(results, (@[@(SPTPersistentCacheResponseCodeOperationSucceeded), @(SPTPersistentCacheResponseCodeNotFound)]));
+    XCTAssertFalse([self.cache prefetchDataForKeys:@[] callback:nil onQueue:nil]);
+}
+
+- (void)testHotSetIsPersistedAfterLoads
+{
+    SPTPersistentCacheOptions *options = [SPTPersistentCacheOptions new];
+    options.cachePath = self.cachePath;
+    options.cacheIdentifier = @"Test";
+    options.hotSetSize = 4;
+    SPTPersistentCache *cache = [[SPTPersistentCache alloc] initWithOptions:options];
+
+    NSString *key = @"TEST_HOT_SET";
+    __weak XCTestExpectation * const storeExpectation = [self expectationWithDescription:@"store"];
+    [cache storeData:[@"TEST" dataUsingEncoding:NSUTF8StringEncoding] forKey:key locked:NO withCallback:^(SPTPersistentCacheResponse *response) {
+        [storeExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    __weak XCTestExpectation * const loadExpectation = [self expectationWithDescription:@"load"];
+    [cache loadDataForKey:key withCallback:^(SPTPersistentCacheResponse *response) {
+        [loadExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    XCTAssertTrue([cache persistHotSet]);
+    NSString *hotSetPath = [self.cachePath stringByAppendingPathComponent:@".hotset"];
+    XCTAssertEqualObjects([NSArray arrayWithContentsOfFile:hotSetPath], @[key]);
+    XCTAssertFalse([self.cache persistHotSet], @"Nothing is persisted with hotSetSize of 0");
+}
+
+- (void)testRecoveryRemovesTemporaryFilesAndTornRecords
+{
+    SPTPersistentCacheFileManager *fileManager = [[SPTPersistentCacheFileManager alloc] initWithOptions:self.cache.options];
+    NSString *key = @"TEST_TORN";
+    NSString *intactKey = @"TEST_INTACT";
+    for (NSString *storeKey in @[key, intactKey]) {
+        __weak XCTestExpectation * const storeExpectation = [self expectationWithDescription:storeKey];
+        [self.cache storeData:[@"TEST" dataUsingEncoding:NSUTF8StringEncoding] forKey:storeKey locked:NO withCallback:^(SPTPersistentCacheResponse *response) {
+            [storeExpectation fulfill];
+        } onQueue:dispatch_get_main_queue()];
+        [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+    }
+
+    // Cut the payload short
+    NSString *tornPath = [fileManager pathForKey:key];
+    NSFileHandle *fileHandle = [NSFileHandle fileHandleForWritingAtPath:tornPath];
+    [fileHandle truncateFileAtOffset:SPTPersistentCacheRecordHeaderSize + 2];
+    [fileHandle closeFile];
+
+    // Old and fresh leftovers of atomic writes
+    NSString *subDirectory = [fileManager subDirectoryPathForKey:key];
+    NSString *oldTemporaryPath = [subDirectory stringByAppendingPathComponent:@".dat.nosync0001.old"];
+    NSString *freshTemporaryPath = [subDirectory stringByAppendingPathComponent:@".dat.nosync0002.new"];
+    NSString *oldCoreTemporaryPath = [subDirectory stringByAppendingPathComponent:[NSString stringWithFormat:@".%@.a1B2c3", key]];
+    // Old hidden files which aren't leftovers of atomic writes aren't ours
+    NSString *hiddenPath = [subDirectory stringByAppendingPathComponent:@".notes"];
+    NSString *hiddenLookalikePath = [subDirectory stringByAppendingPathComponent:@".OTHER_KEY.a1B2c3"];
+    for (NSString *path in @[oldTemporaryPath, freshTemporaryPath, oldCoreTemporaryPath, hiddenPath, hiddenLookalikePath]) {
+        [[NSData dataWithBytes:"TMP" length:3] writeToFile:path atomically:NO];
+    }
+    for (NSString *path in @[oldTemporaryPath, oldCoreTemporaryPath, hiddenPath, hiddenLookalikePath]) {
+        [[NSFileManager defaultManager] setAttributes:@{ NSFileModificationDate: [NSDate dateWithTimeIntervalSinceNow:-3600] }
+                                         ofItemAtPath:path
+                                                error:nil];
+    }
+
+    __weak XCTestExpectation * const recoverExpectation = [self expectationWithDescription:@"recover"];
+    [self.cache recoverWithCallback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        [recoverExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:tornPath]);
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:oldTemporaryPath]);
+    XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:freshTemporaryPath], @"Write might still be in progress");
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:oldCoreTemporaryPath]);
+    XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:hiddenPath]);
+    XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:hiddenLookalikePath], @"Only the directory of the record holds its temporary files");
+    XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:[fileManager pathForKey:intactKey]], @"Valid records must stay");
+}
+
+- (void)testSnapshotExportAndImport
+{
+    NSString *key = @"TEST_SNAPSHOT";
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+    __weak XCTestExpectation * const storeExpectation = [self expectationWithDescription:@"store"];
+    [self.cache storeData:data forKey:key locked:NO withCallback:^(SPTPersistentCacheResponse *response) {
+        [storeExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    NSString *snapshotPath = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    __weak XCTestExpectation * const exportExpectation = [self expectationWithDescription:@"export"];
+    [self.cache exportSnapshotToPath:snapshotPath callback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        [exportExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    SPTPersistentCacheOptions *options = [SPTPersistentCacheOptions new];
+    options.cachePath = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    options.cacheIdentifier = @"Test";
+    SPTPersistentCache *importingCache = [[SPTPersistentCache alloc] initWithOptions:options];
+
+    __weak XCTestExpectation * const importExpectation = [self expectationWithDescription:@"import"];
+    [importingCache importSnapshotFromPath:snapshotPath callback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        [importExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    __weak XCTestExpectation * const loadExpectation = [self expectationWithDescription:@"load"];
+    [importingCache loadDataForKey:key withCallback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        XCTAssertEqualObjects(response.record.data, data);
+        XCTAssertEqual(response.record.version, 1u);
+        [loadExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    [[NSFileManager defaultManager] removeItemAtPath:snapshotPath error:nil];
+    [[NSFileManager defaultManager] removeItemAtPath:options.cachePath error:nil];
+}
+
+- (void)testImportOfMalformedSnapshotFails
+{
+    NSString *snapshotPath = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    [[@"NOT A SNAPSHOT" dataUsingEncoding:NSUTF8StringEncoding] writeToFile:snapshotPath atomically:YES];
+
+    __weak XCTestExpectation * const importExpectation = [self expectationWithDescription:@"import"];
+    [self.cache importSnapshotFromPath:snapshotPath callback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationError);
+        XCTAssertEqual(response.error.code, SPTPersistentCacheLoadingErrorInvalidSnapshot);
+        [importExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    [[NSFileManager defaultManager] removeItemAtPath:snapshotPath error:nil];
+}
+
+- (void)testReadOnlyCacheLoadsWithoutWriting
+{
+    NSString *key = @"TEST_READ_ONLY";
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+    __weak XCTestExpectation * const storeExpectation = [self expectationWithDescription:@"store"];
+    [self.cache storeData:data forKey:key locked:NO withCallback:^(SPTPersistentCacheResponse *response) {
+        [storeExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    SPTPersistentCacheOptions *options = [self.cache.options copy];
+    options.readOnly = YES;
+    SPTPersistentCacheForUnitTests *readOnlyCache = [[SPTPersistentCacheForUnitTests alloc] initWithOptions:options];
+    readOnlyCache.timeIntervalCallback = ^NSTimeInterval {
+        return kTestEpochTime + 10;
+    };
+
+    SPTPersistentCacheFileManager *fileManager = [[SPTPersistentCacheFileManager alloc] initWithOptions:options];
+    SPTPersistentCacheRecordHeader headerBefore;
+    XCTAssertTrue(spt_test_ReadHeaderForFile([fileManager pathForKey:key].UTF8String, YES, &headerBefore));
+
+    __weak XCTestExpectation * const loadExpectation = [self expectationWithDescription:@"load"];
+    [readOnlyCache loadDataForKey:key withCallback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        XCTAssertEqualObjects(response.record.data, data);
+        [loadExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    SPTPersistentCacheRecordHeader headerAfter;
+    XCTAssertTrue(spt_test_ReadHeaderForFile([fileManager pathForKey:key].UTF8String, YES, &headerAfter));
+    XCTAssertEqual(headerBefore.updateTimeSec, headerAfter.updateTimeSec, @"Access time must not be written back");
+
+    __weak XCTestExpectation * const writeExpectation = [self expectationWithDescription:@"write"];
+    [readOnlyCache storeData:data forKey:key locked:NO withCallback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationError);
+        XCTAssertEqual(response.error.code, SPTPersistentCacheLoadingErrorReadOnly);
+        [writeExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+}
+
+- (void)testReadOnlyCacheRereadsTornHeaders
+{
+    NSString *key = @"TEST_READ_ONLY_TORN";
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+    XCTAssertTrue([self.cache storeDataSync:data forKey:key ttl:0 locked:NO error:nil]);
+
+    SPTPersistentCacheOptions *options = [self.cache.options copy];
+    options.readOnly = YES;
+    SPTPersistentCacheForUnitTests *readOnlyCache = [[SPTPersistentCacheForUnitTests alloc] initWithOptions:options];
+    SPTPersistentCachePosixWrapperMock *posixWrapperMock = [SPTPersistentCachePosixWrapperMock new];
+    readOnlyCache.test_posixWrapper = posixWrapperMock;
+
+    // A header caught while the owner rewrites it is read again
+    posixWrapperMock.tornHeaderReadCount = 2;
+    SPTPersistentCacheRecordHeader header;
+    NSError *error = nil;
+    XCTAssertTrue([readOnlyCache statDataForKeySync:key header:&header error:&error]);
+    XCTAssertNil(error);
+    XCTAssertEqual(header.payloadSizeBytes, data.length);
+    XCTAssertEqual(posixWrapperMock.tornHeaderReadCount, 0u);
+
+    // One which stays broken is still reported, after a bounded number of reads
+    posixWrapperMock.tornHeaderReadCount = 100;
+    XCTAssertFalse([readOnlyCache statDataForKeySync:key header:&header error:&error]);
+    XCTAssertEqual(error.code, SPTPersistentCacheLoadingErrorInvalidHeaderCRC);
+    XCTAssertGreaterThan(posixWrapperMock.tornHeaderReadCount, 90u);
+
+    // The owner serializes its header rewrites, so it doesn't read headers again
+    posixWrapperMock.tornHeaderReadCount = 1;
+    self.cache.test_posixWrapper = posixWrapperMock;
+    error = nil;
+    XCTAssertFalse([self.cache statDataForKeySync:key header:&header error:&error]);
+    XCTAssertEqual(error.code, SPTPersistentCacheLoadingErrorInvalidHeaderCRC);
+
+    // Mapped loads read the record again as well before reporting a header which is really broken
+    SPTPersistentCacheFileManager *fileManager = [[SPTPersistentCacheFileManager alloc] initWithOptions:options];
+    const int fd = open([fileManager pathForKey:key].fileSystemRepresentation, O_RDWR);
+    XCTAssertNotEqual(fd, -1);
+    XCTAssertEqual(pread(fd, &header, SPTPersistentCacheRecordHeaderSize, 0), (ssize_t)SPTPersistentCacheRecordHeaderSize);
+    header.crc ^= 1u;
+    XCTAssertEqual(pwrite(fd, &header, SPTPersistentCacheRecordHeaderSize, 0), (ssize_t)SPTPersistentCacheRecordHeaderSize);
+    close(fd);
+    error = nil;
+    XCTAssertNil([readOnlyCache loadDataForKeySync:key error:&error]);
+    XCTAssertEqual(error.code, SPTPersistentCacheLoadingErrorInvalidHeaderCRC);
+}
+
+- (void)testProcessSharedLockingKeepsRefCount
+{
+    SPTPersistentCacheOptions *options = [SPTPersistentCacheOptions new];
+    options.cachePath = self.cachePath;
+    options.cacheIdentifier = @"Test";
+    options.processSharedLocking = YES;
+    SPTPersistentCache *cache = [[SPTPersistentCache alloc] initWithOptions:options];
+    SPTPersistentCacheFileManager *fileManager = [[SPTPersistentCacheFileManager alloc] initWithOptions:options];
+
+    NSString *key = @"TEST_SHARED_LOCK";
+    __weak XCTestExpectation * const storeExpectation = [self expectationWithDescription:@"store"];
+    [cache storeData:[@"TEST" dataUsingEncoding:NSUTF8StringEncoding] forKey:key locked:NO withCallback:^(SPTPersistentCacheResponse *response) {
+        [storeExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    __weak XCTestExpectation * const lockExpectation = [self expectationWithDescription:@"lock"];
+    [cache lockDataForKeys:@[key, key] callback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        SPTPersistentCacheRecordHeader header;
+        XCTAssertTrue(spt_test_ReadHeaderForFile([fileManager pathForKey:key].UTF8String, YES, &header));
+        if (header.refCount == 2) {
+            [lockExpectation fulfill];
+        }
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    __weak XCTestExpectation * const unlockExpectation = [self expectationWithDescription:@"unlock"];
+    [cache unlockDataForKeys:@[key] callback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        [unlockExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    SPTPersistentCacheRecordHeader header;
+    XCTAssertTrue(spt_test_ReadHeaderForFile([fileManager pathForKey:key].UTF8String, YES, &header));
+    XCTAssertEqual(header.refCount, 1u);
+}
+
+#if !TARGET_OS_IPHONE
+- (void)testProcessSharedLockingLoadKeepsLockOfOtherProcess
+{
+    SPTPersistentCacheOptions *options = [SPTPersistentCacheOptions new];
+    options.cachePath = self.cachePath;
+    options.cacheIdentifier = @"Test";
+    options.processSharedLocking = YES;
+
+    NSTimeInterval __block currentTime = kTestEpochTime;
+    SPTPersistentCacheForUnitTests *cache = [[SPTPersistentCacheForUnitTests alloc] initWithOptions:options];
+    cache.timeIntervalCallback = ^NSTimeInterval{
+        return currentTime;
+    };
+    SPTPersistentCacheFileManager *fileManager = [[SPTPersistentCacheFileManager alloc] initWithOptions:options];
+
+    NSString *key = @"TEST_SHARED_LOAD";
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+    XCTAssertTrue([cache storeDataSync:data forKey:key ttl:0 locked:NO error:nil]);
+    char path[PATH_MAX];
+    XCTAssertTrue([[fileManager pathForKey:key] getFileSystemRepresentation:path maxLength:sizeof(path)]);
+
+    int readyPipe[2];
+    XCTAssertEqual(pipe(readyPipe), 0);
+    const pid_t child = fork();
+    if (child == 0) {
+        // The other process locks the record in place under the header lock. Only plain C from here on.
+        struct flock lock = {
+            .l_start = 0,
+            .l_len = (off_t)SPTPersistentCacheRecordHeaderSize,
+            .l_type = F_WRLCK,
+            .l_whence = SEEK_SET,
+        };
+        const int fd = open(path, O_RDWR);
+        const char ready = 1;
+        if (fd == -1 || fcntl(fd, F_SETLKW, &lock) == -1 || write(readyPipe[1], &ready, 1) != 1) {
+            _exit(1);
+        }
+        // Leaves the load time to reach its write-back
+        usleep(200 * 1000);
+        SPTPersistentCacheRecordHeader header;
+        if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+            _exit(1);
+        }
+        header.refCount += 1;
+        header.crc = SPTPersistentCacheCalculateHeaderCRC(&header);
+        _exit(pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) ? 0 : 1);
+    }
+    XCTAssertGreaterThan(child, 0);
+
+    // The load starts while the other process holds the header lock
+    char ready = 0;
+    XCTAssertEqual(read(readyPipe[0], &ready, 1), 1);
+    currentTime = kTestEpochTime + 100;
+    XCTAssertEqualObjects([cache loadDataForKeySync:key error:nil].data, data);
+
+    int status = 0;
+    XCTAssertEqual(waitpid(child, &status, 0), child);
+    XCTAssertTrue(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    close(readyPipe[0]);
+    close(readyPipe[1]);
+
+    SPTPersistentCacheRecordHeader header;
+    XCTAssertTrue(spt_test_ReadHeaderForFile(path, YES, &header));
+    XCTAssertEqual(header.refCount, 1u, @"The lock of the other process must survive the load");
+    XCTAssertEqual(header.updateTimeSec, (uint64_t)kTestEpochTime + 100);
+}
+
+- (void)testHeaderLockSurvivesCloseOfOtherDescriptor
+{
+    SPTPersistentCachePosixWrapper *posixWrapper = [SPTPersistentCachePosixWrapper new];
+    if (!posixWrapper.locksOpenFileDescriptions) {
+        // Record files are only opened and closed under the key lock there
+        return;
+    }
+
+    NSString *filePath = [self.cachePath stringByAppendingPathComponent:@"TEST_HEADER_LOCK"];
+    XCTAssertTrue([[NSMutableData dataWithLength:SPTPersistentCacheRecordHeaderSize] writeToFile:filePath atomically:NO]);
+    char path[PATH_MAX];
+    XCTAssertTrue([filePath getFileSystemRepresentation:path maxLength:sizeof(path)]);
+
+    const int lockedFile = open(path, O_RDWR);
+    XCTAssertNotEqual(lockedFile, -1);
+    XCTAssertEqual([posixWrapper lockRange:lockedFile type:F_WRLCK offset:0 length:(off_t)SPTPersistentCacheRecordHeaderSize], 0);
+    // Another descriptor of the same file, as a send or a header scan would open and close
+    const int otherFile = open(path, O_RDONLY);
+    XCTAssertNotEqual(otherFile, -1);
+    close(otherFile);
+
+    const pid_t child = fork();
+    if (child == 0) {
+        struct flock lock = {
+            .l_start = 0,
+            .l_len = (off_t)SPTPersistentCacheRecordHeaderSize,
+            .l_type = F_WRLCK,
+            .l_whence = SEEK_SET,
+        };
+        const int fd = open(path, O_RDWR);
+        _exit(fd != -1 && fcntl(fd, F_GETLK, &lock) == 0 && lock.l_type != F_UNLCK ? 0 : 1);
+    }
+    XCTAssertGreaterThan(child, 0);
+
+    int status = 0;
+    XCTAssertEqual(waitpid(child, &status, 0), child);
+    XCTAssertTrue(WIFEXITED(status) && WEXITSTATUS(status) == 0, @"The header lock must be held until its descriptor is closed");
+    close(lockedFile);
+}
+
+- (void)testProcessSharedLockingSendsDontReleaseHeaderLocks
+{
+    SPTPersistentCacheOptions *options = [SPTPersistentCacheOptions new];
+    options.cachePath = self.cachePath;
+    options.cacheIdentifier = @"Test";
+    options.processSharedLocking = YES;
+    SPTPersistentCache *cache = [[SPTPersistentCache alloc] initWithOptions:options];
+    SPTPersistentCacheFileManager *fileManager = [[SPTPersistentCacheFileManager alloc] initWithOptions:options];
+
+    NSString *key = @"TEST_SHARED_SEND";
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+    XCTAssertTrue([cache storeDataSync:data forKey:key ttl:0 locked:NO error:nil]);
+    char path[PATH_MAX];
+    XCTAssertTrue([[fileManager pathForKey:key] getFileSystemRepresentation:path maxLength:sizeof(path)]);
+
+    const uint32_t lockCount = 50;
+    const pid_t child = fork();
+    if (child == 0) {
+        // The other process locks the record as many times under the header lock. Only plain C from here on.
+        for (uint32_t i = 0; i < lockCount; ++i) {
+            struct flock lock = {
+                .l_start = 0,
+                .l_len = (off_t)SPTPersistentCacheRecordHeaderSize,
+                .l_type = F_WRLCK,
+                .l_whence = SEEK_SET,
+            };
+            SPTPersistentCacheRecordHeader header;
+            const int fd = open(path, O_RDWR);
+            if (fd == -1 || fcntl(fd, F_SETLKW, &lock) == -1 ||
+                pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+                _exit(1);
+            }
+            header.refCount += 1;
+            header.crc = SPTPersistentCacheCalculateHeaderCRC(&header);
+            if (pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+                _exit(1);
+            }
+            close(fd);
+            usleep(1000);
+        }
+        _exit(0);
+    }
+    XCTAssertGreaterThan(child, 0);
+
+    // Sends of the key open and close its file while other threads hold its header lock
+    int sockets[2];
+    XCTAssertEqual(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    dispatch_group_t group = dispatch_group_create();
+    for (uint32_t i = 0; i < lockCount; ++i) {
+        dispatch_group_enter(group);
+        [cache sendDataForKey:key toFileDescriptor:sockets[0] range:NSMakeRange(0, data.length) callback:^(SPTPersistentCacheResponse *response) {
+            dispatch_group_leave(group);
+        } onQueue:dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0)];
+        dispatch_group_enter(group);
+        [cache lockDataForKeys:@[key] callback:^(SPTPersistentCacheResponse *response) {
+            XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+            dispatch_group_leave(group);
+        } onQueue:dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0)];
+    }
+    XCTAssertEqual(dispatch_group_wait(group, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kDefaultWaitTime * NSEC_PER_SEC))), 0);
+
+    int status = 0;
+    XCTAssertEqual(waitpid(child, &status, 0), child);
+    XCTAssertTrue(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    close(sockets[0]);
+    close(sockets[1]);
+
+    SPTPersistentCacheRecordHeader header;
+    XCTAssertTrue(spt_test_ReadHeaderForFile(path, YES, &header));
+    XCTAssertEqual(header.refCount, 2 * lockCount, @"No lock of either process may be lost");
+}
+#endif
+
+- (void)testLockLeaseExpires
+{
+    SPTPersistentCacheOptions *options = [SPTPersistentCacheOptions new];
+    options.cachePath = self.cachePath;
+    options.cacheIdentifier = @"Test";
+    options.lockLeaseDuration = 60;
+
+    NSTimeInterval __block currentTime = kTestEpochTime;
+    SPTPersistentCacheForUnitTests *cache = [[SPTPersistentCacheForUnitTests alloc] initWithOptions:options];
+    cache.timeIntervalCallback = ^NSTimeInterval{
+        return currentTime;
+    };
+    SPTPersistentCacheFileManager *fileManager = [[SPTPersistentCacheFileManager alloc] initWithOptions:options];
+
+    NSString *key = @"TEST_LEASE";
+    NSString *path = [fileManager pathForKey:key];
+    __weak XCTestExpectation * const storeExpectation = [self expectationWithDescription:@"store"];
+    [cache storeData:[@"TEST" dataUsingEncoding:NSUTF8StringEncoding] forKey:key locked:YES withCallback:^(SPTPersistentCacheResponse *response) {
+        [storeExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    SPTPersistentCacheRecordHeader header;
+    XCTAssertTrue(spt_test_ReadHeaderForFile(path.UTF8String, YES, &header));
+    XCTAssertEqual(header.refCount, 1u);
+    XCTAssertEqual(header.leaseExpirationSec, (uint64_t)kTestEpochTime + 60);
+
+    // Touching renews the lease
+    currentTime = kTestEpochTime + 30;
+    __weak XCTestExpectation * const touchExpectation = [self expectationWithDescription:@"touch"];
+    [cache touchDataForKey:key callback:^(SPTPersistentCacheResponse *response) {
+        [touchExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+    XCTAssertTrue(spt_test_ReadHeaderForFile(path.UTF8String, YES, &header));
+    XCTAssertEqual(header.leaseExpirationSec, (uint64_t)kTestEpochTime + 90);
+
+    currentTime = kTestEpochTime + 89;
+    XCTAssertEqual([cache releaseExpiredLeases], 0u);
+
+    currentTime = kTestEpochTime + 90;
+    XCTAssertEqual([cache releaseExpiredLeases], 1u);
+    XCTAssertTrue(spt_test_ReadHeaderForFile(path.UTF8String, YES, &header));
+    XCTAssertEqual(header.refCount, 0u);
+    XCTAssertEqual(header.leaseExpirationSec, (uint64_t)0);
+}
+
+- (void)testGarbageCollectorReleasesUnindexedLockLease
+{
+    SPTPersistentCacheOptions *options = [SPTPersistentCacheOptions new];
+    options.cachePath = self.cachePath;
+    options.cacheIdentifier = @"Test";
+    options.lockLeaseDuration = 60;
+
+    NSTimeInterval __block currentTime = kTestEpochTime;
+    SPTPersistentCacheForUnitTests *cache = [[SPTPersistentCacheForUnitTests alloc] initWithOptions:options];
+    cache.timeIntervalCallback = ^NSTimeInterval{
+        return currentTime;
+    };
+    SPTPersistentCacheFileManager *fileManager = [[SPTPersistentCacheFileManager alloc] initWithOptions:options];
+
+    NSString *key = @"TEST_LEASE_GC";
+    NSString *path = [fileManager pathForKey:key];
+    __weak XCTestExpectation * const storeExpectation = [self expectationWithDescription:@"store"];
+    [cache storeData:[@"TEST" dataUsingEncoding:NSUTF8StringEncoding] forKey:key locked:YES withCallback:^(SPTPersistentCacheResponse *response) {
+        [storeExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    // A new cache has an empty lease index, as after a restart
+    SPTPersistentCacheForUnitTests *restartedCache = [[SPTPersistentCacheForUnitTests alloc] initWithOptions:options];
+    restartedCache.timeIntervalCallback = ^NSTimeInterval{
+        return currentTime;
+    };
+
+    currentTime = kTestEpochTime + 61;
+    XCTAssertEqual([restartedCache releaseExpiredLeases], 0u);
+    [restartedCache runRegularGC];
+
+    SPTPersistentCacheRecordHeader header;
+    XCTAssertTrue(spt_test_ReadHeaderForFile(path.UTF8String, YES, &header));
+    XCTAssertEqual(header.refCount, 0u);
+    XCTAssertEqual(header.leaseExpirationSec, (uint64_t)0);
+}
+
+- (void)testBatchLockAndUnlock
+{
+    SPTPersistentCacheFileManager *fileManager = [[SPTPersistentCacheFileManager alloc] initWithOptions:self.cache.options];
+    NSString *key = @"TEST_BATCH_LOCK";
+    NSString *missingKey = @"TEST_BATCH_LOCK_MISSING";
+    __weak XCTestExpectation * const storeExpectation = [self expectationWithDescription:@"store"];
+    [self.cache storeData:[@"TEST" dataUsingEncoding:NSUTF8StringEncoding] forKey:key locked:NO withCallback:^(SPTPersistentCacheResponse *response) {
+        [storeExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    SPTPersistentCacheSyncCountingPosixWrapper *posixWrapper = [SPTPersistentCacheSyncCountingPosixWrapper new];
+    self.cache.test_posixWrapper = posixWrapper;
+    __weak XCTestExpectation * const lockExpectation = [self expectationWithDescription:@"lock"];
+    BOOL scheduled = [self.cache batchLockDataForKeys:@[key, missingKey, key] callback:^(NSDictionary<NSString *, SPTPersistentCacheResponse *> *responses) {
+        XCTAssertEqual(responses.count, 2u);
+        XCTAssertEqual(responses[key].result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        XCTAssertEqual(responses[missingKey].result, SPTPersistentCacheResponseCodeNotFound);
+        [lockExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    XCTAssertTrue(scheduled);
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    SPTPersistentCacheRecordHeader header;
+    XCTAssertTrue(spt_test_ReadHeaderForFile([fileManager pathForKey:key].UTF8String, YES, &header));
+    XCTAssertEqual(header.refCount, 2u);
+    // The record only has its data flushed, the folder or the drive is flushed once for the batch
+    XCTAssertEqual(posixWrapper.dataSyncCount, 1u);
+    XCTAssertLessThanOrEqual(posixWrapper.fsyncCount, 1u);
+
+    __weak XCTestExpectation * const unlockExpectation = [self expectationWithDescription:@"unlock"];
+    [self.cache batchUnlockDataForKeys:@[key, key] callback:^(NSDictionary<NSString *, SPTPersistentCacheResponse *> *responses) {
+        XCTAssertEqual(responses.count, 1u);
+        XCTAssertEqual(responses[key].result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        [unlockExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    XCTAssertTrue(spt_test_ReadHeaderForFile([fileManager pathForKey:key].UTF8String, YES, &header));
+    XCTAssertEqual(header.refCount, 0u);
+
+    XCTAssertFalse([self.cache batchLockDataForKeys:@[] callback:nil onQueue:nil]);
+}
+
+- (void)testSendDataToFileDescriptor
+{
+    NSString *key = @"TEST_SEND";
+    __weak XCTestExpectation * const storeExpectation = [self expectationWithDescription:@"store"];
+    [self.cache storeData:[@"0123456789" dataUsingEncoding:NSUTF8StringEncoding] forKey:key locked:NO withCallback:^(SPTPersistentCacheResponse *response) {
+        [storeExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    int sockets[2];
+    XCTAssertEqual(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+
+    __weak XCTestExpectation * const sendExpectation = [self expectationWithDescription:@"send"];
+    BOOL scheduled = [self.cache sendDataForKey:key toFileDescriptor:sockets[0] range:NSMakeRange(2, 100) callback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        [sendExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    XCTAssertTrue(scheduled);
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+    close(sockets[0]);
+
+    char buffer[16] = {0};
+    ssize_t readBytes = read(sockets[1], buffer, sizeof(buffer));
+    close(sockets[1]);
+    XCTAssertEqual(readBytes, 8);
+    XCTAssertEqualObjects([[NSString alloc] initWithBytes:buffer length:8 encoding:NSUTF8StringEncoding], @"23456789");
+
+    // A regular file is written through the buffer where the kernel only sends to sockets
+    NSString *outputPath = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    const int outputFile = open(outputPath.fileSystemRepresentation, O_CREAT | O_WRONLY, 0644);
+    __weak XCTestExpectation * const fileExpectation = [self expectationWithDescription:@"file"];
+    [self.cache sendDataForKey:key toFileDescriptor:outputFile range:NSMakeRange(0, 4) callback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        [fileExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+    close(outputFile);
+
+    XCTAssertEqualObjects([NSData dataWithContentsOfFile:outputPath], [@"0123" dataUsingEncoding:NSUTF8StringEncoding]);
+    [[NSFileManager defaultManager] removeItemAtPath:outputPath error:nil];
+
+    __weak XCTestExpectation * const outOfRangeExpectation = [self expectationWithDescription:@"out of range"];
+    [self.cache sendDataForKey:key toFileDescriptor:STDERR_FILENO range:NSMakeRange(11, 1) callback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationError);
+        XCTAssertEqual(response.error.code, SPTPersistentCacheLoadingErrorWrongPayloadSize);
+        [outOfRangeExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+}
+
+- (void)testSendDoesNotHoldKeyLockWhileSending
+{
+    NSString *key = @"TEST_SEND_UNLOCKED";
+    NSMutableData *payload = [NSMutableData dataWithLength:4 * 1024 * 1024];
+    memset(payload.mutableBytes, 'A', payload.length);
+    XCTAssertTrue([self.cache storeDataSync:payload forKey:key ttl:0 locked:NO error:nil]);
+
+    int sockets[2];
+    XCTAssertEqual(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    __weak XCTestExpectation * const sendExpectation = [self expectationWithDescription:@"send"];
+    [self.cache sendDataForKey:key toFileDescriptor:sockets[0] range:NSMakeRange(0, payload.length) callback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        [sendExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+
+    // Once sending started it waits for the reader, a store of the key mustn't
+    NSMutableData *received = [NSMutableData dataWithLength:1];
+    XCTAssertEqual(read(sockets[1], received.mutableBytes, 1), 1);
+    NSData *newData = [@"NEW" dataUsingEncoding:NSUTF8StringEncoding];
+    dispatch_semaphore_t stored = dispatch_semaphore_create(0);
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^{
+        [self.cache storeDataSync:newData forKey:key ttl:0 locked:NO error:nil];
+        dispatch_semaphore_signal(stored);
+    });
+    XCTAssertEqual(dispatch_semaphore_wait(stored, dispatch_time(DISPATCH_TIME_NOW, 2 * (int64_t)NSEC_PER_SEC)), 0);
+
+    char buffer[64 * 1024];
+    while (received.length < payload.length) {
+        const ssize_t readBytes = read(sockets[1], buffer, sizeof(buffer));
+        if (readBytes <= 0) {
+            break;
+        }
+        [received appendBytes:buffer length:(NSUInteger)readBytes];
+    }
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+    close(sockets[0]);
+    close(sockets[1]);
+
+    XCTAssertEqualObjects(received, payload, @"The opened record keeps the payload it was validated with");
+    XCTAssertEqualObjects([self.cache loadDataForKeySync:key error:nil].data, newData);
+}
+
+- (void)testSynchronousLoadStoreAndStat
+{
+    NSString *key = @"TEST_SYNC";
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+    NSError *error = nil;
+
+    XCTAssertNil([self.cache loadDataForKeySync:key error:&error]);
+    XCTAssertNil(error);
+
+    SPTPersistentCacheRecordHeader header;
+    XCTAssertFalse([self.cache statDataForKeySync:key header:&header error:&error]);
+    XCTAssertNil(error);
+
+    XCTAssertTrue([self.cache storeDataSync:data forKey:key ttl:0 locked:YES error:&error]);
+    XCTAssertNil(error);
+
+    SPTPersistentCacheRecord *record = [self.cache loadDataForKeySync:key error:&error];
+    XCTAssertNil(error);
+    XCTAssertEqualObjects(record.data, data);
+    XCTAssertEqual(record.refCount, 1u);
+
+    XCTAssertTrue([self.cache statDataForKeySync:key header:&header error:&error]);
+    XCTAssertEqual(header.payloadSizeBytes, data.length);
+    XCTAssertEqual(header.refCount, 1u);
+    XCTAssertEqual(header.version, record.version);
+
+    // Queued operations see the synchronous store
+    __weak XCTestExpectation * const loadExpectation = [self expectationWithDescription:@"load"];
+    [self.cache loadDataForKey:key withCallback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqualObjects(response.record.data, data);
+        [loadExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+}
+
+- (void)testCallbackDeliveryOnWorkerThread
+{
+    SPTPersistentCacheOptions *options = [self.cache.options copy];
+    options.callbackDelivery = SPTPersistentCacheCallbackDeliveryWorkerThread;
+    SPTPersistentCache *cache = [[SPTPersistentCache alloc] initWithOptions:options];
+
+    __weak XCTestExpectation * const storeExpectation = [self expectationWithDescription:@"store"];
+    [cache storeData:[@"TEST" dataUsingEncoding:NSUTF8StringEncoding] forKey:@"TEST_WORKER_DELIVERY" locked:NO withCallback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        XCTAssertFalse([NSThread isMainThread], @"The callback should run on the worker thread instead of the given queue");
+        [storeExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+}
+
+- (void)testCallbacksOnWorkerThreadRunAfterKeyLockIsReleased
+{
+    SPTPersistentCacheOptions *options = [self.cache.options copy];
+    options.callbackDelivery = SPTPersistentCacheCallbackDeliveryWorkerThread;
+    SPTPersistentCache *cache = [[SPTPersistentCache alloc] initWithOptions:options];
+    NSString *key = @"TEST_WORKER_DELIVERY_LOCK";
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+
+    // Another thread using the key from a callback would wait forever for a key lock held by the callback
+    BOOL (^loadsOnOtherThread)(void) = ^BOOL{
+        dispatch_semaphore_t loaded = dispatch_semaphore_create(0);
+        dispatch_async(dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^{
+            [cache loadDataForKeySync:key error:nil];
+            dispatch_semaphore_signal(loaded);
+        });
+        return dispatch_semaphore_wait(loaded, dispatch_time(DISPATCH_TIME_NOW, (int64_t)NSEC_PER_SEC)) == 0;
+    };
+
+    __weak XCTestExpectation * const storeExpectation = [self expectationWithDescription:@"store"];
+    [cache storeData:data forKey:key locked:NO withCallback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        XCTAssertTrue(loadsOnOtherThread());
+        [storeExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    __weak XCTestExpectation * const appendExpectation = [self expectationWithDescription:@"append"];
+    [cache appendData:data toKey:key withCallback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        XCTAssertTrue(loadsOnOtherThread());
+        [appendExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+}
+
+- (void)testBatchedCallbackDelivery
+{
+    SPTPersistentCacheOptions *options = [self.cache.options copy];
+    options.callbackDelivery = SPTPersistentCacheCallbackDeliveryBatched;
+    options.callbackBatchInterval = 0.05;
+    SPTPersistentCache *cache = [[SPTPersistentCache alloc] initWithOptions:options];
+
+    const NSUInteger count = 16;
+    dispatch_queue_t queue = dispatch_queue_create("batched.callbacks", DISPATCH_QUEUE_SERIAL);
+    NSMutableSet<NSString *> *keys = [NSMutableSet set];
+    __weak XCTestExpectation * const expectation = [self expectationWithDescription:@"callbacks"];
+    for (NSUInteger i = 0; i < count; ++i) {
+        NSString *key = [NSString stringWithFormat:@"TEST_BATCHED_DELIVERY_%lu", (unsigned long)i];
+        [cache storeData:[key dataUsingEncoding:NSUTF8StringEncoding] forKey:key locked:NO withCallback:^(SPTPersistentCacheResponse *response) {
+            XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+            [keys addObject:key];
+            if (keys.count == count) {
+                [expectation fulfill];
+            }
+        } onQueue:queue];
+    }
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    dispatch_sync(queue, ^{
+        XCTAssertEqual(cache.callbackBatches.count, 0u);
+    });
+}
+
+- (void)testFireAndForgetStoreIsCounted
+{
+    NSString *key = @"TEST_FIRE_AND_FORGET";
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+    const NSUInteger storeCount = self.cache.fireAndForgetStoreCount;
+
+    XCTAssertTrue([self.cache storeData:data forKey:key locked:NO withCallback:nil onQueue:nil]);
+    [self.cache.workQueue waitUntilAllOperationsAreFinished];
+
+    XCTAssertEqual(self.cache.fireAndForgetStoreCount, storeCount + 1);
+    XCTAssertEqual(self.cache.failedFireAndForgetStoreCount, 0u);
+
+    NSError *error = nil;
+    XCTAssertEqualObjects([self.cache loadDataForKeySync:key error:&error].data, data);
+
+    SPTPersistentCacheOptions *options = [self.cache.options copy];
+    options.readOnly = YES;
+    SPTPersistentCache *readOnlyCache = [[SPTPersistentCache alloc] initWithOptions:options];
+    XCTAssertTrue([readOnlyCache storeData:data forKey:key locked:NO withCallback:nil onQueue:nil]);
+    XCTAssertEqual(readOnlyCache.failedFireAndForgetStoreCount, 1u);
+    XCTAssertEqual(readOnlyCache.fireAndForgetStoreCount, 0u);
+}
+
+- (void)testWriteBufferDefersStores
+{
+    SPTPersistentCacheOptions *options = [self.cache.options copy];
+    options.writeBufferSize = 1024;
+    SPTPersistentCache *cache = [[SPTPersistentCache alloc] initWithOptions:options];
+    SPTPersistentCacheFileManager *fileManager = [[SPTPersistentCacheFileManager alloc] initWithOptions:options];
+
+    NSString *key = @"TEST_WRITE_BUFFER";
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+    __weak XCTestExpectation * const storeExpectation = [self expectationWithDescription:@"store"];
+    [cache storeData:data forKey:key locked:NO withCallback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        [storeExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    // Buffered records are readable before they are written
+    NSError *error = nil;
+    XCTAssertEqualObjects([cache loadDataForKeySync:key error:&error].data, data);
+
+    __weak XCTestExpectation * const flushExpectation = [self expectationWithDescription:@"flush"];
+    [cache flushWriteBufferWithCallback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        [flushExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    XCTAssertEqual(cache.writeBuffer.byteCount, 0u);
+    XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:[fileManager pathForKey:key]]);
+    SPTPersistentCacheRecord *record = [cache loadDataForKeySync:key error:&error];
+    XCTAssertEqualObjects(record.data, data);
+    XCTAssertGreaterThan(record.version, 0u);
+
+    // Payloads over the budget are written right away
+    NSString *largeKey = @"TEST_WRITE_BUFFER_LARGE";
+    [cache storeData:[NSMutableData dataWithLength:2048] forKey:largeKey locked:NO withCallback:nil onQueue:nil];
+    XCTAssertNil([cache.writeBuffer entryForKey:largeKey]);
+}
+
+- (void)testWriteBufferIsDroppedByPruneAndWipes
+{
+    SPTPersistentCacheOptions *options = [self.cache.options copy];
+    options.cachePath = [self.cachePath stringByAppendingPathComponent:@"write-buffer-prune"];
+    options.writeBufferSize = 1024;
+    SPTPersistentCache *cache = [[SPTPersistentCache alloc] initWithOptions:options];
+    SPTPersistentCacheFileManager *fileManager = [[SPTPersistentCacheFileManager alloc] initWithOptions:options];
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+
+    // Entries are put into the buffer directly so no flush writes them before the prune or wipe runs
+    void (^buffer)(NSString *, BOOL) = ^(NSString *key, BOOL locked) {
+        BOOL needsFlush = NO;
+        SPTPersistentCacheWriteBufferEntry *entry = [[SPTPersistentCacheWriteBufferEntry alloc] initWithData:data ttl:0 locked:locked];
+        XCTAssertTrue([cache.writeBuffer addEntry:entry forKey:key needsFlush:&needsFlush]);
+    };
+    void (^flush)(void) = ^{
+        __weak XCTestExpectation * const flushExpectation = [self expectationWithDescription:@"flush"];
+        [cache flushWriteBufferWithCallback:^(SPTPersistentCacheResponse *response) {
+            [flushExpectation fulfill];
+        } onQueue:dispatch_get_main_queue()];
+        [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+    };
+
+    buffer(@"TEST_BUFFER_PRUNED", NO);
+    __weak XCTestExpectation * const pruneExpectation = [self expectationWithDescription:@"prune"];
+    [cache pruneWithCallback:^(SPTPersistentCacheResponse *response) {
+        [pruneExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+    flush();
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:[fileManager pathForKey:@"TEST_BUFFER_PRUNED"]]);
+
+    // A wipe drops the buffered records it covers along with the records they replace
+    XCTAssertTrue([cache storeDataSync:data forKey:@"TEST_BUFFER_WIPED" ttl:0 locked:YES error:nil]);
+    buffer(@"TEST_BUFFER_WIPED", NO);
+    buffer(@"TEST_BUFFER_KEPT", YES);
+    __weak XCTestExpectation * const wipeExpectation = [self expectationWithDescription:@"wipe"];
+    [cache wipeNonLockedFilesWithCallback:^(SPTPersistentCacheResponse *response) {
+        [wipeExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+    flush();
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:[fileManager pathForKey:@"TEST_BUFFER_WIPED"]]);
+    XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:[fileManager pathForKey:@"TEST_BUFFER_KEPT"]]);
+}
+
+- (void)testPrefixLoadFindsBufferedRecords
+{
+    SPTPersistentCacheOptions *options = [self.cache.options copy];
+    options.cachePath = [self.cachePath stringByAppendingPathComponent:@"write-buffer-prefix"];
+    options.writeBufferSize = 1024;
+    SPTPersistentCache *cache = [[SPTPersistentCache alloc] initWithOptions:options];
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+
+    BOOL needsFlush = NO;
+    SPTPersistentCacheWriteBufferEntry *entry = [[SPTPersistentCacheWriteBufferEntry alloc] initWithData:data ttl:0 locked:NO];
+    XCTAssertTrue([cache.writeBuffer addEntry:entry forKey:@"TEST_PREFIX_BUFFERED" needsFlush:&needsFlush]);
+
+    __weak XCTestExpectation * const loadExpectation = [self expectationWithDescription:@"load"];
+    [cache loadDataForKeysWithPrefix:@"TEST_PREFIX" chooseKeyCallback:^NSString *(NSArray<NSString *> *keys) {
+        XCTAssertEqualObjects(keys, @[@"TEST_PREFIX_BUFFERED"]);
+        return keys.firstObject;
+    } withCallback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqual(response.result, SPTPersistentCacheResponseCodeOperationSucceeded);
+        XCTAssertEqualObjects(response.record.data, data);
+        [loadExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+}
+
+- (void)testAdaptiveConcurrencyRunsLoadsOnReadQueue
+{
+    SPTPersistentCacheOptions *options = [self.cache.options copy];
+    options.adaptiveConcurrency = YES;
+    SPTPersistentCache *cache = [[SPTPersistentCache alloc] initWithOptions:options];
+    XCTAssertNotNil(cache.readConcurrencyController);
+    XCTAssertNotNil(cache.writeConcurrencyController);
+    XCTAssertNotEqual(cache.readQueue, cache.workQueue);
+    XCTAssertEqual(cache.readQueue.maxConcurrentOperationCount, (NSInteger)cache.readConcurrencyController.limit);
+
+    NSString *key = @"TEST_ADAPTIVE_CONCURRENCY";
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+    __weak XCTestExpectation * const storeExpectation = [self expectationWithDescription:@"store"];
+    [cache storeData:data forKey:key locked:NO withCallback:^(SPTPersistentCacheResponse *response) {
+        [storeExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    __weak XCTestExpectation * const loadExpectation = [self expectationWithDescription:@"load"];
+    [cache loadDataForKey:key withCallback:^(SPTPersistentCacheResponse *response) {
+        XCTAssertEqualObjects(response.record.data, data);
+        [loadExpectation fulfill];
+    } onQueue:dispatch_get_main_queue()];
+    [self waitForExpectationsWithTimeout:kDefaultWaitTime handler:nil];
+
+    XCTAssertEqual(self.cache.readQueue, self.cache.workQueue, @"Loads should share the work queue without adaptive concurrency");
+}
+
+- (void)testGarbageCollectionReadsHeadersInBatches
+{
+    SPTPersistentCacheOptions *options = [self.cache.options copy];
+    options.headerReadQueueDepth = 4;
+    SPTPersistentCache *cache = [[SPTPersistentCache alloc] initWithOptions:options];
+
+    // More records than fit in one batch of header reads
+    const NSUInteger recordCount = 300;
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+    for (NSUInteger i = 0; i < recordCount; ++i) {
+        NSString *key = [NSString stringWithFormat:@"TEST_HEADER_BATCH_%lu", (unsigned long)i];
+        XCTAssertTrue([cache storeDataSync:data forKey:key ttl:0 locked:(i % 10 == 0) error:nil]);
+    }
+
+    [cache collectGarbageForceExpire:YES forceLocked:NO];
+
+    for (NSUInteger i = 0; i < recordCount; ++i) {
+        NSString *key = [NSString stringWithFormat:@"TEST_HEADER_BATCH_%lu", (unsigned long)i];
+        NSError *error = nil;
+        SPTPersistentCacheRecord *record = [cache loadDataForKeySync:key error:&error];
+        XCTAssertNil(error);
+        if (i % 10 == 0) {
+            XCTAssertEqualObjects(record.data, data, @"Locked records should be kept");
+        } else {
+            XCTAssertNil(record, @"Unlocked records should be removed");
+        }
+    }
+}
+
+- (void)testRecordsAreInterchangeableWithCore
+{
+    SPTPersistentCacheOptions *options = [self.cache.options copy];
+    options.cachePath = [self.cachePath stringByAppendingPathComponent:@"core-format"];
+    SPTPersistentCacheForUnitTests *cache = [[SPTPersistentCacheForUnitTests alloc] initWithOptions:options];
+    cache.timeIntervalCallback = ^NSTimeInterval{
+        return kTestEpochTime;
+    };
+    SPTPersistentCacheFileManager *fileManager = [[SPTPersistentCacheFileManager alloc] initWithOptions:options];
+    const sptpc_options coreOptions = {
+        .cache_path = options.cachePath.fileSystemRepresentation,
+        .use_directory_separation = options.useDirectorySeparation,
+        .default_expiration_sec = options.defaultExpirationPeriod,
+    };
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+
+    char path[PATH_MAX];
+    XCTAssertGreaterThan(sptpc_path_for_key(&coreOptions, "TEST_CORE_WRITTEN", path, sizeof(path)), 0);
+    XCTAssertEqualObjects(@(path), [fileManager pathForKey:@"TEST_CORE_WRITTEN"]);
+
+    // Written by the core, loaded by the class
+    XCTAssertEqual(sptpc_record_write(&coreOptions, "TEST_CORE_WRITTEN", data.bytes, data.length, 0, 1, (uint64_t)kTestEpochTime), SPTPC_OK);
+    NSError *error = nil;
+    SPTPersistentCacheRecord *record = [cache loadDataForKeySync:@"TEST_CORE_WRITTEN" error:&error];
+    XCTAssertNil(error);
+    XCTAssertEqualObjects(record.data, data);
+    XCTAssertEqual(record.refCount, 1u);
+    XCTAssertGreaterThan(record.version, 0u);
+
+    // Stored by the class, read by the core
+    XCTAssertTrue([cache storeDataSync:data forKey:@"TEST_CLASS_WRITTEN" ttl:100 locked:NO error:nil]);
+    sptpc_header header;
+    void *payload = NULL;
+    size_t payloadSize = 0;
+    XCTAssertEqual(sptpc_record_read(&coreOptions, "TEST_CLASS_WRITTEN", (uint64_t)kTestEpochTime, &header, &payload, &payloadSize), SPTPC_OK);
+    XCTAssertEqual(payloadSize, data.length);
+    XCTAssertEqual(memcmp(payload, data.bytes, data.length), 0);
+    XCTAssertGreaterThan(header.ttl, 0u);
+    XCTAssertLessThanOrEqual(header.ttl, 100u);
+    XCTAssertEqual(header.ref_count, 0u);
+    free(payload);
+
+    // A record the class replaced keeps counting versions in the core and the other way round
+    XCTAssertEqual(sptpc_record_write(&coreOptions, "TEST_CLASS_WRITTEN", data.bytes, data.length, 0, 0, (uint64_t)kTestEpochTime), SPTPC_OK);
+    sptpc_header replacedHeader;
+    XCTAssertEqual(sptpc_read_header([fileManager pathForKey:@"TEST_CLASS_WRITTEN"].fileSystemRepresentation, &replacedHeader), SPTPC_OK);
+    XCTAssertGreaterThan(replacedHeader.version, header.version);
+    XCTAssertTrue([cache storeDataSync:data forKey:@"TEST_CLASS_WRITTEN" ttl:0 locked:NO error:nil]);
+    XCTAssertGreaterThan([cache loadDataForKeySync:@"TEST_CLASS_WRITTEN" error:nil].version, replacedHeader.version);
+}
+
+- (void)testMetadataTableServesMaintenance
+{
+    SPTPersistentCacheOptions *options = [self.cache.options copy];
+    options.cachePath = [self.cachePath stringByAppendingPathComponent:@"metadata"];
+    options.useMetadataTable = YES;
+    SPTPersistentCache *cache = [[SPTPersistentCache alloc] initWithOptions:options];
+
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+    XCTAssertTrue([cache storeDataSync:data forKey:@"TEST_METADATA_LOCKED" ttl:0 locked:YES error:nil]);
+    XCTAssertTrue([cache storeDataSync:data forKey:@"TEST_METADATA_UNLOCKED" ttl:0 locked:NO error:nil]);
+    NSString *tablePath = [options.cachePath stringByAppendingPathComponent:@".metadata"];
+    XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:tablePath]);
+
+    const NSUInteger recordSize = SPTPersistentCacheRecordHeaderSize + data.length;
+    XCTAssertEqual(cache.totalUsedSizeInBytes, 2 * recordSize);
+    XCTAssertEqual(cache.lockedItemsSizeInBytes, recordSize);
+
+    [cache collectGarbageForceExpire:YES forceLocked:NO];
+    XCTAssertNil([cache loadDataForKeySync:@"TEST_METADATA_UNLOCKED" error:nil]);
+    XCTAssertEqualObjects([cache loadDataForKeySync:@"TEST_METADATA_LOCKED" error:nil].data, data);
+    XCTAssertEqual(cache.totalUsedSizeInBytes, recordSize);
+
+    // Unlocking is mirrored too
+    XCTAssertTrue([cache unlockDataForKeys:@[@"TEST_METADATA_LOCKED"] callback:nil onQueue:nil]);
+    [cache.workQueue waitUntilAllOperationsAreFinished];
+    XCTAssertEqual(cache.lockedItemsSizeInBytes, (NSUInteger)0);
+}
+
+- (void)testMetadataTableGarbageCollectionKeepsStaleRecords
+{
+    SPTPersistentCacheOptions *options = [self.cache.options copy];
+    options.cachePath = [self.cachePath stringByAppendingPathComponent:@"metadata-stale"];
+    options.useMetadataTable = YES;
+    options.staleWhileRevalidatePeriod = 60;
+
+    NSTimeInterval __block currentTime = kTestEpochTime;
+    SPTPersistentCacheForUnitTests *cache = [[SPTPersistentCacheForUnitTests alloc] initWithOptions:options];
+    cache.timeIntervalCallback = ^NSTimeInterval{
+        return currentTime;
+    };
+    SPTPersistentCacheFileManager *fileManager = [[SPTPersistentCacheFileManager alloc] initWithOptions:options];
+    NSFileManager *defaultManager = [NSFileManager defaultManager];
+
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+    XCTAssertTrue([cache storeDataSync:data forKey:@"TEST_METADATA_OLD" ttl:0 locked:NO error:nil]);
+    currentTime = kTestEpochTime + SPTPersistentCacheDefaultExpirationTimeSec + 30;
+    XCTAssertTrue([cache storeDataSync:data forKey:@"TEST_METADATA_NEW" ttl:0 locked:NO error:nil]);
+
+    // Expired but within the grace period
+    [cache collectGarbageForceExpire:NO forceLocked:NO];
+    XCTAssertTrue([defaultManager fileExistsAtPath:[fileManager pathForKey:@"TEST_METADATA_OLD"]]);
+    XCTAssertTrue([defaultManager fileExistsAtPath:[fileManager pathForKey:@"TEST_METADATA_NEW"]]);
+
+    currentTime = kTestEpochTime + SPTPersistentCacheDefaultExpirationTimeSec + 90;
+    [cache collectGarbageForceExpire:NO forceLocked:NO];
+    XCTAssertFalse([defaultManager fileExistsAtPath:[fileManager pathForKey:@"TEST_METADATA_OLD"]]);
+    XCTAssertTrue([defaultManager fileExistsAtPath:[fileManager pathForKey:@"TEST_METADATA_NEW"]]);
+    XCTAssertEqual(cache.totalUsedSizeInBytes, SPTPersistentCacheRecordHeaderSize + data.length);
+}
+
+- (void)testMetadataTableIsKeptByTheFirstCacheOfAFolder
+{
+    SPTPersistentCacheOptions *options = [self.cache.options copy];
+    options.cachePath = [self.cachePath stringByAppendingPathComponent:@"metadata-shared"];
+    options.useMetadataTable = YES;
+    SPTPersistentCache *cache = [[SPTPersistentCache alloc] initWithOptions:options];
+    NSData *data = [@"TEST" dataUsingEncoding:NSUTF8StringEncoding];
+    const NSUInteger recordSize = SPTPersistentCacheRecordHeaderSize + data.length;
+    XCTAssertTrue([cache storeDataSync:data forKey:@"TEST_METADATA_FIRST" ttl:0 locked:NO error:nil]);
+
+    // The second cache scans the folder instead, and doesn't take the table from the first one
+    SPTPersistentCache *secondCache = [[SPTPersistentCache alloc] initWithOptions:options];
+    XCTAssertTrue([secondCache storeDataSync:data forKey:@"TEST_METADATA_SECOND" ttl:0 locked:NO error:nil]);
+    XCTAssertEqualObjects([secondCache loadDataForKeySync:@"TEST_METADATA_FIRST" error:nil].data, data);
+    XCTAssertEqual(secondCache.totalUsedSizeInBytes, 2 * recordSize);
+    secondCache = nil;
+
+    XCTAssertTrue([cache storeDataSync:data forKey:@"TEST_METADATA_THIRD" ttl:0 locked:YES error:nil]);
+    XCTAssertEqual(cache.lockedItemsSizeInBytes, recordSize);
+}
+
 #pragma mark - Internal methods
 
 - (void)putFile:(NSString *)file
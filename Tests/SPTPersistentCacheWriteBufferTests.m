@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#import <XCTest/XCTest.h>
+#import "SPTPersistentCacheWriteBuffer.h"
+
+@interface SPTPersistentCacheWriteBufferTests : XCTestCase
+@property (nonatomic, strong) SPTPersistentCacheWriteBuffer *writeBuffer;
+@end
+
+@implementation SPTPersistentCacheWriteBufferTests
+
+- (void)setUp
+{
+    [super setUp];
+    self.writeBuffer = [[SPTPersistentCacheWriteBuffer alloc] initWithByteBudget:8];
+}
+
+- (SPTPersistentCacheWriteBufferEntry *)entryWithLength:(NSUInteger)length
+{
+    return [[SPTPersistentCacheWriteBufferEntry alloc] initWithData:[NSMutableData dataWithLength:length] ttl:0 locked:NO];
+}
+
+- (void)testInitializer
+{
+    XCTAssertEqual(self.writeBuffer.byteBudget, 8u);
+    XCTAssertEqual(self.writeBuffer.byteCount, 0u);
+    XCTAssertEqualObjects([self.writeBuffer beginFlush], @[]);
+}
+
+- (void)testOnlyFirstEntryAsksForFlush
+{
+    BOOL needsFlush = NO;
+    XCTAssertTrue([self.writeBuffer addEntry:[self entryWithLength:2] forKey:@"A" needsFlush:&needsFlush]);
+    XCTAssertTrue(needsFlush);
+    XCTAssertTrue([self.writeBuffer addEntry:[self entryWithLength:2] forKey:@"B" needsFlush:&needsFlush]);
+    XCTAssertFalse(needsFlush);
+
+    [self.writeBuffer beginFlush];
+    XCTAssertTrue([self.writeBuffer addEntry:[self entryWithLength:2] forKey:@"C" needsFlush:&needsFlush]);
+    XCTAssertTrue(needsFlush);
+}
+
+- (void)testByteBudgetIsEnforced
+{
+    BOOL needsFlush = NO;
+    XCTAssertTrue([self.writeBuffer addEntry:[self entryWithLength:6] forKey:@"A" needsFlush:&needsFlush]);
+    XCTAssertFalse([self.writeBuffer addEntry:[self entryWithLength:4] forKey:@"B" needsFlush:&needsFlush]);
+    XCTAssertFalse(needsFlush);
+    XCTAssertNil([self.writeBuffer entryForKey:@"B"]);
+
+    // Replacing an entry gives its bytes back
+    XCTAssertTrue([self.writeBuffer addEntry:[self entryWithLength:8] forKey:@"A" needsFlush:&needsFlush]);
+    XCTAssertEqual(self.writeBuffer.byteCount, 8u);
+}
+
+- (void)testTakeEntryRemovesIt
+{
+    BOOL needsFlush = NO;
+    SPTPersistentCacheWriteBufferEntry *entry = [self entryWithLength:4];
+    [self.writeBuffer addEntry:entry forKey:@"A" needsFlush:&needsFlush];
+
+    XCTAssertEqual([self.writeBuffer entryForKey:@"A"], entry);
+    XCTAssertEqual([self.writeBuffer takeEntryForKey:@"A"], entry);
+    XCTAssertNil([self.writeBuffer entryForKey:@"A"]);
+    XCTAssertNil([self.writeBuffer takeEntryForKey:@"A"]);
+    XCTAssertEqual(self.writeBuffer.byteCount, 0u);
+}
+
+- (void)testKeysWithPrefix
+{
+    BOOL needsFlush = NO;
+    [self.writeBuffer addEntry:[self entryWithLength:1] forKey:@"AB1" needsFlush:&needsFlush];
+    [self.writeBuffer addEntry:[self entryWithLength:1] forKey:@"AC1" needsFlush:&needsFlush];
+
+    XCTAssertEqualObjects([self.writeBuffer keysWithPrefix:@"AB"], @[@"AB1"]);
+    XCTAssertEqualObjects([self.writeBuffer keysWithPrefix:@"B"], @[]);
+}
+
+- (void)testRemoveEntriesPassingTest
+{
+    BOOL needsFlush = NO;
+    [self.writeBuffer addEntry:[self entryWithLength:2] forKey:@"A" needsFlush:&needsFlush];
+    SPTPersistentCacheWriteBufferEntry *lockedEntry = [[SPTPersistentCacheWriteBufferEntry alloc] initWithData:[NSMutableData dataWithLength:3]
+                                                                                                           ttl:0
+                                                                                                        locked:YES];
+    [self.writeBuffer addEntry:lockedEntry forKey:@"B" needsFlush:&needsFlush];
+
+    NSArray<NSString *> *removedKeys = [self.writeBuffer removeEntriesPassingTest:^BOOL(SPTPersistentCacheWriteBufferEntry *entry) {
+        return entry.locked;
+    }];
+    XCTAssertEqualObjects(removedKeys, @[@"B"]);
+    XCTAssertNil([self.writeBuffer entryForKey:@"B"]);
+    XCTAssertNotNil([self.writeBuffer entryForKey:@"A"]);
+    XCTAssertEqual(self.writeBuffer.byteCount, 2u);
+    XCTAssertEqualObjects([self.writeBuffer beginFlush], @[@"A"]);
+}
+
+- (void)testFlushOrdersLargestFirst
+{
+    BOOL needsFlush = NO;
+    [self.writeBuffer addEntry:[self entryWithLength:1] forKey:@"A" needsFlush:&needsFlush];
+    [self.writeBuffer addEntry:[self entryWithLength:4] forKey:@"B" needsFlush:&needsFlush];
+    [self.writeBuffer addEntry:[self entryWithLength:2] forKey:@"C" needsFlush:&needsFlush];
+
+    XCTAssertEqualObjects([self.writeBuffer beginFlush], (@[@"B", @"C", @"A"]));
+}
+
+@end
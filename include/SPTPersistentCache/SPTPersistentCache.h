@@ -85,7 +85,27 @@ typedef NS_ENUM(NSInteger, SPTPersistentCacheLoadingError) {
     /**
      * Something bad has happened that shouldn't.
      */
-    SPTPersistentCacheLoadingErrorInternalInconsistency
+    SPTPersistentCacheLoadingErrorInternalInconsistency,
+    /**
+     * Conditional store was skipped because a record which can be returned already exists for the key.
+     */
+    SPTPersistentCacheLoadingErrorRecordAlreadyExists,
+    /**
+     * Conditional store was skipped because the version of the stored record is not the expected one.
+     */
+    SPTPersistentCacheLoadingErrorVersionMismatch,
+    /**
+     * Snapshot archive is truncated, corrupted or written in an unknown format.
+     */
+    SPTPersistentCacheLoadingErrorInvalidSnapshot,
+    /**
+     * Operation would modify a cache which is attached read-only.
+     */
+    SPTPersistentCacheLoadingErrorReadOnly,
+    /**
+     * Record file kept being replaced by another process while its header was being altered.
+     */
+    SPTPersistentCacheLoadingErrorRecordReplaced
 };
 
 /**
@@ -104,6 +124,10 @@ typedef void (^SPTPersistentCacheResponseCallback)(SPTPersistentCacheResponse *r
  *  Type of callback that is used to give caller a chance to choose which key to open if any.
  */
 typedef NSString * _Nonnull(^SPTPersistentCacheChooseKeyCallback)(NSArray<NSString *> *keys);
+/**
+ *  Type of callback for batched calls, with the response for each distinct key of the batch.
+ */
+typedef void (^SPTPersistentCacheBatchResponseCallback)(NSDictionary<NSString *, SPTPersistentCacheResponse *> *responses);
 
 
 #pragma mark - SPTPersistentCache Interface
@@ -147,7 +171,8 @@ typedef NSString * _Nonnull(^SPTPersistentCacheChooseKeyCallback)(NSArray<NSStri
  *             Req.#1.1a. To load the data user needs to pick one key and return it.
  *             Req.#1.1b. If non of those are match then return nil and cache will return not found error.
  *             chooseKeyCallback is called on any thread and caller should not do any heavy job in it.
- *             Req.#1.2. Expired records treated as not found on load. (And open stream)
+ *             Req.#1.2. Expired records treated as not found on load. (And open stream) Records within the
+ *             staleWhileRevalidatePeriod of the options are candidates and load marked as stale, like by loadDataForKey.
  * @param prefix Prefix which key should have to be candidate for loading.
  * @param chooseKeyCallback callback to call to define which key to use to load the data. 
  * @param callback callback to call once data is loaded. It mustn't be nil.
@@ -190,6 +215,98 @@ typedef NSString * _Nonnull(^SPTPersistentCacheChooseKeyCallback)(NSArray<NSStri
            locked:(BOOL)locked
      withCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
           onQueue:(dispatch_queue_t _Nullable)queue;
+/**
+ * @discussion Same as storeData:forKey:ttl:locked:withCallback:onQueue: but if ifAbsent is YES the data is only written
+ * when there is no record for the key that could be returned by a load (Req.#1.2). The check and the write are atomic
+ * with respect to other operations of this cache, so of several racing producers only the first one writes its payload.
+ * The others get SPTPersistentCacheResponseCodeOperationError with SPTPersistentCacheLoadingErrorRecordAlreadyExists.
+ * @param data Data to store. Mustn't be nil.
+ * @param key Key to associate the data with.
+ * @param ifAbsent If YES the store is skipped when a record already exists. If NO this is a regular store.
+ * @param ttl TTL value for a file. 0 is equivalent to storeData:forKey: behavior.
+ * @param locked If YES then data refCount is set to 1. If NO then set to 0.
+ * @param callback Callback to call once data is stored or skipped. Could be nil.
+ * @param queue Queue on which to run the callback. Couldn't be nil if callback is specified.
+ */
+- (BOOL)storeData:(NSData *)data
+           forKey:(NSString *)key
+         ifAbsent:(BOOL)ifAbsent
+              ttl:(NSUInteger)ttl
+           locked:(BOOL)locked
+     withCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
+          onQueue:(dispatch_queue_t _Nullable)queue;
+/**
+ * @discussion Compare-and-swap store. The data is only written if the version of the current record for the key equals
+ * expectedVersion, see SPTPersistentCacheRecord.version. A key without a record which can be returned by a load has
+ * version 0. The check and the write are atomic with respect to other operations of this cache. If the versions differ
+ * nothing is written and SPTPersistentCacheResponseCodeOperationError with SPTPersistentCacheLoadingErrorVersionMismatch
+ * is given.
+ * @param data Data to store. Mustn't be nil.
+ * @param key Key to associate the data with.
+ * @param expectedVersion Version the current record must have for the store to happen.
+ * @param ttl TTL value for a file. 0 is equivalent to storeData:forKey: behavior.
+ * @param locked If YES then data refCount is set to 1. If NO then set to 0.
+ * @param callback Callback to call once data is stored or skipped. Could be nil.
+ * @param queue Queue on which to run the callback. Couldn't be nil if callback is specified.
+ */
+- (BOOL)storeData:(NSData *)data
+           forKey:(NSString *)key
+  expectedVersion:(NSUInteger)expectedVersion
+              ttl:(NSUInteger)ttl
+           locked:(BOOL)locked
+     withCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
+          onQueue:(dispatch_queue_t _Nullable)queue;
+/**
+ * @discussion Same as loadDataForKey:withCallback:onQueue: but the record is loaded on the calling thread, which is
+ * blocked until it is done. Loads of the same key are serialized with all other operations of this cache like queued
+ * ones. Meant for callers which are already on a background thread.
+ * @param key Key used to access the data.
+ * @param error Set if the record exists but could not be loaded. Could be NULL.
+ * @return The record, or nil if it doesn't exist, expired (Req.#1.2) or could not be loaded.
+ */
+- (nullable SPTPersistentCacheRecord *)loadDataForKeySync:(NSString *)key error:(NSError * _Nullable *)error;
+/**
+ * @discussion Same as storeData:forKey:ttl:locked:withCallback:onQueue: but the data is written on the calling thread,
+ * which is blocked until it is done. Stores of the same key are serialized with all other operations of this cache.
+ * @param data Data to store. Mustn't be nil.
+ * @param key Key to associate the data with.
+ * @param ttl TTL value for a file. 0 is equivalent to storeData:forKey: behavior.
+ * @param locked If YES then data refCount is set to 1. If NO then set to 0.
+ * @param error Set if the data could not be written. Could be NULL.
+ * @return YES if the data was written.
+ */
+- (BOOL)storeDataSync:(NSData *)data
+               forKey:(NSString *)key
+                  ttl:(NSUInteger)ttl
+               locked:(BOOL)locked
+                error:(NSError * _Nullable *)error;
+/**
+ * @discussion Reads the header of the record for key on the calling thread without loading its payload or updating its
+ * access time. Expired records are treated as not found (Req.#1.2).
+ * @param key Key of the record.
+ * @param header Header to fill in. Mustn't be NULL.
+ * @param error Set if the record exists but its header could not be read. Could be NULL.
+ * @return YES if the record exists and header was filled in.
+ */
+- (BOOL)statDataForKeySync:(NSString *)key
+                    header:(SPTPersistentCacheRecordHeader *)header
+                     error:(NSError * _Nullable *)error;
+/**
+ * @discussion Appends data to the payload of the record for key without rewriting the existing payload.
+ * The appended bytes are written behind the committed payload first and only become part of the record once the
+ * header with the new payload size is written, so an interrupted append leaves the previous payload intact.
+ * TTL, refCount and lock status of the record are kept, its access time and version are updated.
+ * If there is no record for key which could be returned by a load (Req.#1.2) a new unlocked record with default
+ * expiration is created with data as payload.
+ * @param data Data to append. Mustn't be nil.
+ * @param key Key of the record to append to. Mustn't be nil.
+ * @param callback Callback to call once data is appended. Could be nil.
+ * @param queue Queue on which to run the callback. Couldn't be nil if callback is specified.
+ */
+- (BOOL)appendData:(NSData *)data
+             toKey:(NSString *)key
+      withCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
+           onQueue:(dispatch_queue_t _Nullable)queue;
 /**
  * @discussion Update last access time in header of the record. Only applies for default expiration policy (ttl == 0).
  *             Locked files could be touched even if they are expired.
@@ -222,6 +339,38 @@ typedef NSString * _Nonnull(^SPTPersistentCacheChooseKeyCallback)(NSArray<NSStri
 - (BOOL)lockDataForKeys:(NSArray<NSString *> *)keys
                callback:(SPTPersistentCacheResponseCallback _Nullable)callback
                 onQueue:(dispatch_queue_t _Nullable)queue;
+/**
+ * @discussion Write payload of the record for specified key to a file descriptor without bringing it into user space.
+ *             The header is validated like on load, then the payload is moved by the kernel with sendfile. Where the
+ *             kernel can't send to the descriptor, it falls back to copying through a small buffer. The record
+ *             counts as loaded: its access time is updated.
+ *             Req.#1.2. Expired records treated as not found.
+ * @param key Key used to access the data.
+ * @param fileDescriptor Blocking socket or file to write to, written at its current position. It isn't closed.
+ * @param range Range of the payload to write, clipped to the payload size. A location past the end of the payload
+ *              gives SPTPersistentCacheLoadingErrorWrongPayloadSize.
+ * @param callback May be nil if not interested in result.
+ * @param queue Queue on which to run the callback. If callback is nil this is ignored otherwise mustn't be nil.
+ */
+- (BOOL)sendDataForKey:(NSString *)key
+      toFileDescriptor:(int)fileDescriptor
+                 range:(NSRange)range
+              callback:(SPTPersistentCacheResponseCallback _Nullable)callback
+               onQueue:(dispatch_queue_t _Nullable)queue;
+/**
+ * @discussion Warm records for given keys so following loads don't wait for the disk. For each key the record header
+ *             is validated and the system is asked to read the payload ahead into its page cache. This is done with
+ *             prefetch priority and quality of service of the options. Give callback with result for each key in
+ *             input array.
+ *             Req.#1.2. Expired records treated as not found on prefetch. Records within the
+ *             staleWhileRevalidatePeriod of the options are warmed since loads still return them.
+ * @param keys Non nil non empty array of keys.
+ * @param callback May be nil if not interested in result.
+ * @param queue Queue on which to run the callback. If callback is nil this is ignored otherwise mustn't be nil.
+ */
+- (BOOL)prefetchDataForKeys:(NSArray<NSString *> *)keys
+                   callback:(SPTPersistentCacheResponseCallback _Nullable)callback
+                    onQueue:(dispatch_queue_t _Nullable)queue;
 /**
  * @discussion Decrement ref count for given keys. Give callback with result for each key in input array.
  *             If decrements exceeds increments assertion is given.
@@ -232,6 +381,28 @@ typedef NSString * _Nonnull(^SPTPersistentCacheChooseKeyCallback)(NSArray<NSStri
 - (BOOL)unlockDataForKeys:(NSArray<NSString *> *)keys
                  callback:(SPTPersistentCacheResponseCallback _Nullable)callback
                   onQueue:(dispatch_queue_t _Nullable)queue;
+/**
+ * @discussion Increment ref count for given keys as one batch. Headers are updated in path order, a key given several
+ *             times is locked as many times in a single header update. Each record only has its data flushed, see
+ *             fdatasync, and the cache folder is flushed once at the end, or the drive cache on Darwin, instead of a
+ *             full fsync per record. Give a single callback with the result for each distinct key.
+ *             Req.#1.2. Expired records treated as not found on lock.
+ * @param keys Non nil non empty array of keys.
+ * @param callback May be nil if not interested in result.
+ * @param queue Queue on which to run the callback. If callback is nil this is ignored otherwise mustn't be nil.
+ */
+- (BOOL)batchLockDataForKeys:(NSArray<NSString *> *)keys
+                    callback:(SPTPersistentCacheBatchResponseCallback _Nullable)callback
+                     onQueue:(dispatch_queue_t _Nullable)queue;
+/**
+ * @discussion Decrement ref count for given keys as one batch, see `batchLockDataForKeys:callback:onQueue:`.
+ * @param keys Non nil non empty array of keys.
+ * @param callback May be nil if not interested in result.
+ * @param queue Queue on which to run the callback. If callback is nil this is ignored otherwise mustn't be nil.
+ */
+- (BOOL)batchUnlockDataForKeys:(NSArray<NSString *> *)keys
+                      callback:(SPTPersistentCacheBatchResponseCallback _Nullable)callback
+                       onQueue:(dispatch_queue_t _Nullable)queue;
 /**
  * Schedule garbage collection. If already scheduled then this method does nothing.
  */
@@ -261,6 +432,46 @@ typedef NSString * _Nonnull(^SPTPersistentCacheChooseKeyCallback)(NSArray<NSStri
  */
 - (void)wipeNonLockedFilesWithCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
                                onQueue:(dispatch_queue_t _Nullable)queue;
+/**
+ * Sweeps the cache folder for leftovers of interrupted writes and removes them:
+ * temporary files of atomic writes which are older than a minute and records whose file size doesn't match the payload
+ * size in their header. Neither is accounted for by size based pruning. Subdirectories are swept in parallel with
+ * recoveryMaxConcurrentOperations and background quality of service.
+ * @param callback May be nil if not interested in result.
+ * @param queue Queue on which to run the callback. If callback is nil this is ignored otherwise mustn't be nil.
+ */
+- (void)recoverWithCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
+                    onQueue:(dispatch_queue_t _Nullable)queue;
+/**
+ * Packs every record which can be returned, headers included, into a single archive written sequentially. Import it with
+ * importSnapshotFromPath:callback:onQueue: to provision another cache without copying its files one by one.
+ * @param path Path of the archive. An existing file is replaced once the archive is complete.
+ * @param callback May be nil if not interested in result.
+ * @param queue Queue on which to run the callback. If callback is nil this is ignored otherwise mustn't be nil.
+ */
+- (void)exportSnapshotToPath:(NSString *)path
+                    callback:(SPTPersistentCacheResponseCallback _Nullable)callback
+                     onQueue:(dispatch_queue_t _Nullable)queue;
+/**
+ * Stores all records of an archive made by exportSnapshotToPath:callback:onQueue:, replacing records with the same
+ * keys. Records keep their headers, so expiration, lock and version carry over. Records with an invalid header are
+ * skipped. If the archive is malformed nothing is stored and SPTPersistentCacheResponseCodeOperationError with
+ * SPTPersistentCacheLoadingErrorInvalidSnapshot is given.
+ * @param path Path of the archive.
+ * @param callback May be nil if not interested in result.
+ * @param queue Queue on which to run the callback. If callback is nil this is ignored otherwise mustn't be nil.
+ */
+- (void)importSnapshotFromPath:(NSString *)path
+                      callback:(SPTPersistentCacheResponseCallback _Nullable)callback
+                       onQueue:(dispatch_queue_t _Nullable)queue;
+/**
+ * Writes all records held in memory because of `writeBufferSize` of the options. Call it when the application is about
+ * to be suspended or terminated.
+ * @param callback Callback to call once the records are written. Could be nil.
+ * @param queue Queue on which to run the callback. Couldn't be nil if callback is specified.
+ */
+- (void)flushWriteBufferWithCallback:(SPTPersistentCacheResponseCallback _Nullable)callback
+                             onQueue:(dispatch_queue_t _Nullable)queue;
 /**
  * Returns size occupied by cache.
  * @warning This method does synchronous calculations.
@@ -271,6 +482,25 @@ typedef NSString * _Nonnull(^SPTPersistentCacheChooseKeyCallback)(NSArray<NSStri
  * @warning This method does synchronous calculations.
  */
 - (NSUInteger)lockedItemsSizeInBytes;
+/**
+ * Writes the most frequently and recently loaded keys to the cache folder so they are prefetched when the next cache
+ * instance for that folder is created. This also happens on every garbage collection run. Does nothing if hotSetSize of
+ * the options is 0.
+ * @warning This method does synchronous file writing. Call it when the application is about to be suspended or
+ * terminated.
+ * @return YES if the keys were written.
+ */
+- (BOOL)persistHotSet;
+/**
+ * Number of stores made without a callback and without a precondition which were written. Such stores skip building
+ * responses and timing callbacks, so these counters are the only way to learn about their outcome.
+ */
+@property (nonatomic, assign, readonly) NSUInteger fireAndForgetStoreCount;
+/**
+ * Number of stores made without a callback and without a precondition which failed or were rejected by a read-only
+ * cache.
+ */
+@property (nonatomic, assign, readonly) NSUInteger failedFireAndForgetStoreCount;
 
 @end
 
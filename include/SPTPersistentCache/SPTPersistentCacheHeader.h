@@ -35,6 +35,11 @@ typedef NS_ENUM(NSInteger, SPTPersistentCacheRecordHeaderFlags) {
      * This is not an error state but more Application logic.
      */
     SPTPersistentCacheRecordHeaderFlagsStreamIncomplete = 0x1,
+    /*
+     * Indicates that record has been appended to. payloadSizeBytes is then the committed payload length and any bytes
+     * following it in the file belong to an interrupted append and are ignored.
+     */
+    SPTPersistentCacheRecordHeaderFlagsAppendable = 0x2,
 };
 
 /**
@@ -45,12 +50,14 @@ typedef struct SPTPersistentCacheRecordHeader {
     SPTPersistentCacheMagicType magic;
     uint32_t headerSize;
     uint32_t refCount;
-    uint32_t reserved1;
+    // Incremented on every store of the record, 0 for records written before versioning
+    uint32_t version;
     uint64_t ttl;
     // Time of last update i.e. creation or access
     uint64_t updateTimeSec; // unix time scale
     uint64_t payloadSizeBytes;
-    uint64_t reserved2;
+    // Unix time at which the lock lease runs out, 0 if the record has no lease
+    uint64_t leaseExpirationSec;
     uint32_t reserved3;
     uint32_t reserved4;
     uint32_t flags;         // See SPTPersistentRecordHeaderFlags
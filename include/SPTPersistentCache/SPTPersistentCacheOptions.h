@@ -49,7 +49,9 @@ typedef NS_ENUM(NSUInteger, SPTPersistentCacheDebugMethodType) {
     SPTPersistentCacheDebugMethodTypeLock,
     SPTPersistentCacheDebugMethodTypeUnlock,
     SPTPersistentCacheDebugMethodTypeRemove,
-    SPTPersistentCacheDebugMethodTypeRead
+    SPTPersistentCacheDebugMethodTypeRead,
+    SPTPersistentCacheDebugMethodTypeAppend,
+    SPTPersistentCacheDebugMethodTypePrefetch
 };
 
 /**
@@ -61,6 +63,18 @@ typedef NS_ENUM(NSUInteger, SPTPersistentCacheDebugMethodType) {
  */
 typedef void (^SPTPersistentCacheDebugTimingCallback)(NSString *key, SPTPersistentCacheDebugMethodType method, SPTPersistentCacheDebugTimingType type, uint64_t machTime);
 
+/**
+ * How response callbacks are given to the caller.
+ */
+typedef NS_ENUM(NSUInteger, SPTPersistentCacheCallbackDelivery) {
+    /// Each callback is dispatched on its own to the queue given with the request.
+    SPTPersistentCacheCallbackDeliveryQueue,
+    /// Callbacks are called directly on the thread which finished the operation, the given queue is ignored.
+    SPTPersistentCacheCallbackDeliveryWorkerThread,
+    /// Callbacks for the same queue are collected for `callbackBatchInterval` and dispatched to it in one block.
+    SPTPersistentCacheCallbackDeliveryBatched
+};
+
 
 #pragma mark - Garbage Collection Constants
 
@@ -100,6 +114,21 @@ FOUNDATION_EXPORT const NSUInteger SPTPersistentCacheMinimumExpirationLimit;
  *  @note The value is derived from the `cacheIdentifier`.
  */
 @property (nonatomic, copy, readonly) NSString *identifierForQueue;
+/**
+ *  How response callbacks are delivered.
+ *  @discussion `SPTPersistentCacheCallbackDeliveryWorkerThread` saves the dispatch of every response but callbacks
+ *  then run on cache threads, or on the calling thread for requests which are rejected right away, and must be quick.
+ *  `SPTPersistentCacheCallbackDeliveryBatched` keeps callbacks on their queue but dispatches one block per queue and
+ *  interval, which adds up to `callbackBatchInterval` of latency.
+ *  @note Defaults to `SPTPersistentCacheCallbackDeliveryQueue`.
+ */
+@property (nonatomic, assign) SPTPersistentCacheCallbackDelivery callbackDelivery;
+/**
+ *  Time in seconds during which callbacks are collected before being dispatched when `callbackDelivery` is
+ *  `SPTPersistentCacheCallbackDeliveryBatched`.
+ *  @note Defaults to `0.005`.
+ */
+@property (nonatomic, assign) NSTimeInterval callbackBatchInterval;
 
 #pragma mark Cache Options
 
@@ -123,6 +152,27 @@ FOUNDATION_EXPORT const NSUInteger SPTPersistentCacheMinimumExpirationLimit;
  *  @note Defaults to `YES`.
  */
 @property (nonatomic, assign) BOOL useDirectorySeparation;
+/**
+ *  Whether the cache only reads a folder owned by a cache in another process.
+ *  @discussion Record files are memory mapped and loaded payloads point into the mapping, headers are read from the
+ *  mapping and access times are never written back, so loads take no locks and do no I/O besides the mapping. A
+ *  header failing its CRC check may be one the owner is rewriting and is read again a few times before the record is
+ *  reported as corrupt.
+ *  Operations which modify the cache give SPTPersistentCacheLoadingErrorReadOnly, garbage collection and recovery
+ *  don't run. The owning cache should use the same `useDirectorySeparation`.
+ *  @note Defaults to `NO`.
+ */
+@property (nonatomic, assign) BOOL readOnly;
+/**
+ *  Whether header updates, such as the ref count changes of lockDataForKeys and unlockDataForKeys, are made atomic
+ *  across processes sharing the cache folder. Header updates then take a `fcntl` lock on the header of the record
+ *  file. Loads take no lock. Enable it in every process using the folder. Where the system has no open file
+ *  description locks, as on Darwin, closing any descriptor of a file releases the locks the process holds on it. The
+ *  cache then opens and closes record files only under the lock of their key, and a process should have no more than
+ *  one cache of the folder.
+ *  @note Defaults to `NO`.
+ */
+@property (nonatomic, assign) BOOL processSharedLocking;
 
 #pragma mark Priority Options
 
@@ -130,6 +180,15 @@ FOUNDATION_EXPORT const NSUInteger SPTPersistentCacheMinimumExpirationLimit;
  * Max concurrent operations that the cache can perform. Defaults to NSOperationQueueDefaultMaxConcurrentOperationCount.
  */
 @property (nonatomic) NSInteger maxConcurrentOperations;
+/**
+ *  Whether the number of concurrent operations adapts to the latency of the disk.
+ *  @discussion Loads then run on a queue of their own. The concurrency of loads and the concurrency of the other
+ *  operations are adjusted separately from the latency of loads and stores: lowered while latency climbs well above the
+ *  lowest seen and raised while it doesn't. `maxConcurrentOperations` becomes the upper bound, twice the number of
+ *  active processors if it is left at its default.
+ *  @note Defaults to `NO`.
+ */
+@property (nonatomic, assign) BOOL adaptiveConcurrency;
 /**
  * The queue priority for writes. Will also be used for touch and lock. Defaults to NSOperationQueuePriorityNormal.
  */
@@ -155,6 +214,14 @@ FOUNDATION_EXPORT const NSUInteger SPTPersistentCacheMinimumExpirationLimit;
  * The queue quality of service for deletes. Will also be used for unlock, prune, and wipe. Defaults to NSQualityOfServiceDefault.
  */
 @property (nonatomic) NSQualityOfService deleteQualityOfService;
+/**
+ * The queue priority for prefetches. Defaults to NSOperationQueuePriorityVeryLow.
+ */
+@property (nonatomic) NSOperationQueuePriority prefetchPriority;
+/**
+ * The queue quality of service for prefetches. Defaults to NSQualityOfServiceUtility.
+ */
+@property (nonatomic) NSQualityOfService prefetchQualityOfService;
 
 #pragma mark Garbage Collection Options
 
@@ -173,6 +240,41 @@ FOUNDATION_EXPORT const NSUInteger SPTPersistentCacheMinimumExpirationLimit;
  *  @note Defaults to `SPTPersistentCacheDefaultExpirationTimeSec`.
  */
 @property (nonatomic, assign) NSUInteger defaultExpirationPeriod;
+/**
+ *  Time period, in seconds, after expiration during which an unlocked record is still returned by loads but marked as
+ *  stale, see `SPTPersistentCacheResponse.stale`. This lets the caller use the record right away and refresh it in the
+ *  background. Stale records don't get their access time updated and aren't removed by the garbage collection until
+ *  the period has passed.
+ *  @note Defaults to `0` (expired records are treated as not found).
+ */
+@property (nonatomic, assign) NSUInteger staleWhileRevalidatePeriod;
+/**
+ *  Scales how early before expiration loads start recommending a refresh, see
+ *  `SPTPersistentCacheResponse.refreshRecommended`. Each load decides randomly (XFetch), with the probability growing
+ *  towards the expiration time, so refreshes of records expiring at the same time are spread out. Values above `1.0`
+ *  favour earlier refreshes.
+ *  @note Defaults to `0.0` (no early refresh recommendations).
+ */
+@property (nonatomic, assign) double earlyExpirationBeta;
+/**
+ *  Estimated time, in seconds, it takes the caller to recompute a record. Used together with `earlyExpirationBeta`.
+ *  @note Defaults to `1.0`.
+ */
+@property (nonatomic, assign) NSTimeInterval earlyExpirationRecomputeTime;
+/**
+ *  Fraction, between `0.0` and `1.0`, of the TTL by which stores randomly shorten it, so records stored together don't
+ *  expire together. The shortened TTL is stored, so the `ttl` of a loaded record includes the jitter. Records without a
+ *  TTL aren't jittered, loads keep moving their expiration.
+ *  @note Defaults to `0.0` (no jitter).
+ */
+@property (nonatomic, assign) double expirationJitterFactor;
+/**
+ *  Duration, in seconds, of the lease taken by locking a record. Locking or touching a locked record renews the lease.
+ *  Once the lease has run out the record counts as unlocked and garbage collection releases the lock, so records
+ *  locked by a caller that never unlocks them aren't kept forever.
+ *  @note Defaults to `0` (locks never expire).
+ */
+@property (nonatomic, assign) NSUInteger lockLeaseDuration;
 /**
  *  Size in bytes to which cache should adjust itself when performing GC. `0` - no size constraint.
  *  @note Defaults to `0` (unbounded).
@@ -186,6 +288,65 @@ FOUNDATION_EXPORT const NSUInteger SPTPersistentCacheMinimumExpirationLimit;
  * The queue quality of service for garbage collection. Defaults to NSQualityOfServiceBackground.
  */
 @property (nonatomic) NSQualityOfService garbageCollectionQualityOfService;
+/**
+ *  Max number of cache subdirectories scanned at the same time by garbage collection and size pruning.
+ *  @note Defaults to `4`.
+ */
+@property (nonatomic, assign) NSInteger scanMaxConcurrentOperations;
+/**
+ *  Number of record header reads garbage collection and size pruning keep in flight. Headers are read in batches of
+ *  files sorted by path, `0` or `1` reads them one at a time. With `processSharedLocking` on systems without open file
+ *  description locks they are read one at a time under the lock of their key.
+ *  @note Defaults to `8`.
+ */
+@property (nonatomic, assign) NSUInteger headerReadQueueDepth;
+/**
+ *  Whether to mirror the header of every record in a memory mapped table, the hidden file `.metadata` in the cache
+ *  folder. Garbage collection, size pruning, `totalUsedSizeInBytes` and `lockedItemsSizeInBytes` then scan the table
+ *  instead of opening every record file. The table is rebuilt from the records when it is missing or was left in the
+ *  middle of a change, and records which changed while the process was killed are mirrored again by recovery.
+ *  Ignored by read-only caches and with `processSharedLocking` since other processes don't update the table. Keys
+ *  longer than 63 bytes don't fit into the table, maintenance scans the folder instead while there are any.
+ *  @note Defaults to `NO`.
+ */
+@property (nonatomic, assign) BOOL useMetadataTable;
+
+#pragma mark Recovery Options
+
+/**
+ *  Whether to run `recoverWithCallback:onQueue:` in the background when the cache is created.
+ *  @note Defaults to `NO`.
+ */
+@property (nonatomic, assign) BOOL recoverOnStart;
+/**
+ *  Max number of cache subdirectories the recovery sweeps at the same time. Keep it low to leave disk bandwidth to
+ *  regular cache operations.
+ *  @note Defaults to `2`.
+ */
+@property (nonatomic, assign) NSInteger recoveryMaxConcurrentOperations;
+
+#pragma mark Write-Behind Options
+
+/**
+ *  Number of payload bytes which may be held in memory by stores waiting to be written.
+ *  @discussion When non zero, stores without a precondition complete as soon as their payload is in the buffer, where
+ *  loads by key find it, and the buffered records are written in the background largest first. Other operations on a
+ *  buffered key write it first, prefix loads consider buffered keys and prunes and wipes drop the buffered records they
+ *  cover. Stores which don't fit in the budget are written right away. Buffered records are lost
+ *  if the process ends before they are written, use `flushWriteBufferWithCallback:onQueue:` where that matters.
+ *  @note Defaults to `0` (stores are written right away).
+ */
+@property (nonatomic, assign) NSUInteger writeBufferSize;
+
+#pragma mark Warming Options
+
+/**
+ *  Number of the most frequently and recently loaded keys which are persisted and prefetched with
+ *  `prefetchDataForKeys:callback:onQueue:` when a cache is created for the same folder. Access frequency decays with
+ *  `defaultExpirationPeriod` as half-life.
+ *  @note Defaults to `0` (no warming).
+ */
+@property (nonatomic, assign) NSUInteger hotSetSize;
 
 #pragma mark Debugging
 
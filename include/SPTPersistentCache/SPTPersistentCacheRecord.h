@@ -36,9 +36,16 @@ NS_ASSUME_NONNULL_BEGIN
  */
 @property (nonatomic, assign, readonly) NSUInteger refCount;
 /**
- * Defines ttl for given record if applicable. 0 means not applicable.
+ * Defines ttl for given record if applicable. 0 means not applicable. It includes the jitter of
+ * `expirationJitterFactor`, so it may be lower than the ttl the record was stored with.
  */
 @property (nonatomic, assign, readonly) NSUInteger ttl;
+/**
+ * Version of the record. It is incremented every time data is stored for the key and can be passed to
+ * storeData:forKey:expectedVersion:ttl:locked:withCallback:onQueue: to do a compare-and-swap update. It is 0 for
+ * records loaded from the write buffer before they are written, see writeBufferSize of SPTPersistentCacheOptions.
+ */
+@property (nonatomic, assign, readonly) NSUInteger version;
 /**
  * Key for that record.
  */
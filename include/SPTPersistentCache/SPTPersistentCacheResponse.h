@@ -64,6 +64,16 @@ typedef NS_ENUM(NSInteger, SPTPersistentCacheResponseCode) {
  * @see SPTPersistentCacheRecord
  */
 @property (nonatomic, strong, readonly) SPTPersistentCacheRecord *record;
+/**
+ * YES if the record has expired but is returned since it is within the staleWhileRevalidatePeriod of the cache options.
+ * The caller should refresh the record.
+ */
+@property (nonatomic, assign, readonly, getter = isStale) BOOL stale;
+/**
+ * YES if the record is close to expiration and the caller should refresh it now, see earlyExpirationBeta of the cache
+ * options. Always YES for stale records.
+ */
+@property (nonatomic, assign, readonly, getter = isRefreshRecommended) BOOL refreshRecommended;
 
 @end
 
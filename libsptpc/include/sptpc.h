@@ -0,0 +1,354 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#ifndef SPTPC_H
+#define SPTPC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Portable core of SPTPersistentCache. Reads and writes the on-disk record format and maintains a cache folder:
+ * scanning, garbage collection and pruning by size. It only depends on the C library and POSIX, so the same cache
+ * format can be served on Linux.
+ *
+ * Times are unix time in seconds and are given by the caller.
+ */
+
+/** The value of the magic number in the record header, "SPTF". */
+#define SPTPC_MAGIC 0x46545053U
+/** The size of the record header in bytes. */
+#define SPTPC_HEADER_SIZE 64U
+/** Length of the subdirectory name, taken from the start of the key, when directory separation is used. */
+#define SPTPC_SUBDIR_NAME_LENGTH 2U
+
+/**
+ * Flags of the record header.
+ */
+enum {
+    /** Record might not have been completed last time it was written. */
+    SPTPC_FLAG_STREAM_INCOMPLETE = 0x1,
+    /** Record has been appended to, bytes after payload_size_bytes belong to an interrupted append. */
+    SPTPC_FLAG_APPENDABLE = 0x2,
+};
+
+/**
+ * The record header making up the front of the file. Same layout as SPTPersistentCacheRecordHeader.
+ */
+typedef struct sptpc_header {
+    uint32_t magic;
+    uint32_t header_size;
+    uint32_t ref_count;
+    uint32_t version;
+    uint64_t ttl;
+    uint64_t update_time_sec;
+    uint64_t payload_size_bytes;
+    uint64_t lease_expiration_sec;
+    uint32_t reserved3;
+    uint32_t reserved4;
+    uint32_t flags;
+    uint32_t crc;
+} sptpc_header;
+
+/**
+ * Result of core calls. Format errors have the values of SPTPersistentCacheLoadingError.
+ */
+typedef enum sptpc_status {
+    SPTPC_OK = 0,
+    SPTPC_ERROR_MAGIC_MISMATCH = 100,
+    SPTPC_ERROR_HEADER_ALIGNMENT_MISMATCH,
+    SPTPC_ERROR_WRONG_HEADER_SIZE,
+    SPTPC_ERROR_WRONG_PAYLOAD_SIZE,
+    SPTPC_ERROR_INVALID_HEADER_CRC,
+    SPTPC_ERROR_NOT_ENOUGH_DATA_TO_GET_HEADER,
+    SPTPC_ERROR_RECORD_IS_STREAM_AND_BUSY,
+    SPTPC_ERROR_INTERNAL_INCONSISTENCY,
+    /** No record for the key. */
+    SPTPC_ERROR_NOT_FOUND = 200,
+    /** Record has expired and isn't locked, it's treated as not found by the cache. */
+    SPTPC_ERROR_EXPIRED,
+    /** A system call failed, errno tells why. */
+    SPTPC_ERROR_POSIX,
+} sptpc_status;
+
+/**
+ * Describes the cache folder.
+ */
+typedef struct sptpc_options {
+    /** Path of the cache folder. */
+    const char *cache_path;
+    /** Non zero to store records in subdirectories named by the first SPTPC_SUBDIR_NAME_LENGTH characters of keys. */
+    int use_directory_separation;
+    /** Expiration period of records stored without TTL, in seconds. */
+    uint64_t default_expiration_sec;
+    /** Size in bytes pruning shrinks the cache to, 0 for no constraint. */
+    uint64_t size_constraint_bytes;
+    /** Number of header reads garbage collection and pruning keep in flight, 0 or 1 to read one at a time. */
+    size_t header_queue_depth;
+} sptpc_options;
+
+/**
+ * A read-only memory mapping of a record file, see sptpc_record_map.
+ */
+typedef struct sptpc_mapping {
+    /** Start of the mapping, where the header is. */
+    void *base;
+    /** Length of the mapping in bytes. */
+    size_t length;
+    /** Copy of the record header. */
+    sptpc_header header;
+    /** Payload inside the mapping. */
+    const void *payload;
+    /** Size of the payload in bytes. */
+    size_t payload_size;
+} sptpc_mapping;
+
+/* Header */
+
+/**
+ * Returns the CRC-32 (ISO 3309) of len bytes at buf.
+ */
+uint32_t sptpc_crc32(const void *buf, size_t len);
+/**
+ * Creates a header with its CRC set.
+ */
+sptpc_header sptpc_header_make(uint64_t ttl, uint64_t payload_size, uint64_t update_time, int locked);
+/**
+ * Returns the CRC of a header, computed over all fields but crc.
+ */
+uint32_t sptpc_header_crc(const sptpc_header *header);
+/**
+ * Checks alignment, magic, CRC and size of a header.
+ */
+sptpc_status sptpc_header_validate(const sptpc_header *header);
+/**
+ * Returns non zero if the record expired at time now.
+ */
+int sptpc_header_is_expired(const sptpc_header *header, uint64_t now, uint64_t default_expiration_sec);
+/**
+ * Returns non zero if the record is locked at time now. Locks whose lease has run out don't count.
+ */
+int sptpc_header_is_locked(const sptpc_header *header, uint64_t now);
+
+/* Records */
+
+/**
+ * Writes the path of the record file for key into buffer.
+ * @return Length of the path, or -1 with errno ENAMETOOLONG if it doesn't fit.
+ */
+int sptpc_path_for_key(const sptpc_options *options, const char *key, char *buffer, size_t size);
+/**
+ * Reads and validates the header of the record file at path.
+ */
+sptpc_status sptpc_read_header(const char *path, sptpc_header *header);
+/**
+ * Reads and validates the headers of count files, with up to queue_depth reads in flight on as many threads.
+ * Files are opened without checking they exist first, a file which is gone gets SPTPC_ERROR_NOT_FOUND.
+ * @param headers Receives the header of each file, only meaningful where the status is SPTPC_OK.
+ * @param statuses Receives the status of each read.
+ */
+void sptpc_read_headers(const char *const *paths,
+                        size_t count,
+                        size_t queue_depth,
+                        sptpc_header *headers,
+                        sptpc_status *statuses);
+/**
+ * Reads headers like sptpc_read_headers on threads which are kept for every batch it is given, so a scan reading
+ * its headers in batches starts its threads only once.
+ */
+typedef struct sptpc_header_reader sptpc_header_reader;
+/**
+ * Creates a reader with up to queue_depth reads in flight, the thread calling sptpc_header_reader_read being one of
+ * them. Threads which can't be created leave their share to the others.
+ * @return The reader, or NULL if it can't be allocated.
+ */
+sptpc_header_reader *sptpc_header_reader_create(size_t queue_depth);
+/**
+ * Reads and validates the headers of count files, see sptpc_read_headers. Only one thread may read at a time.
+ * @param reader The reader, or NULL to read on the calling thread only.
+ */
+void sptpc_header_reader_read(sptpc_header_reader *reader,
+                              const char *const *paths,
+                              size_t count,
+                              sptpc_header *headers,
+                              sptpc_status *statuses);
+/**
+ * Stops the threads of the reader and frees it. Does nothing for NULL.
+ */
+void sptpc_header_reader_destroy(sptpc_header_reader *reader);
+/**
+ * Reads the record for key. The payload is malloc()ed and must be freed by the caller.
+ * @return SPTPC_ERROR_EXPIRED for expired records which aren't locked.
+ */
+sptpc_status sptpc_record_read(const sptpc_options *options,
+                               const char *key,
+                               uint64_t now,
+                               sptpc_header *header,
+                               void **payload,
+                               size_t *payload_size);
+/**
+ * Maps the record for key into memory without copying its payload. The mapping stays valid after the record is
+ * replaced or removed, and must be released with sptpc_record_unmap.
+ * @return SPTPC_ERROR_EXPIRED for expired records which aren't locked.
+ */
+sptpc_status sptpc_record_map(const sptpc_options *options, const char *key, uint64_t now, sptpc_mapping *mapping);
+/**
+ * Releases a mapping made by sptpc_record_map. Does nothing for zeroed mappings.
+ */
+void sptpc_record_unmap(sptpc_mapping *mapping);
+/**
+ * Atomically replaces the record for key: the file is written and synced under a temporary name, then renamed.
+ * The version of the new record follows the version of the record it replaces.
+ */
+sptpc_status sptpc_record_write(const sptpc_options *options,
+                                const char *key,
+                                const void *payload,
+                                size_t payload_size,
+                                uint64_t ttl,
+                                int locked,
+                                uint64_t now);
+/**
+ * Removes the record for key.
+ */
+sptpc_status sptpc_record_remove(const sptpc_options *options, const char *key);
+
+/* Maintenance */
+
+/**
+ * Called for each record file found by a scan.
+ * @return Non zero to stop the scan.
+ */
+typedef int (*sptpc_scan_callback)(const char *path, const char *key, uint64_t size, uint64_t mtime, void *context);
+/**
+ * Calls callback for each regular file of the cache folder and its subdirectories. Hidden files are skipped.
+ */
+sptpc_status sptpc_scan(const sptpc_options *options, sptpc_scan_callback callback, void *context);
+/**
+ * Removes records which expired and aren't locked. Files which aren't valid records are left alone.
+ * @param removed_count Set to the number of records removed, may be NULL.
+ */
+sptpc_status sptpc_collect_garbage(const sptpc_options *options, uint64_t now, size_t *removed_count);
+/**
+ * Removes least recently modified records which aren't locked until the cache fits size_constraint_bytes.
+ * @param removed_count Set to the number of records removed, may be NULL.
+ */
+sptpc_status sptpc_prune_by_size(const sptpc_options *options, uint64_t now, size_t *removed_count);
+
+/* Metadata */
+
+/** Name of the metadata table file in the cache folder, hidden so scans skip it. */
+#define SPTPC_METADATA_FILE_NAME ".metadata"
+/** Longest key, in bytes, the metadata table can hold. */
+#define SPTPC_METADATA_MAX_KEY_LENGTH 63U
+
+/**
+ * Table mirroring the header fields of every record of a cache folder, so maintenance scans memory instead of opening
+ * record files. It is a memory mapped file of fixed width columns, one per header field, and is kept by one process
+ * at a time. Record changes are only mirrored by callers of sptpc_metadata_update and sptpc_metadata_remove.
+ */
+typedef struct sptpc_metadata sptpc_metadata;
+
+/**
+ * Called for each row of a metadata table scan. The table is locked meanwhile so it mustn't be changed.
+ * @param header Mirrored header fields of the record, its crc isn't set.
+ * @return Non zero to stop the scan.
+ */
+typedef int (*sptpc_metadata_callback)(const char *key, const sptpc_header *header, void *context);
+/**
+ * Opens the metadata table of the cache folder. A table which is missing, of another format, incomplete, was left in
+ * the middle of a change or wasn't closed by its last owner is rebuilt by reading the headers of all records.
+ * @return SPTPC_ERROR_POSIX if the table can't be mapped or another process keeps it, errno is EBUSY if this process
+ * has it open already.
+ */
+sptpc_status sptpc_metadata_open(const sptpc_options *options, sptpc_metadata **table);
+/**
+ * Syncs the table to disk and closes it. Does nothing for NULL.
+ */
+void sptpc_metadata_close(sptpc_metadata *table);
+/**
+ * Inserts or replaces the row for key.
+ * @return SPTPC_ERROR_POSIX with errno ENAMETOOLONG if key is longer than SPTPC_METADATA_MAX_KEY_LENGTH, the table is
+ * incomplete from then on.
+ */
+sptpc_status sptpc_metadata_update(sptpc_metadata *table, const char *key, const sptpc_header *header);
+/**
+ * Removes the row for key if there is one.
+ */
+void sptpc_metadata_remove(sptpc_metadata *table, const char *key);
+/**
+ * Removes all rows. The table is complete again afterwards.
+ */
+void sptpc_metadata_clear(sptpc_metadata *table);
+/**
+ * Reads the row for key.
+ * @return SPTPC_ERROR_NOT_FOUND if there is no row for key.
+ */
+sptpc_status sptpc_metadata_find(sptpc_metadata *table, const char *key, sptpc_header *header);
+/**
+ * Returns non zero if every record key fitted into the table, only then it mirrors the whole cache folder.
+ */
+int sptpc_metadata_is_complete(sptpc_metadata *table);
+/**
+ * Returns the number of rows.
+ */
+size_t sptpc_metadata_count(sptpc_metadata *table);
+/**
+ * Calls callback for each row.
+ */
+void sptpc_metadata_scan(sptpc_metadata *table, sptpc_metadata_callback callback, void *context);
+/**
+ * Returns the size of all records, header included, from the payload sizes in the table.
+ * @param locked_size Set to the size of the records locked at time now, may be NULL.
+ */
+uint64_t sptpc_metadata_size(sptpc_metadata *table, uint64_t now, uint64_t *locked_size);
+
+/**
+ * Rows sptpc_metadata_select can select, combined with |.
+ */
+typedef enum sptpc_selection {
+    /** Unlocked records expired for longer than the grace period. */
+    SPTPC_SELECT_EXPIRED = 1 << 0,
+    SPTPC_SELECT_UNLOCKED = 1 << 1,
+    SPTPC_SELECT_LOCKED = 1 << 2,
+    /** Records still counting locks whose lease ran out. */
+    SPTPC_SELECT_LEASE_EXPIRED = 1 << 3,
+} sptpc_selection;
+
+/**
+ * Calls callback for each row matching any of the selection flags at time now. The columns are compared with vector
+ * instructions where the CPU has them, so only selected rows are read whole.
+ * @param selection sptpc_selection flags.
+ * @param default_expiration_sec Expiration of records without a ttl.
+ * @param grace_sec Added to the expiration of every record for SPTPC_SELECT_EXPIRED.
+ * @return The number of rows callback was called for.
+ */
+size_t sptpc_metadata_select(sptpc_metadata *table, unsigned selection, uint64_t now,
+                             uint64_t default_expiration_sec, uint64_t grace_sec, sptpc_metadata_callback callback,
+                             void *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,453 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#ifndef SPTPC_HPP
+#define SPTPC_HPP
+
+#include "sptpc.h"
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * C++20 facade of the portable core. Records are returned as read-only mappings of their files, and loads can be
+ * awaited from coroutines which then continue on the threads of the cache's executor.
+ */
+namespace sptpc {
+
+/**
+ * Errors of the core, see sptpc_status. Failed system calls are reported in std::generic_category.
+ */
+enum class Errc {
+    magic_mismatch = SPTPC_ERROR_MAGIC_MISMATCH,
+    header_alignment_mismatch = SPTPC_ERROR_HEADER_ALIGNMENT_MISMATCH,
+    wrong_header_size = SPTPC_ERROR_WRONG_HEADER_SIZE,
+    wrong_payload_size = SPTPC_ERROR_WRONG_PAYLOAD_SIZE,
+    invalid_header_crc = SPTPC_ERROR_INVALID_HEADER_CRC,
+    not_enough_data_to_get_header = SPTPC_ERROR_NOT_ENOUGH_DATA_TO_GET_HEADER,
+    record_is_stream_and_busy = SPTPC_ERROR_RECORD_IS_STREAM_AND_BUSY,
+    internal_inconsistency = SPTPC_ERROR_INTERNAL_INCONSISTENCY,
+    not_found = SPTPC_ERROR_NOT_FOUND,
+    expired = SPTPC_ERROR_EXPIRED,
+};
+
+class ErrorCategory final : public std::error_category {
+public:
+    const char *name() const noexcept override
+    {
+        return "sptpc";
+    }
+
+    std::string message(int code) const override
+    {
+        switch (static_cast<Errc>(code)) {
+            case Errc::magic_mismatch: return "Magic number of the record header mismatches";
+            case Errc::header_alignment_mismatch: return "Record header is not aligned";
+            case Errc::wrong_header_size: return "Record header has the wrong size";
+            case Errc::wrong_payload_size: return "Record payload has the wrong size";
+            case Errc::invalid_header_crc: return "CRC of the record header is invalid";
+            case Errc::not_enough_data_to_get_header: return "Record is too short to hold a header";
+            case Errc::record_is_stream_and_busy: return "Record is opened as stream and busy";
+            case Errc::internal_inconsistency: return "Internal inconsistency";
+            case Errc::not_found: return "Record not found";
+            case Errc::expired: return "Record expired";
+        }
+        return "Unknown error";
+    }
+};
+
+inline const std::error_category &error_category() noexcept
+{
+    static const ErrorCategory category;
+    return category;
+}
+
+inline std::error_code make_error_code(Errc error) noexcept
+{
+    return {static_cast<int>(error), error_category()};
+}
+
+/**
+ * Converts a status of the core, reading errno for failed system calls.
+ */
+inline std::error_code make_error_code(sptpc_status status) noexcept
+{
+    if (status == SPTPC_OK) {
+        return {};
+    }
+    if (status == SPTPC_ERROR_POSIX) {
+        return {errno, std::generic_category()};
+    }
+    return {static_cast<int>(status), error_category()};
+}
+
+} // namespace sptpc
+
+template <>
+struct std::is_error_code_enum<sptpc::Errc> : std::true_type {};
+
+namespace sptpc {
+
+/**
+ * Settings of a Cache, see sptpc_options.
+ */
+struct Options {
+    std::string path;
+    bool use_directory_separation = true;
+    std::chrono::seconds default_expiration{10 * 60};
+    std::uint64_t size_constraint_bytes = 0;
+    std::size_t header_queue_depth = 8;
+    /** Number of threads of the executor running awaited loads. */
+    unsigned worker_count = 1;
+    /** Current unix time in seconds, the system clock if empty. */
+    std::function<std::uint64_t()> clock;
+};
+
+/**
+ * Move-only handle of a loaded record. The record file stays mapped, and the payload valid, for the lifetime of the
+ * handle even if the record is replaced or removed meanwhile.
+ */
+class Record {
+public:
+    Record() noexcept = default;
+
+    explicit Record(const sptpc_mapping &mapping) noexcept
+        : mapping_(mapping)
+    {
+    }
+
+    Record(Record &&other) noexcept
+        : mapping_(std::exchange(other.mapping_, sptpc_mapping{}))
+    {
+    }
+
+    Record &operator=(Record &&other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            mapping_ = std::exchange(other.mapping_, sptpc_mapping{});
+        }
+        return *this;
+    }
+
+    Record(const Record &) = delete;
+    Record &operator=(const Record &) = delete;
+
+    ~Record()
+    {
+        reset();
+    }
+
+    /** The payload, without copying it out of the mapping. */
+    std::span<const std::byte> data() const noexcept
+    {
+        return {static_cast<const std::byte *>(mapping_.payload), mapping_.payload_size};
+    }
+
+    const sptpc_header &header() const noexcept
+    {
+        return mapping_.header;
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return mapping_.base != nullptr;
+    }
+
+    /** Releases the mapping. */
+    void reset() noexcept
+    {
+        sptpc_record_unmap(&mapping_);
+    }
+
+private:
+    sptpc_mapping mapping_{};
+};
+
+struct LoadResult {
+    std::error_code error;
+    Record record;
+};
+
+/**
+ * Fixed pool of threads running the work of a cache. Tasks are linked into the queue, so posting doesn't allocate.
+ * Queued tasks are still run when the executor is destroyed.
+ */
+class Executor {
+public:
+    struct Task {
+        void (*run)(Task *task) = nullptr;
+        Task *next = nullptr;
+    };
+
+    explicit Executor(unsigned thread_count)
+    {
+        threads_.reserve(thread_count > 0 ? thread_count : 1);
+        for (unsigned i = 0; i < (thread_count > 0 ? thread_count : 1); ++i) {
+            threads_.emplace_back([this](std::stop_token stop_token) {
+                work(stop_token);
+            });
+        }
+    }
+
+    Executor(const Executor &) = delete;
+    Executor &operator=(const Executor &) = delete;
+
+    ~Executor()
+    {
+        for (std::jthread &thread : threads_) {
+            thread.request_stop();
+        }
+        // Joins
+        threads_.clear();
+    }
+
+    void post(Task *task) noexcept
+    {
+        task->next = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (tail_ != nullptr) {
+                tail_->next = task;
+            } else {
+                head_ = task;
+            }
+            tail_ = task;
+        }
+        condition_.notify_one();
+    }
+
+private:
+    void work(std::stop_token stop_token)
+    {
+        for (;;) {
+            Task *task = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                condition_.wait(lock, stop_token, [this] {
+                    return head_ != nullptr;
+                });
+                if (head_ == nullptr) {
+                    return;
+                }
+                task = head_;
+                head_ = task->next;
+                if (head_ == nullptr) {
+                    tail_ = nullptr;
+                }
+            }
+            task->run(task);
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable_any condition_;
+    Task *head_ = nullptr;
+    Task *tail_ = nullptr;
+    std::vector<std::jthread> threads_;
+};
+
+class Cache;
+
+/**
+ * Awaitable load, see Cache::load. The coroutine continues on an executor thread of the cache.
+ */
+class LoadOperation : private Executor::Task {
+public:
+    LoadOperation(Cache &cache, std::string_view key) noexcept
+        : cache_(cache)
+        , key_(key)
+    {
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> continuation) noexcept;
+
+    LoadResult await_resume() noexcept
+    {
+        return std::move(result_);
+    }
+
+private:
+    static void execute(Executor::Task *task) noexcept;
+
+    Cache &cache_;
+    std::string_view key_;
+    std::coroutine_handle<> continuation_;
+    LoadResult result_;
+};
+
+/**
+ * A cache folder, alternative to the callback API of SPTPersistentCache for C++ code. Calls ending with _sync run on
+ * the calling thread.
+ */
+class Cache {
+public:
+    explicit Cache(Options options)
+        : options_(std::move(options))
+        , executor_(options_.worker_count)
+    {
+    }
+
+    Cache(const Cache &) = delete;
+    Cache &operator=(const Cache &) = delete;
+
+    LoadResult load_sync(std::string_view key) const
+    {
+        LoadResult result;
+        sptpc_mapping mapping;
+        const sptpc_options options = core_options();
+        const sptpc_status status = with_c_string(key, [&](const char *c_key) {
+            return sptpc_record_map(&options, c_key, now(), &mapping);
+        });
+        result.error = make_error_code(status);
+        if (status == SPTPC_OK) {
+            result.record = Record(mapping);
+        }
+        return result;
+    }
+
+    /**
+     * Loads the record for key on the executor: `auto result = co_await cache.load(key);`. The key must stay alive
+     * until the load completes, which temporaries in the co_await expression do.
+     */
+    LoadOperation load(std::string_view key) noexcept
+    {
+        return LoadOperation(*this, key);
+    }
+
+    std::error_code store_sync(std::string_view key,
+                               std::span<const std::byte> payload,
+                               std::chrono::seconds ttl = std::chrono::seconds::zero(),
+                               bool locked = false)
+    {
+        const sptpc_options options = core_options();
+        return make_error_code(with_c_string(key, [&](const char *c_key) {
+            return sptpc_record_write(&options, c_key, payload.data(), payload.size(), static_cast<std::uint64_t>(ttl.count()), locked, now());
+        }));
+    }
+
+    std::error_code remove_sync(std::string_view key)
+    {
+        const sptpc_options options = core_options();
+        return make_error_code(with_c_string(key, [&](const char *c_key) {
+            return sptpc_record_remove(&options, c_key);
+        }));
+    }
+
+    std::error_code collect_garbage_sync(std::size_t *removed_count = nullptr)
+    {
+        const sptpc_options options = core_options();
+        return make_error_code(sptpc_collect_garbage(&options, now(), removed_count));
+    }
+
+    std::error_code prune_by_size_sync(std::size_t *removed_count = nullptr)
+    {
+        const sptpc_options options = core_options();
+        return make_error_code(sptpc_prune_by_size(&options, now(), removed_count));
+    }
+
+    Executor &executor() noexcept
+    {
+        return executor_;
+    }
+
+    const Options &options() const noexcept
+    {
+        return options_;
+    }
+
+private:
+    std::uint64_t now() const
+    {
+        if (options_.clock) {
+            return options_.clock();
+        }
+        const auto since_epoch = std::chrono::system_clock::now().time_since_epoch();
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(since_epoch).count());
+    }
+
+    sptpc_options core_options() const noexcept
+    {
+        sptpc_options options{};
+        options.cache_path = options_.path.c_str();
+        options.use_directory_separation = options_.use_directory_separation;
+        options.default_expiration_sec = static_cast<std::uint64_t>(options_.default_expiration.count());
+        options.size_constraint_bytes = options_.size_constraint_bytes;
+        options.header_queue_depth = options_.header_queue_depth;
+        return options;
+    }
+
+    /**
+     * Calls function with a NUL terminated copy of string, on the stack unless it is long.
+     */
+    template <typename Function>
+    static sptpc_status with_c_string(std::string_view string, Function &&function)
+    {
+        char buffer[256];
+        if (string.size() < sizeof(buffer)) {
+            std::memcpy(buffer, string.data(), string.size());
+            buffer[string.size()] = '\0';
+            return function(static_cast<const char *>(buffer));
+        }
+        const std::string copy(string);
+        return function(copy.c_str());
+    }
+
+    Options options_;
+    Executor executor_;
+};
+
+inline void LoadOperation::await_suspend(std::coroutine_handle<> continuation) noexcept
+{
+    continuation_ = continuation;
+    run = &LoadOperation::execute;
+    cache_.executor().post(this);
+}
+
+inline void LoadOperation::execute(Executor::Task *task) noexcept
+{
+    LoadOperation *operation = static_cast<LoadOperation *>(task);
+    operation->result_ = operation->cache_.load_sync(operation->key_);
+    operation->continuation_.resume();
+}
+
+} // namespace sptpc
+
+#endif
@@ -21,6 +21,7 @@
 #ifndef CRC32ISO3309_H
 #define CRC32ISO3309_H
 
+#include <stdint.h>
 #include <stdlib.h>
 
 #ifdef __cplusplus
@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include "sptpc.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Scans directory and its subdirectories.
+ * @return Non zero if the callback stopped the scan.
+ */
+static int sptpc_scan_directory(const char *directory, sptpc_scan_callback callback, void *context, sptpc_status *status)
+{
+    DIR *dir = opendir(directory);
+    if (dir == NULL) {
+        *status = SPTPC_ERROR_POSIX;
+        return 0;
+    }
+
+    int stopped = 0;
+    struct dirent *entry;
+    while (!stopped && (entry = readdir(dir)) != NULL) {
+        // Skips ".", ".." and temporary files
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        char path[PATH_MAX];
+        const int length = snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+        if (length < 0 || (size_t)length >= sizeof(path)) {
+            continue;
+        }
+
+        struct stat entry_stat;
+        if (lstat(path, &entry_stat) == -1) {
+            continue;
+        }
+
+        if (S_ISDIR(entry_stat.st_mode)) {
+            stopped = sptpc_scan_directory(path, callback, context, status);
+        } else if (S_ISREG(entry_stat.st_mode)) {
+            stopped = callback(path, entry->d_name, (uint64_t)entry_stat.st_size, (uint64_t)entry_stat.st_mtime, context);
+        }
+    }
+
+    closedir(dir);
+    return stopped;
+}
+
+sptpc_status sptpc_scan(const sptpc_options *options, sptpc_scan_callback callback, void *context)
+{
+    sptpc_status status = SPTPC_OK;
+    sptpc_scan_directory(options->cache_path, callback, context, &status);
+    return status;
+}
+
+/**
+ * Number of record paths garbage collection gathers before reading their headers.
+ */
+#define SPTPC_HEADER_BATCH_SIZE 256
+
+typedef struct sptpc_gc_context {
+    const sptpc_options *options;
+    sptpc_header_reader *reader;
+    uint64_t now;
+    size_t removed_count;
+    char *paths[SPTPC_HEADER_BATCH_SIZE];
+    sptpc_header headers[SPTPC_HEADER_BATCH_SIZE];
+    sptpc_status statuses[SPTPC_HEADER_BATCH_SIZE];
+    size_t count;
+    int failed;
+} sptpc_gc_context;
+
+/**
+ * Reads the headers of the gathered paths in one batch and removes the expired records among them.
+ */
+static void sptpc_collect_garbage_batch(sptpc_gc_context *gc)
+{
+    sptpc_header_reader_read(gc->reader, (const char *const *)gc->paths, gc->count, gc->headers, gc->statuses);
+    for (size_t i = 0; i < gc->count; ++i) {
+        if (gc->statuses[i] == SPTPC_OK &&
+            sptpc_header_is_expired(&gc->headers[i], gc->now, gc->options->default_expiration_sec) &&
+            !sptpc_header_is_locked(&gc->headers[i], gc->now) &&
+            unlink(gc->paths[i]) == 0) {
+            ++gc->removed_count;
+        }
+        free(gc->paths[i]);
+    }
+    gc->count = 0;
+}
+
+static int sptpc_collect_garbage_callback(const char *path, const char *key, uint64_t size, uint64_t mtime, void *context)
+{
+    (void)key;
+    (void)size;
+    (void)mtime;
+    sptpc_gc_context *gc = context;
+
+    char *record_path = strdup(path);
+    if (record_path == NULL) {
+        gc->failed = 1;
+        return 1;
+    }
+    gc->paths[gc->count++] = record_path;
+    if (gc->count == SPTPC_HEADER_BATCH_SIZE) {
+        sptpc_collect_garbage_batch(gc);
+    }
+    return 0;
+}
+
+sptpc_status sptpc_collect_garbage(const sptpc_options *options, uint64_t now, size_t *removed_count)
+{
+    sptpc_gc_context *context = calloc(1, sizeof(*context));
+    if (context == NULL) {
+        return SPTPC_ERROR_POSIX;
+    }
+    context->options = options;
+    context->now = now;
+    // One reader for all batches of the scan
+    context->reader = sptpc_header_reader_create(options->header_queue_depth);
+
+    sptpc_status status = sptpc_scan(options, sptpc_collect_garbage_callback, context);
+    if (context->failed) {
+        status = SPTPC_ERROR_POSIX;
+    }
+    sptpc_collect_garbage_batch(context);
+    sptpc_header_reader_destroy(context->reader);
+
+    if (removed_count != NULL) {
+        *removed_count = context->removed_count;
+    }
+    free(context);
+    return status;
+}
+
+typedef struct sptpc_prune_candidate {
+    char *path;
+    uint64_t size;
+    uint64_t mtime;
+    int locked;
+} sptpc_prune_candidate;
+
+typedef struct sptpc_prune_context {
+    uint64_t total_size;
+    sptpc_prune_candidate *candidates;
+    size_t count;
+    size_t capacity;
+    int failed;
+} sptpc_prune_context;
+
+static int sptpc_prune_callback(const char *path, const char *key, uint64_t size, uint64_t mtime, void *context)
+{
+    (void)key;
+    sptpc_prune_context *prune = context;
+    prune->total_size += size;
+
+    if (prune->count == prune->capacity) {
+        const size_t capacity = (prune->capacity > 0 ? prune->capacity * 2 : 64);
+        sptpc_prune_candidate *candidates = realloc(prune->candidates, capacity * sizeof(*candidates));
+        if (candidates == NULL) {
+            prune->failed = 1;
+            return 1;
+        }
+        prune->candidates = candidates;
+        prune->capacity = capacity;
+    }
+
+    char *candidate_path = strdup(path);
+    if (candidate_path == NULL) {
+        prune->failed = 1;
+        return 1;
+    }
+    prune->candidates[prune->count++] = (sptpc_prune_candidate){
+        .path = candidate_path,
+        .size = size,
+        .mtime = mtime,
+    };
+    return 0;
+}
+
+/**
+ * Marks the locked candidates, reading their headers in batches in scan order.
+ * @return Non zero if memory for the batch could not be allocated.
+ */
+static int sptpc_mark_locked_candidates(const sptpc_options *options, uint64_t now, sptpc_prune_context *prune)
+{
+    const char **paths = calloc(SPTPC_HEADER_BATCH_SIZE, sizeof(*paths));
+    sptpc_header *headers = calloc(SPTPC_HEADER_BATCH_SIZE, sizeof(*headers));
+    sptpc_status *statuses = calloc(SPTPC_HEADER_BATCH_SIZE, sizeof(*statuses));
+    const int failed = (paths == NULL || headers == NULL || statuses == NULL);
+    sptpc_header_reader *reader = (failed ? NULL : sptpc_header_reader_create(options->header_queue_depth));
+
+    for (size_t offset = 0; !failed && offset < prune->count; offset += SPTPC_HEADER_BATCH_SIZE) {
+        const size_t remaining = prune->count - offset;
+        const size_t count = (remaining < SPTPC_HEADER_BATCH_SIZE ? remaining : SPTPC_HEADER_BATCH_SIZE);
+        for (size_t i = 0; i < count; ++i) {
+            paths[i] = prune->candidates[offset + i].path;
+        }
+        sptpc_header_reader_read(reader, paths, count, headers, statuses);
+        for (size_t i = 0; i < count; ++i) {
+            prune->candidates[offset + i].locked = (statuses[i] == SPTPC_OK && sptpc_header_is_locked(&headers[i], now));
+        }
+    }
+
+    sptpc_header_reader_destroy(reader);
+    free(paths);
+    free(headers);
+    free(statuses);
+    return failed;
+}
+
+static int sptpc_compare_candidates_by_age(const void *lhs, const void *rhs)
+{
+    const sptpc_prune_candidate *left = lhs;
+    const sptpc_prune_candidate *right = rhs;
+    if (left->mtime != right->mtime) {
+        return (left->mtime < right->mtime ? -1 : 1);
+    }
+    return strcmp(left->path, right->path);
+}
+
+sptpc_status sptpc_prune_by_size(const sptpc_options *options, uint64_t now, size_t *removed_count)
+{
+    if (removed_count != NULL) {
+        *removed_count = 0;
+    }
+    if (options->size_constraint_bytes == 0) {
+        return SPTPC_OK;
+    }
+
+    sptpc_prune_context context = {
+        .total_size = 0,
+    };
+    sptpc_status status = sptpc_scan(options, sptpc_prune_callback, &context);
+    if (context.failed || (status == SPTPC_OK && sptpc_mark_locked_candidates(options, now, &context))) {
+        status = SPTPC_ERROR_POSIX;
+    }
+
+    size_t removed = 0;
+    if (status == SPTPC_OK) {
+        // Evict least recently modified records first, locked records count towards the size but are never evicted
+        qsort(context.candidates, context.count, sizeof(*context.candidates), sptpc_compare_candidates_by_age);
+        for (size_t i = 0; i < context.count && context.total_size > options->size_constraint_bytes; ++i) {
+            if (!context.candidates[i].locked && unlink(context.candidates[i].path) == 0) {
+                context.total_size -= context.candidates[i].size;
+                ++removed;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < context.count; ++i) {
+        free(context.candidates[i].path);
+    }
+    free(context.candidates);
+
+    if (removed_count != NULL) {
+        *removed_count = removed;
+    }
+    return status;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include "sptpc.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "crc32iso3309.h"
+
+_Static_assert(sizeof(sptpc_header) == SPTPC_HEADER_SIZE, "Struct sptpc_header has to be packed without padding");
+_Static_assert(offsetof(sptpc_header, crc) == SPTPC_HEADER_SIZE - sizeof(uint32_t), "CRC has to be the last field");
+
+uint32_t sptpc_crc32(const void *buf, size_t len)
+{
+    return spt_crc32((const uint8_t *)buf, len);
+}
+
+sptpc_header sptpc_header_make(uint64_t ttl, uint64_t payload_size, uint64_t update_time, int locked)
+{
+    sptpc_header header;
+    memset(&header, 0, sizeof(header));
+
+    header.magic = SPTPC_MAGIC;
+    header.header_size = SPTPC_HEADER_SIZE;
+    header.ref_count = (locked ? 1 : 0);
+    header.ttl = ttl;
+    header.payload_size_bytes = payload_size;
+    header.update_time_sec = update_time;
+    header.crc = sptpc_header_crc(&header);
+
+    return header;
+}
+
+uint32_t sptpc_header_crc(const sptpc_header *header)
+{
+    if (header == NULL) {
+        return 0;
+    }
+
+    return sptpc_crc32(header, offsetof(sptpc_header, crc));
+}
+
+sptpc_status sptpc_header_validate(const sptpc_header *header)
+{
+    if (header == NULL) {
+        return SPTPC_ERROR_INTERNAL_INCONSISTENCY;
+    }
+
+    // Check that header could be read according to alignment
+    if ((uintptr_t)header % _Alignof(uint32_t) != 0) {
+        return SPTPC_ERROR_HEADER_ALIGNMENT_MISMATCH;
+    }
+
+    if (header->magic != SPTPC_MAGIC) {
+        return SPTPC_ERROR_MAGIC_MISMATCH;
+    }
+
+    if (sptpc_header_crc(header) != header->crc) {
+        return SPTPC_ERROR_INVALID_HEADER_CRC;
+    }
+
+    if (header->header_size != SPTPC_HEADER_SIZE) {
+        return SPTPC_ERROR_WRONG_HEADER_SIZE;
+    }
+
+    return SPTPC_OK;
+}
+
+int sptpc_header_is_expired(const sptpc_header *header, uint64_t now, uint64_t default_expiration_sec)
+{
+    const int64_t threshold = (int64_t)(header->ttl > 0 ? header->ttl : default_expiration_sec);
+    return (int64_t)(now - header->update_time_sec) > threshold;
+}
+
+int sptpc_header_is_locked(const sptpc_header *header, uint64_t now)
+{
+    const int lease_expired = header->lease_expiration_sec != 0 && now >= header->lease_expiration_sec;
+    return header->ref_count > 0 && !lease_expired;
+}
@@ -0,0 +1,368 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include "sptpc_kernels.h"
+
+#include "sptpc.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+// Compiled for AVX2 function by function and only run after checking the CPU
+#define SPTPC_KERNEL_AVX2 1
+#define SPTPC_AVX2_FUNCTION __attribute__((target("avx2")))
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+// NEON is part of every AArch64 CPU
+#define SPTPC_KERNEL_NEON 1
+#include <arm_neon.h>
+#endif
+
+/*
+ * The kernels mirror sptpc_header_is_expired and sptpc_header_is_locked lane by lane: the age of a record is compared
+ * signed, the lease unsigned, and the grace period is added with wrap around like the scalar code does.
+ */
+
+static int sptpc_kernel_selects(const sptpc_kernel_columns *columns, size_t i, const sptpc_kernel_query *query)
+{
+    if (columns->hashes[i] == 0) {
+        return 0;
+    }
+    const uint64_t lease = columns->lease_expirations[i];
+    const int lease_expired = lease != 0 && query->now >= lease;
+    const int has_ref = columns->ref_counts[i] > 0;
+    const int locked = has_ref && !lease_expired;
+
+    const uint64_t ttl = columns->ttls[i];
+    const int64_t threshold = (int64_t)((ttl > 0 ? ttl : query->default_expiration_sec) + query->grace_sec);
+    const int expired = (int64_t)(query->now - columns->update_times[i]) > threshold;
+
+    return ((query->selection & SPTPC_SELECT_EXPIRED) && expired && !locked) ||
+           ((query->selection & SPTPC_SELECT_UNLOCKED) && !locked) ||
+           ((query->selection & SPTPC_SELECT_LOCKED) && locked) ||
+           ((query->selection & SPTPC_SELECT_LEASE_EXPIRED) && has_ref && lease_expired);
+}
+
+void sptpc_kernel_select_scalar(const sptpc_kernel_columns *columns, size_t count, const sptpc_kernel_query *query,
+                                uint64_t *bits)
+{
+    for (size_t word = 0; word < count / 64; ++word) {
+        uint64_t selected = 0;
+        for (size_t bit = 0; bit < 64; ++bit) {
+            if (sptpc_kernel_selects(columns, word * 64 + bit, query)) {
+                selected |= 1ULL << bit;
+            }
+        }
+        bits[word] = selected;
+    }
+}
+
+void sptpc_kernel_size_scalar(const sptpc_kernel_columns *columns, size_t count, uint64_t now, uint64_t *total,
+                              uint64_t *locked)
+{
+    uint64_t total_size = 0;
+    uint64_t locked_size = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (columns->hashes[i] == 0) {
+            continue;
+        }
+        const uint64_t size = SPTPC_HEADER_SIZE + columns->payload_sizes[i];
+        const uint64_t lease = columns->lease_expirations[i];
+        total_size += size;
+        if (columns->ref_counts[i] > 0 && !(lease != 0 && now >= lease)) {
+            locked_size += size;
+        }
+    }
+    *total = total_size;
+    *locked = locked_size;
+}
+
+#if SPTPC_KERNEL_AVX2
+
+SPTPC_AVX2_FUNCTION
+static __m256i sptpc_avx2_load(const uint64_t *column, size_t i)
+{
+    return _mm256_loadu_si256((const __m256i *)(const void *)(column + i));
+}
+
+/**
+ * Lanes of all ones for the locked records of slots [i, i + 4), and for the ones whose lease ran out.
+ */
+SPTPC_AVX2_FUNCTION
+static __m256i sptpc_avx2_locked(const sptpc_kernel_columns *columns, size_t i, __m256i now, __m256i *has_ref,
+                                 __m256i *lease_expired)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_cmpeq_epi64(zero, zero);
+    // AVX2 only compares signed, flipping the sign bits compares unsigned
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+
+    const __m256i refs =
+        _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i *)(const void *)(columns->ref_counts + i)));
+    const __m256i lease = sptpc_avx2_load(columns->lease_expirations, i);
+    const __m256i lease_set = _mm256_andnot_si256(_mm256_cmpeq_epi64(lease, zero), ones);
+    const __m256i lease_after_now =
+        _mm256_cmpgt_epi64(_mm256_xor_si256(lease, sign), _mm256_xor_si256(now, sign));
+
+    *has_ref = _mm256_andnot_si256(_mm256_cmpeq_epi64(refs, zero), ones);
+    *lease_expired = _mm256_andnot_si256(lease_after_now, lease_set);
+    return _mm256_andnot_si256(*lease_expired, *has_ref);
+}
+
+SPTPC_AVX2_FUNCTION
+static void sptpc_kernel_select_avx2(const sptpc_kernel_columns *columns, size_t count,
+                                     const sptpc_kernel_query *query, uint64_t *bits)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_cmpeq_epi64(zero, zero);
+    const __m256i now = _mm256_set1_epi64x((long long)query->now);
+    const __m256i default_expiration = _mm256_set1_epi64x((long long)query->default_expiration_sec);
+    const __m256i grace = _mm256_set1_epi64x((long long)query->grace_sec);
+    const unsigned selection = query->selection;
+
+    for (size_t word = 0; word < count / 64; ++word) {
+        uint64_t selected_bits = 0;
+        for (size_t bit = 0; bit < 64; bit += 4) {
+            const size_t i = word * 64 + bit;
+            __m256i has_ref;
+            __m256i lease_expired;
+            const __m256i locked = sptpc_avx2_locked(columns, i, now, &has_ref, &lease_expired);
+
+            __m256i selected = zero;
+            if (selection & SPTPC_SELECT_EXPIRED) {
+                const __m256i ttl = sptpc_avx2_load(columns->ttls, i);
+                const __m256i threshold = _mm256_add_epi64(
+                    _mm256_blendv_epi8(ttl, default_expiration, _mm256_cmpeq_epi64(ttl, zero)), grace);
+                const __m256i age = _mm256_sub_epi64(now, sptpc_avx2_load(columns->update_times, i));
+                selected = _mm256_andnot_si256(locked, _mm256_cmpgt_epi64(age, threshold));
+            }
+            if (selection & SPTPC_SELECT_UNLOCKED) {
+                selected = _mm256_or_si256(selected, _mm256_andnot_si256(locked, ones));
+            }
+            if (selection & SPTPC_SELECT_LOCKED) {
+                selected = _mm256_or_si256(selected, locked);
+            }
+            if (selection & SPTPC_SELECT_LEASE_EXPIRED) {
+                selected = _mm256_or_si256(selected, _mm256_and_si256(has_ref, lease_expired));
+            }
+            const __m256i empty = _mm256_cmpeq_epi64(sptpc_avx2_load(columns->hashes, i), zero);
+            selected = _mm256_andnot_si256(empty, selected);
+
+            const unsigned lanes = (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(selected));
+            selected_bits |= (uint64_t)lanes << bit;
+        }
+        bits[word] = selected_bits;
+    }
+}
+
+SPTPC_AVX2_FUNCTION
+static void sptpc_kernel_size_avx2(const sptpc_kernel_columns *columns, size_t count, uint64_t now,
+                                   uint64_t *total, uint64_t *locked)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i header_size = _mm256_set1_epi64x((long long)SPTPC_HEADER_SIZE);
+    const __m256i now_lanes = _mm256_set1_epi64x((long long)now);
+    __m256i total_lanes = zero;
+    __m256i locked_lanes = zero;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i has_ref;
+        __m256i lease_expired;
+        const __m256i locked_mask = sptpc_avx2_locked(columns, i, now_lanes, &has_ref, &lease_expired);
+        const __m256i empty = _mm256_cmpeq_epi64(sptpc_avx2_load(columns->hashes, i), zero);
+        const __m256i size = _mm256_andnot_si256(
+            empty, _mm256_add_epi64(sptpc_avx2_load(columns->payload_sizes, i), header_size));
+
+        total_lanes = _mm256_add_epi64(total_lanes, size);
+        locked_lanes = _mm256_add_epi64(locked_lanes, _mm256_and_si256(size, locked_mask));
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)(void *)lanes, total_lanes);
+    const uint64_t total_size = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm256_storeu_si256((__m256i *)(void *)lanes, locked_lanes);
+    const uint64_t locked_size = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+    // Slots past the last multiple of 4
+    const sptpc_kernel_columns tail = {
+        .hashes = columns->hashes + i,
+        .ttls = columns->ttls + i,
+        .update_times = columns->update_times + i,
+        .payload_sizes = columns->payload_sizes + i,
+        .lease_expirations = columns->lease_expirations + i,
+        .ref_counts = columns->ref_counts + i,
+    };
+    uint64_t tail_total = 0;
+    uint64_t tail_locked = 0;
+    sptpc_kernel_size_scalar(&tail, count - i, now, &tail_total, &tail_locked);
+    *total = total_size + tail_total;
+    *locked = locked_size + tail_locked;
+}
+
+static int sptpc_kernel_has_avx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+#elif SPTPC_KERNEL_NEON
+
+static uint64x2_t sptpc_neon_not(uint64x2_t lanes)
+{
+    return vreinterpretq_u64_u32(vmvnq_u32(vreinterpretq_u32_u64(lanes)));
+}
+
+/**
+ * Lanes of all ones for the locked records of slots [i, i + 2), and for the ones whose lease ran out.
+ */
+static uint64x2_t sptpc_neon_locked(const sptpc_kernel_columns *columns, size_t i, uint64x2_t now,
+                                    uint64x2_t *has_ref, uint64x2_t *lease_expired)
+{
+    const uint64x2_t refs = vmovl_u32(vld1_u32(columns->ref_counts + i));
+    const uint64x2_t lease = vld1q_u64(columns->lease_expirations + i);
+
+    *has_ref = vtstq_u64(refs, refs);
+    *lease_expired = vandq_u64(vtstq_u64(lease, lease), vcgeq_u64(now, lease));
+    return vbicq_u64(*has_ref, *lease_expired);
+}
+
+static void sptpc_kernel_select_neon(const sptpc_kernel_columns *columns, size_t count,
+                                     const sptpc_kernel_query *query, uint64_t *bits)
+{
+    const uint64x2_t zero = vdupq_n_u64(0);
+    const uint64x2_t now = vdupq_n_u64(query->now);
+    const uint64x2_t default_expiration = vdupq_n_u64(query->default_expiration_sec);
+    const uint64x2_t grace = vdupq_n_u64(query->grace_sec);
+    const unsigned selection = query->selection;
+
+    for (size_t word = 0; word < count / 64; ++word) {
+        uint64_t selected_bits = 0;
+        for (size_t bit = 0; bit < 64; bit += 2) {
+            const size_t i = word * 64 + bit;
+            uint64x2_t has_ref;
+            uint64x2_t lease_expired;
+            const uint64x2_t locked = sptpc_neon_locked(columns, i, now, &has_ref, &lease_expired);
+
+            uint64x2_t selected = zero;
+            if (selection & SPTPC_SELECT_EXPIRED) {
+                const uint64x2_t ttl = vld1q_u64(columns->ttls + i);
+                const uint64x2_t threshold = vaddq_u64(vbslq_u64(vceqzq_u64(ttl), default_expiration, ttl), grace);
+                const uint64x2_t age = vsubq_u64(now, vld1q_u64(columns->update_times + i));
+                const uint64x2_t expired = vcgtq_s64(vreinterpretq_s64_u64(age), vreinterpretq_s64_u64(threshold));
+                selected = vbicq_u64(expired, locked);
+            }
+            if (selection & SPTPC_SELECT_UNLOCKED) {
+                selected = vorrq_u64(selected, sptpc_neon_not(locked));
+            }
+            if (selection & SPTPC_SELECT_LOCKED) {
+                selected = vorrq_u64(selected, locked);
+            }
+            if (selection & SPTPC_SELECT_LEASE_EXPIRED) {
+                selected = vorrq_u64(selected, vandq_u64(has_ref, lease_expired));
+            }
+            const uint64x2_t hashes = vld1q_u64(columns->hashes + i);
+            selected = vandq_u64(selected, vtstq_u64(hashes, hashes));
+
+            selected_bits |= (vgetq_lane_u64(selected, 0) & 1U) << bit;
+            selected_bits |= (vgetq_lane_u64(selected, 1) & 1U) << (bit + 1);
+        }
+        bits[word] = selected_bits;
+    }
+}
+
+static void sptpc_kernel_size_neon(const sptpc_kernel_columns *columns, size_t count, uint64_t now,
+                                   uint64_t *total, uint64_t *locked)
+{
+    const uint64x2_t header_size = vdupq_n_u64(SPTPC_HEADER_SIZE);
+    const uint64x2_t now_lanes = vdupq_n_u64(now);
+    uint64x2_t total_lanes = vdupq_n_u64(0);
+    uint64x2_t locked_lanes = vdupq_n_u64(0);
+
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        uint64x2_t has_ref;
+        uint64x2_t lease_expired;
+        const uint64x2_t locked_mask = sptpc_neon_locked(columns, i, now_lanes, &has_ref, &lease_expired);
+        const uint64x2_t hashes = vld1q_u64(columns->hashes + i);
+        const uint64x2_t size =
+            vandq_u64(vaddq_u64(vld1q_u64(columns->payload_sizes + i), header_size), vtstq_u64(hashes, hashes));
+
+        total_lanes = vaddq_u64(total_lanes, size);
+        locked_lanes = vaddq_u64(locked_lanes, vandq_u64(size, locked_mask));
+    }
+
+    // Slots past the last multiple of 2
+    const sptpc_kernel_columns tail = {
+        .hashes = columns->hashes + i,
+        .ttls = columns->ttls + i,
+        .update_times = columns->update_times + i,
+        .payload_sizes = columns->payload_sizes + i,
+        .lease_expirations = columns->lease_expirations + i,
+        .ref_counts = columns->ref_counts + i,
+    };
+    uint64_t tail_total = 0;
+    uint64_t tail_locked = 0;
+    sptpc_kernel_size_scalar(&tail, count - i, now, &tail_total, &tail_locked);
+    *total = vaddvq_u64(total_lanes) + tail_total;
+    *locked = vaddvq_u64(locked_lanes) + tail_locked;
+}
+
+#endif
+
+const char *sptpc_kernel_simd_name(void)
+{
+#if SPTPC_KERNEL_AVX2
+    return (sptpc_kernel_has_avx2() ? "avx2" : NULL);
+#elif SPTPC_KERNEL_NEON
+    return "neon";
+#else
+    return NULL;
+#endif
+}
+
+void sptpc_kernel_select(const sptpc_kernel_columns *columns, size_t count, const sptpc_kernel_query *query,
+                         uint64_t *bits)
+{
+#if SPTPC_KERNEL_AVX2
+    if (sptpc_kernel_has_avx2()) {
+        sptpc_kernel_select_avx2(columns, count, query, bits);
+    } else {
+        sptpc_kernel_select_scalar(columns, count, query, bits);
+    }
+#elif SPTPC_KERNEL_NEON
+    sptpc_kernel_select_neon(columns, count, query, bits);
+#else
+    sptpc_kernel_select_scalar(columns, count, query, bits);
+#endif
+}
+
+void sptpc_kernel_size(const sptpc_kernel_columns *columns, size_t count, uint64_t now, uint64_t *total,
+                       uint64_t *locked)
+{
+#if SPTPC_KERNEL_AVX2
+    if (sptpc_kernel_has_avx2()) {
+        sptpc_kernel_size_avx2(columns, count, now, total, locked);
+    } else {
+        sptpc_kernel_size_scalar(columns, count, now, total, locked);
+    }
+#elif SPTPC_KERNEL_NEON
+    sptpc_kernel_size_neon(columns, count, now, total, locked);
+#else
+    sptpc_kernel_size_scalar(columns, count, now, total, locked);
+#endif
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#ifndef SPTPC_KERNELS_H
+#define SPTPC_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Columns of the metadata table the kernels read, slot i of each column belongs to the same row.
+ */
+typedef struct sptpc_kernel_columns {
+    /** 0 marks an empty slot. */
+    const uint64_t *hashes;
+    const uint64_t *ttls;
+    const uint64_t *update_times;
+    const uint64_t *payload_sizes;
+    const uint64_t *lease_expirations;
+    const uint32_t *ref_counts;
+} sptpc_kernel_columns;
+
+/**
+ * What to select, see sptpc_selection.
+ */
+typedef struct sptpc_kernel_query {
+    unsigned selection;
+    uint64_t now;
+    uint64_t default_expiration_sec;
+    uint64_t grace_sec;
+} sptpc_kernel_query;
+
+/**
+ * Returns the name of the vectorized kernels used on this CPU, NULL if the scalar ones are used.
+ */
+const char *sptpc_kernel_simd_name(void);
+/**
+ * Sets bit i % 64 of bits[i / 64] for each selected slot i in [0, count) and clears it for the others.
+ * @param count A multiple of 64.
+ */
+void sptpc_kernel_select(const sptpc_kernel_columns *columns, size_t count, const sptpc_kernel_query *query,
+                         uint64_t *bits);
+/**
+ * Sums SPTPC_HEADER_SIZE plus the payload size of the used slots in [0, count), and of the ones locked at time now.
+ */
+void sptpc_kernel_size(const sptpc_kernel_columns *columns, size_t count, uint64_t now, uint64_t *total,
+                       uint64_t *locked);
+/**
+ * Scalar versions of the kernels above, the vectorized ones must give the same results.
+ */
+void sptpc_kernel_select_scalar(const sptpc_kernel_columns *columns, size_t count, const sptpc_kernel_query *query,
+                                uint64_t *bits);
+void sptpc_kernel_size_scalar(const sptpc_kernel_columns *columns, size_t count, uint64_t now, uint64_t *total,
+                              uint64_t *locked);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
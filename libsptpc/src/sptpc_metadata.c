@@ -0,0 +1,697 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include "sptpc.h"
+#include "sptpc_kernels.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** The value of the magic number in the table header, "SPTM". */
+#define SPTPC_METADATA_MAGIC 0x4D545053U
+#define SPTPC_METADATA_FORMAT_VERSION 2U
+/** Slots of a new table, tables grow by doubling when half full so probes stay short. */
+#define SPTPC_METADATA_MIN_CAPACITY 1024U
+#define SPTPC_METADATA_KEY_SIZE (SPTPC_METADATA_MAX_KEY_LENGTH + 1U)
+/** Number of record headers read at once while rebuilding. */
+#define SPTPC_METADATA_REBUILD_BATCH_SIZE 256U
+/** Number of slots selected at once, a multiple of 64 dividing every capacity. */
+#define SPTPC_METADATA_SELECT_BLOCK_SIZE 1024U
+
+/**
+ * Front of the table file, followed by the columns in the order of the column pointers of sptpc_metadata.
+ */
+typedef struct sptpc_metadata_file_header {
+    uint32_t magic;
+    uint32_t format_version;
+    /** Number of slots, a power of two. */
+    uint32_t capacity;
+    /** Number of used slots. */
+    uint32_t count;
+    /** Non zero while a change is being made, a table found busy is rebuilt. */
+    uint32_t busy;
+    /** Non zero once a key didn't fit. */
+    uint32_t incomplete;
+    /**
+     * Non zero while an owner has the table open. Records may have changed without their rows when the owner exited
+     * without closing the table, such a table is rebuilt.
+     */
+    uint32_t open;
+    uint32_t reserved[9];
+} sptpc_metadata_file_header;
+
+_Static_assert(sizeof(sptpc_metadata_file_header) == 64, "The table header keeps the columns 8 byte aligned");
+
+struct sptpc_metadata {
+    pthread_mutex_t mutex;
+    int fd;
+    /** Identity of the table file in the list of open tables. */
+    dev_t device;
+    ino_t inode;
+    sptpc_metadata *next_open;
+    void *base;
+    size_t length;
+    sptpc_metadata_file_header *file_header;
+    /** Hash of the key in each slot, 0 for empty slots. */
+    uint64_t *hashes;
+    uint64_t *ttls;
+    uint64_t *update_times;
+    uint64_t *payload_sizes;
+    uint64_t *lease_expirations;
+    uint32_t *ref_counts;
+    uint32_t *versions;
+    uint32_t *flags;
+    char (*keys)[SPTPC_METADATA_KEY_SIZE];
+};
+
+/**
+ * Tables open in this process. The lock on the table file only keeps other processes out, and closing any descriptor of
+ * the file would release it, so a second open in this process is refused before the file is opened.
+ */
+static pthread_mutex_t sptpc_metadata_open_tables_mutex = PTHREAD_MUTEX_INITIALIZER;
+static sptpc_metadata *sptpc_metadata_open_tables = NULL;
+
+static size_t sptpc_metadata_length(uint32_t capacity)
+{
+    const size_t row_size = 5 * sizeof(uint64_t) + 3 * sizeof(uint32_t) + SPTPC_METADATA_KEY_SIZE;
+    return sizeof(sptpc_metadata_file_header) + (size_t)capacity * row_size;
+}
+
+/**
+ * FNV-1a of key, never 0 so that 0 can mark empty slots.
+ */
+static uint64_t sptpc_metadata_hash(const char *key)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (const unsigned char *c = (const unsigned char *)key; *c != '\0'; ++c) {
+        hash = (hash ^ *c) * 0x100000001B3ULL;
+    }
+    return (hash != 0 ? hash : 1);
+}
+
+/**
+ * Points the columns into a mapping of capacity slots.
+ */
+static void sptpc_metadata_attach(sptpc_metadata *table, void *base, size_t length, uint32_t capacity)
+{
+    table->base = base;
+    table->length = length;
+    table->file_header = base;
+
+    char *column = (char *)base + sizeof(sptpc_metadata_file_header);
+    table->hashes = (uint64_t *)(void *)column;
+    column += capacity * sizeof(uint64_t);
+    table->ttls = (uint64_t *)(void *)column;
+    column += capacity * sizeof(uint64_t);
+    table->update_times = (uint64_t *)(void *)column;
+    column += capacity * sizeof(uint64_t);
+    table->payload_sizes = (uint64_t *)(void *)column;
+    column += capacity * sizeof(uint64_t);
+    table->lease_expirations = (uint64_t *)(void *)column;
+    column += capacity * sizeof(uint64_t);
+    table->ref_counts = (uint32_t *)(void *)column;
+    column += capacity * sizeof(uint32_t);
+    table->versions = (uint32_t *)(void *)column;
+    column += capacity * sizeof(uint32_t);
+    table->flags = (uint32_t *)(void *)column;
+    column += capacity * sizeof(uint32_t);
+    table->keys = (char (*)[SPTPC_METADATA_KEY_SIZE])(void *)column;
+}
+
+static void sptpc_metadata_detach(sptpc_metadata *table)
+{
+    if (table->base != NULL) {
+        munmap(table->base, table->length);
+        table->base = NULL;
+    }
+}
+
+/**
+ * Replaces the mapping with an empty table of capacity slots.
+ * @return -1 with errno set on failure, the table is left unmapped then.
+ */
+static int sptpc_metadata_map_empty(sptpc_metadata *table, uint32_t capacity)
+{
+    sptpc_metadata_detach(table);
+
+    // Truncating to 0 first zeroes every column
+    const size_t length = sptpc_metadata_length(capacity);
+    if (ftruncate(table->fd, 0) == -1 || ftruncate(table->fd, (off_t)length) == -1) {
+        return -1;
+    }
+    void *base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, table->fd, 0);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+
+    sptpc_metadata_attach(table, base, length, capacity);
+    table->file_header->magic = SPTPC_METADATA_MAGIC;
+    table->file_header->format_version = SPTPC_METADATA_FORMAT_VERSION;
+    table->file_header->capacity = capacity;
+    return 0;
+}
+
+/**
+ * Maps the table left in the file if it is valid, complete and was not in the middle of a change.
+ * @return Non zero if the table was mapped.
+ */
+static int sptpc_metadata_map_existing(sptpc_metadata *table)
+{
+    sptpc_metadata_file_header file_header;
+    struct stat file_stat;
+    if (fstat(table->fd, &file_stat) == -1 ||
+        pread(table->fd, &file_header, sizeof(file_header), 0) != (ssize_t)sizeof(file_header)) {
+        return 0;
+    }
+
+    const uint32_t capacity = file_header.capacity;
+    if (file_header.magic != SPTPC_METADATA_MAGIC ||
+        file_header.format_version != SPTPC_METADATA_FORMAT_VERSION ||
+        file_header.busy != 0 ||
+        file_header.incomplete != 0 ||
+        file_header.open != 0 ||
+        capacity < SPTPC_METADATA_MIN_CAPACITY ||
+        (capacity & (capacity - 1)) != 0 ||
+        file_header.count > capacity / 2 ||
+        (uint64_t)file_stat.st_size != sptpc_metadata_length(capacity)) {
+        return 0;
+    }
+
+    const size_t length = sptpc_metadata_length(capacity);
+    void *base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, table->fd, 0);
+    if (base == MAP_FAILED) {
+        return 0;
+    }
+    sptpc_metadata_attach(table, base, length, capacity);
+    return 1;
+}
+
+/**
+ * Finds the slot of key, or the empty slot where it belongs. Tables are at most half full so there always is one.
+ */
+static size_t sptpc_metadata_slot(const sptpc_metadata *table, const char *key, uint64_t hash, int *found)
+{
+    const size_t mask = table->file_header->capacity - 1;
+    size_t slot = (size_t)hash & mask;
+    while (table->hashes[slot] != 0) {
+        if (table->hashes[slot] == hash && strcmp(table->keys[slot], key) == 0) {
+            *found = 1;
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+    *found = 0;
+    return slot;
+}
+
+static void sptpc_metadata_set_row(sptpc_metadata *table, size_t slot, const sptpc_header *header)
+{
+    table->ttls[slot] = header->ttl;
+    table->update_times[slot] = header->update_time_sec;
+    table->payload_sizes[slot] = header->payload_size_bytes;
+    table->lease_expirations[slot] = header->lease_expiration_sec;
+    table->ref_counts[slot] = header->ref_count;
+    table->versions[slot] = header->version;
+    table->flags[slot] = header->flags;
+}
+
+static sptpc_header sptpc_metadata_row(const sptpc_metadata *table, size_t slot)
+{
+    sptpc_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SPTPC_MAGIC;
+    header.header_size = SPTPC_HEADER_SIZE;
+    header.ref_count = table->ref_counts[slot];
+    header.version = table->versions[slot];
+    header.ttl = table->ttls[slot];
+    header.update_time_sec = table->update_times[slot];
+    header.payload_size_bytes = table->payload_sizes[slot];
+    header.lease_expiration_sec = table->lease_expirations[slot];
+    header.flags = table->flags[slot];
+    return header;
+}
+
+static void sptpc_metadata_move_row(sptpc_metadata *table, size_t to, size_t from)
+{
+    table->hashes[to] = table->hashes[from];
+    table->ttls[to] = table->ttls[from];
+    table->update_times[to] = table->update_times[from];
+    table->payload_sizes[to] = table->payload_sizes[from];
+    table->lease_expirations[to] = table->lease_expirations[from];
+    table->ref_counts[to] = table->ref_counts[from];
+    table->versions[to] = table->versions[from];
+    table->flags[to] = table->flags[from];
+    memcpy(table->keys[to], table->keys[from], SPTPC_METADATA_KEY_SIZE);
+}
+
+/**
+ * Inserts or replaces a row, the table must have room for it. Must be called while the table is busy.
+ */
+static void sptpc_metadata_put(sptpc_metadata *table, const char *key, uint64_t hash, const sptpc_header *header)
+{
+    int found = 0;
+    const size_t slot = sptpc_metadata_slot(table, key, hash, &found);
+    sptpc_metadata_set_row(table, slot, header);
+    if (!found) {
+        strcpy(table->keys[slot], key);
+        table->hashes[slot] = hash;
+        ++table->file_header->count;
+    }
+}
+
+/**
+ * Doubles the capacity, rows are copied aside and put into the remapped file.
+ */
+static int sptpc_metadata_grow(sptpc_metadata *table)
+{
+    const uint32_t capacity = table->file_header->capacity;
+    if (capacity > UINT32_MAX / 2) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    void *old_base = malloc(table->length);
+    if (old_base == NULL) {
+        return -1;
+    }
+    memcpy(old_base, table->base, table->length);
+    sptpc_metadata old_table;
+    memset(&old_table, 0, sizeof(old_table));
+    sptpc_metadata_attach(&old_table, old_base, table->length, capacity);
+
+    if (sptpc_metadata_map_empty(table, capacity * 2) == -1) {
+        free(old_base);
+        return -1;
+    }
+    table->file_header->busy = 1;
+    table->file_header->incomplete = old_table.file_header->incomplete;
+    table->file_header->open = old_table.file_header->open;
+    for (size_t slot = 0; slot < capacity; ++slot) {
+        if (old_table.hashes[slot] != 0) {
+            const sptpc_header header = sptpc_metadata_row(&old_table, slot);
+            sptpc_metadata_put(table, old_table.keys[slot], old_table.hashes[slot], &header);
+        }
+    }
+    free(old_base);
+    return 0;
+}
+
+/**
+ * Inserts or replaces a row, growing the table when it gets half full. Must be called holding the mutex while the
+ * table is busy.
+ */
+static sptpc_status sptpc_metadata_update_locked(sptpc_metadata *table, const char *key, const sptpc_header *header)
+{
+    if (strlen(key) > SPTPC_METADATA_MAX_KEY_LENGTH) {
+        table->file_header->incomplete = 1;
+        errno = ENAMETOOLONG;
+        return SPTPC_ERROR_POSIX;
+    }
+
+    const uint64_t hash = sptpc_metadata_hash(key);
+    int found = 0;
+    sptpc_metadata_slot(table, key, hash, &found);
+
+    if (!found && (table->file_header->count + 1) * 2 > table->file_header->capacity && sptpc_metadata_grow(table) == -1) {
+        // The table was unmapped, it is rebuilt when it is opened next time
+        return SPTPC_ERROR_POSIX;
+    }
+    sptpc_metadata_put(table, key, hash, header);
+    return SPTPC_OK;
+}
+
+typedef struct sptpc_metadata_rebuild_context {
+    sptpc_metadata *table;
+    sptpc_header_reader *reader;
+    char *paths[SPTPC_METADATA_REBUILD_BATCH_SIZE];
+    sptpc_header headers[SPTPC_METADATA_REBUILD_BATCH_SIZE];
+    sptpc_status statuses[SPTPC_METADATA_REBUILD_BATCH_SIZE];
+    size_t count;
+    int failed;
+} sptpc_metadata_rebuild_context;
+
+/**
+ * Reads the headers of the gathered paths in one batch and puts rows for the valid records.
+ */
+static void sptpc_metadata_rebuild_batch(sptpc_metadata_rebuild_context *rebuild)
+{
+    sptpc_header_reader_read(rebuild->reader, (const char *const *)rebuild->paths, rebuild->count, rebuild->headers, rebuild->statuses);
+    for (size_t i = 0; i < rebuild->count; ++i) {
+        const char *separator = strrchr(rebuild->paths[i], '/');
+        const char *key = (separator != NULL ? separator + 1 : rebuild->paths[i]);
+        if (!rebuild->failed && rebuild->statuses[i] == SPTPC_OK &&
+            sptpc_metadata_update_locked(rebuild->table, key, &rebuild->headers[i]) != SPTPC_OK &&
+            rebuild->table->base == NULL) {
+            rebuild->failed = 1;
+        }
+        free(rebuild->paths[i]);
+    }
+    rebuild->count = 0;
+}
+
+static int sptpc_metadata_rebuild_callback(const char *path, const char *key, uint64_t size, uint64_t mtime, void *context)
+{
+    (void)key;
+    (void)size;
+    (void)mtime;
+    sptpc_metadata_rebuild_context *rebuild = context;
+
+    char *record_path = strdup(path);
+    if (record_path == NULL) {
+        rebuild->failed = 1;
+        return 1;
+    }
+    rebuild->paths[rebuild->count++] = record_path;
+    if (rebuild->count == SPTPC_METADATA_REBUILD_BATCH_SIZE) {
+        sptpc_metadata_rebuild_batch(rebuild);
+    }
+    return rebuild->failed;
+}
+
+/**
+ * Replaces the table with rows read from the headers of all records of the cache folder.
+ */
+static sptpc_status sptpc_metadata_rebuild(sptpc_metadata *table, const sptpc_options *options)
+{
+    if (sptpc_metadata_map_empty(table, SPTPC_METADATA_MIN_CAPACITY) == -1) {
+        return SPTPC_ERROR_POSIX;
+    }
+
+    sptpc_metadata_rebuild_context *context = calloc(1, sizeof(*context));
+    if (context == NULL) {
+        return SPTPC_ERROR_POSIX;
+    }
+    context->table = table;
+    // One reader for all batches of the scan
+    context->reader = sptpc_header_reader_create(options->header_queue_depth);
+
+    table->file_header->busy = 1;
+    sptpc_status status = sptpc_scan(options, sptpc_metadata_rebuild_callback, context);
+    sptpc_metadata_rebuild_batch(context);
+    sptpc_header_reader_destroy(context->reader);
+    if (context->failed) {
+        status = SPTPC_ERROR_POSIX;
+    }
+    free(context);
+
+    // A failed rebuild stays busy so it is done again next time
+    if (status == SPTPC_OK) {
+        table->file_header->busy = 0;
+    }
+    return status;
+}
+
+sptpc_status sptpc_metadata_open(const sptpc_options *options, sptpc_metadata **table)
+{
+    *table = NULL;
+
+    char path[PATH_MAX];
+    const int length = snprintf(path, sizeof(path), "%s/%s", options->cache_path, SPTPC_METADATA_FILE_NAME);
+    if (length < 0 || (size_t)length >= sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return SPTPC_ERROR_POSIX;
+    }
+
+    sptpc_metadata *new_table = calloc(1, sizeof(*new_table));
+    if (new_table == NULL) {
+        return SPTPC_ERROR_POSIX;
+    }
+
+    pthread_mutex_lock(&sptpc_metadata_open_tables_mutex);
+    struct stat file_stat;
+    if (stat(path, &file_stat) == 0) {
+        for (const sptpc_metadata *open_table = sptpc_metadata_open_tables; open_table != NULL; open_table = open_table->next_open) {
+            if (open_table->device == file_stat.st_dev && open_table->inode == file_stat.st_ino) {
+                pthread_mutex_unlock(&sptpc_metadata_open_tables_mutex);
+                free(new_table);
+                errno = EBUSY;
+                return SPTPC_ERROR_POSIX;
+            }
+        }
+    }
+
+    sptpc_status status = SPTPC_ERROR_POSIX;
+    new_table->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (new_table->fd != -1) {
+        // Another process keeping the table would not see our changes, nor we its
+        struct flock lock = {
+            .l_type = F_WRLCK,
+            .l_whence = SEEK_SET,
+        };
+        if (fcntl(new_table->fd, F_SETLK, &lock) == 0 && fstat(new_table->fd, &file_stat) == 0) {
+            new_table->device = file_stat.st_dev;
+            new_table->inode = file_stat.st_ino;
+            status = (sptpc_metadata_map_existing(new_table) ? SPTPC_OK : sptpc_metadata_rebuild(new_table, options));
+        }
+    }
+    if (status != SPTPC_OK) {
+        const int error_number = errno;
+        sptpc_metadata_detach(new_table);
+        if (new_table->fd != -1) {
+            close(new_table->fd);
+        }
+        pthread_mutex_unlock(&sptpc_metadata_open_tables_mutex);
+        free(new_table);
+        errno = error_number;
+        return status;
+    }
+
+    // Stays set until the table is closed, and on disk if we exit without closing it
+    new_table->file_header->open = 1;
+    msync(new_table->base, sizeof(sptpc_metadata_file_header), MS_SYNC);
+
+    new_table->next_open = sptpc_metadata_open_tables;
+    sptpc_metadata_open_tables = new_table;
+    pthread_mutex_unlock(&sptpc_metadata_open_tables_mutex);
+
+    pthread_mutex_init(&new_table->mutex, NULL);
+    *table = new_table;
+    return SPTPC_OK;
+}
+
+void sptpc_metadata_close(sptpc_metadata *table)
+{
+    if (table == NULL) {
+        return;
+    }
+    if (table->base != NULL) {
+        msync(table->base, table->length, MS_SYNC);
+        // Cleared only once the rows are on disk
+        table->file_header->open = 0;
+        msync(table->base, sizeof(sptpc_metadata_file_header), MS_SYNC);
+    }
+    sptpc_metadata_detach(table);
+
+    pthread_mutex_lock(&sptpc_metadata_open_tables_mutex);
+    for (sptpc_metadata **link = &sptpc_metadata_open_tables; *link != NULL; link = &(*link)->next_open) {
+        if (*link == table) {
+            *link = table->next_open;
+            break;
+        }
+    }
+    close(table->fd);
+    pthread_mutex_unlock(&sptpc_metadata_open_tables_mutex);
+
+    pthread_mutex_destroy(&table->mutex);
+    free(table);
+}
+
+sptpc_status sptpc_metadata_update(sptpc_metadata *table, const char *key, const sptpc_header *header)
+{
+    sptpc_status status = SPTPC_ERROR_POSIX;
+    pthread_mutex_lock(&table->mutex);
+    if (table->base != NULL) {
+        table->file_header->busy = 1;
+        status = sptpc_metadata_update_locked(table, key, header);
+        if (table->base != NULL) {
+            table->file_header->busy = 0;
+        }
+    }
+    pthread_mutex_unlock(&table->mutex);
+    return status;
+}
+
+void sptpc_metadata_remove(sptpc_metadata *table, const char *key)
+{
+    pthread_mutex_lock(&table->mutex);
+    int found = 0;
+    const size_t hole_slot = (table->base != NULL ? sptpc_metadata_slot(table, key, sptpc_metadata_hash(key), &found) : 0);
+    if (found) {
+        table->file_header->busy = 1;
+
+        // Backward shift deletion: rows after the hole move into it unless that would put them before their home slot
+        const size_t mask = table->file_header->capacity - 1;
+        size_t hole = hole_slot;
+        for (size_t slot = (hole + 1) & mask; table->hashes[slot] != 0; slot = (slot + 1) & mask) {
+            const size_t home = (size_t)table->hashes[slot] & mask;
+            const int stays = (hole <= slot ? (home > hole && home <= slot) : (home > hole || home <= slot));
+            if (!stays) {
+                sptpc_metadata_move_row(table, hole, slot);
+                hole = slot;
+            }
+        }
+        table->hashes[hole] = 0;
+        memset(table->keys[hole], 0, SPTPC_METADATA_KEY_SIZE);
+        --table->file_header->count;
+
+        table->file_header->busy = 0;
+    }
+    pthread_mutex_unlock(&table->mutex);
+}
+
+void sptpc_metadata_clear(sptpc_metadata *table)
+{
+    pthread_mutex_lock(&table->mutex);
+    if (table->base != NULL) {
+        const uint32_t capacity = table->file_header->capacity;
+        table->file_header->busy = 1;
+        memset(table->hashes, 0, capacity * sizeof(*table->hashes));
+        table->file_header->count = 0;
+        table->file_header->incomplete = 0;
+        table->file_header->busy = 0;
+    }
+    pthread_mutex_unlock(&table->mutex);
+}
+
+sptpc_status sptpc_metadata_find(sptpc_metadata *table, const char *key, sptpc_header *header)
+{
+    pthread_mutex_lock(&table->mutex);
+    int found = 0;
+    const size_t slot = (table->base != NULL ? sptpc_metadata_slot(table, key, sptpc_metadata_hash(key), &found) : 0);
+    if (found) {
+        *header = sptpc_metadata_row(table, slot);
+    }
+    pthread_mutex_unlock(&table->mutex);
+    return (found ? SPTPC_OK : SPTPC_ERROR_NOT_FOUND);
+}
+
+int sptpc_metadata_is_complete(sptpc_metadata *table)
+{
+    pthread_mutex_lock(&table->mutex);
+    const int complete = (table->base != NULL && table->file_header->incomplete == 0);
+    pthread_mutex_unlock(&table->mutex);
+    return complete;
+}
+
+size_t sptpc_metadata_count(sptpc_metadata *table)
+{
+    pthread_mutex_lock(&table->mutex);
+    const size_t count = (table->base != NULL ? table->file_header->count : 0);
+    pthread_mutex_unlock(&table->mutex);
+    return count;
+}
+
+void sptpc_metadata_scan(sptpc_metadata *table, sptpc_metadata_callback callback, void *context)
+{
+    pthread_mutex_lock(&table->mutex);
+    const size_t capacity = (table->base != NULL ? table->file_header->capacity : 0);
+    for (size_t slot = 0; slot < capacity; ++slot) {
+        if (table->hashes[slot] == 0) {
+            continue;
+        }
+        const sptpc_header header = sptpc_metadata_row(table, slot);
+        if (callback(table->keys[slot], &header, context)) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&table->mutex);
+}
+
+static sptpc_kernel_columns sptpc_metadata_columns(const sptpc_metadata *table)
+{
+    const sptpc_kernel_columns columns = {
+        .hashes = table->hashes,
+        .ttls = table->ttls,
+        .update_times = table->update_times,
+        .payload_sizes = table->payload_sizes,
+        .lease_expirations = table->lease_expirations,
+        .ref_counts = table->ref_counts,
+    };
+    return columns;
+}
+
+uint64_t sptpc_metadata_size(sptpc_metadata *table, uint64_t now, uint64_t *locked_size)
+{
+    uint64_t total = 0;
+    uint64_t locked = 0;
+
+    pthread_mutex_lock(&table->mutex);
+    if (table->base != NULL) {
+        const sptpc_kernel_columns columns = sptpc_metadata_columns(table);
+        sptpc_kernel_size(&columns, table->file_header->capacity, now, &total, &locked);
+    }
+    pthread_mutex_unlock(&table->mutex);
+
+    if (locked_size != NULL) {
+        *locked_size = locked;
+    }
+    return total;
+}
+
+size_t sptpc_metadata_select(sptpc_metadata *table, unsigned selection, uint64_t now,
+                             uint64_t default_expiration_sec, uint64_t grace_sec, sptpc_metadata_callback callback,
+                             void *context)
+{
+    _Static_assert(SPTPC_METADATA_MIN_CAPACITY % SPTPC_METADATA_SELECT_BLOCK_SIZE == 0,
+                   "Blocks divide every capacity");
+    const sptpc_kernel_query query = {
+        .selection = selection,
+        .now = now,
+        .default_expiration_sec = default_expiration_sec,
+        .grace_sec = grace_sec,
+    };
+    uint64_t bits[SPTPC_METADATA_SELECT_BLOCK_SIZE / 64];
+    size_t selected = 0;
+    int stopped = 0;
+
+    pthread_mutex_lock(&table->mutex);
+    const size_t capacity = (table->base != NULL ? table->file_header->capacity : 0);
+    const sptpc_kernel_columns columns = sptpc_metadata_columns(table);
+    for (size_t block = 0; block < capacity && !stopped; block += SPTPC_METADATA_SELECT_BLOCK_SIZE) {
+        const sptpc_kernel_columns block_columns = {
+            .hashes = columns.hashes + block,
+            .ttls = columns.ttls + block,
+            .update_times = columns.update_times + block,
+            .payload_sizes = columns.payload_sizes + block,
+            .lease_expirations = columns.lease_expirations + block,
+            .ref_counts = columns.ref_counts + block,
+        };
+        sptpc_kernel_select(&block_columns, SPTPC_METADATA_SELECT_BLOCK_SIZE, &query, bits);
+
+        for (size_t word = 0; word < SPTPC_METADATA_SELECT_BLOCK_SIZE / 64 && !stopped; ++word) {
+            for (uint64_t remaining = bits[word]; remaining != 0 && !stopped; remaining &= remaining - 1) {
+                const size_t slot = block + word * 64 + (size_t)__builtin_ctzll(remaining);
+                const sptpc_header header = sptpc_metadata_row(table, slot);
+                ++selected;
+                stopped = callback(table->keys[slot], &header, context);
+            }
+        }
+    }
+    pthread_mutex_unlock(&table->mutex);
+    return selected;
+}
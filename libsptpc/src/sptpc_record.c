@@ -0,0 +1,498 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include "sptpc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int sptpc_path_for_key(const sptpc_options *options, const char *key, char *buffer, size_t size)
+{
+    const size_t key_length = strlen(key);
+    int length;
+    // 2 letter separation: xx/  zx/  xy/  yz/ etc.
+    if (options->use_directory_separation && key_length >= SPTPC_SUBDIR_NAME_LENGTH) {
+        length = snprintf(buffer, size, "%s/%.*s/%s", options->cache_path, (int)SPTPC_SUBDIR_NAME_LENGTH, key, key);
+    } else {
+        length = snprintf(buffer, size, "%s/%s", options->cache_path, key);
+    }
+
+    if (length < 0 || (size_t)length >= size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return length;
+}
+
+static ssize_t sptpc_pread_fully(int fd, void *buffer, size_t size, off_t offset)
+{
+    size_t done = 0;
+    while (done < size) {
+        const ssize_t result = pread(fd, (char *)buffer + done, size - done, offset + (off_t)done);
+        if (result == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (result == 0) {
+            break;
+        }
+        done += (size_t)result;
+    }
+    return (ssize_t)done;
+}
+
+static int sptpc_write_fully(int fd, const void *buffer, size_t size)
+{
+    size_t done = 0;
+    while (done < size) {
+        const ssize_t result = write(fd, (const char *)buffer + done, size - done);
+        if (result == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        done += (size_t)result;
+    }
+    return 0;
+}
+
+/**
+ * Reads and validates the header of an opened record file.
+ */
+static sptpc_status sptpc_read_header_of_file(int fd, sptpc_header *header)
+{
+    const ssize_t read_bytes = sptpc_pread_fully(fd, header, sizeof(*header), 0);
+    if (read_bytes == -1) {
+        return SPTPC_ERROR_POSIX;
+    }
+    if ((size_t)read_bytes != sizeof(*header)) {
+        return SPTPC_ERROR_NOT_ENOUGH_DATA_TO_GET_HEADER;
+    }
+    return sptpc_header_validate(header);
+}
+
+sptpc_status sptpc_read_header(const char *path, sptpc_header *header)
+{
+    const int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return (errno == ENOENT ? SPTPC_ERROR_NOT_FOUND : SPTPC_ERROR_POSIX);
+    }
+
+    const sptpc_status status = sptpc_read_header_of_file(fd, header);
+    close(fd);
+    return status;
+}
+
+typedef struct sptpc_header_batch {
+    const char *const *paths;
+    size_t count;
+    sptpc_header *headers;
+    sptpc_status *statuses;
+    atomic_size_t next;
+} sptpc_header_batch;
+
+struct sptpc_header_reader {
+    pthread_mutex_t mutex;
+    pthread_cond_t batch_ready;
+    pthread_cond_t batch_done;
+    sptpc_header_batch *batch;
+    /* Bumped for each batch handed to the threads */
+    uint64_t generation;
+    /* Threads still reading the current batch */
+    size_t busy;
+    int stopping;
+    size_t thread_count;
+    pthread_t threads[];
+};
+
+/**
+ * Reads headers of the batch until none is left. Run by the calling thread and every thread of the reader.
+ */
+static void sptpc_read_header_batch(sptpc_header_batch *batch)
+{
+    size_t i;
+    while ((i = atomic_fetch_add_explicit(&batch->next, 1, memory_order_relaxed)) < batch->count) {
+        batch->statuses[i] = sptpc_read_header(batch->paths[i], &batch->headers[i]);
+    }
+}
+
+/**
+ * Waits for batches and reads them along with the calling thread, until the reader is destroyed.
+ */
+static void *sptpc_header_reader_thread(void *context)
+{
+    sptpc_header_reader *reader = context;
+    uint64_t generation = 0;
+
+    pthread_mutex_lock(&reader->mutex);
+    for (;;) {
+        while (!reader->stopping && reader->generation == generation) {
+            pthread_cond_wait(&reader->batch_ready, &reader->mutex);
+        }
+        if (reader->stopping) {
+            break;
+        }
+        generation = reader->generation;
+        sptpc_header_batch *batch = reader->batch;
+        pthread_mutex_unlock(&reader->mutex);
+
+        sptpc_read_header_batch(batch);
+
+        pthread_mutex_lock(&reader->mutex);
+        if (--reader->busy == 0) {
+            pthread_cond_signal(&reader->batch_done);
+        }
+    }
+    pthread_mutex_unlock(&reader->mutex);
+    return NULL;
+}
+
+sptpc_header_reader *sptpc_header_reader_create(size_t queue_depth)
+{
+    // The calling thread reads too
+    const size_t thread_count = (queue_depth > 0 ? queue_depth - 1 : 0);
+    sptpc_header_reader *reader = calloc(1, sizeof(*reader) + thread_count * sizeof(pthread_t));
+    if (reader == NULL) {
+        return NULL;
+    }
+
+    if (pthread_mutex_init(&reader->mutex, NULL) != 0) {
+        free(reader);
+        return NULL;
+    }
+    if (pthread_cond_init(&reader->batch_ready, NULL) != 0) {
+        pthread_mutex_destroy(&reader->mutex);
+        free(reader);
+        return NULL;
+    }
+    if (pthread_cond_init(&reader->batch_done, NULL) != 0) {
+        pthread_cond_destroy(&reader->batch_ready);
+        pthread_mutex_destroy(&reader->mutex);
+        free(reader);
+        return NULL;
+    }
+
+    // Threads which can't be created leave their share to the others
+    while (reader->thread_count < thread_count &&
+           pthread_create(&reader->threads[reader->thread_count], NULL, sptpc_header_reader_thread, reader) == 0) {
+        ++reader->thread_count;
+    }
+    return reader;
+}
+
+void sptpc_header_reader_read(sptpc_header_reader *reader,
+                              const char *const *paths,
+                              size_t count,
+                              sptpc_header *headers,
+                              sptpc_status *statuses)
+{
+    sptpc_header_batch batch = {
+        .paths = paths,
+        .count = count,
+        .headers = headers,
+        .statuses = statuses,
+    };
+    atomic_init(&batch.next, 0);
+
+    // A single header is read without waking the threads
+    const int shared = (reader != NULL && reader->thread_count > 0 && count > 1);
+    if (shared) {
+        pthread_mutex_lock(&reader->mutex);
+        reader->batch = &batch;
+        reader->busy = reader->thread_count;
+        ++reader->generation;
+        pthread_cond_broadcast(&reader->batch_ready);
+        pthread_mutex_unlock(&reader->mutex);
+    }
+
+    sptpc_read_header_batch(&batch);
+
+    if (shared) {
+        // The batch lives on this stack, every thread must be done with it
+        pthread_mutex_lock(&reader->mutex);
+        while (reader->busy > 0) {
+            pthread_cond_wait(&reader->batch_done, &reader->mutex);
+        }
+        reader->batch = NULL;
+        pthread_mutex_unlock(&reader->mutex);
+    }
+}
+
+void sptpc_header_reader_destroy(sptpc_header_reader *reader)
+{
+    if (reader == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&reader->mutex);
+    reader->stopping = 1;
+    pthread_cond_broadcast(&reader->batch_ready);
+    pthread_mutex_unlock(&reader->mutex);
+
+    for (size_t i = 0; i < reader->thread_count; ++i) {
+        pthread_join(reader->threads[i], NULL);
+    }
+    pthread_cond_destroy(&reader->batch_done);
+    pthread_cond_destroy(&reader->batch_ready);
+    pthread_mutex_destroy(&reader->mutex);
+    free(reader);
+}
+
+void sptpc_read_headers(const char *const *paths,
+                        size_t count,
+                        size_t queue_depth,
+                        sptpc_header *headers,
+                        sptpc_status *statuses)
+{
+    sptpc_header_reader *reader = sptpc_header_reader_create(queue_depth < count ? queue_depth : count);
+    sptpc_header_reader_read(reader, paths, count, headers, statuses);
+    sptpc_header_reader_destroy(reader);
+}
+
+/**
+ * Checks the record of a validated header can be returned and that the file holds its payload.
+ * Appendable records may have an uncommitted tail.
+ */
+static sptpc_status sptpc_check_record(const sptpc_options *options, const sptpc_header *header, uint64_t file_size, uint64_t now)
+{
+    if (sptpc_header_is_expired(header, now, options->default_expiration_sec) && !sptpc_header_is_locked(header, now)) {
+        return SPTPC_ERROR_EXPIRED;
+    }
+
+    const int appendable = (header->flags & SPTPC_FLAG_APPENDABLE) != 0;
+    if (file_size < SPTPC_HEADER_SIZE ||
+        (appendable ? header->payload_size_bytes > file_size - SPTPC_HEADER_SIZE : header->payload_size_bytes != file_size - SPTPC_HEADER_SIZE) ||
+        (uint64_t)(size_t)header->payload_size_bytes != header->payload_size_bytes) {
+        return SPTPC_ERROR_WRONG_PAYLOAD_SIZE;
+    }
+    return SPTPC_OK;
+}
+
+/**
+ * Opens the record for key and checks its header.
+ * @return Descriptor of the record file or -1 with status set.
+ */
+static int sptpc_open_record(const sptpc_options *options, const char *key, uint64_t now, sptpc_header *header, struct stat *file_stat, sptpc_status *status)
+{
+    char path[PATH_MAX];
+    if (sptpc_path_for_key(options, key, path, sizeof(path)) == -1) {
+        *status = SPTPC_ERROR_POSIX;
+        return -1;
+    }
+
+    const int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        *status = (errno == ENOENT ? SPTPC_ERROR_NOT_FOUND : SPTPC_ERROR_POSIX);
+        return -1;
+    }
+
+    *status = sptpc_read_header_of_file(fd, header);
+    if (*status == SPTPC_OK && fstat(fd, file_stat) == -1) {
+        *status = SPTPC_ERROR_POSIX;
+    }
+    if (*status == SPTPC_OK) {
+        *status = sptpc_check_record(options, header, (uint64_t)file_stat->st_size, now);
+    }
+
+    if (*status != SPTPC_OK) {
+        const int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    return fd;
+}
+
+sptpc_status sptpc_record_read(const sptpc_options *options,
+                               const char *key,
+                               uint64_t now,
+                               sptpc_header *header,
+                               void **payload,
+                               size_t *payload_size)
+{
+    sptpc_status status;
+    struct stat file_stat;
+    const int fd = sptpc_open_record(options, key, now, header, &file_stat, &status);
+    if (fd == -1) {
+        return status;
+    }
+
+    const size_t size = (size_t)header->payload_size_bytes;
+    void *buffer = malloc(size > 0 ? size : 1);
+    if (buffer == NULL) {
+        status = SPTPC_ERROR_POSIX;
+    } else {
+        const ssize_t read_bytes = sptpc_pread_fully(fd, buffer, size, SPTPC_HEADER_SIZE);
+        if (read_bytes == -1) {
+            status = SPTPC_ERROR_POSIX;
+        } else if ((size_t)read_bytes != size) {
+            status = SPTPC_ERROR_WRONG_PAYLOAD_SIZE;
+        }
+    }
+
+    const int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+
+    if (status != SPTPC_OK) {
+        free(buffer);
+        return status;
+    }
+
+    *payload = buffer;
+    *payload_size = size;
+    return SPTPC_OK;
+}
+
+sptpc_status sptpc_record_map(const sptpc_options *options, const char *key, uint64_t now, sptpc_mapping *mapping)
+{
+    memset(mapping, 0, sizeof(*mapping));
+
+    sptpc_status status;
+    struct stat file_stat;
+    const int fd = sptpc_open_record(options, key, now, &mapping->header, &file_stat, &status);
+    if (fd == -1) {
+        return status;
+    }
+
+    // Only the committed part of the record is mapped
+    const size_t length = SPTPC_HEADER_SIZE + (size_t)mapping->header.payload_size_bytes;
+    void *base = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    const int saved_errno = errno;
+    close(fd);
+    if (base == MAP_FAILED) {
+        errno = saved_errno;
+        memset(mapping, 0, sizeof(*mapping));
+        return SPTPC_ERROR_POSIX;
+    }
+
+    mapping->base = base;
+    mapping->length = length;
+    mapping->payload = (const char *)base + SPTPC_HEADER_SIZE;
+    mapping->payload_size = (size_t)mapping->header.payload_size_bytes;
+    return SPTPC_OK;
+}
+
+void sptpc_record_unmap(sptpc_mapping *mapping)
+{
+    if (mapping->base != NULL) {
+        munmap(mapping->base, mapping->length);
+    }
+    memset(mapping, 0, sizeof(*mapping));
+}
+
+/**
+ * Version 0 is reserved for records written before versioning and for absent records.
+ */
+static uint32_t sptpc_next_record_version(uint32_t version)
+{
+    const uint32_t next_version = version + 1;
+    return (next_version == 0 ? 1 : next_version);
+}
+
+sptpc_status sptpc_record_write(const sptpc_options *options,
+                                const char *key,
+                                const void *payload,
+                                size_t payload_size,
+                                uint64_t ttl,
+                                int locked,
+                                uint64_t now)
+{
+    char path[PATH_MAX];
+    const int path_length = sptpc_path_for_key(options, key, path, sizeof(path));
+    if (path_length == -1) {
+        return SPTPC_ERROR_POSIX;
+    }
+
+    // Create the subdirectory of the key
+    const char *file_name = strrchr(path, '/');
+    const size_t directory_length = (size_t)(file_name - path);
+    char directory[PATH_MAX];
+    memcpy(directory, path, directory_length);
+    directory[directory_length] = '\0';
+    if (mkdir(directory, 0755) == -1 && errno != EEXIST) {
+        return SPTPC_ERROR_POSIX;
+    }
+
+    // Hidden temporary files are removed by recovery if the process dies before the rename
+    char temporary_path[PATH_MAX];
+    const int temporary_length = snprintf(temporary_path, sizeof(temporary_path), "%s/.%s.XXXXXX", directory, file_name + 1);
+    if (temporary_length < 0 || (size_t)temporary_length >= sizeof(temporary_path)) {
+        errno = ENAMETOOLONG;
+        return SPTPC_ERROR_POSIX;
+    }
+
+    sptpc_header current_header;
+    const uint32_t current_version = (sptpc_read_header(path, &current_header) == SPTPC_OK ? current_header.version : 0);
+
+    sptpc_header header = sptpc_header_make(ttl, payload_size, now, locked);
+    header.version = sptpc_next_record_version(current_version);
+    header.crc = sptpc_header_crc(&header);
+
+    const int fd = mkstemp(temporary_path);
+    if (fd == -1) {
+        return SPTPC_ERROR_POSIX;
+    }
+
+    if (fchmod(fd, 0644) == -1 ||
+        sptpc_write_fully(fd, &header, sizeof(header)) == -1 ||
+        sptpc_write_fully(fd, payload, payload_size) == -1 ||
+        fsync(fd) == -1) {
+        const int saved_errno = errno;
+        close(fd);
+        unlink(temporary_path);
+        errno = saved_errno;
+        return SPTPC_ERROR_POSIX;
+    }
+
+    if (close(fd) == -1 || rename(temporary_path, path) == -1) {
+        const int saved_errno = errno;
+        unlink(temporary_path);
+        errno = saved_errno;
+        return SPTPC_ERROR_POSIX;
+    }
+
+    return SPTPC_OK;
+}
+
+sptpc_status sptpc_record_remove(const sptpc_options *options, const char *key)
+{
+    char path[PATH_MAX];
+    if (sptpc_path_for_key(options, key, path, sizeof(path)) == -1) {
+        return SPTPC_ERROR_POSIX;
+    }
+
+    if (unlink(path) == -1) {
+        return (errno == ENOENT ? SPTPC_ERROR_NOT_FOUND : SPTPC_ERROR_POSIX);
+    }
+    return SPTPC_OK;
+}
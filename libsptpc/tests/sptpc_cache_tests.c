@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include "sptpc.h"
+
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "sptpc_test.h"
+
+static int count_files_callback(const char *path, const char *key, uint64_t size, uint64_t mtime, void *context)
+{
+    (void)path;
+    (void)key;
+    (void)size;
+    (void)mtime;
+    ++*(size_t *)context;
+    return 0;
+}
+
+static size_t count_files(const sptpc_options *options)
+{
+    size_t count = 0;
+    sptpc_scan(options, count_files_callback, &count);
+    return count;
+}
+
+static int record_exists(const sptpc_options *options, const char *key)
+{
+    char path[PATH_MAX];
+    sptpc_path_for_key(options, key, path, sizeof(path));
+    return access(path, F_OK) == 0;
+}
+
+static void set_modification_time(const sptpc_options *options, const char *key, time_t time)
+{
+    char path[PATH_MAX];
+    sptpc_path_for_key(options, key, path, sizeof(path));
+    const struct timeval times[2] = { { .tv_sec = time }, { .tv_sec = time } };
+    SPTPC_ASSERT_EQUAL(utimes(path, times), 0);
+}
+
+static void test_scan_skips_hidden_files(void)
+{
+    char directory[PATH_MAX];
+    SPTPC_ASSERT(sptpc_test_make_directory(directory, sizeof(directory)) != NULL);
+    const sptpc_options options = {
+        .cache_path = directory,
+        .use_directory_separation = 1,
+        .default_expiration_sec = 60,
+    };
+
+    SPTPC_ASSERT_EQUAL(sptpc_record_write(&options, "aa1", "a", 1, 0, 0, 1000), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_record_write(&options, "bb1", "b", 1, 0, 0, 1000), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_record_write(&options, "bb2", "b", 1, 0, 0, 1000), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_record_write(&options, ".hidden", "h", 1, 0, 0, 1000), SPTPC_OK);
+
+    SPTPC_ASSERT_EQUAL(count_files(&options), 3u);
+
+    sptpc_test_remove_directory(directory);
+}
+
+static void test_collect_garbage(void)
+{
+    char directory[PATH_MAX];
+    SPTPC_ASSERT(sptpc_test_make_directory(directory, sizeof(directory)) != NULL);
+    const sptpc_options options = {
+        .cache_path = directory,
+        .use_directory_separation = 1,
+        .default_expiration_sec = 60,
+        .header_queue_depth = 4,
+    };
+
+    SPTPC_ASSERT_EQUAL(sptpc_record_write(&options, "expired", "a", 1, 0, 0, 1000), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_record_write(&options, "locked", "a", 1, 0, 1, 1000), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_record_write(&options, "fresh", "a", 1, 0, 0, 1050), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_record_write(&options, "ttl", "a", 1, 200, 0, 1000), SPTPC_OK);
+
+    size_t removed_count = 0;
+    SPTPC_ASSERT_EQUAL(sptpc_collect_garbage(&options, 1061, &removed_count), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(removed_count, 1u);
+    SPTPC_ASSERT(!record_exists(&options, "expired"));
+    SPTPC_ASSERT(record_exists(&options, "locked"));
+    SPTPC_ASSERT(record_exists(&options, "fresh"));
+    SPTPC_ASSERT(record_exists(&options, "ttl"));
+
+    sptpc_test_remove_directory(directory);
+}
+
+static void test_prune_by_size(void)
+{
+    char directory[PATH_MAX];
+    SPTPC_ASSERT(sptpc_test_make_directory(directory, sizeof(directory)) != NULL);
+    sptpc_options options = {
+        .cache_path = directory,
+        .use_directory_separation = 1,
+        .default_expiration_sec = 60,
+    };
+
+    char payload[100] = {0};
+    SPTPC_ASSERT_EQUAL(sptpc_record_write(&options, "oldest", payload, sizeof(payload), 0, 0, 1000), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_record_write(&options, "locked", payload, sizeof(payload), 0, 1, 1000), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_record_write(&options, "older", payload, sizeof(payload), 0, 0, 1000), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_record_write(&options, "newest", payload, sizeof(payload), 0, 0, 1000), SPTPC_OK);
+    set_modification_time(&options, "locked", 100);
+    set_modification_time(&options, "oldest", 200);
+    set_modification_time(&options, "older", 300);
+    set_modification_time(&options, "newest", 400);
+
+    size_t removed_count = 0;
+    SPTPC_ASSERT_EQUAL(sptpc_prune_by_size(&options, 1000, &removed_count), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(removed_count, 0u);
+
+    // Room for two records, the locked one is kept even though it's the oldest
+    options.size_constraint_bytes = 2 * (SPTPC_HEADER_SIZE + sizeof(payload));
+    SPTPC_ASSERT_EQUAL(sptpc_prune_by_size(&options, 1000, &removed_count), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(removed_count, 2u);
+    SPTPC_ASSERT(record_exists(&options, "locked"));
+    SPTPC_ASSERT(!record_exists(&options, "oldest"));
+    SPTPC_ASSERT(!record_exists(&options, "older"));
+    SPTPC_ASSERT(record_exists(&options, "newest"));
+
+    sptpc_test_remove_directory(directory);
+}
+
+int main(void)
+{
+    SPTPC_RUN_TEST(test_scan_skips_hidden_files);
+    SPTPC_RUN_TEST(test_collect_garbage);
+    SPTPC_RUN_TEST(test_prune_by_size);
+    return sptpc_test_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
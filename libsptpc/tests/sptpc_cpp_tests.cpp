@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include "sptpc.hpp"
+
+#include <climits>
+#include <future>
+#include <thread>
+
+#include "sptpc_test.h"
+
+namespace {
+
+/**
+ * Coroutine which starts right away and fulfils a promise when done.
+ */
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+std::span<const std::byte> bytes(std::string_view string)
+{
+    return std::as_bytes(std::span<const char>(string.data(), string.size()));
+}
+
+sptpc::Options make_options(const char *directory)
+{
+    sptpc::Options options;
+    options.path = directory;
+    options.clock = [] {
+        return std::uint64_t{1000};
+    };
+    return options;
+}
+
+void test_load_sync_maps_record()
+{
+    char directory[PATH_MAX];
+    SPTPC_ASSERT(sptpc_test_make_directory(directory, sizeof(directory)) != nullptr);
+    sptpc::Cache cache(make_options(directory));
+
+    SPTPC_ASSERT(!cache.store_sync("record", bytes("payload")));
+
+    sptpc::LoadResult result = cache.load_sync("record");
+    SPTPC_ASSERT(!result.error);
+    SPTPC_ASSERT(static_cast<bool>(result.record));
+    SPTPC_ASSERT_EQUAL(result.record.data().size(), 7u);
+    SPTPC_ASSERT(std::memcmp(result.record.data().data(), "payload", 7) == 0);
+
+    // Handles are move-only and keep the mapping alive after removal
+    sptpc::Record record = std::move(result.record);
+    SPTPC_ASSERT(!result.record);
+    SPTPC_ASSERT(!cache.remove_sync("record"));
+    SPTPC_ASSERT(std::memcmp(record.data().data(), "payload", 7) == 0);
+
+    SPTPC_ASSERT(cache.load_sync("record").error == sptpc::Errc::not_found);
+
+    sptpc_test_remove_directory(directory);
+}
+
+void test_load_sync_expired()
+{
+    char directory[PATH_MAX];
+    SPTPC_ASSERT(sptpc_test_make_directory(directory, sizeof(directory)) != nullptr);
+    std::uint64_t now = 1000;
+    sptpc::Options options = make_options(directory);
+    options.clock = [&now] {
+        return now;
+    };
+    sptpc::Cache cache(std::move(options));
+
+    SPTPC_ASSERT(!cache.store_sync("record", bytes("payload"), std::chrono::seconds(10)));
+    now = 1011;
+    SPTPC_ASSERT(cache.load_sync("record").error == sptpc::Errc::expired);
+
+    std::size_t removed_count = 0;
+    SPTPC_ASSERT(!cache.collect_garbage_sync(&removed_count));
+    SPTPC_ASSERT_EQUAL(removed_count, 1u);
+
+    sptpc_test_remove_directory(directory);
+}
+
+DetachedTask load_on_executor(sptpc::Cache &cache, std::promise<std::pair<sptpc::LoadResult, std::thread::id>> &promise)
+{
+    sptpc::LoadResult result = co_await cache.load(std::string("record"));
+    promise.set_value({std::move(result), std::this_thread::get_id()});
+}
+
+void test_load_awaitable()
+{
+    char directory[PATH_MAX];
+    SPTPC_ASSERT(sptpc_test_make_directory(directory, sizeof(directory)) != nullptr);
+    sptpc::Cache cache(make_options(directory));
+    SPTPC_ASSERT(!cache.store_sync("record", bytes("payload")));
+
+    std::promise<std::pair<sptpc::LoadResult, std::thread::id>> promise;
+    std::future<std::pair<sptpc::LoadResult, std::thread::id>> future = promise.get_future();
+    load_on_executor(cache, promise);
+
+    std::pair<sptpc::LoadResult, std::thread::id> completion = future.get();
+    SPTPC_ASSERT(!completion.first.error);
+    SPTPC_ASSERT_EQUAL(completion.first.record.data().size(), 7u);
+    // The coroutine continues on the executor
+    SPTPC_ASSERT(completion.second != std::this_thread::get_id());
+
+    sptpc_test_remove_directory(directory);
+}
+
+} // namespace
+
+int main()
+{
+    SPTPC_RUN_TEST(test_load_sync_maps_record);
+    SPTPC_RUN_TEST(test_load_sync_expired);
+    SPTPC_RUN_TEST(test_load_awaitable);
+    return sptpc_test_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
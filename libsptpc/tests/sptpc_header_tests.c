@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include "sptpc.h"
+
+#include <stddef.h>
+
+#include "sptpc_test.h"
+
+static void test_header_make(void)
+{
+    const sptpc_header header = sptpc_header_make(10, 400, 1488, 1);
+
+    SPTPC_ASSERT_EQUAL(header.magic, SPTPC_MAGIC);
+    SPTPC_ASSERT_EQUAL(header.header_size, SPTPC_HEADER_SIZE);
+    SPTPC_ASSERT_EQUAL(header.ref_count, 1u);
+    SPTPC_ASSERT_EQUAL(header.version, 0u);
+    SPTPC_ASSERT_EQUAL(header.ttl, 10u);
+    SPTPC_ASSERT_EQUAL(header.payload_size_bytes, 400u);
+    SPTPC_ASSERT_EQUAL(header.update_time_sec, 1488u);
+    SPTPC_ASSERT_EQUAL(header.lease_expiration_sec, 0u);
+    SPTPC_ASSERT_EQUAL(header.flags, 0u);
+    SPTPC_ASSERT_EQUAL(header.crc, sptpc_header_crc(&header));
+    SPTPC_ASSERT_EQUAL(sptpc_header_validate(&header), SPTPC_OK);
+}
+
+static void test_header_validate(void)
+{
+    SPTPC_ASSERT_EQUAL(sptpc_header_validate(NULL), SPTPC_ERROR_INTERNAL_INCONSISTENCY);
+
+    sptpc_header header = sptpc_header_make(0, 1, 1488, 0);
+    header.magic = 0;
+    SPTPC_ASSERT_EQUAL(sptpc_header_validate(&header), SPTPC_ERROR_MAGIC_MISMATCH);
+
+    header = sptpc_header_make(0, 1, 1488, 0);
+    header.ttl = 5;
+    SPTPC_ASSERT_EQUAL(sptpc_header_validate(&header), SPTPC_ERROR_INVALID_HEADER_CRC);
+
+    header = sptpc_header_make(0, 1, 1488, 0);
+    header.header_size = 32;
+    header.crc = sptpc_header_crc(&header);
+    SPTPC_ASSERT_EQUAL(sptpc_header_validate(&header), SPTPC_ERROR_WRONG_HEADER_SIZE);
+
+    uint32_t buffer[SPTPC_HEADER_SIZE / sizeof(uint32_t) + 1];
+    SPTPC_ASSERT_EQUAL(sptpc_header_validate((const sptpc_header *)((const char *)buffer + 1)), SPTPC_ERROR_HEADER_ALIGNMENT_MISMATCH);
+}
+
+static void test_header_crc_matches_iso3309(void)
+{
+    // Check value of CRC-32 for "123456789"
+    SPTPC_ASSERT_EQUAL(sptpc_crc32("123456789", 9), 0xCBF43926U);
+    SPTPC_ASSERT_EQUAL(offsetof(sptpc_header, crc), SPTPC_HEADER_SIZE - sizeof(uint32_t));
+}
+
+static void test_header_expiration(void)
+{
+    const sptpc_header header = sptpc_header_make(0, 1, 1000, 0);
+    SPTPC_ASSERT(!sptpc_header_is_expired(&header, 1060, 60));
+    SPTPC_ASSERT(sptpc_header_is_expired(&header, 1061, 60));
+
+    const sptpc_header ttl_header = sptpc_header_make(10, 1, 1000, 0);
+    SPTPC_ASSERT(sptpc_header_is_expired(&ttl_header, 1011, 60));
+}
+
+static void test_header_lock_lease(void)
+{
+    sptpc_header header = sptpc_header_make(0, 1, 1000, 1);
+    SPTPC_ASSERT(sptpc_header_is_locked(&header, 5000));
+
+    header.lease_expiration_sec = 1100;
+    SPTPC_ASSERT(sptpc_header_is_locked(&header, 1099));
+    SPTPC_ASSERT(!sptpc_header_is_locked(&header, 1100));
+
+    header.ref_count = 0;
+    header.lease_expiration_sec = 0;
+    SPTPC_ASSERT(!sptpc_header_is_locked(&header, 1000));
+}
+
+int main(void)
+{
+    SPTPC_RUN_TEST(test_header_make);
+    SPTPC_RUN_TEST(test_header_validate);
+    SPTPC_RUN_TEST(test_header_crc_matches_iso3309);
+    SPTPC_RUN_TEST(test_header_expiration);
+    SPTPC_RUN_TEST(test_header_lock_lease);
+    return sptpc_test_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include "sptpc.h"
+#include "sptpc_kernels.h"
+
+#include <stdint.h>
+
+#include "sptpc_test.h"
+
+#define ROW_COUNT 4096U
+
+static uint64_t hashes[ROW_COUNT];
+static uint64_t ttls[ROW_COUNT];
+static uint64_t update_times[ROW_COUNT];
+static uint64_t payload_sizes[ROW_COUNT];
+static uint64_t lease_expirations[ROW_COUNT];
+static uint32_t ref_counts[ROW_COUNT];
+
+static const sptpc_kernel_columns columns = {
+    .hashes = hashes,
+    .ttls = ttls,
+    .update_times = update_times,
+    .payload_sizes = payload_sizes,
+    .lease_expirations = lease_expirations,
+    .ref_counts = ref_counts,
+};
+
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/**
+ * Fills the columns with rows around time now, including the edges of every comparison: empty slots, records updated
+ * in the future, leases running out at now and huge ttls.
+ */
+static void fill_columns(uint64_t now)
+{
+    static const uint64_t edge_values[] = {0, 1, 59, 60, 61, UINT64_MAX, (uint64_t)INT64_MAX, (uint64_t)INT64_MIN};
+    const size_t edge_count = sizeof(edge_values) / sizeof(edge_values[0]);
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+
+    for (size_t i = 0; i < ROW_COUNT; ++i) {
+        hashes[i] = (next_random(&state) % 8 == 0 ? 0 : next_random(&state) | 1);
+        ttls[i] = (next_random(&state) % 2 ? edge_values[next_random(&state) % edge_count]
+                                           : next_random(&state) % 120);
+        update_times[i] = now - 200 + next_random(&state) % 300;
+        payload_sizes[i] = next_random(&state) % 100000;
+        switch (next_random(&state) % 3) {
+        case 0:
+            lease_expirations[i] = 0;
+            break;
+        case 1:
+            lease_expirations[i] = now - 2 + next_random(&state) % 5;
+            break;
+        default:
+            lease_expirations[i] = edge_values[next_random(&state) % edge_count];
+            break;
+        }
+        ref_counts[i] = (uint32_t)(next_random(&state) % 3 == 0 ? next_random(&state) % 3 : 0);
+    }
+    ref_counts[1] = UINT32_MAX;
+}
+
+static sptpc_header row_header(size_t i)
+{
+    sptpc_header header = sptpc_header_make(ttls[i], payload_sizes[i], update_times[i], 0);
+    header.ref_count = ref_counts[i];
+    header.lease_expiration_sec = lease_expirations[i];
+    return header;
+}
+
+static int bit_is_set(const uint64_t *bits, size_t i)
+{
+    return (bits[i / 64] >> (i % 64)) & 1;
+}
+
+static void test_kernel_select_matches_header_checks(void)
+{
+    const uint64_t now = 1000000;
+    fill_columns(now);
+
+    static uint64_t bits[ROW_COUNT / 64];
+    const sptpc_kernel_query expired_query = {
+        .selection = SPTPC_SELECT_EXPIRED,
+        .now = now,
+        .default_expiration_sec = 60,
+    };
+    sptpc_kernel_select_scalar(&columns, ROW_COUNT, &expired_query, bits);
+    for (size_t i = 0; i < ROW_COUNT; ++i) {
+        const sptpc_header header = row_header(i);
+        const int expected = hashes[i] != 0 && sptpc_header_is_expired(&header, now, 60) &&
+                             !sptpc_header_is_locked(&header, now);
+        SPTPC_ASSERT_EQUAL(bit_is_set(bits, i), expected);
+    }
+
+    const sptpc_kernel_query locked_query = {
+        .selection = SPTPC_SELECT_LOCKED,
+        .now = now,
+    };
+    sptpc_kernel_select_scalar(&columns, ROW_COUNT, &locked_query, bits);
+    for (size_t i = 0; i < ROW_COUNT; ++i) {
+        const sptpc_header header = row_header(i);
+        SPTPC_ASSERT_EQUAL(bit_is_set(bits, i), hashes[i] != 0 && sptpc_header_is_locked(&header, now));
+    }
+}
+
+static void test_kernel_select_matches_scalar(void)
+{
+    fprintf(stderr, "vectorized kernels: %s\n", sptpc_kernel_simd_name() ? sptpc_kernel_simd_name() : "none");
+    static const uint64_t grace_periods[] = {0, 30, UINT64_MAX};
+    static uint64_t bits[ROW_COUNT / 64];
+    static uint64_t scalar_bits[ROW_COUNT / 64];
+
+    for (uint64_t now = 999998; now <= 1000002; ++now) {
+        fill_columns(1000000);
+        for (size_t g = 0; g < sizeof(grace_periods) / sizeof(grace_periods[0]); ++g) {
+            for (unsigned selection = 0; selection < 16; ++selection) {
+                const sptpc_kernel_query query = {
+                    .selection = selection,
+                    .now = now,
+                    .default_expiration_sec = 60,
+                    .grace_sec = grace_periods[g],
+                };
+                sptpc_kernel_select(&columns, ROW_COUNT, &query, bits);
+                sptpc_kernel_select_scalar(&columns, ROW_COUNT, &query, scalar_bits);
+                SPTPC_ASSERT(memcmp(bits, scalar_bits, sizeof(bits)) == 0);
+            }
+        }
+    }
+}
+
+static void test_kernel_size_matches_scalar(void)
+{
+    const uint64_t now = 1000000;
+    fill_columns(now);
+
+    // Odd counts leave slots past the last full vector
+    const size_t counts[] = {0, 1, 3, 5, 64, ROW_COUNT - 1, ROW_COUNT};
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        uint64_t total = 0;
+        uint64_t locked = 0;
+        uint64_t scalar_total = 0;
+        uint64_t scalar_locked = 0;
+        sptpc_kernel_size(&columns, counts[c], now, &total, &locked);
+        sptpc_kernel_size_scalar(&columns, counts[c], now, &scalar_total, &scalar_locked);
+        SPTPC_ASSERT_EQUAL(total, scalar_total);
+        SPTPC_ASSERT_EQUAL(locked, scalar_locked);
+    }
+
+    uint64_t expected_total = 0;
+    uint64_t expected_locked = 0;
+    for (size_t i = 0; i < ROW_COUNT; ++i) {
+        if (hashes[i] == 0) {
+            continue;
+        }
+        const sptpc_header header = row_header(i);
+        expected_total += SPTPC_HEADER_SIZE + payload_sizes[i];
+        if (sptpc_header_is_locked(&header, now)) {
+            expected_locked += SPTPC_HEADER_SIZE + payload_sizes[i];
+        }
+    }
+    uint64_t total = 0;
+    uint64_t locked = 0;
+    sptpc_kernel_size_scalar(&columns, ROW_COUNT, now, &total, &locked);
+    SPTPC_ASSERT_EQUAL(total, expected_total);
+    SPTPC_ASSERT_EQUAL(locked, expected_locked);
+}
+
+int main(void)
+{
+    SPTPC_RUN_TEST(test_kernel_select_matches_header_checks);
+    SPTPC_RUN_TEST(test_kernel_select_matches_scalar);
+    SPTPC_RUN_TEST(test_kernel_size_matches_scalar);
+    return sptpc_test_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include "sptpc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "sptpc_test.h"
+
+static int count_rows_callback(const char *key, const sptpc_header *header, void *context)
+{
+    (void)key;
+    (void)header;
+    ++*(size_t *)context;
+    return 0;
+}
+
+static void test_metadata_update_find_remove(void)
+{
+    char directory[PATH_MAX];
+    SPTPC_ASSERT(sptpc_test_make_directory(directory, sizeof(directory)) != NULL);
+    const sptpc_options options = {
+        .cache_path = directory,
+        .default_expiration_sec = 60,
+    };
+
+    sptpc_metadata *table = NULL;
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_open(&options, &table), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_count(table), 0u);
+
+    const sptpc_header locked = sptpc_header_make(0, 10, 1000, 1);
+    const sptpc_header unlocked = sptpc_header_make(30, 20, 1000, 0);
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_update(table, "locked", &locked), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_update(table, "unlocked", &unlocked), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_update(table, "unlocked", &unlocked), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_count(table), 2u);
+
+    sptpc_header header;
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_find(table, "unlocked", &header), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(header.ttl, 30u);
+    SPTPC_ASSERT_EQUAL(header.payload_size_bytes, 20u);
+    SPTPC_ASSERT_EQUAL(header.update_time_sec, 1000u);
+
+    uint64_t locked_size = 0;
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_size(table, 1000, &locked_size), 2 * SPTPC_HEADER_SIZE + 30);
+    SPTPC_ASSERT_EQUAL(locked_size, SPTPC_HEADER_SIZE + 10);
+
+    // Rows outlive the table being closed
+    sptpc_metadata_close(table);
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_open(&options, &table), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_count(table), 2u);
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_find(table, "locked", &header), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(header.ref_count, 1u);
+
+    sptpc_metadata_remove(table, "locked");
+    sptpc_metadata_remove(table, "missing");
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_find(table, "locked", &header), SPTPC_ERROR_NOT_FOUND);
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_count(table), 1u);
+
+    sptpc_metadata_clear(table);
+    size_t rows = 0;
+    sptpc_metadata_scan(table, count_rows_callback, &rows);
+    SPTPC_ASSERT_EQUAL(rows, 0u);
+
+    sptpc_metadata_close(table);
+    sptpc_test_remove_directory(directory);
+}
+
+static void test_metadata_growth(void)
+{
+    char directory[PATH_MAX];
+    SPTPC_ASSERT(sptpc_test_make_directory(directory, sizeof(directory)) != NULL);
+    const sptpc_options options = {
+        .cache_path = directory,
+        .default_expiration_sec = 60,
+    };
+
+    sptpc_metadata *table = NULL;
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_open(&options, &table), SPTPC_OK);
+
+    // Enough rows to grow the table twice, every other one is removed again
+    const size_t row_count = 3000;
+    for (size_t i = 0; i < row_count; ++i) {
+        char key[32];
+        snprintf(key, sizeof(key), "key%zu", i);
+        const sptpc_header header = sptpc_header_make(i, i, 1000, 0);
+        SPTPC_ASSERT_EQUAL(sptpc_metadata_update(table, key, &header), SPTPC_OK);
+    }
+    for (size_t i = 1; i < row_count; i += 2) {
+        char key[32];
+        snprintf(key, sizeof(key), "key%zu", i);
+        sptpc_metadata_remove(table, key);
+    }
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_count(table), row_count / 2);
+
+    for (size_t i = 0; i < row_count; ++i) {
+        char key[32];
+        snprintf(key, sizeof(key), "key%zu", i);
+        sptpc_header header;
+        if (i % 2 == 0) {
+            SPTPC_ASSERT_EQUAL(sptpc_metadata_find(table, key, &header), SPTPC_OK);
+            SPTPC_ASSERT_EQUAL(header.ttl, (uint64_t)i);
+        } else {
+            SPTPC_ASSERT_EQUAL(sptpc_metadata_find(table, key, &header), SPTPC_ERROR_NOT_FOUND);
+        }
+    }
+
+    size_t rows = 0;
+    sptpc_metadata_scan(table, count_rows_callback, &rows);
+    SPTPC_ASSERT_EQUAL(rows, row_count / 2);
+
+    sptpc_metadata_close(table);
+    sptpc_test_remove_directory(directory);
+}
+
+static void test_metadata_rebuild(void)
+{
+    char directory[PATH_MAX];
+    SPTPC_ASSERT(sptpc_test_make_directory(directory, sizeof(directory)) != NULL);
+    const sptpc_options options = {
+        .cache_path = directory,
+        .use_directory_separation = 1,
+        .default_expiration_sec = 60,
+        .header_queue_depth = 4,
+    };
+
+    SPTPC_ASSERT_EQUAL(sptpc_record_write(&options, "aa1", "a", 1, 0, 0, 1000), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_record_write(&options, "bb1", "bb", 2, 0, 1, 1000), SPTPC_OK);
+
+    // A missing table is rebuilt from the records
+    sptpc_metadata *table = NULL;
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_open(&options, &table), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_count(table), 2u);
+    sptpc_header header;
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_find(table, "bb1", &header), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(header.payload_size_bytes, 2u);
+    SPTPC_ASSERT_EQUAL(header.version, 1u);
+
+    // Keys which don't fit leave the table incomplete
+    char long_key[SPTPC_METADATA_MAX_KEY_LENGTH + 2];
+    memset(long_key, 'c', sizeof(long_key) - 1);
+    long_key[sizeof(long_key) - 1] = '\0';
+    SPTPC_ASSERT_EQUAL(sptpc_record_write(&options, long_key, "c", 1, 0, 0, 1000), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_update(table, long_key, &header), SPTPC_ERROR_POSIX);
+    SPTPC_ASSERT(!sptpc_metadata_is_complete(table));
+    sptpc_metadata_close(table);
+
+    // Incomplete tables are rebuilt and become complete once the record is gone
+    SPTPC_ASSERT_EQUAL(sptpc_record_remove(&options, long_key), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_open(&options, &table), SPTPC_OK);
+    SPTPC_ASSERT(sptpc_metadata_is_complete(table));
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_count(table), 2u);
+    sptpc_metadata_close(table);
+
+    // So are corrupted tables
+    char path[PATH_MAX];
+    SPTPC_ASSERT(snprintf(path, sizeof(path), "%s/%s", directory, SPTPC_METADATA_FILE_NAME) < (int)sizeof(path));
+    SPTPC_ASSERT_EQUAL(truncate(path, 100), 0);
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_open(&options, &table), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_count(table), 2u);
+    uint64_t locked_size = 0;
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_size(table, 1000, &locked_size), 2 * SPTPC_HEADER_SIZE + 3);
+    SPTPC_ASSERT_EQUAL(locked_size, SPTPC_HEADER_SIZE + 2);
+    sptpc_metadata_close(table);
+
+    sptpc_test_remove_directory(directory);
+}
+
+static void test_metadata_unclean_close(void)
+{
+    char directory[PATH_MAX];
+    SPTPC_ASSERT(sptpc_test_make_directory(directory, sizeof(directory)) != NULL);
+    const sptpc_options options = {
+        .cache_path = directory,
+        .use_directory_separation = 1,
+        .default_expiration_sec = 60,
+        .header_queue_depth = 4,
+    };
+
+    SPTPC_ASSERT_EQUAL(sptpc_record_write(&options, "aa1", "a", 1, 0, 0, 1000), SPTPC_OK);
+
+    // An owner exiting between writing a record and mirroring it leaves a table missing the record
+    const pid_t child = fork();
+    SPTPC_ASSERT(child != -1);
+    if (child == 0) {
+        sptpc_metadata *child_table = NULL;
+        if (sptpc_metadata_open(&options, &child_table) != SPTPC_OK ||
+            sptpc_record_write(&options, "bb1", "bb", 2, 0, 0, 1000) != SPTPC_OK) {
+            _exit(EXIT_FAILURE);
+        }
+        _exit(EXIT_SUCCESS);
+    }
+    int child_status = 0;
+    SPTPC_ASSERT_EQUAL(waitpid(child, &child_status, 0), child);
+    SPTPC_ASSERT(WIFEXITED(child_status) && WEXITSTATUS(child_status) == EXIT_SUCCESS);
+
+    // Such a table is rebuilt
+    sptpc_metadata *table = NULL;
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_open(&options, &table), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_count(table), 2u);
+    sptpc_header header;
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_find(table, "bb1", &header), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(header.payload_size_bytes, 2u);
+    sptpc_metadata_close(table);
+
+    // A cleanly closed table is kept, the record written meanwhile is only known to the rebuilt one
+    SPTPC_ASSERT_EQUAL(sptpc_record_write(&options, "cc1", "c", 1, 0, 0, 1000), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_open(&options, &table), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_count(table), 2u);
+    sptpc_metadata_close(table);
+
+    sptpc_test_remove_directory(directory);
+}
+
+static void test_metadata_open_twice(void)
+{
+    char directory[PATH_MAX];
+    SPTPC_ASSERT(sptpc_test_make_directory(directory, sizeof(directory)) != NULL);
+    const sptpc_options options = {
+        .cache_path = directory,
+        .use_directory_separation = 1,
+        .default_expiration_sec = 60,
+        .header_queue_depth = 4,
+    };
+
+    sptpc_metadata *table = NULL;
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_open(&options, &table), SPTPC_OK);
+    sptpc_header header = {
+        .payload_size_bytes = 1,
+        .update_time_sec = 1000,
+    };
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_update(table, "aa1", &header), SPTPC_OK);
+
+    // A second open in the same process is refused and leaves the first one its lock
+    sptpc_metadata *second_table = NULL;
+    errno = 0;
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_open(&options, &second_table), SPTPC_ERROR_POSIX);
+    SPTPC_ASSERT_EQUAL(errno, EBUSY);
+    SPTPC_ASSERT(second_table == NULL);
+
+    char path[PATH_MAX];
+    SPTPC_ASSERT(snprintf(path, sizeof(path), "%s/%s", directory, SPTPC_METADATA_FILE_NAME) < (int)sizeof(path));
+    const pid_t child = fork();
+    SPTPC_ASSERT(child != -1);
+    if (child == 0) {
+        const int fd = open(path, O_RDONLY);
+        struct flock lock = {
+            .l_type = F_WRLCK,
+            .l_whence = SEEK_SET,
+        };
+        const int locked = (fd != -1 && fcntl(fd, F_GETLK, &lock) == 0 && lock.l_type != F_UNLCK &&
+                            lock.l_pid == getppid());
+        _exit(locked ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    int child_status = 0;
+    SPTPC_ASSERT_EQUAL(waitpid(child, &child_status, 0), child);
+    SPTPC_ASSERT(WIFEXITED(child_status) && WEXITSTATUS(child_status) == EXIT_SUCCESS);
+    sptpc_metadata_close(table);
+
+    // Once closed it can be opened again, with its rows
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_open(&options, &second_table), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_find(second_table, "aa1", &header), SPTPC_OK);
+    sptpc_metadata_close(second_table);
+
+    sptpc_test_remove_directory(directory);
+}
+
+static int collect_key_callback(const char *key, const sptpc_header *header, void *context)
+{
+    (void)header;
+    char *keys = context;
+    strcat(keys, key);
+    strcat(keys, " ");
+    return 0;
+}
+
+static void test_metadata_select(void)
+{
+    char directory[PATH_MAX];
+    SPTPC_ASSERT(sptpc_test_make_directory(directory, sizeof(directory)) != NULL);
+    const sptpc_options options = {
+        .cache_path = directory,
+        .default_expiration_sec = 60,
+    };
+
+    sptpc_metadata *table = NULL;
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_open(&options, &table), SPTPC_OK);
+
+    const sptpc_header fresh = sptpc_header_make(0, 10, 1000, 0);
+    const sptpc_header stale = sptpc_header_make(0, 10, 1000 - 70, 0);
+    const sptpc_header expired = sptpc_header_make(0, 10, 1000 - 100, 0);
+    const sptpc_header locked = sptpc_header_make(0, 10, 1000 - 100, 1);
+    sptpc_header lease_expired = sptpc_header_make(0, 10, 1000 - 100, 1);
+    lease_expired.lease_expiration_sec = 1000;
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_update(table, "fresh", &fresh), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_update(table, "stale", &stale), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_update(table, "expired", &expired), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_update(table, "locked", &locked), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_update(table, "lease", &lease_expired), SPTPC_OK);
+
+    char keys[128] = "";
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_select(table, SPTPC_SELECT_EXPIRED, 1000, 60, 0, collect_key_callback, keys), 3u);
+    SPTPC_ASSERT(strstr(keys, "stale ") && strstr(keys, "expired ") && strstr(keys, "lease "));
+
+    // The grace period keeps stale records
+    keys[0] = '\0';
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_select(table, SPTPC_SELECT_EXPIRED, 1000, 60, 20, collect_key_callback, keys), 2u);
+    SPTPC_ASSERT(strstr(keys, "stale ") == NULL);
+
+    keys[0] = '\0';
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_select(table, SPTPC_SELECT_LOCKED | SPTPC_SELECT_LEASE_EXPIRED, 1000, 60, 0,
+                                             collect_key_callback, keys),
+                       2u);
+    SPTPC_ASSERT(strstr(keys, "locked ") && strstr(keys, "lease "));
+
+    size_t rows = 0;
+    SPTPC_ASSERT_EQUAL(sptpc_metadata_select(table, SPTPC_SELECT_UNLOCKED | SPTPC_SELECT_LOCKED, 1000, 60, 0,
+                                             count_rows_callback, &rows),
+                       5u);
+    SPTPC_ASSERT_EQUAL(rows, 5u);
+
+    sptpc_metadata_close(table);
+    sptpc_test_remove_directory(directory);
+}
+
+int main(void)
+{
+    SPTPC_RUN_TEST(test_metadata_update_find_remove);
+    SPTPC_RUN_TEST(test_metadata_growth);
+    SPTPC_RUN_TEST(test_metadata_rebuild);
+    SPTPC_RUN_TEST(test_metadata_unclean_close);
+    SPTPC_RUN_TEST(test_metadata_open_twice);
+    SPTPC_RUN_TEST(test_metadata_select);
+    return sptpc_test_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#include "sptpc.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "sptpc_test.h"
+
+static void test_path_for_key(void)
+{
+    sptpc_options options = {
+        .cache_path = "/cache",
+        .use_directory_separation = 1,
+    };
+    char path[PATH_MAX];
+
+    SPTPC_ASSERT_EQUAL(sptpc_path_for_key(&options, "abcdef", path, sizeof(path)), 16);
+    SPTPC_ASSERT(strcmp(path, "/cache/ab/abcdef") == 0);
+
+    // Keys shorter than a subdirectory name stay in the cache folder
+    SPTPC_ASSERT_EQUAL(sptpc_path_for_key(&options, "a", path, sizeof(path)), 8);
+    SPTPC_ASSERT(strcmp(path, "/cache/a") == 0);
+
+    options.use_directory_separation = 0;
+    SPTPC_ASSERT_EQUAL(sptpc_path_for_key(&options, "abcdef", path, sizeof(path)), 13);
+    SPTPC_ASSERT(strcmp(path, "/cache/abcdef") == 0);
+
+    char small[8];
+    SPTPC_ASSERT_EQUAL(sptpc_path_for_key(&options, "abcdef", small, sizeof(small)), -1);
+    SPTPC_ASSERT_EQUAL(errno, ENAMETOOLONG);
+}
+
+static void test_record_write_and_read(void)
+{
+    char directory[PATH_MAX];
+    SPTPC_ASSERT(sptpc_test_make_directory(directory, sizeof(directory)) != NULL);
+    const sptpc_options options = {
+        .cache_path = directory,
+        .use_directory_separation = 1,
+        .default_expiration_sec = 60,
+    };
+
+    SPTPC_ASSERT_EQUAL(sptpc_record_write(&options, "record", "payload", 7, 0, 0, 1000), SPTPC_OK);
+
+    sptpc_header header;
+    void *payload = NULL;
+    size_t payload_size = 0;
+    SPTPC_ASSERT_EQUAL(sptpc_record_read(&options, "record", 1000, &header, &payload, &payload_size), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(payload_size, 7u);
+    SPTPC_ASSERT(payload != NULL && memcmp(payload, "payload", 7) == 0);
+    SPTPC_ASSERT_EQUAL(header.version, 1u);
+    SPTPC_ASSERT_EQUAL(header.update_time_sec, 1000u);
+    free(payload);
+
+    // Versions continue across stores
+    SPTPC_ASSERT_EQUAL(sptpc_record_write(&options, "record", "", 0, 0, 1, 1000), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_record_read(&options, "record", 1000, &header, &payload, &payload_size), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(payload_size, 0u);
+    SPTPC_ASSERT_EQUAL(header.version, 2u);
+    SPTPC_ASSERT_EQUAL(header.ref_count, 1u);
+    free(payload);
+
+    SPTPC_ASSERT_EQUAL(sptpc_record_remove(&options, "record"), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_record_read(&options, "record", 1000, &header, &payload, &payload_size), SPTPC_ERROR_NOT_FOUND);
+    SPTPC_ASSERT_EQUAL(sptpc_record_remove(&options, "record"), SPTPC_ERROR_NOT_FOUND);
+
+    sptpc_test_remove_directory(directory);
+}
+
+static void test_record_read_expired(void)
+{
+    char directory[PATH_MAX];
+    SPTPC_ASSERT(sptpc_test_make_directory(directory, sizeof(directory)) != NULL);
+    const sptpc_options options = {
+        .cache_path = directory,
+        .default_expiration_sec = 60,
+    };
+
+    SPTPC_ASSERT_EQUAL(sptpc_record_write(&options, "unlocked", "a", 1, 0, 0, 1000), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(sptpc_record_write(&options, "locked", "a", 1, 0, 1, 1000), SPTPC_OK);
+
+    sptpc_header header;
+    void *payload = NULL;
+    size_t payload_size = 0;
+    SPTPC_ASSERT_EQUAL(sptpc_record_read(&options, "unlocked", 1061, &header, &payload, &payload_size), SPTPC_ERROR_EXPIRED);
+
+    // Locked records are returned even if they expired
+    SPTPC_ASSERT_EQUAL(sptpc_record_read(&options, "locked", 1061, &header, &payload, &payload_size), SPTPC_OK);
+    free(payload);
+
+    sptpc_test_remove_directory(directory);
+}
+
+static void test_record_read_corrupted(void)
+{
+    char directory[PATH_MAX];
+    SPTPC_ASSERT(sptpc_test_make_directory(directory, sizeof(directory)) != NULL);
+    const sptpc_options options = {
+        .cache_path = directory,
+        .default_expiration_sec = 60,
+    };
+
+    SPTPC_ASSERT_EQUAL(sptpc_record_write(&options, "record", "payload", 7, 0, 0, 1000), SPTPC_OK);
+    char path[PATH_MAX];
+    sptpc_path_for_key(&options, "record", path, sizeof(path));
+
+    // Torn write: payload shorter than the header says
+    SPTPC_ASSERT_EQUAL(truncate(path, SPTPC_HEADER_SIZE + 3), 0);
+    sptpc_header header;
+    void *payload = NULL;
+    size_t payload_size = 0;
+    SPTPC_ASSERT_EQUAL(sptpc_record_read(&options, "record", 1000, &header, &payload, &payload_size), SPTPC_ERROR_WRONG_PAYLOAD_SIZE);
+
+    SPTPC_ASSERT_EQUAL(truncate(path, 10), 0);
+    SPTPC_ASSERT_EQUAL(sptpc_record_read(&options, "record", 1000, &header, &payload, &payload_size), SPTPC_ERROR_NOT_ENOUGH_DATA_TO_GET_HEADER);
+    SPTPC_ASSERT_EQUAL(sptpc_read_header(path, &header), SPTPC_ERROR_NOT_ENOUGH_DATA_TO_GET_HEADER);
+
+    sptpc_test_remove_directory(directory);
+}
+
+static void test_record_map(void)
+{
+    char directory[PATH_MAX];
+    SPTPC_ASSERT(sptpc_test_make_directory(directory, sizeof(directory)) != NULL);
+    const sptpc_options options = {
+        .cache_path = directory,
+        .default_expiration_sec = 60,
+    };
+
+    SPTPC_ASSERT_EQUAL(sptpc_record_write(&options, "record", "payload", 7, 0, 0, 1000), SPTPC_OK);
+
+    sptpc_mapping mapping;
+    SPTPC_ASSERT_EQUAL(sptpc_record_map(&options, "record", 1000, &mapping), SPTPC_OK);
+    SPTPC_ASSERT_EQUAL(mapping.payload_size, 7u);
+    SPTPC_ASSERT(memcmp(mapping.payload, "payload", 7) == 0);
+    SPTPC_ASSERT_EQUAL(mapping.header.version, 1u);
+
+    // The mapping outlives the record file
+    SPTPC_ASSERT_EQUAL(sptpc_record_remove(&options, "record"), SPTPC_OK);
+    SPTPC_ASSERT(memcmp(mapping.payload, "payload", 7) == 0);
+    sptpc_record_unmap(&mapping);
+    SPTPC_ASSERT(mapping.base == NULL);
+
+    SPTPC_ASSERT_EQUAL(sptpc_record_map(&options, "record", 1000, &mapping), SPTPC_ERROR_NOT_FOUND);
+    SPTPC_ASSERT(mapping.base == NULL);
+
+    sptpc_test_remove_directory(directory);
+}
+
+/**
+ * Writes the records test_read_headers and test_header_reader read, every third one is missing and every third one is
+ * too short to hold a header.
+ */
+static void write_header_records(const sptpc_options *options, char paths[12][PATH_MAX], const char *path_list[12])
+{
+    for (size_t i = 0; i < 12; ++i) {
+        char key[16];
+        snprintf(key, sizeof(key), "record%zu", i);
+        sptpc_path_for_key(options, key, paths[i], PATH_MAX);
+        path_list[i] = paths[i];
+        if (i % 3 != 0) {
+            SPTPC_ASSERT_EQUAL(sptpc_record_write(options, key, "payload", 7, (uint64_t)i, 0, 1000), SPTPC_OK);
+        }
+        if (i % 3 == 2) {
+            SPTPC_ASSERT_EQUAL(truncate(paths[i], 10), 0);
+        }
+    }
+}
+
+static void check_header_records(size_t first, size_t count, const sptpc_header *headers, const sptpc_status *statuses)
+{
+    for (size_t j = 0; j < count; ++j) {
+        const size_t i = first + j;
+        if (i % 3 == 0) {
+            SPTPC_ASSERT_EQUAL(statuses[j], SPTPC_ERROR_NOT_FOUND);
+        } else if (i % 3 == 1) {
+            SPTPC_ASSERT_EQUAL(statuses[j], SPTPC_OK);
+            SPTPC_ASSERT_EQUAL(headers[j].ttl, (uint64_t)i);
+        } else {
+            SPTPC_ASSERT_EQUAL(statuses[j], SPTPC_ERROR_NOT_ENOUGH_DATA_TO_GET_HEADER);
+        }
+    }
+}
+
+static void test_read_headers(void)
+{
+    char directory[PATH_MAX];
+    SPTPC_ASSERT(sptpc_test_make_directory(directory, sizeof(directory)) != NULL);
+    const sptpc_options options = {
+        .cache_path = directory,
+        .default_expiration_sec = 60,
+    };
+
+    char paths[12][PATH_MAX];
+    const char *path_list[12];
+    write_header_records(&options, paths, path_list);
+
+    const size_t queue_depths[] = {0, 1, 4, 32};
+    for (size_t depth = 0; depth < sizeof(queue_depths) / sizeof(queue_depths[0]); ++depth) {
+        sptpc_header headers[12];
+        sptpc_status statuses[12];
+        sptpc_read_headers(path_list, 12, queue_depths[depth], headers, statuses);
+        check_header_records(0, 12, headers, statuses);
+    }
+
+    sptpc_test_remove_directory(directory);
+}
+
+static void test_header_reader(void)
+{
+    char directory[PATH_MAX];
+    SPTPC_ASSERT(sptpc_test_make_directory(directory, sizeof(directory)) != NULL);
+    const sptpc_options options = {
+        .cache_path = directory,
+        .default_expiration_sec = 60,
+    };
+
+    char paths[12][PATH_MAX];
+    const char *path_list[12];
+    write_header_records(&options, paths, path_list);
+
+    // The same threads read batch after batch, down to single headers. A NULL reader reads on the calling thread.
+    sptpc_header_reader *reader = sptpc_header_reader_create(4);
+    SPTPC_ASSERT(reader != NULL);
+    sptpc_header_reader *readers[] = {reader, NULL};
+    for (size_t r = 0; r < sizeof(readers) / sizeof(readers[0]); ++r) {
+        for (size_t round = 0; round < 50; ++round) {
+            const size_t batch_size = round % 5 + 1;
+            for (size_t first = 0; first < 12; first += batch_size) {
+                const size_t count = (12 - first < batch_size ? 12 - first : batch_size);
+                sptpc_header headers[5];
+                sptpc_status statuses[5];
+                sptpc_header_reader_read(readers[r], path_list + first, count, headers, statuses);
+                check_header_records(first, count, headers, statuses);
+            }
+        }
+    }
+    sptpc_header_reader_destroy(reader);
+    sptpc_header_reader_destroy(NULL);
+
+    sptpc_test_remove_directory(directory);
+}
+
+int main(void)
+{
+    SPTPC_RUN_TEST(test_path_for_key);
+    SPTPC_RUN_TEST(test_record_write_and_read);
+    SPTPC_RUN_TEST(test_record_read_expired);
+    SPTPC_RUN_TEST(test_record_read_corrupted);
+    SPTPC_RUN_TEST(test_record_map);
+    SPTPC_RUN_TEST(test_read_headers);
+    SPTPC_RUN_TEST(test_header_reader);
+    return sptpc_test_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
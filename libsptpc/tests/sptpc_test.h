@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2016 Spotify AB.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+#ifndef SPTPC_TEST_H
+#define SPTPC_TEST_H
+
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/**
+ * Minimal test harness of the core: each test is a function, failures are counted and reported.
+ */
+
+static int sptpc_test_failures = 0;
+
+#define SPTPC_ASSERT(condition)                                                         \
+    do {                                                                                \
+        if (!(condition)) {                                                             \
+            fprintf(stderr, "%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #condition); \
+            ++sptpc_test_failures;                                                      \
+        }                                                                               \
+    } while (0)
+
+#define SPTPC_ASSERT_EQUAL(lhs, rhs) SPTPC_ASSERT((lhs) == (rhs))
+
+#define SPTPC_RUN_TEST(test)                                                            \
+    do {                                                                                \
+        const int failures_before = sptpc_test_failures;                                \
+        test();                                                                         \
+        fprintf(stderr, "%s %s\n", (sptpc_test_failures == failures_before ? "PASS" : "FAIL"), #test); \
+    } while (0)
+
+/**
+ * Creates an empty temporary directory for a cache, the path is written to buffer.
+ */
+static inline const char *sptpc_test_make_directory(char *buffer, size_t size)
+{
+    const char *temporary_directory = getenv("TMPDIR");
+    snprintf(buffer, size, "%s/sptpc_test.XXXXXX", temporary_directory ? temporary_directory : "/tmp");
+    return mkdtemp(buffer);
+}
+
+static inline int sptpc_test_remove_entry(const char *path, const struct stat *entry_stat, int type, struct FTW *ftw)
+{
+    (void)entry_stat;
+    (void)type;
+    (void)ftw;
+    return remove(path);
+}
+
+/**
+ * Removes a temporary directory created by sptpc_test_make_directory with everything in it.
+ */
+static inline void sptpc_test_remove_directory(const char *path)
+{
+    nftw(path, sptpc_test_remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+#endif